@@ -9,8 +9,11 @@ void local_service::run() {
 	std::string label;
 	{
 	    boost::unique_lock<boost::mutex> lockit(lock_);
-	    queue_changed_.wait_for(lockit, timeout);
 	    std::tie(f,label) = get_next_function();
+	    if (!f) {
+		queue_changed_.wait_for(lockit, timeout);
+		std::tie(f,label) = get_next_function();
+	    }
 	}
 	if (f) {
 	    if (!label.empty()) {
@@ -1,5 +1,11 @@
-#include <unordered_map>
-#include <list>
+#pragma once
+
+#ifndef _common_lru_cache_hpp
+#define _common_lru_cache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <vector>
 #include <functional>
 
@@ -10,78 +16,212 @@ template<typename K, typename V> struct lru_cache_callback_nop {
     inline void evicted(const K &key, V &value) { }
     inline void accessed(const K &key, V &value) { }
 };
-    
+
+//
+// LRU cache. Entries are nodes in a pool (freed nodes are reused)
+// linked together in access order (most recent first) by indices, and
+// looked up through an open addressing (linear probing) index. So
+// neither find() nor a replacing insert() allocate memory.
+//
+// When an entry is removed (erase, clear or to make room for an
+// insert) the callback's evicted() is called after the entry has been
+// removed from the cache.
+//
 template<typename K, typename V, typename C = lru_cache_callback_nop<K,V> > class lru_cache {
 public:
     typedef K key_type;
     typedef V value_type;
 
-    inline lru_cache(size_t capacity) : capacity_(capacity), callback_() { }
-    inline lru_cache(size_t capacity, const C &callback) : capacity_(capacity), callback_(callback) { }
+    inline lru_cache(size_t capacity) : capacity_(capacity), callback_() { init(); }
+    inline lru_cache(size_t capacity, const C &callback) : capacity_(capacity), callback_(callback) { init(); }
     inline ~lru_cache() { clear(); }
 
     inline void set_callback(C &callback) { callback_ = callback; }
 
+    inline size_t size() const { return size_; }
+    inline size_t capacity() const { return capacity_; }
+
     inline void insert(const K &key, const V &value) {
-        auto it = map_.find(key);
-	if (it == map_.end()) {
-	    if (access_.size() >= capacity_) {
-	        auto removed_key = access_.back();
-		erase(removed_key);
-	    }
-	    access_.push_front(key);
-	    map_[key] = std::make_pair(value, access_.begin());
+	if (index_[find_slot(key)] != EMPTY) {
+	    return;
+	}
+	if (size_ >= capacity_ && tail_ != NIL) {
+	    K removed_key = nodes_[tail_].key;
+	    erase(removed_key);
+	}
+	if (2*(size_ + 1) > index_.size()) {
+	    rehash(2*index_.size());
 	}
+	size_t n = new_node(key, value);
+	link_front(n);
+	index_[find_slot(key)] = n;
+	size_++;
     }
 
     inline V * find(const K &key)
     {
-        auto it = map_.find(key);
-	if (it == map_.end()) {
+	size_t n = index_[find_slot(key)];
+	if (n == EMPTY) {
 	    return nullptr;
 	}
-	auto &v = it->second.first;
-	auto &access_it = it->second.second;
-	access_.erase(access_it);
-	access_.push_front(key);
-	it->second.second = access_.begin();
-	
-	return &v;
+	if (n != head_) {
+	    unlink(n);
+	    link_front(n);
+	}
+	return &nodes_[n].value;
     }
 
     inline void erase(const K &key) {
-	auto removed_it = map_.find(key);
-	if (removed_it == map_.end()) {
+	size_t slot = find_slot(key);
+	size_t n = index_[slot];
+	if (n == EMPTY) {
 	    return;
 	}
-	auto removed_key = removed_it->first;
-	auto removed_value = removed_it->second.first;
-        auto access_it = removed_it->second.second;
-	access_.erase(access_it);
-	map_.erase(removed_it);
-	callback_.evicted(removed_key, removed_value); 
+	remove_slot(slot);
+	unlink(n);
+	K removed_key = nodes_[n].key;
+	V removed_value = nodes_[n].value;
+	nodes_[n].next = free_;
+	free_ = n;
+	size_--;
+	callback_.evicted(removed_key, removed_value);
     }
 
     inline void clear() {
-        while (!access_.empty()) {
-	    erase(access_.back());
-        }
+	while (tail_ != NIL) {
+	    K removed_key = nodes_[tail_].key;
+	    erase(removed_key);
+	}
     }
 
     inline void foreach(const std::function<void(const K &key, V &value)> &apply) {
-        for (auto &e : map_) {
-	    apply(e.first, e.second.first);
-        }
+	for (size_t n = head_; n != NIL; n = nodes_[n].next) {
+	    apply(nodes_[n].key, nodes_[n].value);
+	}
     }
 
 private:
-    typedef typename std::list<K>::iterator access_iterator_type;
+    static const size_t NIL = static_cast<size_t>(-1);
+    static const size_t EMPTY = NIL;
+    static const size_t INITIAL_INDEX_SIZE = 16;
+
+    struct node {
+	K key;
+	V value;
+	size_t prev;
+	size_t next;
+    };
+
+    inline void init() {
+	size_ = 0;
+	head_ = NIL;
+	tail_ = NIL;
+	free_ = NIL;
+	index_.assign(INITIAL_INDEX_SIZE, EMPTY);
+	mask_ = INITIAL_INDEX_SIZE - 1;
+    }
+
+    inline size_t home(const K &key) const {
+	uint64_t h = static_cast<uint64_t>(std::hash<K>()(key));
+	h *= 0x9e3779b97f4a7c15ULL;
+	return static_cast<size_t>(h ^ (h >> 32)) & mask_;
+    }
+
+    // Slot with the key, or the empty slot where it would be inserted
+    inline size_t find_slot(const K &key) const {
+	size_t slot = home(key);
+	while (index_[slot] != EMPTY && !(nodes_[index_[slot]].key == key)) {
+	    slot = (slot + 1) & mask_;
+	}
+	return slot;
+    }
+
+    // Backward shift deletion (no tombstones)
+    inline void remove_slot(size_t hole) {
+	index_[hole] = EMPTY;
+	size_t slot = hole;
+	for (;;) {
+	    slot = (slot + 1) & mask_;
+	    size_t n = index_[slot];
+	    if (n == EMPTY) {
+		return;
+	    }
+	    size_t h = home(nodes_[n].key);
+	    // Can the entry be moved to the hole? Only if its home is not
+	    // cyclically in (hole, slot].
+	    bool in_between = (hole <= slot) ? (h > hole && h <= slot)
+		                             : (h > hole || h <= slot);
+	    if (!in_between) {
+		index_[hole] = n;
+		index_[slot] = EMPTY;
+		hole = slot;
+	    }
+	}
+    }
+
+    inline void rehash(size_t new_size) {
+	index_.assign(new_size, EMPTY);
+	mask_ = new_size - 1;
+	for (size_t n = head_; n != NIL; n = nodes_[n].next) {
+	    index_[find_slot(nodes_[n].key)] = n;
+	}
+    }
+
+    inline size_t new_node(const K &key, const V &value) {
+	if (free_ != NIL) {
+	    size_t n = free_;
+	    free_ = nodes_[n].next;
+	    nodes_[n].key = key;
+	    nodes_[n].value = value;
+	    return n;
+	}
+	nodes_.push_back(node{key, value, NIL, NIL});
+	return nodes_.size() - 1;
+    }
+
+    inline void link_front(size_t n) {
+	nodes_[n].prev = NIL;
+	nodes_[n].next = head_;
+	if (head_ != NIL) {
+	    nodes_[head_].prev = n;
+	} else {
+	    tail_ = n;
+	}
+	head_ = n;
+    }
+
+    inline void unlink(size_t n) {
+	auto &nd = nodes_[n];
+	if (nd.prev != NIL) {
+	    nodes_[nd.prev].next = nd.next;
+	} else {
+	    head_ = nd.next;
+	}
+	if (nd.next != NIL) {
+	    nodes_[nd.next].prev = nd.prev;
+	} else {
+	    tail_ = nd.prev;
+	}
+    }
+
     size_t capacity_;
-    std::unordered_map<K, std::pair<V , access_iterator_type> > map_;
-    std::list<K> access_;
+    size_t size_;
+    // Most recently accessed first
+    size_t head_;
+    size_t tail_;
+    // Free list of nodes (through next)
+    size_t free_;
+    // Nodes don't move (pointers to values stay valid until erased)
+    std::deque<node> nodes_;
+    std::vector<size_t> index_;
+    size_t mask_;
     C callback_;
-
 };
 
+template<typename K, typename V, typename C> const size_t lru_cache<K,V,C>::NIL;
+template<typename K, typename V, typename C> const size_t lru_cache<K,V,C>::EMPTY;
+template<typename K, typename V, typename C> const size_t lru_cache<K,V,C>::INITIAL_INDEX_SIZE;
+
 }}
 
+#endif
@@ -0,0 +1,123 @@
+#include "symbol_table.hpp"
+#include <algorithm>
+#include <boost/thread/lock_guard.hpp>
+
+namespace prologcoin { namespace common {
+
+const size_t symbol_table::NONE;
+const size_t symbol_table::INITIAL_NUM_SLOTS;
+const size_t symbol_table::ARENA_CHUNK_SIZE;
+
+symbol_table::table::table(size_t num_slots)
+    : mask(num_slots - 1),
+      slots(new boost::atomic<const entry *>[num_slots])
+{
+    for (size_t i = 0; i < num_slots; i++) {
+	slots[i].store(nullptr, boost::memory_order_relaxed);
+    }
+}
+
+symbol_table::symbol_table()
+{
+    init();
+}
+
+symbol_table::~symbol_table()
+{
+}
+
+void symbol_table::init()
+{
+    current_.reset(new table(INITIAL_NUM_SLOTS));
+    size_.store(0, boost::memory_order_relaxed);
+    arena_free_ = nullptr;
+    arena_left_ = 0;
+    table_.store(current_.get(), boost::memory_order_release);
+}
+
+void symbol_table::clear()
+{
+    boost::lock_guard<spinlock> lockit(lock_);
+
+    table_.store(nullptr, boost::memory_order_relaxed);
+    current_.reset();
+    retired_.clear();
+    entries_.clear();
+    arena_.clear();
+    init();
+}
+
+void symbol_table::set(const std::string &name, size_t value)
+{
+    boost::lock_guard<spinlock> lockit(lock_);
+
+    const char *str = name.data();
+    size_t len = name.size();
+    uint32_t h = hash(str, len);
+
+    size_t slot = h & current_->mask;
+    for (;; slot = (slot + 1) & current_->mask) {
+	const entry *e = current_->slots[slot].load(boost::memory_order_relaxed);
+	if (e == nullptr) {
+	    break;
+	}
+	if (e->hash == h && e->len == len && memcmp(e->name, str, len) == 0) {
+	    e->value.store(value, boost::memory_order_release);
+	    return;
+	}
+    }
+
+    // A new name. Keep the load factor at most 1/2.
+    if (2*(size() + 1) > current_->mask + 1) {
+	grow();
+	slot = h & current_->mask;
+	while (current_->slots[slot].load(boost::memory_order_relaxed) != nullptr) {
+	    slot = (slot + 1) & current_->mask;
+	}
+    }
+
+    entries_.emplace_back();
+    entry &e = entries_.back();
+    e.hash = h;
+    e.len = len;
+    e.name = intern(str, len);
+    e.value.store(value, boost::memory_order_relaxed);
+
+    // Publish the entry (readers can see it from now on)
+    current_->slots[slot].store(&e, boost::memory_order_release);
+    size_.store(size() + 1, boost::memory_order_relaxed);
+}
+
+void symbol_table::grow()
+{
+    std::unique_ptr<table> t(new table(2*(current_->mask + 1)));
+    for (auto &e : entries_) {
+	size_t slot = e.hash & t->mask;
+	while (t->slots[slot].load(boost::memory_order_relaxed) != nullptr) {
+	    slot = (slot + 1) & t->mask;
+	}
+	t->slots[slot].store(&e, boost::memory_order_relaxed);
+    }
+    table_.store(t.get(), boost::memory_order_release);
+
+    // Readers may still be probing the old table
+    retired_.push_back(std::move(current_));
+    current_ = std::move(t);
+}
+
+const char * symbol_table::intern(const char *name, size_t len)
+{
+    if (len > arena_left_) {
+	size_t chunk_size = std::max(len, ARENA_CHUNK_SIZE);
+	arena_.push_back(std::unique_ptr<char[]>(new char[chunk_size]));
+	arena_free_ = arena_.back().get();
+	arena_left_ = chunk_size;
+    }
+    char *p = arena_free_;
+    memcpy(p, name, len);
+    arena_free_ += len;
+    arena_left_ -= len;
+    return p;
+}
+
+}}
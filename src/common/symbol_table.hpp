@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef _common_symbol_table_hpp
+#define _common_symbol_table_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <boost/atomic.hpp>
+#include "fast_hash.hpp"
+#include "spinlock.hpp"
+
+namespace prologcoin { namespace common {
+
+//
+// Interned (hash-consed) symbol names, each mapped to a value. Names
+// are copied once into an arena and never move, and they are looked
+// up with an open addressing (linear probing) table of pointers to
+// entries.
+//
+// find() is lock-free and can be called concurrently with other
+// find() and set() calls (e.g. from different sessions.) set() calls
+// are serialized with a spinlock. Entries are never removed (only
+// clear() does that), and a table that is replaced when growing is
+// kept until clear(), so a reader never sees freed memory.
+//
+class symbol_table {
+public:
+    static const size_t NONE = static_cast<size_t>(-1);
+
+    symbol_table();
+    ~symbol_table();
+
+    symbol_table(const symbol_table &) = delete;
+    symbol_table & operator = (const symbol_table &) = delete;
+
+    // Returns NONE if the name isn't in the table.
+    inline size_t find(const char *name, size_t len) const {
+	uint32_t h = hash(name, len);
+	const table *t = table_.load(boost::memory_order_acquire);
+	for (size_t slot = h & t->mask;; slot = (slot + 1) & t->mask) {
+	    const entry *e = t->slots[slot].load(boost::memory_order_acquire);
+	    if (e == nullptr) {
+		return NONE;
+	    }
+	    if (e->hash == h && e->len == len &&
+		memcmp(e->name, name, len) == 0) {
+		return e->value.load(boost::memory_order_acquire);
+	    }
+	}
+    }
+
+    inline size_t find(const std::string &name) const {
+	return find(name.data(), name.size());
+    }
+
+    // Interns the name (if it is new) and sets its value.
+    void set(const std::string &name, size_t value);
+
+    inline size_t size() const {
+	return size_.load(boost::memory_order_relaxed);
+    }
+
+    // Not thread safe; there must be no concurrent readers.
+    void clear();
+
+private:
+    static const size_t INITIAL_NUM_SLOTS = 1024;
+    static const size_t ARENA_CHUNK_SIZE = 64*1024;
+
+    struct entry {
+	uint32_t hash;
+	size_t len;
+	const char *name;
+	mutable boost::atomic<size_t> value;
+    };
+
+    struct table {
+	table(size_t num_slots);
+
+	size_t mask;
+	std::unique_ptr<boost::atomic<const entry *>[]> slots;
+    };
+
+    static inline uint32_t hash(const char *name, size_t len) {
+	fast_hash h;
+	h.update(name, len);
+	return h.finalize();
+    }
+
+    void init();
+    void grow();
+    const char * intern(const char *name, size_t len);
+
+    boost::atomic<const table *> table_;
+    boost::atomic<size_t> size_;
+
+    // Everything below is only touched by writers (with lock_ held.)
+    spinlock lock_;
+    std::unique_ptr<table> current_;
+    std::vector<std::unique_ptr<table> > retired_;
+    std::deque<entry> entries_;
+    std::vector<std::unique_ptr<char[]> > arena_;
+    char *arena_free_;
+    size_t arena_left_;
+};
+
+}}
+
+#endif
@@ -264,6 +264,9 @@ std::string dat_cell::inner_str() const
 heap::heap() 
   : size_(0),
     head_block_(nullptr),
+    base_(nullptr),
+    num_base_blocks_(0),
+    block_cache_enabled_(true),
     coin_security_enabled_(true),
     external_ptrs_max_(0)
 {
@@ -277,8 +280,11 @@ void heap::reset()
     }
     blocks_.clear();
     watched_.clear();
+    clear_block_cache();
     size_ = 0;
     head_block_ = nullptr;
+    base_ = nullptr;
+    num_base_blocks_ = 0;
     external_ptrs_max_ = 0;
     get_block_fn_ = &get_block_default;
     get_block_fn_context_ = nullptr;
@@ -293,6 +299,36 @@ void heap::reset()
     atom_name_to_index_table_.clear();
 }
 
+void heap::fork(const heap &base)
+{
+    assert(base.get_block_fn_ == &get_block_default);
+
+    reset();
+
+    base_ = &base;
+    num_base_blocks_ = base.blocks_.size();
+    blocks_.resize(num_base_blocks_, nullptr);
+    watched_ = base.watched_;
+    coin_security_enabled_ = base.coin_security_enabled_;
+    atom_index_to_name_table_ = base.atom_index_to_name_table_;
+    atom_name_to_index_table_ = base.atom_name_to_index_table_;
+
+    // New cells are allocated in the head block, so it is copied now
+    if (num_base_blocks_ > 0) {
+	set_head_block(&copy_base_block(num_base_blocks_ - 1));
+    }
+}
+
+heap_block & heap::copy_base_block(size_t index)
+{
+    auto &from = *base_->blocks_[index];
+    auto *block = new heap_block(*this, index);
+    std::copy(from.cells(), from.cells() + from.size(), block->cells());
+    block->trim(from.size());
+    blocks_[index] = block;
+    return *block;
+}
+
 heap::~heap()
 {
 #ifdef DEBUG_TERM
@@ -309,6 +345,11 @@ heap::~heap()
     }
 }
 
+void heap::clear_block_cache()
+{
+    std::fill(block_cache_, block_cache_ + BLOCK_CACHE_SIZE, nullptr);
+}
+
 const con_cell heap::EMPTY_LIST = con_cell("[]",0);
 const con_cell heap::DOTTED_PAIR = con_cell(".",2);
 const con_cell heap::COMMA = con_cell(",",2);
@@ -329,10 +370,26 @@ void heap::internal_trim(size_t new_size)
 	    delete blocks_[i];
 	}
 	blocks_.resize(block_index+1);
+	num_base_blocks_ = std::min(num_base_blocks_, blocks_.size());
     }
     head_block_ = &block;
 }
 
+void heap::compacted(size_t from, size_t new_size)
+{
+    if (new_size <= from) {
+	trim(new_size);
+	return;
+    }
+    size_t first = find_block_index(from);
+    size_t last = find_block_index(new_size-1);
+    for (size_t i = first; i < last; i++) {
+	auto &block = get_block_fn_(*this, get_block_fn_context_, i);
+	block.trim(heap_block::MAX_SIZE);
+    }
+    trim(new_size);
+}
+
 size_t heap::list_length(const cell lst0) const
 {
     size_t n = 0;
@@ -455,6 +512,34 @@ size_t heap::resolve_atom_index(const std::string &name) const
     return new_index;
 }
 
+void heap::save_atom_table(std::vector<std::pair<size_t, std::string> > &atoms) const
+{
+    atoms.assign(atom_index_to_name_table_.begin(),
+		 atom_index_to_name_table_.end());
+    std::sort(atoms.begin(), atoms.end());
+}
+
+bool heap::load_atom_table(const std::vector<std::pair<size_t, std::string> > &atoms)
+{
+    if (new_atom_fn_ != new_atom_default) {
+	return false;
+    }
+    for (auto &atom : atoms) {
+	auto it = atom_name_to_index_table_.find(atom.second);
+	if (it != atom_name_to_index_table_.end()) {
+	    if (it->second != atom.first) {
+		return false;
+	    }
+	} else if (atom_index_to_name_table_.count(atom.first)) {
+	    return false;
+	}
+    }
+    for (auto &atom : atoms) {
+	set_atom_index(atom.second, atom.first);
+    }
+    return true;
+}
+
 bool heap::is_name(con_cell c, const std::string &name) const
 {
     if (c.is_direct()) {
@@ -633,7 +718,7 @@ void heap::set_big(cell big, const boost::multiprecision::cpp_int &i)
     if (i != 0) {
 	// It needs to be in the right most position of the bignum
 	// (the bignum is in big endian form)
-	auto nbytes = (nbits - ((msb(i) + 7) / 8)*8) / 8;
+	auto nbytes = (nbits - ((msb(i) + 8) / 8)*8) / 8;
 	while (nbytes) {
 	    ++bi;
 	    nbytes--;
@@ -655,6 +740,53 @@ void heap::get_big(cell big, uint8_t *bytes, size_t n) const
     }
 }
 
+//
+// Byte p of the bignum (in big endian order) lives at byte offset
+// (4+p) % 8 of cell (4+p) / 8, where the first 4 bytes are occupied
+// by the header.
+//
+
+void heap::get_big_limbs(cell big, uint64_t *limbs, size_t n) const
+{
+    auto dc = deref(big);
+    big_cell &b = static_cast<big_cell &>(dc);
+    size_t index = b.index();
+    size_t nbytes = num_bytes(b);
+    assert(n >= (nbytes + 7) / 8);
+    check_index(index+(nbytes+4+sizeof(cell)-1)/sizeof(cell)-1);
+    std::fill(limbs, limbs + n, 0);
+    for (size_t p = 0, k = 4; p < nbytes; index++, k = 0) {
+	auto raw = untagged_at(index).raw_value();
+	for (; k < sizeof(cell) && p < nbytes; k++, p++) {
+	    auto s = nbytes - 1 - p;
+	    limbs[s / 8] |= ((raw >> (8*k)) & 0xff) << (8*(s % 8));
+	}
+    }
+}
+
+big_cell heap::new_big_limbs(const uint64_t *limbs, size_t n)
+{
+    while (n > 1 && limbs[n-1] == 0) {
+	n--;
+    }
+    size_t nbytes = 8*(n-1) + 1;
+    for (auto top = limbs[n-1] >> 8; top != 0; top >>= 8) {
+	nbytes++;
+    }
+    big_cell big = new_big(8*nbytes);
+    size_t index = big.index();
+    for (size_t p = 0, k = 4; p < nbytes; index++, k = 0) {
+	auto &c = untagged_at(index);
+	auto raw = (k == 0) ? 0 : (c.raw_value() & 0xffffffff);
+	for (; k < sizeof(cell) && p < nbytes; k++, p++) {
+	    auto s = nbytes - 1 - p;
+	    raw |= ((limbs[s / 8] >> (8*(s % 8))) & 0xff) << (8*k);
+	}
+	c = untagged_cell(raw);
+    }
+    return big;
+}
+
 bool heap::big_equal(big_cell big1, big_cell big2, uint64_t &cost) const
 {
     uint64_t cost_tmp = 1;
@@ -202,6 +202,13 @@ public:
 	cached_ = *base_;
     }
 
+    inline void flush() {
+	if (base_ && dirty_) {
+	    base_[index_/sizeof(untagged_cell)] = cached_;
+	    dirty_ = false;
+	}
+    }
+
     inline void operator = (const cell_byte &other) {
 	if (base_ && dirty_) base_[index_/sizeof(untagged_cell)] = cached_;
 	base_ = other.base_;
@@ -780,7 +787,7 @@ public:
         : heap_(h), index_(index), offset_(index*MAX_SIZE),
 	  size_(0), changed_(false) {
     }
-    ~heap_block() = default;
+    inline ~heap_block();
 
     inline const cell * cells() const { return &cells_[0]; }
     inline cell * cells() { return &cells_[0]; }  
@@ -963,6 +970,14 @@ public:
 
     void reset();
 
+    // Make this heap a copy-on-write clone of 'base'. The blocks of
+    // 'base' are shared (and only read) until they are written to,
+    // then the block is copied. 'base' must use the default block
+    // functions, outlive this heap and not change while it is shared.
+    void fork(const heap &base);
+
+    inline bool is_fork() const { return base_ != nullptr; }
+
     inline heap & get_heap() { return *this; }
     inline const heap & get_heap() const { return *this; }
 
@@ -1053,6 +1068,14 @@ public:
 	}
     }
 
+    // Save the atom table (e.g. along with code that refers to atoms
+    // by index) and add the atoms of a saved table again. Adding
+    // fails, without adding anything, if an atom would get another
+    // index than it already has (or if this heap gets its atom
+    // indices elsewhere.)
+    void save_atom_table(std::vector<std::pair<size_t, std::string> > &atoms) const;
+    bool load_atom_table(const std::vector<std::pair<size_t, std::string> > &atoms);
+
     inline bool is_dollar_atom_name(con_cell cell) const
     {
         if (cell.is_direct()) {
@@ -1367,6 +1390,16 @@ public:
     void get_big(cell big, uint8_t *bytes, size_t n) const;
     void set_big(cell big, const uint8_t *bytes, size_t n);
 
+    // The magnitude as 64-bit limbs (least significant first.) These
+    // read/write whole cells rather than going byte by byte through
+    // big_iterator.
+    inline size_t num_limbs(cell big) const {
+	auto dc = deref(big);
+	return (num_bytes(reinterpret_cast<big_cell &>(dc)) + 7) / 8;
+    }
+    void get_big_limbs(cell big, uint64_t *limbs, size_t n) const;
+    big_cell new_big_limbs(const uint64_t *limbs, size_t n);
+
     big_header get_big_header(cell big) const {
       auto dc = deref(big);
       big_cell &b = reinterpret_cast<big_cell &>(dc);
@@ -1413,6 +1446,36 @@ public:
 	return index;
     }
 
+    // Copy 'n' cells (at most a block) to consecutive cells on the
+    // heap. The REF and STR cells are relative to the first cell
+    // (i.e. 0 is the first cell), so a term (e.g. a clause) stored
+    // like this can be instantiated without a term copy. Returns the
+    // address of the first cell.
+    inline size_t new_relocated_cells(const cell *cells, size_t n)
+    {
+        cell *p;
+        size_t index;
+	std::tie(p, index) = allocate(tag_t::REF, n);
+	for (size_t i = 0; i < n; i++) {
+	    cell c = cells[i];
+	    switch (c.tag()) {
+	    case tag_t::REF:
+	    case tag_t::STR: {
+		auto &pc = static_cast<ptr_cell &>(c);
+		pc.set_index(pc.index() + index);
+		break;
+	        }
+	    case tag_t::CON:
+		coin_security_check(static_cast<con_cell &>(c));
+		break;
+	    default:
+		break;
+	    }
+	    p[i] = c;
+	}
+	return index;
+    }
+
     inline void new_dat_cell(cell c)
     {
         cell *p;
@@ -1486,6 +1549,22 @@ public:
     inline bool watched(size_t addr) const {
         return find_block(addr).watched(addr);
     }  
+
+    // Heap blocks may have unused space at the end (non-spanning
+    // allocations that didn't fit), so not every address below size()
+    // is a cell.
+    inline bool is_cell(size_t addr) const {
+        if (addr >= size()) {
+	    return false;
+	}
+	auto &block = find_block(addr);
+	return addr - block.offset() < block.size();
+    }
+
+    // Used by a compacting garbage collector after it has moved
+    // all cells from 'from' and upwards to [from, new_size).
+    // The blocks in between are now fully used.
+    void compacted(size_t from, size_t new_size);
   
     bool check_term(const term t, std::string *name = nullptr) const;
 private:
@@ -1510,9 +1589,13 @@ public:
     {
         if (block_index == NEW_BLOCK) {
   	    new_block_default(h);
-	    block_index = h.blocks_.size();
+	    return *h.head_block_;
+	}
+	auto *block = h.blocks_[block_index];
+	if (block == nullptr) {
+	    return h.copy_base_block(block_index);
 	}
-        return *h.blocks_[block_index];
+        return *block;
     }
 
     static inline void modified_block_default(heap_block & /*block*/, void * /* context */) {
@@ -1549,6 +1632,29 @@ public:
     inline void set_head_block(heap_block *h) {
         head_block_ = h;
         size_ = h->index() * heap_block::MAX_SIZE + h->size();
+	if (block_cache_enabled_) {
+	    block_cache_[h->index() % BLOCK_CACHE_SIZE] = h;
+	}
+    }
+
+    // Block pointers are cached (direct mapped on the block index) so
+    // that find_block() rarely needs to go through get_block_fn_.
+    // Deleted blocks and new head blocks are updated automatically,
+    // but if get_block_fn_ can return a different block for the same
+    // index (e.g. after discarding changes) the cache must be cleared.
+    void clear_block_cache();
+
+    inline bool is_block_cache() const { return block_cache_enabled_; }
+    inline void set_block_cache(bool enabled) {
+	block_cache_enabled_ = enabled;
+	clear_block_cache();
+    }
+
+    inline void forget_block(const heap_block &block) {
+	auto &slot = block_cache_[block.index() % BLOCK_CACHE_SIZE];
+	if (slot == &block) {
+	    slot = nullptr;
+	}
     }
 
 private:
@@ -1562,12 +1668,37 @@ private:
 
     inline heap_block & find_block(size_t addr)
     {
-        return get_block_fn_(*this, get_block_fn_context_, find_block_index(addr));
+	size_t index = find_block_index(addr);
+	heap_block *block = block_cache_[index % BLOCK_CACHE_SIZE];
+	if (block != nullptr && block->index() == index) {
+	    return *block;
+	}
+	return lookup_block(index);
     }
 
     inline const heap_block & find_block(size_t addr) const
     {
-        return get_block_fn_(const_cast<heap &>(*this), get_block_fn_context_, find_block_index(addr));
+	size_t index = find_block_index(addr);
+	const heap_block *block = block_cache_[index % BLOCK_CACHE_SIZE];
+	if (block != nullptr && block->index() == index) {
+	    return *block;
+	}
+	if (index < num_base_blocks_ && blocks_[index] == nullptr) {
+	    // Not written to since the fork, so read the shared block
+	    return *base_->blocks_[index];
+	}
+        return const_cast<heap &>(*this).lookup_block(index);
+    }
+
+    heap_block & copy_base_block(size_t index);
+
+    inline heap_block & lookup_block(size_t index)
+    {
+	auto &block = get_block_fn_(*this, get_block_fn_context_, index);
+	if (block_cache_enabled_) {
+	    block_cache_[index % BLOCK_CACHE_SIZE] = &block;
+	}
+	return block;
     }
 
     inline const bool in_range(size_t addr) const
@@ -1654,8 +1785,17 @@ private:
     size_t size_;
     std::vector<heap_block *> blocks_;
     heap_block * head_block_;
+
+    // Blocks [0, num_base_blocks_) of a fork are nullptr until they
+    // have been copied from base_.
+    const heap *base_;
+    size_t num_base_blocks_;
     std::vector<size_t> watched_;
 
+    static const size_t BLOCK_CACHE_SIZE = 256;
+    heap_block * block_cache_[BLOCK_CACHE_SIZE];
+    bool block_cache_enabled_;
+
     bool coin_security_enabled_;
 
 #ifdef DEBUG_TERM
@@ -1682,7 +1822,7 @@ public:
     typedef size_t (*new_atom_fn)(const heap &h, void *context, const std::string &atom_name);
     typedef void (*trim_fn)(heap &h, void *context, size_t new_size);
   
-    inline void setup_get_block_fn(get_block_fn fn, void *context) { get_block_fn_ = fn; get_block_fn_context_ = context; }
+    inline void setup_get_block_fn(get_block_fn fn, void *context) { get_block_fn_ = fn; get_block_fn_context_ = context; clear_block_cache(); }
     inline void setup_modified_block_fn(modified_block_fn fn, void *context) { modified_block_fn_ = fn; modified_block_fn_context_ = context; }
     inline void setup_new_atom_fn(new_atom_fn fn, void *context) { new_atom_fn_ = fn; new_atom_fn_context_ = context; }
     inline void setup_trim_fn(trim_fn fn, void *context) { trim_fn_ = fn; trim_fn_context_ = context; }
@@ -1706,6 +1846,10 @@ inline void heap_block::modified() {
     heap_.modified_block_fn_(*this, heap_.modified_block_fn_context_);
 }
 
+inline heap_block::~heap_block() {
+    heap_.forget_block(*this);
+}
+
 inline bool heap_block::is_head_block() const {
     return this == heap_.head_block_;
 }
@@ -1734,6 +1878,12 @@ template<typename T> inline big_iterator_base<T>::big_iterator_base(const big_it
 template<typename T> inline big_iterator_base<T> & big_iterator_base<T>::operator ++()
 {
     i_++;
+    if (i_ == end_) {
+	// Past the last byte. Don't look at the next cell as it may
+	// be in a heap block that doesn't exist.
+	cell_byte_.flush();
+	return *this;
+    }
     if (i_ % 8 == 0) {
 	index_++;
 	if ((index_ % heap_block::MAX_SIZE) == 0) {
@@ -1893,6 +2043,24 @@ public:
     size_t size() const {
 	return ref_2_name_.size();
     }
+    // Keep the names for variables that survived a garbage collection
+    // (at or above 'from'.) The function returns false if the
+    // variable was reclaimed, otherwise it updates its address.
+    template<typename Fn> void relocate(size_t from, Fn fn) {
+	std::vector<std::pair<ref_cell, std::string> > moved;
+	auto it = ref_2_name_.lower_bound(ref_cell(from));
+	while (it != ref_2_name_.end()) {
+	    size_t index = it->first.index();
+	    if (fn(index)) {
+		moved.push_back(std::make_pair(ref_cell(index), it->second));
+	    }
+	    it = ref_2_name_.erase(it);
+	}
+	for (auto &m : moved) {
+	    ref_2_name_[m.first] = m.second;
+	}
+    }
+
     void trim_names(size_t heap_limit) {
 	ref_cell r(heap_limit);
 	auto it_end = ref_2_name_.end();
@@ -225,26 +225,43 @@ void term_utils::restore_cells_after_unify() {
   }
 }
 
+static inline bool is_atomic(const term t)
+{
+    return t.tag() == tag_t::CON || t.tag() == tag_t::INT;
+}
+
 bool term_utils::unify_helper(term a, term b, uint64_t &cost)
 {
     size_t d = stack_size();
     uint64_t cost_tmp = 0;
 
+    reserve_stack(d + UNIFY_STACK_RESERVE);
+
+    // If true, then a and b are already dereferenced (and paid for)
+    // and they are the next pair to unify. This way the first argument
+    // pair of a structure that isn't unified inline (e.g. the tail of
+    // a list with atomic elements) is never pushed.
+    bool next_pair = false;
+
     push(b);
     push(a);
 
-    while (stack_size() > d) {
+    while (next_pair || stack_size() > d) {
 	
 	// The cost of deref is at least 1 (if the ref chains are longer
 	// the cost will be bigger.)
 	// So every iteration of this stack based unification loop
 	// will add 2 to the accumulated cost.
 
-	uint64_t cost_deref1 = 0, cost_deref2 = 0;
-        a = deref_with_cost(pop(), cost_deref1);
-	cost_tmp += cost_deref1;
-	b = deref_with_cost(pop(), cost_deref2);
-	cost_tmp += cost_deref2;
+	if (next_pair) {
+	    next_pair = false;
+	} else {
+	    uint64_t cost_deref1 = 0, cost_deref2 = 0;
+	    a = deref_with_cost(pop(), cost_deref1);
+	    cost_tmp += cost_deref1;
+	    b = deref_with_cost(pop(), cost_deref2);
+	    cost_tmp += cost_deref2;
+	}
 
 	if (a == b) {
 	    continue;
@@ -346,14 +363,46 @@ bool term_utils::unify_helper(term a, term b, uint64_t &cost)
           auto fwdcell = fwd_cell(bindex);
           heap_set(aindex, fwdcell);
 
-	  // Push pairwise args
+	  // Fast path: unify the leading argument pairs that are equal
+	  // or atomic inline. Nothing is bound until the first pair
+	  // that isn't, so the remaining pairs are the same (and are
+	  // dereferenced in the same order) as if all were pushed here.
+	  // arg() dereferences, so deref_with_cost would charge exactly
+	  // 1 per argument.
 	  size_t num_args = f.arity();
-	  for (size_t i = 0; i < num_args; i++) {
-	    auto ai = arg(astr, num_args-i-1);
-	    auto bi = arg(bstr, num_args-i-1);
-	    push(bi);
-	    push(ai);
+	  size_t i = 0;
+	  term ai, bi;
+	  for (; i < num_args; i++) {
+	    ai = arg(astr, i);
+	    bi = arg(bstr, i);
+	    cost_tmp += 2;
+	    if (ai == bi) {
+	      continue;
+	    }
+	    if (ai.tag().is_ref() || bi.tag().is_ref() ||
+		!(is_atomic(ai) || is_atomic(bi))) {
+	      break;
+	    }
+	    // Different atomic terms, or an atomic and a non-atomic term.
+	    cost = cost_tmp;
+	    restore_cells_after_unify();
+	    return false;
+	  }
+	  if (i == num_args) {
+	    break;
+	  }
+
+	  // Push the remaining pairwise args, and continue with
+	  // this pair.
+	  for (size_t j = num_args - 1; j > i; j--) {
+	    auto aj = arg(astr, j);
+	    auto bj = arg(bstr, j);
+	    push(bj);
+	    push(aj);
 	  }
+	  a = ai;
+	  b = bi;
+	  next_pair = true;
 	  break;
 	}
 	case tag_t::BIG: {
@@ -527,13 +576,36 @@ term term_utils::copy(term c, naming_map &names,
     
     uint64_t cost_tmp = 0;
 
-    push(src.deref(c));
-    push(int_cell(0));
-    while (stack_size() > current_stack) {
+    reserve_stack(current_stack + COPY_STACK_RESERVE);
+
+    auto copy_con = [&](con_cell cc) -> con_cell {
+	if (cc.is_direct()) {
+	    return cc;
+	}
+	auto search = con_map.find(cc);
+	if (search != con_map.end()) {
+	    return search->second;
+	}
+	con_cell dst_cc = functor(src.atom_name(cc), cc.arity());
+	con_map[cc] = dst_cc;
+	return dst_cc;
+    };
+
+    // If true, then c is the next (unprocessed) term to copy. It
+    // hasn't been pushed onto the stack.
+    bool next_term = true;
+    c = src.deref(c);
+
+    while (next_term || stack_size() > current_stack) {
 	cost_tmp++;
 
-        bool processed = pop() == int_cell(1);
-        c = pop();
+	bool processed = false;
+	if (next_term) {
+	    next_term = false;
+	} else {
+	    processed = pop() == int_cell(1);
+	    c = pop();
+	}
 
 	auto search_c = term_map.find(c);
 	if (search_c != term_map.end()) {
@@ -573,26 +645,9 @@ term term_utils::copy(term c, naming_map &names,
 	  }
 	  break;
 	case tag_t::CON:
-	  {
-	      auto &cc = reinterpret_cast<con_cell &>(c);
-	      if (cc.is_direct()) {
-                temp_push(c);
-                temp_push(int_cell(0));
-                current_path.erase(c);
-	      } else {
-		  auto search = con_map.find(cc);
-		  con_cell dst_cc;
-		  if (search == con_map.end()) {
-		      dst_cc = functor(src.atom_name(cc), cc.arity());
-		      con_map[cc] = dst_cc;
-		  } else {
-		      dst_cc = search->second;
-		  }
-		  temp_push(dst_cc);
-                  temp_push(int_cell(0));
-                  current_path.erase(c);
-	      }
-	  }
+	  temp_push(copy_con(reinterpret_cast<con_cell &>(c)));
+	  temp_push(int_cell(0));
+	  current_path.erase(c);
 	  break;
 	case tag_t::INT:
 	  temp_push(c);
@@ -636,12 +691,33 @@ term term_utils::copy(term c, naming_map &names,
 	      // First push STR cell as processed
 	      push(c);
 	      push(int_cell(1));
-	      // Then the arguments to be processed (argN-1 ... arg0)
-	      // We want to process arg0 first (that's why it is pushed last.)
-	      for (size_t i = 0; i < num_args; i++) {
-		push(src.arg(c, num_args-i-1));
+	      // Fast path: the leading atomic arguments are copied
+	      // directly (each one counts as a processed term.)
+	      size_t i = 0;
+	      term ci;
+	      for (; i < num_args; i++) {
+		ci = src.arg(c, i);
+		if (ci.tag() == tag_t::INT) {
+		  temp_push(ci);
+		} else if (ci.tag() == tag_t::CON) {
+		  temp_push(copy_con(reinterpret_cast<con_cell &>(ci)));
+		} else {
+		  break;
+		}
+		temp_push(int_cell(0));
+		cost_tmp++;
+	      }
+	      // Then the remaining arguments to be processed
+	      // (argN-1 ... argi+1), and continue with argi. (So the
+	      // tail of a list with atomic elements is never pushed.)
+	      for (size_t j = num_args; j > i + 1; j--) {
+		push(src.arg(c, j-1));
 		push(int_cell(0));
 	      }
+	      if (i < num_args) {
+		c = ci;
+		next_term = true;
+	      }
 	    }
 	  }
 	  break;
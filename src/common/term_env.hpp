@@ -206,6 +206,12 @@ public:
         { T::get_heap().set_big(t, i); }
     inline void set_big(term t, const uint8_t *bytes, size_t n)
         { T::get_heap().set_big(t, bytes, n); }
+    inline size_t num_limbs(term t) const
+        { return T::get_heap().num_limbs(t); }
+    inline void get_big_limbs(term t, uint64_t *limbs, size_t n) const
+        { T::get_heap().get_big_limbs(t, limbs, n); }
+    inline term new_big_limbs(const uint64_t *limbs, size_t n)
+        { return T::get_heap().new_big_limbs(limbs, n); }
     inline void trim_heap(size_t new_size)
         { return T::get_heap().trim(new_size); }
     inline size_t heap_size() const
@@ -369,6 +375,8 @@ public:
       { return T::get_stack().size(); }
   inline void trim_stack(size_t new_size)
       { T::get_stack().resize(new_size); }
+  inline void reserve_stack(size_t n)
+      { T::get_stack().reserve(n); }
 
   inline void push_trail(size_t i)
       { T::get_trail().push_back(i); }
@@ -536,6 +544,10 @@ public:
     }
   
 private:
+    // Initial stack capacity (in cells) for unify and copy
+    static const size_t UNIFY_STACK_RESERVE = 64;
+    static const size_t COPY_STACK_RESERVE = 64;
+
     void restore_cells_after_unify();
     bool unify_helper(term a, term b, uint64_t &cost);
     int functor_standard_order(con_cell a, con_cell b);
@@ -19,6 +19,7 @@ void term_ops::reset()
 	    { "?-",     1, 1200,       FX,  SPACE_XF },
 
 	    { ";",      2, 1100,       XFY, SPACE_XFX },
+	    { "table",  1, 1150,       FX,  SPACE_FX },
 	    { "|",      2, 1100,       XFY, SPACE_XFX },
 	    { "->",     2, 1050,       XFY, SPACE_XFX },
 	    { "*->",    2, 1050,       XFY, SPACE_XFX },
@@ -908,7 +908,7 @@ protected:
 	  out += d;
 	  first = false;
       }
-      out_nbits = leading_zeros ? msb(track_nbits) : msb(out);
+      out_nbits = leading_zeros ? msb(track_nbits) : msb(out) + 1;
   }
 
   sym reduce_unsigned_number__natural_number(args_t &args)
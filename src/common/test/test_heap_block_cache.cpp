@@ -0,0 +1,179 @@
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <common/term_env.hpp>
+#include <common/lru_cache.hpp>
+#include <common/utime.hpp>
+
+using namespace prologcoin::common;
+
+//
+// Check that the block pointer cache of the heap stays consistent and
+// measure deref/unify over a heap that is backed by a block store
+// similar to the one of the global interpreter (modified blocks in a
+// hash map, committed blocks in an LRU cache.) Set to 1 to get bigger
+// (more meaningful) timings.
+//
+#define PERFORMANCE_TEST 0
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+class block_store {
+public:
+    block_store(heap &h) : heap_(h), current_index_(NO_BLOCK),
+			   current_(nullptr), cache_(1024) {
+	heap_.setup_get_block_fn(&call_get_block, this);
+    }
+
+    ~block_store() {
+	cache_.foreach([](const size_t &, heap_block *&block) {
+		delete block;
+	    });
+	for (auto &m : modified_) {
+	    delete m.second;
+	}
+    }
+
+    // Move all modified blocks to the LRU cache (as commit_heap)
+    void commit() {
+	for (auto &m : modified_) {
+	    cache_.insert(m.first, m.second);
+	}
+	modified_.clear();
+    }
+
+private:
+    static const size_t NO_BLOCK = static_cast<size_t>(-2);
+
+    static heap_block & call_get_block(heap &h, void *context, size_t index) {
+	return reinterpret_cast<block_store *>(context)->get_block(index);
+    }
+
+    heap_block & get_block(size_t index) {
+	if (index == current_index_) {
+	    return *current_;
+	}
+	if (index == heap::NEW_BLOCK) {
+	    size_t new_index = heap_.get_head_block() == nullptr ? 0 : heap_.num_blocks();
+	    auto *block = new heap_block(heap_, new_index);
+	    modified_.insert(std::make_pair(new_index, block));
+	    heap_.set_head_block(block);
+	    current_index_ = new_index;
+	    current_ = block;
+	    return *block;
+	}
+	current_index_ = index;
+	auto it = modified_.find(index);
+	if (it != modified_.end()) {
+	    current_ = it->second;
+	    return *current_;
+	}
+	auto *found = cache_.find(index);
+	assert(found != nullptr);
+	current_ = *found;
+	return *current_;
+    }
+
+    heap &heap_;
+    size_t current_index_;
+    heap_block *current_;
+    std::unordered_map<size_t, heap_block *> modified_;
+    lru_cache<size_t, heap_block *> cache_;
+};
+
+static term new_list(term_env &env, size_t n)
+{
+    term lst = heap::EMPTY_LIST;
+    for (size_t i = 0; i < n; i++) {
+	lst = env.new_dotted_pair(int_cell(static_cast<int64_t>(n - i)), lst);
+    }
+    return lst;
+}
+
+static int64_t sum_list(term_env &env, term lst)
+{
+    int64_t sum = 0;
+    lst = env.deref(lst);
+    while (env.is_dotted_pair(lst)) {
+	term el = env.deref(env.arg(lst, 0));
+	sum += reinterpret_cast<int_cell &>(el).value();
+	lst = env.deref(env.arg(lst, 1));
+    }
+    return sum;
+}
+
+static void test_block_cache_trim()
+{
+    header( "test_block_cache_trim()" );
+
+    static const size_t N = 3*heap_block::MAX_SIZE;
+
+    term_env env;
+    term lst1 = new_list(env, N);
+    size_t mark = env.heap_size();
+    term lst2 = new_list(env, N);
+    assert(sum_list(env, lst2) == static_cast<int64_t>(N*(N+1)/2));
+
+    // Trimming deletes the blocks of lst2. The new blocks for the
+    // same indices must be found.
+    env.trim_heap(mark);
+    term lst3 = new_list(env, N/2);
+    std::cout << "Sums: " << sum_list(env, lst1) << " " << sum_list(env, lst3) << "\n";
+    assert(sum_list(env, lst1) == static_cast<int64_t>(N*(N+1)/2));
+    assert(sum_list(env, lst3) == static_cast<int64_t>((N/2)*(N/2+1)/2));
+}
+
+static uint64_t run_bench(term_env &env, term lst1, term lst2, size_t loops,
+			  bool cached)
+{
+    env.get_heap().set_block_cache(cached);
+    auto start = utime::now();
+    for (size_t i = 0; i < loops; i++) {
+	uint64_t cost = 0;
+	bool ok = env.unify(lst1, lst2, cost);
+	assert(ok);
+	assert(sum_list(env, lst1) == sum_list(env, lst2));
+    }
+    return (utime::now() - start).in_us();
+}
+
+static void test_block_cache_bench()
+{
+    header( "test_block_cache_bench()" );
+
+#if PERFORMANCE_TEST
+    static const size_t LOOPS = 200;
+#else
+    static const size_t LOOPS = 5;
+#endif
+    static const size_t N = 16*heap_block::MAX_SIZE;
+
+    term_env env;
+    block_store store(env.get_heap());
+
+    term lst1 = new_list(env, N);
+    store.commit();
+    term lst2 = new_list(env, N);
+
+    std::cout << "Heap blocks: " << env.get_heap().num_blocks() << "\n";
+
+    uint64_t uncached = run_bench(env, lst1, lst2, LOOPS, false);
+    uint64_t cached = run_bench(env, lst1, lst2, LOOPS, true);
+
+    std::cout << "deref/unify of two " << N << " element lists, "
+	      << LOOPS << " times\n";
+    std::cout << "  without block cache: " << uncached / 1000 << " ms\n";
+    std::cout << "  with block cache:    " << cached / 1000 << " ms\n";
+}
+
+int main(int argc, char *argv[])
+{
+    test_block_cache_trim();
+    test_block_cache_bench();
+    return 0;
+}
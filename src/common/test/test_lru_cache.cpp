@@ -1,11 +1,21 @@
 #include <common/lru_cache.hpp>
 #include <common/checked_cast.hpp>
+#include <common/utime.hpp>
 #include <cassert>
 #include <string>
 #include <iostream>
+#include <list>
+#include <unordered_map>
+#include <random>
 
 using namespace prologcoin::common;
 
+//
+// Set to 1 to get bigger (more meaningful) timings in
+// test_lru_cache_bench.
+//
+#define PERFORMANCE_TEST 0
+
 static void header( const std::string &str )
 {
     std::cout << "\n";
@@ -91,10 +101,160 @@ static void test_lru_cache_2()
     }
 }
 
+// The straightforward implementation (a list of keys in access order
+// and a map to the list positions.) Used as reference.
+template<typename K, typename V> class list_lru_cache {
+public:
+    list_lru_cache(size_t capacity) : capacity_(capacity) { }
+
+    void insert(const K &key, const V &value) {
+	if (map_.find(key) != map_.end()) {
+	    return;
+	}
+	if (access_.size() >= capacity_) {
+	    evicted_.push_back(access_.back());
+	    map_.erase(access_.back());
+	    access_.pop_back();
+	}
+	access_.push_front(key);
+	map_[key] = std::make_pair(value, access_.begin());
+    }
+
+    V * find(const K &key) {
+	auto it = map_.find(key);
+	if (it == map_.end()) {
+	    return nullptr;
+	}
+	access_.erase(it->second.second);
+	access_.push_front(key);
+	it->second.second = access_.begin();
+	return &it->second.first;
+    }
+
+    void erase(const K &key) {
+	auto it = map_.find(key);
+	if (it == map_.end()) {
+	    return;
+	}
+	evicted_.push_back(key);
+	access_.erase(it->second.second);
+	map_.erase(it);
+    }
+
+    std::vector<K> evicted_;
+
+private:
+    size_t capacity_;
+    std::unordered_map<K, std::pair<V, typename std::list<K>::iterator> > map_;
+    std::list<K> access_;
+};
+
+static void test_lru_cache_3()
+{
+    header("test_lru_cache_3");
+
+    static const size_t CACHE_SIZE = 100;
+    static const size_t NUM_OPS = 100000;
+
+    std::cout << "Random operations compared with reference implementation" << std::endl;
+
+    std::vector<int> evicted;
+
+    struct my_callback_t : public lru_cache_callback_nop<int,int> {
+        my_callback_t(const my_callback_t &other) : ev_(other.ev_) { }
+        my_callback_t(std::vector<int> &ev) : ev_(ev) { }
+        void evicted(int key, int value) {
+	    assert(value == key*10);
+	    ev_.push_back(key);
+        }
+        std::vector<int> &ev_;
+    } my_callback(evicted);
+
+    lru_cache<int, int, my_callback_t> cache(CACHE_SIZE, my_callback);
+    list_lru_cache<int, int> ref(CACHE_SIZE);
+
+    std::mt19937 gen(4711);
+    std::uniform_int_distribution<int> key_dist(0, 3*CACHE_SIZE);
+    std::uniform_int_distribution<int> op_dist(0, 9);
+
+    for (size_t i = 0; i < NUM_OPS; i++) {
+	int key = key_dist(gen);
+	int op = op_dist(gen);
+	if (op < 5) {
+	    auto *v1 = cache.find(key);
+	    auto *v2 = ref.find(key);
+	    assert((v1 == nullptr) == (v2 == nullptr));
+	    assert(v1 == nullptr || *v1 == *v2);
+	} else if (op < 9) {
+	    cache.insert(key, key*10);
+	    ref.insert(key, key*10);
+	} else {
+	    cache.erase(key);
+	    ref.erase(key);
+	}
+	assert(evicted == ref.evicted_);
+    }
+
+    std::cout << "Evicted: " << evicted.size() << std::endl;
+    assert(cache.size() <= CACHE_SIZE);
+}
+
+template<typename Cache> static uint64_t bench_cache(Cache &cache, size_t num_keys, size_t num_ops)
+{
+    std::mt19937 gen(17);
+    std::uniform_int_distribution<size_t> key_dist(0, num_keys-1);
+    std::vector<size_t> keys(num_ops);
+    for (auto &k : keys) {
+	k = key_dist(gen)*4096;
+    }
+    uint64_t sum = 0;
+    auto start = utime::now();
+    for (auto k : keys) {
+	auto *v = cache.find(k);
+	if (v == nullptr) {
+	    cache.insert(k, k);
+	} else {
+	    sum += *v;
+	}
+    }
+    auto t = (utime::now() - start).in_us();
+    // Don't let the loop be optimized away
+    assert(sum != 1);
+    return t;
+}
+
+static void test_lru_cache_bench()
+{
+    header("test_lru_cache_bench");
+
+    static const size_t CACHE_SIZE = 65536;
+#if PERFORMANCE_TEST
+    static const size_t NUM_OPS = 20000000;
+#else
+    static const size_t NUM_OPS = 1000000;
+#endif
+
+    std::cout << "Cache size: " << CACHE_SIZE << ", "
+	      << NUM_OPS << " lookups (insert on miss)" << std::endl;
+
+    // Mostly hits and mostly misses
+    for (size_t num_keys : { CACHE_SIZE / 2, 4 * CACHE_SIZE }) {
+	list_lru_cache<size_t, size_t> ref(CACHE_SIZE);
+	lru_cache<size_t, size_t> cache(CACHE_SIZE);
+	auto t_ref = bench_cache(ref, num_keys, NUM_OPS);
+	auto t_cache = bench_cache(cache, num_keys, NUM_OPS);
+	std::cout << (num_keys < CACHE_SIZE ? "Hits:   " : "Misses: ")
+		  << "list " << t_ref / 1000 << " ms, "
+		  << "lru_cache " << t_cache / 1000 << " ms" << std::endl;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     test_lru_cache_1();
     test_lru_cache_2();    
+    test_lru_cache_3();
+    test_lru_cache_bench();
 
     return 0;
 }
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <iomanip>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <common/symbol_table.hpp>
+
+using namespace prologcoin::common;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static std::string symbol_name(size_t i)
+{
+    return "symbol_number_" + std::to_string(i);
+}
+
+static void test_symbol_table_basic()
+{
+    header( "test_symbol_table_basic()" );
+
+    symbol_table tab;
+
+    assert(tab.find("foobarbaz") == symbol_table::NONE);
+    assert(tab.size() == 0);
+
+    tab.set("foobarbaz", 42);
+    assert(tab.find("foobarbaz") == 42);
+    assert(tab.find("foobarba") == symbol_table::NONE);
+    assert(tab.find("foobarbaz2") == symbol_table::NONE);
+
+    // Replace the value (no new entry)
+    tab.set("foobarbaz", 0);
+    assert(tab.find("foobarbaz") == 0);
+    assert(tab.size() == 1);
+
+    // Empty names and names with embedded NULs are fine
+    tab.set("", 1);
+    tab.set(std::string("a\0b", 3), 2);
+    assert(tab.find("") == 1);
+    assert(tab.find(std::string("a\0b", 3)) == 2);
+    assert(tab.find("a") == symbol_table::NONE);
+
+    // Grow the table (and the arena) a few times
+    static const size_t N = 100000;
+    for (size_t i = 0; i < N; i++) {
+	tab.set(symbol_name(i), i);
+    }
+    assert(tab.size() == N + 3);
+    for (size_t i = 0; i < N; i++) {
+	assert(tab.find(symbol_name(i)) == i);
+    }
+    assert(tab.find(symbol_name(N)) == symbol_table::NONE);
+    std::cout << "Found all " << N << " symbols" << std::endl;
+
+    tab.clear();
+    assert(tab.size() == 0);
+    assert(tab.find("foobarbaz") == symbol_table::NONE);
+    assert(tab.find(symbol_name(0)) == symbol_table::NONE);
+    tab.set(symbol_name(0), 7);
+    assert(tab.find(symbol_name(0)) == 7);
+}
+
+static void test_symbol_table_concurrent()
+{
+    header( "test_symbol_table_concurrent()" );
+
+    // One writer adds symbols (growing the table several times) while
+    // readers look them up. A reader must never see a symbol with a
+    // wrong value, and once the writer has reported a symbol as added
+    // the readers must find it.
+
+    static const size_t N = 200000;
+    static const size_t NUM_READERS = 4;
+
+    symbol_table tab;
+    boost::atomic<size_t> num_added(0);
+    boost::atomic<size_t> num_found(0);
+    boost::atomic<bool> failed(false);
+
+    std::vector<boost::thread> readers;
+    for (size_t r = 0; r < NUM_READERS; r++) {
+	readers.push_back(boost::thread([&, r]() {
+	    size_t found = 0;
+	    size_t i = r;
+	    while (num_added.load() < N) {
+		size_t added = num_added.load(boost::memory_order_acquire);
+		size_t j = i % N;
+		size_t v = tab.find(symbol_name(j));
+		if (v != symbol_table::NONE) {
+		    found++;
+		    if (v != j) failed = true;
+		} else if (j < added) {
+		    failed = true;
+		}
+		i += 7919;
+	    }
+	    num_found += found;
+	}));
+    }
+
+    for (size_t i = 0; i < N; i++) {
+	tab.set(symbol_name(i), i);
+	num_added.store(i + 1, boost::memory_order_release);
+    }
+
+    for (auto &t : readers) {
+	t.join();
+    }
+
+    std::cout << "Readers found " << num_found.load()
+	      << " symbols while they were added" << std::endl;
+
+    assert(!failed.load());
+    assert(tab.size() == N);
+}
+
+int main( int argc, char *argv[] )
+{
+    test_symbol_table_basic();
+    test_symbol_table_concurrent();
+
+    return 0;
+}
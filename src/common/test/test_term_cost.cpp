@@ -26,9 +26,79 @@ static void test_cost1()
     std::cout << "COST: " << cost << "\n";
 }
 
+//
+// Golden costs for unify and copy. The unification and copy loops have
+// fast paths (atomic arguments, list spines) that must charge exactly
+// the same cost as the generic loop, as the cost is consensus critical.
+// Each case is "Left = Right" (so the sides can share variables.)
+//
+struct cost_case {
+    const char *goal;
+    bool unifies;
+    uint64_t unify_cost;
+    uint64_t copy_cost;
+};
+
+static const cost_case cost_cases[] = {
+    { "foo = foo.", true, 2, 4 },
+    { "foo = bar.", false, 2, 4 },
+    { "42 = 42.", true, 2, 4 },
+    { "X = 42.", true, 2, 4 },
+    { "f(a,1,b) = f(a,1,b).", true, 8, 12 },
+    { "f(a,1,b) = f(a,2,b).", false, 6, 12 },
+    { "f(X,Y,Z) = f(1,2,3).", true, 8, 12 },
+    { "f(X,X,X) = f(Y,Y,1).", true, 9, 12 },
+    { "f(X,Y) = f(Y,1).", true, 7, 10 },
+    { "f(X,g(X),Y) = f(1,Y,g(1)).", true, 11, 16 },
+    { "[1,2,3,4,5] = [1,2,3,4,5].", true, 22, 34 },
+    { "[1,2,3,4,5] = [1,2,3,4,6].", false, 20, 34 },
+    { "[1,2,3|T] = [A,B,C,4,5].", true, 14, 28 },
+    { "[X,Y,Z] = [Y,Z,a].", true, 14, 22 },
+    { "[f(X),g(Y)|T] = [f(1),g(2),h].", true, 14, 27 },
+    { "[a,[b,[c,d]],e] = [a,[b,[c,D]],E].", true, 30, 46 },
+    { "[X|X] = [[]|Y].", true, 7, 10 },
+    { "f(X,X) = f(g(1,Z),g(Y,2)).", true, 11, 16 },
+    { "[A,B|T] = [1|T].", true, 6, 13 },
+    { "f([1,2|X], X) = f(Y, [3,4]).", true, 6, 22 },
+    { "foo(a, bar(1, 2), baz([x,y,z])) = foo(A, bar(B, 2), baz([C|D])).", true, 18, 34 },
+    { "g(123456789012345678901234567890, x) = g(123456789012345678901234567890, X).", true, 6, 10 },
+    { "g(123456789012345678901234567890) = g(987654321098765432109876543210).", false, 4, 8 }
+};
+
+static void test_cost_unify_copy()
+{
+    header( "test_cost_unify_copy()" );
+
+    bool all_ok = true;
+
+    for (auto &c : cost_cases) {
+	term_env env;
+	term t = env.parse(c.goal);
+	term lhs = env.arg(t, 0);
+	term rhs = env.arg(t, 1);
+
+	uint64_t copy_cost = 0;
+	env.copy(t, copy_cost);
+
+	uint64_t unify_cost = 0;
+	bool unifies = env.unify(lhs, rhs, unify_cost);
+
+	bool ok = unifies == c.unifies && unify_cost == c.unify_cost &&
+	          copy_cost == c.copy_cost;
+	std::cout << c.goal << ": unify=" << (unifies ? "true" : "false")
+		  << " unify_cost=" << unify_cost
+		  << " copy_cost=" << copy_cost
+		  << (ok ? "" : " (MISMATCH)") << "\n";
+	all_ok = all_ok && ok;
+    }
+
+    assert(all_ok);
+}
+
 int main( int argc, char *argv[] )
 {
     test_cost1();
+    test_cost_unify_copy();
 
     return 0;
 }
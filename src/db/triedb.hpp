@@ -14,6 +14,7 @@
 #include <bitset>
 #include <algorithm>
 #include <set>
+#include <unordered_map>
 #include "../common/lru_cache.hpp"
 #include "../common/bits.hpp"
 #include "util.hpp"
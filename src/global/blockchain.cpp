@@ -15,7 +15,8 @@ blockchain::blockchain(const std::string &data_dir) :
     db_heap_dir_((boost::filesystem::path(data_dir_) / "db" / "heap").string()),
     db_closures_dir_((boost::filesystem::path(data_dir_) / "db" / "closures").string()),
     db_symbols_dir_((boost::filesystem::path(data_dir_) / "db" / "symbols").string()),
-    db_program_dir_((boost::filesystem::path(data_dir_) / "db" / "program").string()) {
+    db_program_dir_((boost::filesystem::path(data_dir_) / "db" / "program").string()),
+    db_code_dir_((boost::filesystem::path(data_dir_) / "db" / "code").string()) {
    init();
 }
 
@@ -82,6 +83,7 @@ void blockchain::init()
     db_closures_ = nullptr;
     db_symbols_ = nullptr;
     db_program_ = nullptr;
+    db_code_ = nullptr;
     
     tip_ = meta_entry();
     at_height_.clear();
@@ -119,6 +121,17 @@ void blockchain::init()
     }
 
     tip_ = best;
+
+    // Continue the code cache from its latest root
+    code_root_ = db_root_id();
+    for (size_t height = 0;; height++) {
+	auto &ids = code_db().find_roots(height);
+	if (ids.empty()) {
+	    break;
+	}
+	code_root_ = *ids.rbegin();
+    }
+
     auto tip_path = boost::filesystem::path(data_dir_) / "db" / "tip.txt";
     if (boost::filesystem::exists(tip_path)) {
 	std::string line;
@@ -199,6 +212,7 @@ void blockchain::flush_db() {
     closures_db().flush();
     symbols_db().flush();
     program_db().flush();
+    code_db().flush();
     meta_db().flush();
 }
 
@@ -231,6 +245,11 @@ void blockchain::advance() {
 	next_program = program_db().new_root(tip().get_root_id_program());
     }
 
+    // The code cache isn't tied to the tip; it just continues from
+    // its latest root.
+    code_root_ = code_root_.is_zero() ? code_db().new_root()
+	                              : code_db().new_root(code_root_);
+
     size_t new_height = genesis ? 0 : tip().get_height() + 1;
 
     meta_entry new_tip(tip());
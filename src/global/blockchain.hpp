@@ -67,6 +67,14 @@ public:
         return get_db_instance(db_program_, db_program_dir_);
     }    
 
+    // Precompiled WAM code of predicates. This is a cache local to
+    // this node and not part of the state (it's not included in the
+    // meta id.) Entries are keyed by the hash of the clauses, so they
+    // are valid for any tip.
+    inline db::triedb & code_db() {
+        return get_db_instance(db_code_, db_code_dir_);
+    }
+
     inline db_root_id heap_root() const {
 	return tip_.get_root_id_heap();
     }
@@ -87,6 +95,10 @@ public:
 	return tip_.get_root_id_goal_blocks();
     }
 
+    inline db_root_id code_root() const {
+	return code_root_;
+    }
+
     inline meta_entry & tip() {
 	return tip_;
     }
@@ -152,6 +164,7 @@ private:
     std::string db_closures_dir_;
     std::string db_symbols_dir_;  
     std::string db_program_dir_;
+    std::string db_code_dir_;
 
     mutable std::unique_ptr<db::triedb> db_meta_;
     mutable std::unique_ptr<db::triedb> db_goal_blocks_;
@@ -159,8 +172,10 @@ private:
     mutable std::unique_ptr<db::triedb> db_closures_;
     mutable std::unique_ptr<db::triedb> db_symbols_;
     mutable std::unique_ptr<db::triedb> db_program_;
+    mutable std::unique_ptr<db::triedb> db_code_;
 
     meta_entry tip_;
+    db_root_id code_root_;
     std::unordered_map<size_t, std::set<meta_id> > at_height_;
     std::map<meta_id, meta_entry> chains_;
 
@@ -28,6 +28,7 @@ bool global::set_tip(const meta_id &id)
 	return false;
     }
     blockchain_.set_tip(*entry);
+    symbols_cache_.clear();
     interp_ = nullptr;
     interp_ = std::unique_ptr<global_interpreter>(new global_interpreter(*this));
     interp_->init();
@@ -48,6 +49,7 @@ void global::total_reset() {
     interp_ = nullptr;
     erase_db(data_dir_);
     blockchain_.init();
+    symbols_cache_.clear();
     interp_ = std::unique_ptr<global_interpreter>(new global_interpreter(*this));
     interp_->init();
 }
@@ -140,6 +142,64 @@ bool global::db_set_predicate(const qname &qn,
     return true;
 }
 
+bool global::db_get_code(const uint8_t *hash, std::vector<uint8_t> &image)
+{
+    auto root = blockchain_.code_root();
+    if (root.is_zero()) {
+	return false;
+    }
+
+    // Max 10 collisions
+    uint64_t key = db::read_uint64(hash);
+    for (size_t i = 0; i < 10; i++) {
+	auto leaf = blockchain_.code_db().find(root, key + i);
+	if (leaf == nullptr) {
+	    return false;
+	}
+	auto p = leaf->custom_data();
+	auto n = leaf->custom_data_size();
+	if (n > CODE_HASH_SIZE && memcmp(p, hash, CODE_HASH_SIZE) == 0) {
+	    image.assign(p + CODE_HASH_SIZE, p + n);
+	    return true;
+	}
+    }
+    return false;
+}
+
+bool global::db_set_code(const uint8_t *hash, const std::vector<uint8_t> &image)
+{
+    auto root = blockchain_.code_root();
+    if (root.is_zero()) {
+	return false;
+    }
+    if (CODE_HASH_SIZE + image.size() > db::triedb_leaf::MAX_SIZE_IN_BYTES) {
+	return false;
+    }
+
+    // Max 10 collisions. An entry with the same hash is replaced (the
+    // old image may be from another version of the compiler.)
+    uint64_t key = db::read_uint64(hash);
+    size_t i;
+    for (i = 0; i < 10; i++) {
+	auto leaf = blockchain_.code_db().find(root, key + i);
+	if (leaf == nullptr) {
+	    break;
+	}
+	if (leaf->custom_data_size() > CODE_HASH_SIZE &&
+	    memcmp(leaf->custom_data(), hash, CODE_HASH_SIZE) == 0) {
+	    break;
+	}
+    }
+    if (i == 10) {
+	return false;
+    }
+    std::vector<uint8_t> custom_data(hash, hash + CODE_HASH_SIZE);
+    custom_data.insert(custom_data.end(), image.begin(), image.end());
+    blockchain_.code_db().update(root, key + i,
+				 &custom_data[0], custom_data.size());
+    return true;
+}
+
 term global::db_get_goal_block(term_env &dst, const meta_id &root_id) {
     auto *e = blockchain_.get_meta_entry(root_id);
     if (e == nullptr) {
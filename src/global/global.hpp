@@ -7,6 +7,7 @@
 #include "../common/term_serializer.hpp"
 #include "../common/fast_hash.hpp"
 #include "../common/checked_cast.hpp"
+#include "../common/symbol_table.hpp"
 #include "../db/triedb.hpp"
 #include "../db/util.hpp"
 #include "global_interpreter.hpp"
@@ -205,7 +206,18 @@ public:
 	return symbol_name;
     }
 
+    // The symbols db is fronted by a cache of the lookups at the
+    // current tip (see symbols_cache_.)
     size_t db_get_symbol_index(const std::string &name) {
+	size_t index = symbols_cache_.find(name);
+	if (index == common::symbol_table::NONE) {
+	    index = db_lookup_symbol_index(name);
+	    symbols_cache_.set(name, index);
+	}
+	return index;
+    }
+
+    size_t db_lookup_symbol_index(const std::string &name) {
 	if (blockchain_.symbols_root().is_zero()) {
 	    return 0;
 	}
@@ -267,6 +279,8 @@ public:
 		blockchain_.symbols_root(), index,
 		custom_data, custom_data_size);
 
+	symbols_cache_.set(name, index);
+
 	return true;
     }
 
@@ -301,6 +315,17 @@ public:
     bool db_set_predicate(const interp::qname &qn,
 			  const std::vector<common::term> &clauses);
 
+    //
+    // Precompiled code (see blockchain::code_db().) Entries are
+    // keyed by a hash of the predicate's clauses (see
+    // global_interpreter::code_hash().)
+    //
+
+    static const size_t CODE_HASH_SIZE = 32;
+
+    bool db_get_code(const uint8_t *hash, std::vector<uint8_t> &image);
+    bool db_set_code(const uint8_t *hash, const std::vector<uint8_t> &image);
+
     //
     // Closures
     //
@@ -368,6 +393,11 @@ private:
 
     std::string data_dir_;
     blockchain blockchain_;
+    // Symbol name => index (as db_lookup_symbol_index would return it
+    // at the current tip.) Names that aren't in the db map to 0, so
+    // this is a negative cache as well. Only valid for the current
+    // tip; it is cleared when the tip is changed.
+    common::symbol_table symbols_cache_;
     std::unique_ptr<global_interpreter> interp_;
     uint64_t commit_version_;
     uint64_t commit_nonce_;
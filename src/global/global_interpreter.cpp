@@ -1,6 +1,7 @@
 #include "global_interpreter.hpp"
 #include "builtins.hpp"
 #include "../common/checked_cast.hpp"
+#include "../common/blake2.hpp"
 #include "../ec/builtins.hpp"
 #include "../coin/builtins.hpp"
 #include "global.hpp"
@@ -13,13 +14,17 @@ namespace prologcoin { namespace global {
 global_interpreter::global_interpreter(global &g)
     : interp::interpreter("global"),
       global_(g),
+      naming_(false),
       current_block_index_(static_cast<size_t>(-2)),
       current_block_(nullptr),
       block_flusher_(),
       block_cache_(global::BLOCK_CACHE_SIZE / heap_block::MAX_SIZE / sizeof(cell), block_flusher_),
+      cached_code_loads_(0),
       new_predicates_(0),
       new_frozen_closures_(0),
       old_heap_size_(0),
+      heap_gc_(false),
+      gc_floor_(0),
       next_atom_id_(0),
       start_next_atom_id_(0),
       next_predicate_id_(0),
@@ -43,6 +48,10 @@ void global_interpreter::init()
     setup_standard_lib();
     set_retain_state_between_queries(true);
 
+    // The global heap is backed by the heap db and retained between
+    // queries, so the heap collector can't compact it in place.
+    set_gc_threshold(0);
+
     // TODO: Remove this two lines
     load_builtins_file_io();
     set_debug_enabled();
@@ -69,8 +78,12 @@ void global_interpreter::total_reset()
     new_atoms_.clear();
     modified_blocks_.clear();
     updated_predicates_.clear();
+    compiled_predicates_.clear();
+    cached_code_loads_ = 0;
     old_predicates_.clear();
     modified_closures_.clear();
+    remembered_.clear();
+    gc_floor_ = 0;
 
     global::erase_db(get_global().data_dir());
     interpreter::total_reset();
@@ -105,6 +118,101 @@ void global_interpreter::load_predicate(const interp::qname &qn) {
 	    import_predicate(qn); // Here's the lazy rule
 	}
     }
+    gc_floor_ = heap_size();
+}
+
+bool global_interpreter::code_hash(const interp::qname &qn, uint8_t *hash)
+{
+    // Hash the structure of the clauses (with variables numbered in
+    // order of appearance), so it doesn't depend on where they are on
+    // the heap, and the compiler options.
+    blake2b_state s;
+    blake2b_init(&s, global::CODE_HASH_SIZE);
+
+    uint8_t data[sizeof(uint64_t)];
+    auto update = [&](uint64_t v) {
+	db::write_uint64(data, v);
+	blake2b_update(&s, data, sizeof(data));
+    };
+
+    update(qn.first.raw_value());
+    update(qn.second.raw_value());
+    update(code_options());
+
+    std::unordered_map<term, size_t> vars;
+    std::vector<term> stack;
+    for (auto &mc : get_predicate(qn).get_clauses()) {
+	if (mc.is_erased()) {
+	    continue;
+	}
+	vars.clear();
+	stack.push_back(mc.clause());
+	while (!stack.empty()) {
+	    term t = deref(stack.back());
+	    stack.pop_back();
+	    switch (t.tag()) {
+	    case tag_t::CON:
+	    case tag_t::INT:
+		update(t.raw_value());
+		break;
+	    case tag_t::RFW:
+		t = reinterpret_cast<ref_cell &>(t).unwatch();
+		// Fall through
+	    case tag_t::REF: {
+		auto it = vars.find(t);
+		size_t n = vars.size();
+		if (it == vars.end()) {
+		    vars[t] = n;
+		} else {
+		    n = it->second;
+		}
+		update(ref_cell(n).raw_value());
+		break;
+	        }
+	    case tag_t::STR: {
+		auto f = functor(t);
+		update(f.raw_value());
+		for (size_t i = f.arity(); i > 0; i--) {
+		    stack.push_back(arg(t, i - 1));
+		}
+		break;
+	        }
+	    default:
+		// Bignums end up as constants in the code, which can't
+		// be relocated (see save_code_image())
+		return false;
+	    }
+	}
+	update(static_cast<uint64_t>(mc.cost()));
+    }
+
+    blake2b_final(&s, hash, global::CODE_HASH_SIZE);
+    return true;
+}
+
+bool global_interpreter::load_cached_code(const interp::qname &qn)
+{
+    uint8_t hash[global::CODE_HASH_SIZE];
+    if (!code_hash(qn, hash)) {
+	return false;
+    }
+    std::vector<uint8_t> image;
+    if (!get_global().db_get_code(hash, image)) {
+	return false;
+    }
+    if (!load_code_image(qn, &image[0], image.size())) {
+	return false;
+    }
+    cached_code_loads_++;
+    gc_floor_ = heap_size();
+    return true;
+}
+
+void global_interpreter::compiled_code(const interp::qname &qn)
+{
+    // The code is stored at commit (clauses may still change)
+    compiled_predicates_.insert(qn);
+    gc_floor_ = heap_size();
 }
 
 size_t global_interpreter::unique_predicate_id(const common::con_cell /*module*/) {
@@ -211,6 +319,7 @@ bool global_interpreter::execute_goal(term t) {
     preprocess_hashes(t);
 
     bool r = execute(t);
+    remember_trail();
     // If no choicepoints, then clean up the trail
     if (!has_more()) {
 	set_register_hb(static_cast<size_t>(0));
@@ -270,9 +379,64 @@ bool global_interpreter::execute_goal(buffer_t &serialized, bool silent)
 void global_interpreter::execute_cut() {
     set_b0(nullptr); // Set cut point to top level
     interpreter_base::cut();
+    remember_trail();
     interpreter_base::clear_trail();
 }
 
+void global_interpreter::remember_trail()
+{
+    if (!heap_gc_) {
+	return;
+    }
+    size_t n = trail_size();
+    for (size_t i = 0; i < n; i++) {
+	size_t addr = trail_get(i);
+	if (addr < old_heap_size_) {
+	    remembered_.insert(addr);
+	}
+    }
+}
+
+size_t global_interpreter::collect_block_garbage()
+{
+    // Only at a clean state. Names (naming mode) are bound outside
+    // of the trail.
+    if (naming_ || has_meta_context() || e0() != nullptr || b() != nullptr) {
+	return 0;
+    }
+    remember_trail();
+
+    // Cells of this block below the floor are scanned for pointers
+    // to newer cells.
+    size_t floor = std::max(get_heap_limit(), gc_floor_);
+    floor = std::max(floor, old_heap_size_);
+
+    std::vector<size_t> remembered(remembered_.begin(), remembered_.end());
+    std::sort(remembered.begin(), remembered.end());
+
+    return gc(floor, old_heap_size_, remembered);
+}
+
+void global_interpreter::gc_roots(const std::function<void (term &)> &fn)
+{
+    // Closures are keyed by the address of the frozen variable
+    std::map<size_t, term> closures;
+    for (auto &cl : modified_closures_) {
+	term key = ref_cell(cl.first);
+	term closure = cl.second;
+	fn(key);
+	if (closure != term()) {
+	    fn(closure);
+	}
+	closures[reinterpret_cast<ref_cell &>(key).index()] = closure;
+    }
+    modified_closures_.swap(closures);
+
+    for (auto &nt : name_to_term_) {
+	fn(nt.second);
+    }
+}
+
 void global_interpreter::discard_changes() {
     // Discard program changes
     for (auto &qn : updated_predicates_) {
@@ -294,6 +458,8 @@ void global_interpreter::discard_changes() {
     // Unwind everything on heap (unbind variables, etc.)
     reset();
 
+    remembered_.clear();
+
     // Discard heap changes
     for (auto &m : modified_blocks_) {
 	auto block_index = m.first;
@@ -302,6 +468,8 @@ void global_interpreter::discard_changes() {
 	block_cache_.erase(block_index);
     }
     modified_blocks_.clear();
+    // Blocks will be reloaded from the heap db
+    get_heap().clear_block_cache();
 
     // Discard new symbols
     for (auto &sym : new_atoms_) {
@@ -350,9 +518,9 @@ size_t global_interpreter::new_atom(const std::string &atom_name)
 	return index;
     }
 
+    // (heap::resolve_atom_index registers the new index)
     size_t atom_id = next_atom_id_;
     next_atom_id_++;
-    set_atom_index(atom_name, atom_id);
     new_atoms_.push_back(std::make_pair(atom_id, atom_name));
     return atom_id;
 }
@@ -518,6 +686,8 @@ void global_interpreter::commit_symbols()
     }
 
     new_atoms_.clear();
+    // Committed indices are not handed out again by discard_changes()
+    start_next_atom_id_ = next_atom_id_;
 }
 
 void global_interpreter::commit_closures()
@@ -548,6 +718,11 @@ size_t global_interpreter::num_frozen_closures() const {
 
 void global_interpreter::commit_heap()
 {
+    if (heap_gc_) {
+	collect_block_garbage();
+    }
+    remembered_.clear();
+
     std::vector<heap_block*> blocks;
     for (auto &e : modified_blocks_) {
         auto *block = e.second;
@@ -611,8 +786,26 @@ void global_interpreter::init_from_program_db()
     start_next_predicate_id_ = next_predicate_id_;
 }
     
+void global_interpreter::commit_code()
+{
+    for (auto &qn : compiled_predicates_) {
+	// Skip predicates that were updated after being compiled
+	if (!is_compiled(qn)) {
+	    continue;
+	}
+	uint8_t hash[global::CODE_HASH_SIZE];
+	std::vector<uint8_t> image;
+	if (code_hash(qn, hash) && save_code_image(qn, image)) {
+	    get_global().db_set_code(hash, image);
+	}
+    }
+    compiled_predicates_.clear();
+}
+
 void global_interpreter::commit_program()
 {    
+    commit_code();
+
     if (updated_predicates_.empty()) {
 	 return;
     }
@@ -622,7 +815,9 @@ void global_interpreter::commit_program()
 	auto &mclauses = pred.get_clauses();
 	std::vector<term> clauses;
 	for (auto &mc : mclauses) {
-	    clauses.push_back(mc.clause());
+	    if (!mc.is_erased()) {
+		clauses.push_back(mc.clause());
+	    }
 	}
 	get_global().db_set_predicate(qn, clauses);
     }
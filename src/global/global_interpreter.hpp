@@ -61,6 +61,7 @@ public:
     void commit_symbols();
     void commit_program();
     void commit_closures();
+    void commit_code();
 
     virtual size_t num_predicates() const override;
     size_t num_symbols();
@@ -94,6 +95,16 @@ public:
     }
 
     virtual void load_predicate(const interp::qname &qn) override;
+
+    // Hash of the clauses of a predicate (and the compiler options)
+    // that identifies its compiled code. Returns false if the predicate
+    // can't be cached.
+    bool code_hash(const interp::qname &qn, uint8_t *hash);
+
+    // Number of predicates loaded from the code cache
+    inline size_t num_cached_code_loads() const {
+        return cached_code_loads_;
+    }
     virtual size_t unique_predicate_id(const common::con_cell module) override;
   
     inline void set_current_block(common::heap_block *b, size_t block_index) {
@@ -111,6 +122,13 @@ public:
     }
   
     static void setup_consensus_lib(interpreter &interp);
+
+protected:
+    virtual bool load_cached_code(const interp::qname &qn) override;
+    virtual void compiled_code(const interp::qname &qn) override;
+    virtual void gc_roots(const std::function<void (term &)> &fn) override;
+
+public:
   
     inline void set_naming(bool b) { naming_ = b; }
 
@@ -135,6 +153,16 @@ public:
         return trail_size() == 0;
     }
 
+    // Reclaim garbage of the current block before commit_heap() writes
+    // it to the heap db. Only blocks modified since the last commit are
+    // looked at; older cells pointing to newer ones are found through
+    // the remembered set (bindings recorded from the trail.) Disabled
+    // by default as it changes the heap addresses of committed terms,
+    // so it must be enabled by all nodes or none.
+    inline void set_heap_gc(bool b) { heap_gc_ = b; }
+    inline bool is_heap_gc() const { return heap_gc_; }
+    size_t collect_block_garbage();
+
     friend class global_builtins;
   
 private:
@@ -192,6 +220,8 @@ private:
 
     void discard_changes();
 
+    void remember_trail();
+
     common::heap_block * db_get_heap_block(size_t block_index);
 
     inline common::heap_block & get_heap_block(size_t block_index)
@@ -255,6 +285,9 @@ private:
     std::unordered_map<size_t, common::heap_block *> modified_blocks_;
  
     std::vector<interp::qname> updated_predicates_;
+    // Compiled (not loaded from the code cache) since last commit
+    std::unordered_set<interp::qname> compiled_predicates_;
+    size_t cached_code_loads_;
     std::vector<interp::predicate> old_predicates_;
     int new_predicates_;
     int new_frozen_closures_;
@@ -263,6 +296,12 @@ private:
     std::map<size_t, common::term> modified_closures_;
 
     size_t old_heap_size_;
+
+    bool heap_gc_;
+    // Addresses of cells below old_heap_size_ bound since last commit
+    std::unordered_set<size_t> remembered_;
+    // Program code (lazily loaded or compiled) lives below this
+    size_t gc_floor_;
     
     size_t next_atom_id_;
     size_t start_next_atom_id_;
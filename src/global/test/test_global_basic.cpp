@@ -3,6 +3,7 @@
 #include <common/checked_cast.hpp>
 #include <common/test/test_home_dir.hpp>
 #include <common/term_tools.hpp>
+#include <common/utime.hpp>
 #include <ec/builtins.hpp>
 #include <global/global.hpp>
 
@@ -218,6 +219,200 @@ static void test_global_frozen_closures()
     recheck_frozen_closures(all_frozen_closures);
 }
 
+static void test_global_code_cache()
+{
+    header("test_global_code_cache");
+
+    static const con_cell USER("user",0);
+    static const con_cell TX("tx",5);
+
+    global::erase_db(test_dir);
+
+    {
+	// Genesis loads and compiles the consensus library. The code is
+	// stored at the next commit.
+	global g(test_dir);
+	assert(g.interp().num_cached_code_loads() == 0);
+	g.increment_height();
+
+	auto &bc = g.get_blockchain();
+	size_t n = bc.code_db().num_entries(bc.code_root());
+	std::cout << "Cached predicates: " << n << std::endl;
+	assert(n > 0);
+    }
+
+    std::cout << "Rechecking by reopening database..." << std::endl;
+
+    global g(test_dir);
+    size_t loads = g.interp().num_cached_code_loads();
+    std::cout << "Loaded from cache: " << loads << std::endl;
+    assert(loads > 0);
+    assert(g.interp().is_compiled(USER, TX));
+}
+
+// The frozen closures (as text) of the first num_blocks blocks
+static std::string frozen_closures(global &g, size_t num_blocks)
+{
+    auto cmd = g.interp().parse("frozenk(0, " + boost::lexical_cast<std::string>(2*num_blocks) + ", X), frozen(X, Cs).");
+    assert(g.execute_goal(cmd));
+    size_t n = g.interp().list_length(g.interp().get_result_term("X"));
+    std::cout << "Frozen closures: " << n << std::endl;
+    assert(n == num_blocks);
+    std::string closures = g.interp().to_string(g.interp().get_result_term("Cs"));
+    g.discard();
+    return closures;
+}
+
+// Synthetic transaction workload: every block creates a reward (a new
+// coin with a frozen closure) and some garbage. Returns the heap size
+// after the last commit.
+static size_t run_reward_blocks(bool heap_gc, size_t num_blocks)
+{
+    global::erase_db(test_dir);
+
+    size_t growth = 0;
+    std::string closures;
+    {
+	global g(test_dir);
+	g.interp().set_heap_gc(heap_gc);
+	prologcoin::ec::builtins::load(g.interp());
+
+	size_t start_size = g.heap_size();
+	for (size_t i = 0; i < num_blocks; i++) {
+	    auto cmd = g.interp().parse("ec:privkey(X), ec:pubkey(X,Y), ec:address(Y,Z), reward(Z), functor(_, g, 20), length(_, 100).");
+	    assert(g.execute_goal(cmd));
+	    g.execute_cut();
+	    g.advance();
+	}
+	growth = g.heap_size() - start_size;
+	std::cout << "Heap growth (" << (heap_gc ? "with" : "without")
+		  << " gc): " << growth << " cells, "
+		  << (growth / num_blocks) << " per block" << std::endl;
+	closures = frozen_closures(g, num_blocks);
+    }
+
+    // The committed (and collected) heap reads back the same
+    std::cout << "Rechecking by reopening database..." << std::endl;
+    global g(test_dir);
+    assert(frozen_closures(g, num_blocks) == closures);
+
+    return growth;
+}
+
+static void test_global_heap_gc()
+{
+    header("test_global_heap_gc");
+
+    static const size_t NUM_BLOCKS = 100;
+
+    size_t without_gc = run_reward_blocks(false, NUM_BLOCKS);
+    size_t with_gc = run_reward_blocks(true, NUM_BLOCKS);
+    assert(with_gc < without_gc);
+}
+
+// Parse a program with many (long) atoms into the global interpreter.
+// Every new atom is looked up in the symbols db, unless the symbols
+// cache already knows about it.
+static uint64_t parse_atoms(global &g, const std::string &prog,
+			    size_t num_atoms)
+{
+    auto start = utime::now();
+    term t = g.interp().parse(prog);
+    uint64_t t_ms = (utime::now() - start).in_ms();
+    assert(g.interp().list_length(t) == num_atoms);
+    return t_ms;
+}
+
+static void test_global_symbols()
+{
+    header("test_global_symbols");
+
+    static const size_t NUM_ATOMS = 100000;
+
+    global::erase_db(test_dir);
+
+    std::string prog = "[";
+    for (size_t i = 0; i < NUM_ATOMS; i++) {
+	if (i > 0) prog += ",";
+	prog += "atom_number_" + boost::lexical_cast<std::string>(i);
+    }
+    prog += "].";
+
+    std::vector<size_t> indices;
+
+    {
+	global g(test_dir);
+	g.increment_height();
+
+	// New atoms (not in the symbols db)
+	std::cout << "Parse new atoms: " << parse_atoms(g, prog, NUM_ATOMS)
+		  << " ms" << std::endl;
+	g.discard();
+
+	// Same atoms again (the cache knows they're not in the db)
+	std::cout << "Parse new atoms again: "
+		  << parse_atoms(g, prog, NUM_ATOMS) << " ms" << std::endl;
+
+	for (size_t i = 0; i < NUM_ATOMS; i += 1000) {
+	    auto f = g.interp().functor("atom_number_" + boost::lexical_cast<std::string>(i), 0);
+	    indices.push_back(f.atom_index());
+	}
+	g.increment_height();
+	assert(g.num_symbols() >= NUM_ATOMS);
+    }
+
+    std::cout << "Rechecking by reopening database..." << std::endl;
+
+    global g(test_dir);
+
+    // Atoms are now in the symbols db
+    std::cout << "Parse known atoms: " << parse_atoms(g, prog, NUM_ATOMS)
+	      << " ms" << std::endl;
+
+    size_t num_symbols = g.num_symbols();
+    for (size_t i = 0; i < NUM_ATOMS; i += 1000) {
+	auto f = g.interp().functor("atom_number_" + boost::lexical_cast<std::string>(i), 0);
+	assert(f.atom_index() == indices[i / 1000]);
+    }
+    assert(g.num_symbols() == num_symbols);
+}
+
+// A symbol that isn't in the symbols db (which the cache remembers) is
+// added in a later block. Lookups follow the tip, also when it is set
+// back to a block before the symbol was added.
+static void test_global_symbols_tip()
+{
+    header("test_global_symbols_tip");
+
+    global::erase_db(test_dir);
+
+    global g(test_dir);
+    g.increment_height();
+    auto before = g.tip_id();
+
+    assert(g.db_get_symbol_index("late_symbol") == 0);
+    size_t index = g.interp().functor("late_symbol", 0).atom_index();
+    std::cout << "New symbol index: " << index << std::endl;
+    assert(g.db_get_symbol_index("late_symbol") == 0);
+    g.increment_height();
+    auto after = g.tip_id();
+    assert(g.db_get_symbol_index("late_symbol") == index);
+
+    std::cout << "Set tip to the block before..." << std::endl;
+    assert(g.set_tip(before));
+    assert(g.db_get_symbol_index("late_symbol") == 0);
+    // Make sure the old index is taken by another symbol
+    assert(g.interp().functor("other_symbol", 0).atom_index() == index);
+    assert(g.interp().functor("late_symbol", 0).atom_index() != index);
+    g.discard();
+
+    std::cout << "Set tip to the block after..." << std::endl;
+    assert(g.set_tip(after));
+    assert(g.db_get_symbol_index("late_symbol") == index);
+    assert(g.db_get_symbol_index("other_symbol") == 0);
+    assert(g.interp().functor("late_symbol", 0).atom_index() == index);
+}
+
 int main(int argc, char *argv[])
 {
     home_dir = find_home_dir(argv[0]);
@@ -228,5 +423,9 @@ int main(int argc, char *argv[])
   
     test_global_basic();
     test_global_frozen_closures();
+    test_global_code_cache();
+    test_global_heap_gc();
+    test_global_symbols();
+    test_global_symbols_tip();
     return 0;
 }
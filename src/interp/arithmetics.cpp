@@ -13,23 +13,336 @@ namespace prologcoin { namespace interp {
 	return ic;
     }
 
+    //
+    // Arbitrary precision (limb) arithmetic
+    //
+
+    void arithmetics_fn::check_size(size_t num_limbs)
+    {
+	if (num_limbs > MAX_BIG_LIMBS) {
+	    throw arithmetic_exception("Big integer is too large.");
+	}
+    }
+
+    void arithmetics_fn::get_bignum(interpreter_base &interp, const term &t, bignum &v)
+    {
+	if (is_big(t)) {
+	    size_t n = interp.num_limbs(t);
+	    interp.add_accumulated_cost(n);
+	    v.neg = false;
+	    v.mag.resize(n);
+	    interp.get_big_limbs(t, &v.mag[0], n);
+	    trim(v.mag);
+	} else {
+	    auto val = get_int(t).value();
+	    v.neg = val < 0;
+	    v.mag.clear();
+	    if (val != 0) {
+		v.mag.push_back(v.neg ? -static_cast<uint64_t>(val) : static_cast<uint64_t>(val));
+	    }
+	}
+    }
+
+    term arithmetics_fn::new_number(interpreter_base &interp, const bignum &v)
+    {
+	if (v.mag.empty()) {
+	    return int_cell(0);
+	}
+	if (v.mag.size() == 1) {
+	    auto m = v.mag[0];
+	    if (!v.neg && m <= static_cast<uint64_t>(int_cell::max().value())) {
+		return int_cell(static_cast<int64_t>(m));
+	    }
+	    if (v.neg && m <= -static_cast<uint64_t>(int_cell::min().value())) {
+		return int_cell(-static_cast<int64_t>(m));
+	    }
+	}
+	if (v.neg) {
+	    throw arithmetic_exception("Negative big integers are unsupported.");
+	}
+	check_size(v.mag.size());
+	interp.add_accumulated_cost(v.mag.size());
+	return interp.new_big_limbs(&v.mag[0], v.mag.size());
+    }
+
+    void arithmetics_fn::trim(limbs_t &a)
+    {
+	while (!a.empty() && a.back() == 0) {
+	    a.pop_back();
+	}
+    }
+
+    int arithmetics_fn::mag_compare(const limbs_t &a, const limbs_t &b)
+    {
+	if (a.size() != b.size()) {
+	    return a.size() < b.size() ? -1 : 1;
+	}
+	for (size_t i = a.size(); i > 0; i--) {
+	    if (a[i-1] != b[i-1]) {
+		return a[i-1] < b[i-1] ? -1 : 1;
+	    }
+	}
+	return 0;
+    }
+
+    void arithmetics_fn::mag_add(const limbs_t &a, const limbs_t &b, limbs_t &r)
+    {
+	const limbs_t &x = (a.size() >= b.size()) ? a : b;
+	const limbs_t &y = (a.size() >= b.size()) ? b : a;
+	r.resize(x.size() + 1);
+	unsigned __int128 carry = 0;
+	for (size_t i = 0; i < x.size(); i++) {
+	    carry += x[i];
+	    if (i < y.size()) carry += y[i];
+	    r[i] = static_cast<uint64_t>(carry);
+	    carry >>= 64;
+	}
+	r[x.size()] = static_cast<uint64_t>(carry);
+	trim(r);
+    }
+
+    // Requires a >= b. r may be the same as a.
+    void arithmetics_fn::mag_sub(const limbs_t &a, const limbs_t &b, limbs_t &r)
+    {
+	r.resize(a.size());
+	uint64_t borrow = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+	    unsigned __int128 d = static_cast<unsigned __int128>(a[i])
+		- (i < b.size() ? b[i] : 0) - borrow;
+	    r[i] = static_cast<uint64_t>(d);
+	    borrow = static_cast<uint64_t>(d >> 64) & 1;
+	}
+	trim(r);
+    }
+
+    void arithmetics_fn::mag_mul(const limbs_t &a, const limbs_t &b, limbs_t &r)
+    {
+	r.assign(a.size() + b.size(), 0);
+	for (size_t i = 0; i < a.size(); i++) {
+	    unsigned __int128 carry = 0;
+	    for (size_t j = 0; j < b.size(); j++) {
+		carry += static_cast<unsigned __int128>(a[i]) * b[j] + r[i+j];
+		r[i+j] = static_cast<uint64_t>(carry);
+		carry >>= 64;
+	    }
+	    r[i+b.size()] = static_cast<uint64_t>(carry);
+	}
+	trim(r);
+    }
+
+    void arithmetics_fn::mag_shift_left(const limbs_t &a, size_t n, limbs_t &r)
+    {
+	size_t limbs = n / 64, bits = n % 64;
+	r.assign(a.size() + limbs + 1, 0);
+	for (size_t i = 0; i < a.size(); i++) {
+	    r[i+limbs] |= a[i] << bits;
+	    if (bits != 0) r[i+limbs+1] = a[i] >> (64 - bits);
+	}
+	trim(r);
+    }
+
+    void arithmetics_fn::mag_shift_right(const limbs_t &a, size_t n, limbs_t &r)
+    {
+	size_t limbs = n / 64, bits = n % 64;
+	if (limbs >= a.size()) {
+	    r.clear();
+	    return;
+	}
+	r.resize(a.size() - limbs);
+	for (size_t i = 0; i < r.size(); i++) {
+	    r[i] = a[i+limbs] >> bits;
+	    if (bits != 0 && i+limbs+1 < a.size()) {
+		r[i] |= a[i+limbs+1] << (64 - bits);
+	    }
+	}
+	trim(r);
+    }
+
+    // Truncating division. Requires b != 0.
+    void arithmetics_fn::mag_divmod(const limbs_t &a, const limbs_t &b, limbs_t &q, limbs_t &r)
+    {
+	if (mag_compare(a, b) < 0) {
+	    q.clear();
+	    r = a;
+	    return;
+	}
+	q.assign(a.size(), 0);
+	if (b.size() == 1) {
+	    unsigned __int128 rem = 0;
+	    for (size_t i = a.size(); i > 0; i--) {
+		rem = (rem << 64) | a[i-1];
+		q[i-1] = static_cast<uint64_t>(rem / b[0]);
+		rem %= b[0];
+	    }
+	    trim(q);
+	    r.clear();
+	    if (rem != 0) r.push_back(static_cast<uint64_t>(rem));
+	    return;
+	}
+	// Shift and subtract, one bit at a time
+	r.clear();
+	for (size_t i = a.size()*64; i > 0; i--) {
+	    size_t bit = i - 1;
+	    uint64_t carry = (a[bit / 64] >> (bit % 64)) & 1;
+	    for (auto &limb : r) {
+		auto next = limb >> 63;
+		limb = (limb << 1) | carry;
+		carry = next;
+	    }
+	    if (carry != 0) r.push_back(carry);
+	    if (mag_compare(r, b) >= 0) {
+		mag_sub(r, b, r);
+		q[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+	    }
+	}
+	trim(q);
+    }
+
+    void arithmetics_fn::add(const bignum &a, const bignum &b, bignum &r)
+    {
+	if (a.neg == b.neg) {
+	    mag_add(a.mag, b.mag, r.mag);
+	    r.neg = a.neg;
+	} else if (mag_compare(a.mag, b.mag) >= 0) {
+	    mag_sub(a.mag, b.mag, r.mag);
+	    r.neg = a.neg;
+	} else {
+	    mag_sub(b.mag, a.mag, r.mag);
+	    r.neg = b.neg;
+	}
+	if (r.mag.empty()) r.neg = false;
+    }
+
+    void arithmetics_fn::divmod(interpreter_base &interp, term *args, const std::string &name, bool floor, bignum &q, bignum &r)
+    {
+	bignum a, b;
+	get_bignum(interp, args[0], a);
+	get_bignum(interp, args[1], b);
+	if (b.mag.empty()) {
+	    throw interpreter_exception_division_by_zero(
+			name + ": attempt to divide by zero");
+	}
+	interp.add_accumulated_cost(a.mag.size() * b.mag.size());
+	mag_divmod(a.mag, b.mag, q.mag, r.mag);
+	q.neg = !q.mag.empty() && a.neg != b.neg;
+	r.neg = !r.mag.empty() && a.neg;
+	if (floor && !r.mag.empty() && a.neg != b.neg) {
+	    // Round towards negative infinity
+	    limbs_t one(1, 1), q1;
+	    mag_add(q.mag, one, q1);
+	    q.mag = q1;
+	    q.neg = true;
+	    bignum r1;
+	    add(r, b, r1);
+	    r = r1;
+	}
+    }
+
+    term arithmetics_fn::shift(interpreter_base &interp, const term &t, int64_t n)
+    {
+	if (!is_big(t)) {
+	    auto x = get_int(t).value();
+	    if (n <= 0) {
+		return int_cell(x >> std::min<int64_t>(-n, 63));
+	    }
+	    if (n < 64) {
+		__int128 r = static_cast<__int128>(x) * (static_cast<__int128>(1) << n);
+		if (r >= int_cell::min().value() && r <= int_cell::max().value()) {
+		    return int_cell(static_cast<int64_t>(r));
+		}
+	    }
+	}
+	bignum a, r;
+	get_bignum(interp, t, a);
+	r.neg = a.neg;
+	if (n > 0) {
+	    check_size(a.mag.size() + static_cast<size_t>(n) / 64);
+	    mag_shift_left(a.mag, static_cast<size_t>(n), r.mag);
+	} else {
+	    // Only BIG (non-negative) numbers get here
+	    mag_shift_right(a.mag, static_cast<size_t>(-n), r.mag);
+	}
+	return new_number(interp, r);
+    }
+
+    int arithmetics_fn::compare(interpreter_base &interp, const term a, const term b)
+    {
+	if (!is_big(a) && !is_big(b)) {
+	    auto x = get_int(a), y = get_int(b);
+	    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+	}
+	bignum x, y;
+	get_bignum(interp, a, x);
+	get_bignum(interp, b, y);
+	if (x.neg != y.neg) {
+	    return x.neg ? -1 : 1;
+	}
+	int cmp = mag_compare(x.mag, y.mag);
+	return x.neg ? -cmp : cmp;
+    }
+
+    //
+    // Functions
+    //
+
     term arithmetics_fn::plus_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) + get_int(args[1]);
+	if (!is_big(args[0]) && !is_big(args[1])) {
+	    // int_cells are 61 bits, so this can't overflow
+	    auto r = get_int(args[0]).value() + get_int(args[1]).value();
+	    if (is_int_range(r)) {
+		return int_cell(r);
+	    }
+	}
+	bignum a, b, r;
+	get_bignum(interp, args[0], a);
+	get_bignum(interp, args[1], b);
+	add(a, b, r);
+	return new_number(interp, r);
     }
 
     term arithmetics_fn::minus_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) - get_int(args[1]);
+	if (!is_big(args[0]) && !is_big(args[1])) {
+	    auto r = get_int(args[0]).value() - get_int(args[1]).value();
+	    if (is_int_range(r)) {
+		return int_cell(r);
+	    }
+	}
+	bignum a, b, r;
+	get_bignum(interp, args[0], a);
+	get_bignum(interp, args[1], b);
+	b.neg = !b.neg && !b.mag.empty();
+	add(a, b, r);
+	return new_number(interp, r);
     }
 
     term arithmetics_fn::times_2(interpreter_base &interp, term *args)
     {
-	return get_int(args[0]) * get_int(args[1]);
+	if (!is_big(args[0]) && !is_big(args[1])) {
+	    __int128 r = static_cast<__int128>(get_int(args[0]).value())
+		* get_int(args[1]).value();
+	    if (r >= int_cell::min().value() && r <= int_cell::max().value()) {
+		return int_cell(static_cast<int64_t>(r));
+	    }
+	}
+	bignum a, b, r;
+	get_bignum(interp, args[0], a);
+	get_bignum(interp, args[1], b);
+	check_size(a.mag.size() + b.mag.size());
+	interp.add_accumulated_cost(a.mag.size() * b.mag.size());
+	mag_mul(a.mag, b.mag, r.mag);
+	r.neg = !r.mag.empty() && a.neg != b.neg;
+	return new_number(interp, r);
     }
 
     term arithmetics_fn::div0_2(interpreter_base &interp, term *args)
     {
+	if (is_big(args[0]) || is_big(args[1])) {
+	    bignum q, r;
+	    divmod(interp, args, "// /2", false, q, r);
+	    return new_number(interp, q);
+	}
 	auto a = get_int(args[0]);
 	auto b = get_int(args[1]);
 	if (b.is_zero()) {
@@ -42,6 +355,11 @@ namespace prologcoin { namespace interp {
     }
 
     term arithmetics_fn::div_2(interpreter_base &interp, term *args) {
+	if (is_big(args[0]) || is_big(args[1])) {
+	    bignum q, r;
+	    divmod(interp, args, "div/2", true, q, r);
+	    return new_number(interp, q);
+	}
 	auto b = get_int(args[1]);
 	if (b.is_zero()) {
 	    throw interpreter_exception_division_by_zero(
@@ -49,7 +367,7 @@ namespace prologcoin { namespace interp {
 	}
 	auto d = get_int(div0_2(interp, args));
 	auto r = get_int(rem_2(interp, args));
-	if (r.is_negative()) {
+	if (!r.is_zero() && r.is_negative() != b.is_negative()) {
 	    --d;
 	}
 	return d;
@@ -57,6 +375,11 @@ namespace prologcoin { namespace interp {
 
     term arithmetics_fn::rem_2(interpreter_base &interp, term *args)
     {
+	if (is_big(args[0]) || is_big(args[1])) {
+	    bignum q, r;
+	    divmod(interp, args, "rem/2", false, q, r);
+	    return new_number(interp, r);
+	}
 	auto a = get_int(args[0]);
 	auto b = get_int(args[1]);
 	if (b.is_zero()) {
@@ -69,6 +392,11 @@ namespace prologcoin { namespace interp {
 	
     term arithmetics_fn::mod_2(interpreter_base &interp, term *args)
     {
+	if (is_big(args[0]) || is_big(args[1])) {
+	    bignum q, r;
+	    divmod(interp, args, "mod/2", true, q, r);
+	    return new_number(interp, r);
+	}
 	auto a = get_int(args[0]);
 	auto b = get_int(args[1]);
 	if (b.is_zero()) {
@@ -94,6 +422,22 @@ namespace prologcoin { namespace interp {
 	}
     }
 
+    term arithmetics_fn::shift_left_2(interpreter_base &interp, term *args)
+    {
+	if (is_big(args[1])) {
+	    throw arithmetic_exception("<< /2: shift amount is too large");
+	}
+	return shift(interp, args[0], get_int(args[1]).value());
+    }
+
+    term arithmetics_fn::shift_right_2(interpreter_base &interp, term *args)
+    {
+	if (is_big(args[1])) {
+	    throw arithmetic_exception(">> /2: shift amount is too large");
+	}
+	return shift(interp, args[0], -get_int(args[1]).value());
+    }
+
     void arithmetics::total_reset() {
 	fn_map_.clear();
 	args_.clear();
@@ -118,6 +462,8 @@ namespace prologcoin { namespace interp {
 	load_fn("rem", 2, &arithmetics_fn::rem_2);
 	load_fn("div", 2, &arithmetics_fn::div_2);
 	load_fn("//", 2, &arithmetics_fn::div0_2);
+	load_fn("<<", 2, &arithmetics_fn::shift_left_2);
+	load_fn(">>", 2, &arithmetics_fn::shift_right_2);
     }
 
     void arithmetics::unload()
@@ -193,10 +539,7 @@ namespace prologcoin { namespace interp {
 		interp_.abort(interpreter_exception_not_sufficiently_instantiated(context + ": Arguments are not sufficiently instantiated"));
 		break;
 	    }
-	    case tag_t::BIG: {
-		interp_.abort(interpreter_exception_unsupported(context + ": Big integers are unsupported."));
-		break;
-	    }
+	    case tag_t::BIG:
 	    case tag_t::INT: {
 		assert(false); // Should not occur
 		break;
@@ -3,6 +3,7 @@
 #ifndef _interp_arithmetics_hpp
 #define _interp_arithmetics_hpp
 
+#include <boost/container/small_vector.hpp>
 #include "../common/term.hpp"
 #include "interpreter_exception.hpp"
 
@@ -33,8 +34,55 @@ public:
 	static common::term rem_2(interpreter_base &interp, common::term *args);
 	static common::term div0_2(interpreter_base &interp, common::term *args);
 	static common::term div_2(interpreter_base &interp, common::term *args);			
+	static common::term shift_left_2(interpreter_base &interp, common::term *args);
+	static common::term shift_right_2(interpreter_base &interp, common::term *args);
+
+	static int compare(interpreter_base &interp, const common::term a, const common::term b);
+
     private:
+	//
+	// Numbers outside the int_cell range are BIG cells (which are
+	// unsigned.) We compute on those in sign and magnitude form, where
+	// the magnitude is 64-bit limbs (least significant first, no
+	// leading zero limbs, so zero is empty.)
+	//
+	typedef boost::container::small_vector<uint64_t, 8> limbs_t;
+
+	struct bignum {
+	    bool neg = false;
+	    limbs_t mag;
+	};
+
+	// The header of a BIG cell has 29 bits for the number of bits
+	static const size_t MAX_BIG_LIMBS = ((static_cast<size_t>(1) << 29) - 1) / 64;
+
 	static common::int_cell get_int(const common::term &t);
+
+	static inline bool is_big(const common::term &t) {
+	    return t.tag() == common::tag_t::BIG;
+	}
+
+	static inline bool is_int_range(int64_t v) {
+	    return v >= common::int_cell::min().value() &&
+		   v <= common::int_cell::max().value();
+	}
+
+	static void get_bignum(interpreter_base &interp, const common::term &t, bignum &v);
+	static common::term new_number(interpreter_base &interp, const bignum &v);
+	static void check_size(size_t num_limbs);
+
+	static void trim(limbs_t &a);
+	static int mag_compare(const limbs_t &a, const limbs_t &b);
+	static void mag_add(const limbs_t &a, const limbs_t &b, limbs_t &r);
+	static void mag_sub(const limbs_t &a, const limbs_t &b, limbs_t &r);
+	static void mag_mul(const limbs_t &a, const limbs_t &b, limbs_t &r);
+	static void mag_shift_left(const limbs_t &a, size_t n, limbs_t &r);
+	static void mag_shift_right(const limbs_t &a, size_t n, limbs_t &r);
+	static void mag_divmod(const limbs_t &a, const limbs_t &b, limbs_t &q, limbs_t &r);
+
+	static void add(const bignum &a, const bignum &b, bignum &r);
+	static void divmod(interpreter_base &interp, common::term *args, const std::string &name, bool floor, bignum &q, bignum &r);
+	static common::term shift(interpreter_base &interp, const common::term &t, int64_t n);
     };
 
 
@@ -54,6 +102,11 @@ public:
 
 	common::term eval(common::term &expr, const std::string &context);
 
+	// Compare two evaluated numbers (-1, 0 or 1)
+	inline int compare(const common::term a, const common::term b) {
+	    return arithmetics_fn::compare(interp_, a, b);
+	}
+
     private:
 	void load_fn(const std::string &name, size_t arity, fn f);
 	void load_fns();
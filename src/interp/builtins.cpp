@@ -112,6 +112,37 @@ bool builtins::program_state_1(interpreter_base &interp, size_t arity, common::t
     return interp.unify( args[0], lst);
 }
 
+//
+// code_statistics/1
+//
+bool builtins::code_statistics_1(interpreter_base &interp, size_t arity, common::term args[]) {
+    auto &wami = reinterpret_cast<wam_interpreter &>(interp);
+
+    term lst = interp.EMPTY_LIST;
+    auto push_it = [&](const std::string &name, size_t val) {
+	auto f = interp.functor(name, 1);
+	term v = int_cell(checked_cast<int64_t>(val));
+	lst = interp.new_dotted_pair( interp.new_term(f, { v }), lst);
+    };
+
+    push_it( "code_collections", wami.num_code_collections());
+    push_it( "code_segments", wami.num_segments());
+    push_it( "reclaimed_code_bytes", wami.reclaimed_code_size());
+    push_it( "dead_code_bytes", wami.dead_code_size());
+    push_it( "live_code_bytes", wami.live_code_size());
+
+    return interp.unify( args[0], lst);
+}
+
+//
+// garbage_collect_code/0
+//
+bool builtins::garbage_collect_code_0(interpreter_base &interp, size_t arity, common::term args[]) {
+    auto &wami = reinterpret_cast<wam_interpreter &>(interp);
+    wami.collect_dead_code();
+    return true;
+}
+
 //
 // term_size/2
 //
@@ -596,7 +627,7 @@ bool builtins::greater_than_equals_2(interpreter_base &interp, size_t, common::t
     term rhs = args[1];
     term result_lhs = interp.arith().eval(lhs, ">=/2");
     term result_rhs = interp.arith().eval(rhs, ">=/2");
-    return interp.standard_order(result_lhs, result_rhs) >= 0;
+    return interp.arith().compare(result_lhs, result_rhs) >= 0;
 }
 
 bool builtins::less_than_equals_2(interpreter_base &interp, size_t, common::term args[])
@@ -605,7 +636,7 @@ bool builtins::less_than_equals_2(interpreter_base &interp, size_t, common::term
     term rhs = args[1];
     term result_lhs = interp.arith().eval(lhs, "=</2");
     term result_rhs = interp.arith().eval(rhs, "=</2");
-    return interp.standard_order(result_lhs, result_rhs) <= 0;
+    return interp.arith().compare(result_lhs, result_rhs) <= 0;
 }
 
 
@@ -615,7 +646,7 @@ bool builtins::greater_than_2(interpreter_base &interp, size_t, common::term arg
     term rhs = args[1];
     term result_lhs = interp.arith().eval(lhs, ">/2");
     term result_rhs = interp.arith().eval(rhs, ">/2");
-    return interp.standard_order(result_lhs, result_rhs) > 0;
+    return interp.arith().compare(result_lhs, result_rhs) > 0;
 }
 
 bool builtins::less_than_2(interpreter_base &interp, size_t, common::term args[])
@@ -624,36 +655,33 @@ bool builtins::less_than_2(interpreter_base &interp, size_t, common::term args[]
     term rhs = args[1];
     term result_lhs = interp.arith().eval(lhs, "</2");
     term result_rhs = interp.arith().eval(rhs, "</2");
-    return interp.standard_order(result_lhs, result_rhs) < 0;
+    return interp.arith().compare(result_lhs, result_rhs) < 0;
 }
 
 //
 // Analyzing & constructing terms
 //
 
-void builtins::store_p_on_heap_if_wam(interpreter_base &interp) {
+// Keep P in the choice point (not on the heap) so that
+// wam_interpreter::collect_dead_code() sees the code it refers to.
+void builtins::save_p_in_choice_point_if_wam(interpreter_base &interp) {
     if (interp.p().has_wam_code()) {
-        wam_interpreter &wami = reinterpret_cast<wam_interpreter &>(interp);
-	auto ic = int_cell(wami.to_code_addr(interp.p().wam_code()));
-	interp.new_cell0(ic);
-    } else {
-        interp.new_cell0(interpreter_base::EMPTY_LIST);
+        interp.b()->wp = interp.p().wam_code();
     }
 }
 
-void builtins::restore_p_from_heap_if_wam(interpreter_base &interp) {
-    auto c = interp.get_heap()[interp.heap_size()-1];
-    if (c.tag() == tag_t::INT) {
-        wam_interpreter &wami = reinterpret_cast<wam_interpreter &>(interp);
-	auto ic = static_cast<int_cell &>(c).value();
-	auto wam_code = wami.to_code(ic);
-	interp.p().set_wam_code(wam_code);
+void builtins::restore_p_from_choice_point_if_wam(interpreter_base &interp) {
+    if (interp.b()->wp != nullptr) {
+	interp.p().set_wam_code(interp.b()->wp);
     }
 }
 
 bool builtins::arg_3_cp(interpreter_base &interp, size_t arity, common::term args[])
 {
-    auto arg_index_term = interp.get_heap()[interp.heap_size()-2];
+    // The index is the last cell before the choice point (the heap may
+    // not have been trimmed back to it.)
+    size_t index_addr = interp.b()->h - 1;
+    auto arg_index_term = interp.get_heap()[index_addr];
     auto arg_index = reinterpret_cast<int_cell &>(arg_index_term).value();
     term t = args[1];
     size_t n = interp.functor(t).arity();
@@ -662,8 +690,8 @@ bool builtins::arg_3_cp(interpreter_base &interp, size_t arity, common::term arg
         interp.b()->bp = code_point::fail();
 	return false;
     }
-    interp.get_heap()[interp.heap_size()-2] = int_cell(arg_index);
-    restore_p_from_heap_if_wam(interp);
+    interp.get_heap()[index_addr] = int_cell(arg_index);
+    restore_p_from_choice_point_if_wam(interp);
     interp.unify(args[0], int_cell(arg_index+1));
     term val = interp.arg(t, arg_index);
     return interp.unify(args[2], val);
@@ -684,10 +712,10 @@ bool builtins::arg_3(interpreter_base &interp, size_t arity, common::term args[]
         static const common::con_cell ARG3("arg", 3);
 	// Store current index
 	interp.new_cell0(int_cell(0));
-	// Store P so we can restore program pointer
-	store_p_on_heap_if_wam(interp);
 	// Allocate choice point
 	interp.allocate_choice_point(code_point(interpreter_base::EMPTY_LIST,arg_3_cp, false));
+	// Store P so we can restore program pointer
+	save_p_in_choice_point_if_wam(interp);
 	interp.unify(arg_index_term, int_cell(1));
 	arg_index_term = int_cell(1);
     }
@@ -897,49 +925,430 @@ bool builtins::operator_deconstruct(interpreter_base &interp, size_t arity, comm
     return interp.unify(rhs, lst);
 }
 
+//
+// Sorting. All sort predicates share a natural merge sort: the list is
+// read once into (key, element) pairs with the keys dereferenced, the
+// runs already in order (or strictly reversed, which are flipped) are
+// found in a single pass and then merged pairwise. Sorted or nearly
+// sorted input therefore costs little more than reading it.
+//
+
+struct sort_entry {
+    term key;
+    term elem;
+};
+
+// Small integers and atoms are common keys and need no traversal. They
+// add what standard_order() charges for them (a dereference of each
+// term) to 'cost', which the caller charges.
+static inline int sort_compare(interpreter_base &interp, const term a, const term b, uint64_t &cost)
+{
+    if (a.tag() == tag_t::INT && b.tag() == tag_t::INT) {
+	cost += 2;
+	auto va = reinterpret_cast<const int_cell &>(a).value();
+	auto vb = reinterpret_cast<const int_cell &>(b).value();
+	return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
+    }
+    if (a == b && a.tag() != tag_t::STR && a.tag() != tag_t::BIG) {
+	cost += 2;
+	return 0;
+    }
+    return interp.standard_order(a, b);
+}
+
+static void natural_merge_sort(interpreter_base &interp, std::vector<sort_entry> &v, bool descending, bool &reordered, uint64_t &cost)
+{
+    const size_t n = v.size();
+    int sign = descending ? -1 : 1;
+
+    // Find runs; runs[i] is where run i starts
+    std::vector<size_t> runs;
+    size_t i = 0;
+    while (i < n) {
+	runs.push_back(i);
+	size_t j = i + 1;
+	if (j < n && sign*sort_compare(interp, v[j].key, v[j-1].key, cost) < 0) {
+	    // Strictly decreasing, so reversing it keeps the sort stable
+	    while (j < n && sign*sort_compare(interp, v[j].key, v[j-1].key, cost) < 0) {
+		j++;
+	    }
+	    std::reverse(v.begin() + i, v.begin() + j);
+	    reordered = true;
+	} else {
+	    while (j < n && sign*sort_compare(interp, v[j].key, v[j-1].key, cost) >= 0) {
+		j++;
+	    }
+	}
+	i = j;
+    }
+    if (runs.size() <= 1) {
+	return;
+    }
+    reordered = true;
+
+    std::vector<sort_entry> tmp(n);
+    std::vector<sort_entry> *src = &v, *dst = &tmp;
+    std::vector<size_t> merged;
+    while (runs.size() > 1) {
+	merged.clear();
+	for (size_t r = 0; r < runs.size(); r += 2) {
+	    size_t lo = runs[r];
+	    size_t mid = (r + 1 < runs.size()) ? runs[r+1] : n;
+	    size_t hi = (r + 2 < runs.size()) ? runs[r+2] : n;
+	    merged.push_back(lo);
+	    auto &s = *src;
+	    auto &d = *dst;
+	    // Runs that are already in order relative each other are copied
+	    if (mid == hi || sign*sort_compare(interp, s[mid].key, s[mid-1].key, cost) >= 0) {
+		std::copy(s.begin() + lo, s.begin() + hi, d.begin() + lo);
+		continue;
+	    }
+	    size_t a = lo, b = mid, k = lo;
+	    while (a < mid && b < hi) {
+		if (sign*sort_compare(interp, s[b].key, s[a].key, cost) < 0) {
+		    d[k++] = s[b++];
+		} else {
+		    d[k++] = s[a++];
+		}
+	    }
+	    k = std::copy(s.begin() + a, s.begin() + mid, d.begin() + k) - d.begin();
+	    std::copy(s.begin() + b, s.begin() + hi, d.begin() + k);
+	}
+	runs.swap(merged);
+	std::swap(src, dst);
+    }
+    if (src != &v) {
+	v.swap(tmp);
+    }
+}
+
+term builtins::sort_list(interpreter_base &interp, const std::string &name, term lst, size_t key, bool descending, bool dedup)
+{
+    if (lst.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated(name + ": Arguments are not sufficiently instantiated"));
+    }
+
+    interp.add_accumulated_cost(interp.cost(lst));
+
+    std::vector<sort_entry> vec;
+    term orig = lst;
+    while (interp.is_dotted_pair(lst)) {
+	term el = interp.arg(lst, 0);
+	term k = el;
+	if (key > 0) {
+	    if (el.tag().is_ref()) {
+		interp.abort(interpreter_exception_not_sufficiently_instantiated(name + ": Arguments are not sufficiently instantiated"));
+	    }
+	    if (el.tag() != tag_t::STR || interp.functor(el).arity() < key) {
+		interp.abort(interpreter_exception_wrong_arg_type(name + ": Element has no argument " + boost::lexical_cast<std::string>(key) + "; found " + interp.to_string(el)));
+	    }
+	    k = interp.arg(el, key - 1);
+	}
+	vec.push_back(sort_entry{k, el});
+	lst = interp.arg(lst, 1);
+    }
+    if (lst.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated(name + ": Arguments are not sufficiently instantiated"));
+    }
+    if (!interp.is_empty_list(lst)) {
+        interp.abort(interpreter_exception_not_list(name + ": First argument is not a list; found " + interp.to_string(orig)));
+    }
+
+    bool reordered = false;
+    uint64_t cost = 0;
+    natural_merge_sort(interp, vec, descending, reordered, cost);
+
+    if (dedup) {
+	size_t n = vec.size();
+	auto last = std::unique(vec.begin(), vec.end(),
+				[&](const sort_entry &a, const sort_entry &b)
+				{ return sort_compare(interp, a.key, b.key, cost) == 0; });
+	vec.erase(last, vec.end());
+	reordered = reordered || vec.size() != n;
+    }
+    interp.add_accumulated_cost(cost);
+
+    // Already sorted input is returned as is
+    if (!reordered) {
+	return orig;
+    }
+
+    term r = interpreter_base::EMPTY_LIST;
+    for (auto it = vec.rbegin(); it != vec.rend(); ++it) {
+	r = interp.new_dotted_pair(it->elem, r);
+    }
+    return r;
+}
+
 bool builtins::sort_2(interpreter_base &interp, size_t arity, term args[])
 {
-    term arg0 = args[0];
-    term arg1 = args[1];
+    term r = sort_list(interp, "sort/2", args[0], 0, false, true);
+    return interp.unify(args[1], r);
+}
+
+bool builtins::msort_2(interpreter_base &interp, size_t arity, term args[])
+{
+    term r = sort_list(interp, "msort/2", args[0], 0, false, false);
+    return interp.unify(args[1], r);
+}
+
+void builtins::check_pairs(interpreter_base &interp, const std::string &name, term lst)
+{
+    while (interp.is_dotted_pair(lst)) {
+	term el = interp.arg(lst, 0);
+	if (el.tag().is_ref()) {
+	    interp.abort(interpreter_exception_not_sufficiently_instantiated(name + ": Arguments are not sufficiently instantiated"));
+	}
+	if (el.tag() != tag_t::STR || interp.functor(el) != con_cell("-",2)) {
+	    interp.abort(interpreter_exception_wrong_arg_type(name + ": Element is not a pair Key-Value; found " + interp.to_string(el)));
+	}
+	lst = interp.arg(lst, 1);
+    }
+}
+
+bool builtins::keysort_2(interpreter_base &interp, size_t arity, term args[])
+{
+    check_pairs(interp, "keysort/2", args[0]);
+    term r = sort_list(interp, "keysort/2", args[0], 1, false, false);
+    return interp.unify(args[1], r);
+}
+
+bool builtins::sort_4(interpreter_base &interp, size_t arity, term args[])
+{
+    term key = args[0];
+    term order = args[1];
+
+    if (key.tag().is_ref() || order.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/4: Arguments are not sufficiently instantiated"));
+    }
+    if (key.tag() != tag_t::INT || reinterpret_cast<int_cell &>(key).value() < 0) {
+        interp.abort(interpreter_exception_wrong_arg_type("sort/4: First argument must be a non-negative integer; was " + interp.to_string(key)));
+    }
+    bool descending, dedup;
+    if (order == con_cell("@<",0)) {
+	descending = false; dedup = true;
+    } else if (order == con_cell("@=<",0)) {
+	descending = false; dedup = false;
+    } else if (order == con_cell("@>",0)) {
+	descending = true; dedup = true;
+    } else if (order == con_cell("@>=",0)) {
+	descending = true; dedup = false;
+    } else {
+        interp.abort(interpreter_exception_wrong_arg_type("sort/4: Second argument must be one of @<, @=<, @> or @>=; was " + interp.to_string(order)));
+	return false;
+    }
+
+    size_t k = static_cast<size_t>(reinterpret_cast<int_cell &>(key).value());
+    term r = sort_list(interp, "sort/4", args[2], k, descending, dedup);
+    return interp.unify(args[3], r);
+}
+
+//
+// Assoc. AVL trees as ordinary terms: t is the empty tree and
+// t(Key,Value,Balance,Left,Right) a node, where Balance is <, = or > as
+// the left subtree is lower than, as high as or higher than the right.
+// An update copies the path from the root and shares the rest, so older
+// versions stay valid and backtracking needs nothing special. The cost
+// is the number of nodes visited and created.
+//
+
+void builtins::check_assoc(interpreter_base &interp, const std::string &name, term t)
+{
+    if (t.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated(name + ": Arguments are not sufficiently instantiated"));
+    }
+    if (t != con_cell("t",0) &&
+	(t.tag() != tag_t::STR || interp.functor(t) != con_cell("t",5))) {
+        interp.abort(interpreter_exception_wrong_arg_type(name + ": Not an assoc; found " + interp.to_string(t)));
+    }
+}
+
+static inline term new_assoc_node(interpreter_base &interp, term key, term value, term balance, term left, term right, uint64_t &touched)
+{
+    touched++;
+    return interp.new_term(con_cell("t",5), {key, value, balance, left, right});
+}
+
+term builtins::assoc_put(interpreter_base &interp, term t, term key, term value, bool &grew, uint64_t &touched)
+{
+    static const con_cell LOWER("<",0), EVEN("=",0), HIGHER(">",0);
+
+    check_assoc(interp, "put_assoc/4", t);
+    if (t == con_cell("t",0)) {
+	grew = true;
+	return new_assoc_node(interp, key, value, EVEN, t, t, touched);
+    }
+    touched++;
+    term k = interp.arg(t, 0), v = interp.arg(t, 1), b = interp.arg(t, 2);
+    term l = interp.arg(t, 3), r = interp.arg(t, 4);
+    int cmp = sort_compare(interp, key, k, touched);
+    if (cmp == 0) {
+	grew = false;
+	return new_assoc_node(interp, k, value, b, l, r, touched);
+    }
+    if (cmp < 0) {
+	term l1 = assoc_put(interp, l, key, value, grew, touched);
+	if (!grew) {
+	    return new_assoc_node(interp, k, v, b, l1, r, touched);
+	}
+	if (b == LOWER) {
+	    grew = false;
+	    return new_assoc_node(interp, k, v, EVEN, l1, r, touched);
+	}
+	if (b == EVEN) {
+	    return new_assoc_node(interp, k, v, HIGHER, l1, r, touched);
+	}
+	// Left subtree is now two higher; rotate
+	grew = false;
+	if (interp.arg(l1, 2) == HIGHER) {
+	    term n = new_assoc_node(interp, k, v, EVEN, interp.arg(l1, 4), r, touched);
+	    return new_assoc_node(interp, interp.arg(l1, 0), interp.arg(l1, 1), EVEN, interp.arg(l1, 3), n, touched);
+	}
+	term lr = interp.arg(l1, 4);
+	term lrb = interp.arg(lr, 2);
+	term nl = new_assoc_node(interp, interp.arg(l1, 0), interp.arg(l1, 1), lrb == LOWER ? HIGHER : EVEN, interp.arg(l1, 3), interp.arg(lr, 3), touched);
+	term nr = new_assoc_node(interp, k, v, lrb == HIGHER ? LOWER : EVEN, interp.arg(lr, 4), r, touched);
+	return new_assoc_node(interp, interp.arg(lr, 0), interp.arg(lr, 1), EVEN, nl, nr, touched);
+    } else {
+	term r1 = assoc_put(interp, r, key, value, grew, touched);
+	if (!grew) {
+	    return new_assoc_node(interp, k, v, b, l, r1, touched);
+	}
+	if (b == HIGHER) {
+	    grew = false;
+	    return new_assoc_node(interp, k, v, EVEN, l, r1, touched);
+	}
+	if (b == EVEN) {
+	    return new_assoc_node(interp, k, v, LOWER, l, r1, touched);
+	}
+	// Right subtree is now two higher; rotate
+	grew = false;
+	if (interp.arg(r1, 2) == LOWER) {
+	    term n = new_assoc_node(interp, k, v, EVEN, l, interp.arg(r1, 3), touched);
+	    return new_assoc_node(interp, interp.arg(r1, 0), interp.arg(r1, 1), EVEN, n, interp.arg(r1, 4), touched);
+	}
+	term rl = interp.arg(r1, 3);
+	term rlb = interp.arg(rl, 2);
+	term nl = new_assoc_node(interp, k, v, rlb == LOWER ? HIGHER : EVEN, l, interp.arg(rl, 3), touched);
+	term nr = new_assoc_node(interp, interp.arg(r1, 0), interp.arg(r1, 1), rlb == HIGHER ? LOWER : EVEN, interp.arg(rl, 4), interp.arg(r1, 4), touched);
+	return new_assoc_node(interp, interp.arg(rl, 0), interp.arg(rl, 1), EVEN, nl, nr, touched);
+    }
+}
 
-    if (arg0.tag().is_ref()) {
-        interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/2: Arguments are not sufficiently instantiated"));
+// Build a balanced tree from sorted entries [lo,hi)
+static term assoc_build(interpreter_base &interp, const std::vector<sort_entry> &vec, size_t lo, size_t hi, size_t &height, uint64_t &touched)
+{
+    if (lo == hi) {
+	height = 0;
+	return con_cell("t",0);
     }
+    size_t mid = lo + (hi - lo) / 2;
+    size_t hl, hr;
+    term l = assoc_build(interp, vec, lo, mid, hl, touched);
+    term r = assoc_build(interp, vec, mid + 1, hi, hr, touched);
+    height = std::max(hl, hr) + 1;
+    con_cell b = (hl < hr) ? con_cell("<",0) : ((hl > hr) ? con_cell(">",0) : con_cell("=",0));
+    term el = vec[mid].elem;
+    return new_assoc_node(interp, vec[mid].key, interp.arg(el, 1), b, l, r, touched);
+}
 
-    if (!interp.is_list(arg0)) {
-        interp.abort(interpreter_exception_not_sufficiently_instantiated("sort/2: First argument is not a list; found " + interp.to_string(arg0)));
+void builtins::assoc_collect(interpreter_base &interp, term t, std::vector<term> &nodes)
+{
+    check_assoc(interp, "assoc_to_list/2", t);
+    if (t == con_cell("t",0)) {
+	return;
     }
+    assoc_collect(interp, interp.arg(t, 3), nodes);
+    nodes.push_back(t);
+    assoc_collect(interp, interp.arg(t, 4), nodes);
+}
 
-    interp.add_accumulated_cost(interp.cost(arg0));
+bool builtins::empty_assoc_1(interpreter_base &interp, size_t arity, term args[])
+{
+    return interp.unify(args[0], con_cell("t",0));
+}
+
+bool builtins::get_assoc_3(interpreter_base &interp, size_t arity, term args[])
+{
+    term key = args[0];
+    term t = args[1];
+
+    uint64_t touched = 0;
+    for (;;) {
+	check_assoc(interp, "get_assoc/3", t);
+	if (t == con_cell("t",0)) {
+	    interp.add_accumulated_cost(touched);
+	    return false;
+	}
+	touched++;
+	int cmp = sort_compare(interp, key, interp.arg(t, 0), touched);
+	if (cmp == 0) {
+	    break;
+	}
+	t = interp.arg(t, cmp < 0 ? 3 : 4);
+    }
+    interp.add_accumulated_cost(touched);
+    return interp.unify(args[2], interp.arg(t, 1));
+}
+
+bool builtins::put_assoc_4(interpreter_base &interp, size_t arity, term args[])
+{
+    uint64_t touched = 0;
+    bool grew = false;
+    term t = assoc_put(interp, args[1], args[0], args[2], grew, touched);
+    interp.add_accumulated_cost(touched);
+    return interp.unify(args[3], t);
+}
 
-    size_t n = interp.list_length(arg0);
+bool builtins::list_to_assoc_2(interpreter_base &interp, size_t arity, term args[])
+{
+    term lst = args[0];
 
-    std::vector<term> vec(n);
+    if (lst.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated("list_to_assoc/2: Arguments are not sufficiently instantiated"));
+    }
+    check_pairs(interp, "list_to_assoc/2", lst);
 
-    for (size_t i = 0; i < n; i++) {
-        term el = interp.arg(arg0, 0);
-	vec[i] = el;
-	arg0 = interp.arg(arg0, 1);
+    std::vector<sort_entry> vec;
+    while (interp.is_dotted_pair(lst)) {
+	term el = interp.arg(lst, 0);
+	vec.push_back(sort_entry{interp.arg(el, 0), el});
+	lst = interp.arg(lst, 1);
+    }
+    if (lst.tag().is_ref()) {
+        interp.abort(interpreter_exception_not_sufficiently_instantiated("list_to_assoc/2: Arguments are not sufficiently instantiated"));
+    }
+    if (!interp.is_empty_list(lst)) {
+        interp.abort(interpreter_exception_not_list("list_to_assoc/2: First argument is not a list; found " + interp.to_string(args[0])));
     }
 
-    std::stable_sort(vec.begin(), vec.end(),
-		     [&](const term &t1, const term &t2)
-		     { return interp.standard_order(t1,t2) < 0; } );
+    bool reordered = false;
+    uint64_t touched = 0;
+    natural_merge_sort(interp, vec, false, reordered, touched);
+    for (size_t i = 1; i < vec.size(); i++) {
+	if (sort_compare(interp, vec[i-1].key, vec[i].key, touched) == 0) {
+	    interp.abort(interpreter_exception_wrong_arg_type("list_to_assoc/2: Duplicate key " + interp.to_string(vec[i].key)));
+	}
+    }
 
-    vec.erase( std::unique(vec.begin(), vec.end()), vec.end());
-    n = vec.size();
+    size_t height = 0;
+    term t = assoc_build(interp, vec, 0, vec.size(), height, touched);
+    interp.add_accumulated_cost(touched);
+    return interp.unify(args[1], t);
+}
 
-    // Build list from vector
+bool builtins::assoc_to_list_2(interpreter_base &interp, size_t arity, term args[])
+{
+    std::vector<term> nodes;
+    assoc_collect(interp, args[0], nodes);
+    interp.add_accumulated_cost(nodes.size());
 
     term r = interpreter_base::EMPTY_LIST;
-	
-    for (size_t i = 0; i < n; i++) {
-        term el = vec[n-i-1];
-	r = interp.new_dotted_pair(el, r);
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+	term pair = interp.new_term(con_cell("-",2), {interp.arg(*it, 0), interp.arg(*it, 1)});
+	r = interp.new_dotted_pair(pair, r);
     }
-
-    bool ok = interp.unify(arg1, r);
-    return ok;
+    return interp.unify(args[1], r);
 }
 
 //
@@ -1379,11 +1788,17 @@ bool builtins::password_2(interpreter_base &interp, size_t arity, common::term a
 	if (pred.empty()) {
 	    return false;
 	}
-	auto &clauses = pred.clauses();
-	if (interp.functor(clauses[0].clause()) != PASSWD) {
+	term clause;
+	for (auto &mclause : pred.clauses()) {
+	    if (!mclause.is_erased()) {
+		clause = mclause.clause();
+		break;
+	    }
+	}
+	if (interp.functor(clause) != PASSWD) {
 	    return false;
 	}
-	auto head = interp.clause_head(clauses[0].clause());
+	auto head = interp.clause_head(clause);
 	auto passwd = interp.arg(head,0);
 	if (!interp.is_string(passwd)) {
 	    return false;
@@ -1522,14 +1937,14 @@ bool builtins::show_0(interpreter_base &interp, size_t arity, common::term args[
 bool builtins::asserta_1(interpreter_base &interp, size_t arity, common::term args[] ) {
 
     term clause = interp.copy(args[0]);
-    interp.load_clause(clause, FIRST_CLAUSE);
+    interp.load_clause(clause, FIRST_CLAUSE, true);
     return true;
 }
 
 bool builtins::assertz_1(interpreter_base &interp, size_t arity, common::term args[] ) {
 
     term clause = interp.copy(args[0]);
-    interp.load_clause(clause, LAST_CLAUSE);
+    interp.load_clause(clause, LAST_CLAUSE, true);
     return true;
 }
 
@@ -1567,12 +1982,12 @@ bool builtins::retract(interpreter_base &interp, const std::string &pname, term
     bool r = pred.matching_clauses(interp, head);
     if (r) {
 	interp.updated_predicate_pre(qn);
-    }
-    pred.remove_clauses(interp, head, all);
-    if (r) {
+	pred.set_dynamic();
+	pred.remove_clauses(interp, head, all);
 	interp.updated_predicate_post(qn);
     }
-    return r;
+    // retractall/1 succeeds even if there was nothing to remove
+    return r || all;
 }
 
 
@@ -1717,6 +2132,16 @@ void builtins::load(interpreter_base &interp) {
     i.load_builtin(i.functor("copy_term",2), &builtins::copy_term_2);
     i.load_builtin(con_cell("=..", 2), &builtins::operator_deconstruct);
     i.load_builtin(con_cell("sort", 2), &builtins::sort_2);
+    i.load_builtin(con_cell("msort", 2), &builtins::msort_2);
+    i.load_builtin(i.functor("keysort", 2), &builtins::keysort_2);
+    i.load_builtin(con_cell("sort", 4), &builtins::sort_4);
+
+    // Assoc (AVL trees)
+    i.load_builtin(i.functor("empty_assoc", 1), &builtins::empty_assoc_1);
+    i.load_builtin(i.functor("get_assoc", 3), &builtins::get_assoc_3);
+    i.load_builtin(i.functor("put_assoc", 4), &builtins::put_assoc_4);
+    i.load_builtin(i.functor("list_to_assoc", 2), &builtins::list_to_assoc_2);
+    i.load_builtin(i.functor("assoc_to_list", 2), &builtins::assoc_to_list_2);
 
     // Meta
     i.load_builtin(con_cell("\\+", 1), builtin(&builtins::operator_disprove,true));
@@ -1747,6 +2172,8 @@ void builtins::load(interpreter_base &interp) {
     i.load_builtin(con_cell("toc",1), builtin(&builtins::toc_1));
     i.load_builtin(interp.functor("term_size", 1), &builtins::term_size_2);
     i.load_builtin(interp.functor("term_size", 2), &builtins::term_size_2);
+    i.load_builtin(i.functor("code_statistics", 1), &builtins::code_statistics_1);
+    i.load_builtin(i.functor("garbage_collect_code", 0), &builtins::garbage_collect_code_0);
 
     // Program database
     i.load_builtin(con_cell("show",0), builtin(&builtins::show_0));
@@ -67,6 +67,8 @@ typedef std::pair<common::con_cell, common::con_cell> qname;
 	static bool program_state_0(interpreter_base &interp, size_t arity, common::term args[]);
 	static bool program_state_1(interpreter_base &interp, size_t arity, common::term args[]);
 	static bool term_size_2(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool code_statistics_1(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool garbage_collect_code_0(interpreter_base &interp, size_t arity, common::term args[]);
 
 	//
 	// Simple
@@ -177,8 +179,8 @@ typedef std::pair<common::con_cell, common::con_cell> qname;
 	//
 	// Analyzing & constructing terms
 	//
-	static void store_p_on_heap_if_wam(interpreter_base &interp);
-	static void restore_p_from_heap_if_wam(interpreter_base &interp);
+	static void save_p_in_choice_point_if_wam(interpreter_base &interp);
+	static void restore_p_from_choice_point_if_wam(interpreter_base &interp);
 	static bool arg_3_cp(interpreter_base &interp, size_t arity, common::term args[]);
         static bool arg_3(interpreter_base &interp, size_t arity, common::term args[]);
         static bool functor_3(interpreter_base &interp, size_t arity, common::term args[]);
@@ -186,7 +188,23 @@ typedef std::pair<common::con_cell, common::con_cell> qname;
 	static bool same_term_2(interpreter_base &interp, size_t arity, common::term args[]);
 	static bool operator_deconstruct(interpreter_base &interp, size_t arity, common::term args[]);
         static bool sort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool msort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool keysort_2(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool sort_4(interpreter_base &interp, size_t arity, common::term args[]);
     private:
+	static common::term sort_list(interpreter_base &interp,
+				      const std::string &name,
+				      common::term lst, size_t key,
+				      bool descending, bool dedup);
+	static void check_pairs(interpreter_base &interp,
+				const std::string &name, common::term lst);
+	static void check_assoc(interpreter_base &interp,
+				const std::string &name, common::term t);
+	static common::term assoc_put(interpreter_base &interp, common::term t,
+				      common::term key, common::term value,
+				      bool &grew, uint64_t &touched);
+	static void assoc_collect(interpreter_base &interp, common::term t,
+				  std::vector<common::term> &nodes);
 	static common::term deconstruct_write_list(interpreter_base &interp,
 						   common::term &t,
 						   size_t index);
@@ -195,6 +213,14 @@ typedef std::pair<common::con_cell, common::con_cell> qname;
 					  common::term &t, size_t index);
 
     public:
+	//
+	// Assoc (AVL trees)
+	//
+	static bool empty_assoc_1(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool get_assoc_3(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool put_assoc_4(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool list_to_assoc_2(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool assoc_to_list_2(interpreter_base &interp, size_t arity, common::term args[]);
 
 	//
 	// Meta
@@ -0,0 +1,481 @@
+#include "builtins_tabling.hpp"
+#include "interpreter_base.hpp"
+#include "../common/term_parser.hpp"
+
+namespace prologcoin { namespace interp {
+
+    using namespace prologcoin::common;
+
+    //
+    // Trie over the cells of terms in preorder. Variables are numbered
+    // in order of first occurrence, so two terms map to the same node
+    // iff they are variants.
+    //
+    class variant_trie {
+    public:
+        static const size_t NONE = static_cast<size_t>(-1);
+
+        variant_trie() : nodes_(1) { }
+
+	// Returns the value at the node for the key (NONE if new.)
+        size_t & operator [] (const std::vector<uint64_t> &key) {
+	    size_t n = 0;
+	    for (auto k : key) {
+	        auto it = nodes_[n].children.find(k);
+		if (it != nodes_[n].children.end()) {
+		    n = it->second;
+		} else {
+		    size_t child = nodes_.size();
+		    nodes_[n].children[k] = child;
+		    nodes_.push_back(node());
+		    n = child;
+		}
+	    }
+	    return nodes_[n].value;
+	}
+
+    private:
+        struct node {
+	    node() : value(NONE) { }
+	    std::unordered_map<uint64_t, size_t> children;
+	    size_t value;
+	};
+        std::vector<node> nodes_;
+    };
+
+    const size_t variant_trie::NONE;
+
+    //
+    // Tables are evaluated with linear (iterated) tabling: a call that
+    // is not a variant of a table under evaluation becomes a new frame
+    // and runs the clauses of its predicate, adding all answers to its
+    // table. A variant of a table under evaluation (an "active" table)
+    // consumes the answers found so far and records the dependency
+    // (the link) like in Tarjan's SCC algorithm. A frame that depends
+    // on an older frame is popped as incomplete; the leader of the SCC
+    // (a frame without such a dependency) reruns its clauses until an
+    // iteration adds no new answers and then completes all tables of
+    // its SCC. Incomplete tables are rerun (once) in each iteration of
+    // their leader.
+    //
+    class table_store : public managed_data {
+    public:
+        enum status_t { ACTIVE, INCOMPLETE, COMPLETE };
+
+        static table_store & get(interpreter_base &interp) {
+	    static const con_cell TABLES("$tables", 0);
+	    auto *store = reinterpret_cast<table_store *>(interp.get_managed_data(TABLES));
+	    if (store == nullptr) {
+	        store = new table_store(interp);
+		interp.set_managed_data(TABLES, store);
+	    }
+	    return *store;
+	}
+
+        table_store(interpreter_base &interp)
+	  : iteration_count_(0), answer_count_(0),
+	    evaluate_(interp.functor("evaluate", 0)),
+	    consume_(interp.functor("consume", 0)),
+	    complete_(interp.functor("complete", 0)) { }
+
+        virtual ~table_store() {
+	    clear();
+	}
+
+        inline bool is_evaluating() const {
+	    return !frames_.empty();
+	}
+
+        void clear() {
+	    for (auto *t : tables_) delete t;
+	    tables_.clear();
+	    calls_ = variant_trie();
+	    frames_.clear();
+	    incomplete_.clear();
+	    env_.reset();
+	}
+
+	void abort() {
+	    for (auto *t : tables_) {
+	        if (t->status != COMPLETE) {
+		    t->status = INCOMPLETE;
+		    t->link = variant_trie::NONE;
+		}
+	    }
+	    frames_.clear();
+	    incomplete_.clear();
+	}
+
+	// Returns the table for the variant of the goal and how to
+	// proceed: evaluate it, consume what it has so far or
+	// use its complete answers.
+	size_t lookup(interpreter_base &interp, term goal, con_cell &what) {
+	    variant_key(interp, goal, key_);
+	    size_t &id = calls_[key_];
+	    if (id == variant_trie::NONE) {
+	        id = tables_.size();
+		tables_.push_back(new table());
+		what = evaluate_;
+		return id;
+	    }
+	    auto &t = *tables_[id];
+	    if (t.status == COMPLETE) {
+	        what = complete_;
+	    } else if (t.status == ACTIVE) {
+	        consume(t.frame);
+		what = consume_;
+	    } else if (t.link < frames_.size() &&
+		       frames_[t.link].iteration == t.iteration) {
+	        // Already rerun in this iteration of its leader
+	        consume(t.link);
+		what = consume_;
+	    } else {
+	        what = evaluate_;
+	    }
+	    return id;
+	}
+
+	void push(size_t id) {
+	    auto &t = *tables_[id];
+	    t.status = ACTIVE;
+	    t.frame = frames_.size();
+	    frames_.push_back(frame{id, t.frame, ++iteration_count_,
+			            answer_count_, false, incomplete_.size()});
+	}
+
+	// Returns false if the leader needs another iteration.
+	bool pop(size_t id) {
+	    size_t pos = frames_.size() - 1;
+	    auto &f = frames_[pos];
+	    assert(f.table == id);
+	    auto &t = *tables_[id];
+
+	    if (f.link < pos) {
+	        // Depends on an older frame; incomplete until its leader
+	        // completes.
+	        t.status = INCOMPLETE;
+		t.link = f.link;
+		t.iteration = frames_[f.link].iteration;
+		incomplete_.push_back(id);
+		size_t link = f.link;
+		bool looped = f.looped;
+		frames_.pop_back();
+		auto &parent = frames_.back();
+		parent.link = std::min(parent.link, link);
+		parent.looped = parent.looped || looped;
+		return true;
+	    }
+
+	    if (f.looped && f.answers != answer_count_) {
+	        f.iteration = ++iteration_count_;
+		f.answers = answer_count_;
+		f.looped = false;
+		incomplete_.resize(f.incomplete_mark);
+		return false;
+	    }
+
+	    for (size_t i = f.incomplete_mark; i < incomplete_.size(); i++) {
+	        tables_[incomplete_[i]]->status = COMPLETE;
+	    }
+	    incomplete_.resize(f.incomplete_mark);
+	    t.status = COMPLETE;
+	    frames_.pop_back();
+	    return true;
+	}
+
+	void add_answer(interpreter_base &interp, size_t id, term answer) {
+	    auto &t = *tables_[id];
+	    variant_key(interp, answer, key_);
+	    size_t &index = t.answer_trie[key_];
+	    if (index != variant_trie::NONE) {
+	        return;
+	    }
+	    index = t.answers.size();
+	    uint64_t cost = 0;
+	    t.answers.push_back(env_.copy(answer, interp, cost));
+	    interp.add_accumulated_cost(cost);
+	    answer_count_++;
+	}
+
+	term answers(interpreter_base &interp, size_t id) {
+	    auto &t = *tables_[id];
+	    term lst = interpreter_base::EMPTY_LIST;
+	    for (auto it = t.answers.rbegin(); it != t.answers.rend(); ++it) {
+	        lst = interp.new_dotted_pair(interp.copy(*it, env_), lst);
+	    }
+	    return lst;
+	}
+
+	inline bool is_table(size_t id) const {
+	    return id < tables_.size();
+	}
+
+	inline bool is_top_frame(size_t id) const {
+	    return !frames_.empty() && frames_.back().table == id;
+	}
+
+    private:
+        struct table {
+	    table() : status(INCOMPLETE), link(variant_trie::NONE),
+		      iteration(0), frame(0) { }
+	    status_t status;
+	    // For incomplete tables: the position of the frame it depends
+	    // on and its iteration when this table was evaluated.
+	    size_t link;
+	    size_t iteration;
+	    size_t frame;
+	    variant_trie answer_trie;
+	    std::vector<term> answers;
+	};
+
+        struct frame {
+	    size_t table;
+	    size_t link;
+	    size_t iteration;
+	    // Number of answers (in all tables) at the start of the
+	    // iteration
+	    size_t answers;
+	    // Set if some call consumed from this frame (or a frame that
+	    // depends on it) during the iteration
+	    bool looped;
+	    size_t incomplete_mark;
+	};
+
+        void consume(size_t pos) {
+	    frames_[pos].looped = true;
+	    auto &top = frames_.back();
+	    top.link = std::min(top.link, pos);
+	}
+
+        void variant_key(interpreter_base &interp, term t, std::vector<uint64_t> &key) {
+	    key.clear();
+	    vars_.clear();
+	    stack_.clear();
+	    stack_.push_back(t);
+	    while (!stack_.empty()) {
+	        term c = interp.deref(stack_.back());
+		stack_.pop_back();
+		switch (c.tag()) {
+		case tag_t::REF: {
+		    auto &ref = reinterpret_cast<ref_cell &>(c);
+		    auto it = vars_.find(ref.index());
+		    size_t num = vars_.size();
+		    if (it == vars_.end()) {
+		        vars_[ref.index()] = num;
+		    } else {
+		        num = it->second;
+		    }
+		    key.push_back(ref_cell(num).raw_value());
+		    break;
+		}
+		case tag_t::STR: {
+		    auto f = interp.functor(c);
+		    key.push_back(f.raw_value());
+		    for (size_t i = f.arity(); i > 0; i--) {
+		        stack_.push_back(interp.arg(c, i - 1));
+		    }
+		    break;
+		}
+		case tag_t::BIG: {
+		    auto &big = reinterpret_cast<big_cell &>(c);
+		    size_t n = (interp.num_bits(big) + 7) / 8;
+		    bytes_.resize(n);
+		    interp.get_big(c, &bytes_[0], n);
+		    key.push_back(interp.get_big_header(c).raw_value());
+		    for (size_t i = 0; i < n; i += sizeof(uint64_t)) {
+		        uint64_t w = 0;
+			for (size_t j = i; j < n && j < i + sizeof(uint64_t); j++) {
+			    w = (w << 8) | bytes_[j];
+			}
+			key.push_back(w);
+		    }
+		    break;
+		}
+		default:
+		    key.push_back(c.raw_value());
+		    break;
+		}
+	    }
+	    interp.add_accumulated_cost(key.size());
+	}
+
+        std::vector<table *> tables_;
+        variant_trie calls_;
+        std::vector<frame> frames_;
+        std::vector<size_t> incomplete_;
+        size_t iteration_count_;
+        size_t answer_count_;
+        term_env env_;
+        con_cell evaluate_, consume_, complete_;
+
+        // Scratch space for variant_key
+        std::vector<uint64_t> key_;
+        std::unordered_map<size_t, size_t> vars_;
+        std::vector<term> stack_;
+        std::vector<uint8_t> bytes_;
+    };
+
+    size_t builtins_tabling::get_table_id(interpreter_base &interp, term t,
+					  const std::string &from_fun)
+    {
+        t = interp.deref(t);
+	if (t.tag() != tag_t::INT ||
+	    !table_store::get(interp).is_table(reinterpret_cast<int_cell &>(t).value())) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      from_fun + ": Not a table; was: " + interp.to_string(t)));
+	}
+	return reinterpret_cast<int_cell &>(t).value();
+    }
+
+    //
+    // '$tbl_call'/2 looks up the table for the call variant, evaluates
+    // it if needed and returns its answers. Evaluation runs the clauses
+    // of the predicate (failure driven) adding all answers to the table
+    // until '$tbl_pop'/1 says it is done.
+    //
+    static const char *TABLING_LIB = R"PROG(
+'$tbl_call'(Goal, Impl) :-
+    '$tbl_lookup'(Goal, T, Status),
+    '$tbl_eval'(Status, T, Goal, Impl),
+    '$tbl_answers'(T, Answers),
+    '$tbl_member'(Goal, Answers).
+
+'$tbl_eval'(complete, _, _, _).
+'$tbl_eval'(consume, _, _, _).
+'$tbl_eval'(evaluate, T, Goal, Impl) :-
+    '$tbl_push'(T),
+    '$tbl_fixpoint'(T, Goal, Impl).
+
+'$tbl_fixpoint'(T, Goal, Impl) :-
+    ( call(Impl), '$tbl_add'(T, Goal), fail ; true ),
+    ( '$tbl_pop'(T) -> true ; '$tbl_fixpoint'(T, Goal, Impl) ).
+
+'$tbl_member'(X, [X|_]).
+'$tbl_member'(X, [_|Xs]) :- '$tbl_member'(X, Xs).
+)PROG";
+
+    void builtins_tabling::load_lib(interpreter_base &interp)
+    {
+        static const con_cell SYSTEM("system", 0);
+	auto *pred = interp.internal_get_predicate(
+			      qname(SYSTEM, interp.functor("$tbl_call", 2)));
+	if (pred != nullptr && !pred->empty()) {
+	    return;
+	}
+
+	std::stringstream in(TABLING_LIB);
+	term_tokenizer tok(in);
+	term_parser parser(tok, interp);
+
+	con_cell current = interp.current_module();
+	interp.set_current_module(SYSTEM);
+	while (!parser.is_eof()) {
+	    interp.load_clause(parser.parse(), LAST_CLAUSE);
+	}
+	interp.set_current_module(current);
+    }
+
+    void builtins_tabling::table_spec(interpreter_base &interp, term spec)
+    {
+        static const con_cell COMMA(",", 2);
+        static const con_cell SLASH("/", 2);
+
+        spec = interp.deref(spec);
+	if (interp.is_functor(spec, COMMA)) {
+	    table_spec(interp, interp.arg(spec, 0));
+	    table_spec(interp, interp.arg(spec, 1));
+	    return;
+	}
+	if (!interp.is_functor(spec, SLASH)) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      "table/1: Expected Name/Arity; was: "
+		      + interp.to_string(spec)));
+	}
+	term name = interp.deref(interp.arg(spec, 0));
+	term arity = interp.deref(interp.arg(spec, 1));
+	if (!interp.is_atom(name) || arity.tag() != tag_t::INT ||
+	    reinterpret_cast<int_cell &>(arity).value() < 0) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      "table/1: Expected Name/Arity; was: "
+		      + interp.to_string(spec)));
+	}
+	con_cell f = interp.functor(interp.atom_name(name),
+				    reinterpret_cast<int_cell &>(arity).value());
+	interp.set_tabled(qname(interp.current_module(), f));
+    }
+
+    bool builtins_tabling::table_1(interpreter_base &interp, size_t arity, term args[])
+    {
+        auto &store = table_store::get(interp);
+	if (store.is_evaluating()) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      "table/1: Cannot declare tables while tables are evaluated"));
+	}
+        load_lib(interp);
+        table_spec(interp, args[0]);
+	// Existing answers may depend on the previous definitions
+	store.clear();
+	return true;
+    }
+
+    bool builtins_tabling::abolish_all_tables_0(interpreter_base &interp, size_t arity, term args[])
+    {
+        auto &store = table_store::get(interp);
+	if (store.is_evaluating()) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      "abolish_all_tables/0: Cannot abolish tables while tables are evaluated"));
+	}
+	store.clear();
+	return true;
+    }
+
+    bool builtins_tabling::tbl_lookup_3(interpreter_base &interp, size_t arity, term args[])
+    {
+        con_cell what;
+        size_t id = table_store::get(interp).lookup(interp, args[0], what);
+	return interp.unify(args[1], int_cell(id)) && interp.unify(args[2], what);
+    }
+
+    bool builtins_tabling::tbl_push_1(interpreter_base &interp, size_t arity, term args[])
+    {
+        size_t id = get_table_id(interp, args[0], "$tbl_push/1");
+	table_store::get(interp).push(id);
+	return true;
+    }
+
+    bool builtins_tabling::tbl_pop_1(interpreter_base &interp, size_t arity, term args[])
+    {
+        size_t id = get_table_id(interp, args[0], "$tbl_pop/1");
+	auto &store = table_store::get(interp);
+	if (!store.is_top_frame(id)) {
+	    interp.abort(interpreter_exception_wrong_arg_type(
+		      "$tbl_pop/1: Table is not evaluated; was: "
+		      + interp.to_string(args[0])));
+	}
+	return store.pop(id);
+    }
+
+    bool builtins_tabling::tbl_add_2(interpreter_base &interp, size_t arity, term args[])
+    {
+        size_t id = get_table_id(interp, args[0], "$tbl_add/2");
+	table_store::get(interp).add_answer(interp, id, args[1]);
+	return true;
+    }
+
+    bool builtins_tabling::tbl_answers_2(interpreter_base &interp, size_t arity, term args[])
+    {
+        size_t id = get_table_id(interp, args[0], "$tbl_answers/2");
+	term lst = table_store::get(interp).answers(interp, id);
+	return interp.unify(args[1], lst);
+    }
+
+    void builtins_tabling::abort_evaluations(interpreter_base &interp)
+    {
+        static const con_cell TABLES("$tables", 0);
+        auto *store = reinterpret_cast<table_store *>(interp.get_managed_data(TABLES));
+	if (store != nullptr) {
+	    store->abort();
+	}
+    }
+
+}}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef _interp_builtins_tabling_hpp
+#define _interp_builtins_tabling_hpp
+
+#include "../common/term.hpp"
+
+namespace prologcoin { namespace interp {
+    class interpreter_base;
+
+    //
+    // Tabling (variant based.) A tabled predicate p/N (declared with
+    // ':- table p/N.') is given the single clause
+    //
+    //    p(X1,...,XN) :- '$tbl_call'(p(X1,...,XN), M:'p tabled'(X1,...,XN)).
+    //
+    // where 'p tabled'/N holds the clauses of p/N. '$tbl_call'/2
+    // (loaded into the system module by the first table/1) uses the
+    // builtins below to look up the table of the call variant, evaluate
+    // it to a fixpoint and return its answers. See table_store in
+    // builtins_tabling.cpp.
+    //
+    class builtins_tabling {
+    public:
+        static bool table_1(interpreter_base &interp, size_t arity, common::term args[]);
+        static bool abolish_all_tables_0(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool tbl_lookup_3(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool tbl_push_1(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool tbl_pop_1(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool tbl_add_2(interpreter_base &interp, size_t arity, common::term args[]);
+	static bool tbl_answers_2(interpreter_base &interp, size_t arity, common::term args[]);
+
+	// Drop evaluations in progress (e.g. when the interpreter is reset
+	// after an exception.) Answers found so far are kept.
+	static void abort_evaluations(interpreter_base &interp);
+
+    private:
+        static void load_lib(interpreter_base &interp);
+        static void table_spec(interpreter_base &interp, common::term spec);
+        static size_t get_table_id(interpreter_base &interp, common::term t,
+				   const std::string &from_fun);
+    };
+
+}}
+
+#endif
@@ -1,6 +1,11 @@
 #include "interpreter.hpp"
 #include "wam_compiler.hpp"
+#ifndef NO_STANDARD_LIB_IMAGE
+#include "standard_lib_gen.hpp"
+#endif
+#include "../common/checked_cast.hpp"
 #include <boost/range/adaptor/reversed.hpp>
+#include <exception>
 
 using namespace prologcoin::common;
 
@@ -12,10 +17,15 @@ interpreter::interpreter(const std::string &name) : wam_interpreter(name)
     query_vars_ = nullptr;
     num_instances_ = 0;
     retain_state_between_queries_ = false;
+    par_worker_ = false;
+    num_par_threads_ = std::max(boost::thread::hardware_concurrency(), 1u);
+    par_synced_generation_ = std::numeric_limits<size_t>::max();
 }
 
 void interpreter::total_reset()
 {
+    delete_par_workers();
+
     wam_interpreter::total_reset();
 
     wam_enabled_ = true;
@@ -24,14 +34,24 @@ void interpreter::total_reset()
     retain_state_between_queries_ = false;
 }
 
+void interpreter::fork(const interpreter &snapshot)
+{
+    wam_interpreter::fork(snapshot);
+
+    wam_enabled_ = snapshot.wam_enabled_;
+    retain_state_between_queries_ = snapshot.retain_state_between_queries_;
+    num_par_threads_ = snapshot.num_par_threads_;
+}
+
 interpreter::~interpreter()
 {
+    delete_par_workers();
     delete query_vars_;
 }
 
-void interpreter::setup_standard_lib()
-{
-    std::string lib = R"PROG(
+// The standard library. It is also precompiled into an image (see
+// standard_lib_gen.hpp) that is loaded instead when it is up to date.
+static const char standard_lib_source[] = R"PROG(
 
 %
 % Some standard predicates
@@ -86,8 +106,83 @@ length(Xs, N) :- '$length'(Xs,N,0).
 '$length'([], N, N) :- !.
 '$length'([_|Xs], N, I) :- I1 is I + 1, '$length'(Xs, N, I1).
 
+%
+% predsort/3
+%
+% A natural merge sort like the sort builtins: ascending runs are
+% collected and then merged pairwise. Elements comparing = are dropped.
+%
+
+predsort(P, L, Sorted) :-
+    '$predsort_runs'(L, P, Runs),
+    '$predsort_merge_all'(Runs, P, Sorted).
+
+'$predsort_runs'([], _, []).
+'$predsort_runs'([X|Xs], P, [Run|Runs]) :-
+    '$predsort_run'(Xs, X, P, Run, Rest),
+    '$predsort_runs'(Rest, P, Runs).
+
+'$predsort_run'([], X, _, [X], []).
+'$predsort_run'([Y|Ys], X, P, Run, Rest) :-
+    call(P, O, X, Y),
+    '$predsort_run'(O, X, Y, Ys, P, Run, Rest).
+
+'$predsort_run'('<', X, Y, Ys, P, [X|Run], Rest) :-
+    '$predsort_run'(Ys, Y, P, Run, Rest).
+'$predsort_run'('=', X, _, Ys, P, Run, Rest) :-
+    '$predsort_run'(Ys, X, P, Run, Rest).
+'$predsort_run'('>', X, Y, Ys, _, [X], [Y|Ys]).
+
+'$predsort_merge_all'([], _, []).
+'$predsort_merge_all'([R|Rs], P, Sorted) :-
+    '$predsort_merge_all'(Rs, R, P, Sorted).
+
+'$predsort_merge_all'([], R, _, R).
+'$predsort_merge_all'([R2|Rs], R1, P, Sorted) :-
+    '$predsort_merge_pairs'([R1,R2|Rs], P, Rs1),
+    '$predsort_merge_all'(Rs1, P, Sorted).
+
+'$predsort_merge_pairs'([], _, []).
+'$predsort_merge_pairs'([R|Rs], P, Ms) :-
+    '$predsort_merge_pairs'(Rs, R, P, Ms).
+
+'$predsort_merge_pairs'([], R, _, [R]).
+'$predsort_merge_pairs'([R2|Rs], R1, P, [M|Ms]) :-
+    '$predsort_merge'(R1, R2, P, M),
+    '$predsort_merge_pairs'(Rs, P, Ms).
+
+'$predsort_merge'([], Ys, _, Ys).
+'$predsort_merge'([X|Xs], Ys, P, Zs) :-
+    '$predsort_merge'(Ys, X, Xs, P, Zs).
+
+'$predsort_merge'([], X, Xs, _, [X|Xs]).
+'$predsort_merge'([Y|Ys], X, Xs, P, Zs) :-
+    call(P, O, X, Y),
+    '$predsort_merge'(O, X, Xs, Y, Ys, P, Zs).
+
+'$predsort_merge'('<', X, Xs, Y, Ys, P, [X|Zs]) :-
+    '$predsort_merge'(Xs, [Y|Ys], P, Zs).
+'$predsort_merge'('=', X, Xs, _, Ys, P, [X|Zs]) :-
+    '$predsort_merge'(Xs, Ys, P, Zs).
+'$predsort_merge'('>', X, Xs, Y, Ys, P, [Y|Zs]) :-
+    '$predsort_merge'(Ys, X, Xs, P, Zs).
+
 )PROG";
 
+// (FNV-1a, as the hash must be the same when the image is generated
+//  and when it is loaded.)
+static uint64_t standard_lib_hash()
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (const char *p = standard_lib_source; *p != '\0'; p++) {
+	h ^= static_cast<uint8_t>(*p);
+	h *= 0x100000001b3;
+    }
+    return h;
+}
+
+void interpreter::setup_standard_lib()
+{
     set_current_module(con_cell("system",0));
     // Check if standard library is already available
     // (This enables the client of this class to load the library in a
@@ -95,8 +190,10 @@ length(Xs, N) :- '$length'(Xs,N,0).
     //  persistent state.)
     auto &member_2 = get_predicate(con_cell("system",0), con_cell("member",2));
     if (member_2.empty()) {
-        // Nope, so load it
-        load_program(lib);
+        // Nope, so load it (the precompiled image if possible)
+        if (!load_standard_lib_image()) {
+	    load_program(standard_lib_source);
+	}
 	auto &member_2_verify = get_predicate(con_cell("system",0), con_cell("member",2));
 	assert(!member_2_verify.empty());
     }
@@ -105,12 +202,45 @@ length(Xs, N) :- '$length'(Xs,N,0).
     load_builtin(con_cell("@",2), operator_at_2);
     load_builtin(con_cell("@-",2), operator_at_silent_2);
     load_builtin(con_cell("@=",2), operator_at_parallel_2);
+    load_builtin(con_cell("par",2), interp::builtin(par_2, true));
+    load_builtin(functor("par_findall",3), interp::builtin(par_findall_3, true));
     
     compile();
     set_current_module(con_cell("user",0));
     use_module(con_cell("system",0));
 }
 
+void interpreter::enable_profiling()
+{
+    load_builtin(functor("profile_start", 0), profile_start_0);
+    load_builtin(functor("profile_stop", 0), profile_stop_0);
+    load_builtin(functor("profile_dump", 1), profile_dump_1);
+    load_builtin(functor("predicate_statistics_start", 0), predicate_statistics_start_0);
+    load_builtin(functor("predicate_statistics_stop", 0), predicate_statistics_stop_0);
+    load_builtin(functor("predicate_statistics", 2), predicate_statistics_2);
+    load_builtin(functor("predicate_statistics_dump", 1), predicate_statistics_dump_1);
+}
+
+bool interpreter::load_standard_lib_image()
+{
+#ifdef NO_STANDARD_LIB_IMAGE
+    // Only the image generator (script/make_standard_lib.cpp) is built
+    // without it.
+    return false;
+#else
+    return load_module_image(con_cell("system",0), standard_lib_hash(),
+			     standard_lib_image, sizeof(standard_lib_image));
+#endif
+}
+
+void interpreter::save_standard_lib_image(std::vector<uint8_t> &image)
+{
+    set_current_module(con_cell("system",0));
+    load_program(standard_lib_source);
+    compile();
+    save_module_image(con_cell("system",0), standard_lib_hash(), image);
+}
+
 // Save everything so interpreter state can be restored.
 struct new_instance_context : public meta_context {
     new_instance_context(interpreter_base &i, meta_fn fn)
@@ -192,6 +322,9 @@ bool interpreter::execute(const term query)
         if (!retain_state_between_queries_) {
 	    clear_all_frozen_closures();
         }
+	if (is_predicate_statistics()) {
+	    port_reset();
+	}
     }
     if (query_vars_ == nullptr) {
 	query_vars_ = new std::vector<binding>();
@@ -255,6 +388,12 @@ bool interpreter::cont()
 		    }
 		} else {
 		    dispatch();
+		    if (is_sampling()) {
+			sample_naive();
+		    }
+		}
+		if (is_predicate_statistics()) {
+		    port_step();
 		}
 	    }
 
@@ -270,6 +409,9 @@ bool interpreter::cont()
 	set_register_hb(b());
 	tidy_trail();
     } catch (std::runtime_error &) {
+	if (is_predicate_statistics()) {
+	    port_reset();
+	}
         reset();
 	throw;
     }
@@ -350,6 +492,10 @@ void interpreter::fail()
   	    std::cout << "interpreter::fail(): fail " << to_string(qr()) << "\n";
 	}
 
+        if (is_predicate_statistics() && (b() == top_b() || !b_is_wam())) {
+	    // (Otherwise it's counted by backtrack_wam())
+	    port_backtrack(b());
+	}
         if (b() == top_b()) {
 	    set_top_fail(true);
 	    ok = true;
@@ -372,8 +518,8 @@ void interpreter::fail()
 	        ok = bp.bn()(*this, ch->arity, args());	      
 	    } else if (bp.term_code().tag() != common::tag_t::INT) {
 	        // Direct query
-	        static managed_clauses empty_clauses;
-	        ok = select_clause(bp, 0, empty_clauses, 0);
+	        static clause_list empty_clauses;
+	        ok = select_clause(bp, 0, empty_clauses, 0, 0, true);
 	    } else {
 		auto bpterm = bp.term_code();
 		size_t bpval = reinterpret_cast<const int_cell &>(bpterm).value();
@@ -382,14 +528,17 @@ void interpreter::fail()
 		    size_t pred_id = bpval >> 32;
 		    
 		    auto &pred = get_predicate(pred_id);
-		    auto first_arg = get_first_arg(qr());
 		    if (is_debug()) {
 			std::string redo_str = to_string(qr());
-			std::cout << "interpreter::fail(): redo " << redo_str << " (first_arg=" << to_string(first_arg) << ")" << std::endl;
+			std::cout << "interpreter::fail(): redo " << redo_str << std::endl;
 		    }
-		    auto &clauses = pred.get_clauses(*this, first_arg);
-		    size_t from_clause = bpval & 0xffffffff;
-		    ok = select_clause(code_point(qr()), pred_id, clauses, from_clause);
+		    // Arguments have been restored from the choice point.
+		    // The clauses may have changed since dispatch(), but
+		    // the list we get still has every clause that was
+		    // visible then (in clause order.)
+		    auto &clauses = pred.get_clauses(*this, num_of_args(), args());
+		    size_t from_clause = clauses.lower_bound(ch->ord);
+		    ok = select_clause(code_point(qr()), pred_id, clauses, ch->gen, from_clause, true);
 		}
 	    }
 	    if (!ok) {
@@ -480,8 +629,10 @@ bool interpreter::can_unify_args(term head, const code_point &p)
 
 bool interpreter::select_clause(const code_point &instruction,
 				size_t predicate_id,
-				const managed_clauses &clauses,
-				size_t from_clause)
+				const clause_list &clauses,
+				size_t gen,
+				size_t from_clause,
+				bool has_choices)
 {
     if (is_debug()) {
 	std::cout << "select clause predicate_id=" << predicate_id << " predicate=" << to_string(get_predicate(predicate_id).qualified_name()) << " from=" << from_clause << "\n";
@@ -497,7 +648,6 @@ bool interpreter::select_clause(const code_point &instruction,
     }
 
     size_t num_clauses = clauses.size();
-    bool has_choices = num_clauses > 1;
 
     if (is_debug()) {
         std::cout << "select clause: num_clauses=" << num_clauses << ": match with=" << to_string(instruction.term_code()) << "\n";
@@ -510,6 +660,11 @@ bool interpreter::select_clause(const code_point &instruction,
     for (size_t i = from_clause; i < num_clauses; i++) {
         auto &m_clause = clauses[i];
 
+	// Asserted after or retracted before this call was made?
+	if (!m_clause.is_visible(gen)) {
+	    continue;
+	}
+
 	// Avoid copying if it does not match
 	if (!can_unify_args(clause_head(m_clause.clause()),
 			    code_point(instruction.term_code()))) {
@@ -517,9 +672,7 @@ bool interpreter::select_clause(const code_point &instruction,
 	}
 	
 	size_t current_heap = heap_size();
-	// No need to copy the names when instantiating a new clause from
-	// the program database, as it's the caller's names that matter.
-	auto copy_clause = copy_without_names(m_clause.clause()); // Instantiate it
+	auto copy_clause = instantiate_clause(m_clause);
 
 	term copy_head = clause_head(copy_clause);
 	term copy_body = clause_body(copy_clause);
@@ -528,12 +681,16 @@ bool interpreter::select_clause(const code_point &instruction,
 	    // Update choice point (where to continue on fail...)
 	    if (has_choices) {
 	        auto choice_point = b();
-		if (i == num_clauses - 1) {
+		size_t next = i + 1;
+		while (next < num_clauses && !clauses[next].is_visible(gen)) {
+		    next++;
+		}
+		if (next == num_clauses) {
 		    // If we are at the last clause, then we can remove the choice point.
 		    choice_point->bp = code_point::fail();
 		    interpreter_base::cut();
 		} else {
-		    choice_point->bp = code_point(int_cell((predicate_id << 32) + (i+1)));
+		    choice_point->ord = clauses[next].ordinal();
 		}
 	    }
 
@@ -562,10 +719,97 @@ bool interpreter::select_clause(const code_point &instruction,
     return false;
 }
 
+term interpreter::instantiate_clause(const managed_clause &m_clause)
+{
+    // The first time a clause is executed it is stored as cells that
+    // can be copied to the heap as they are (with relative addresses),
+    // so its control constructs and goals are not copied term by term
+    // (with a variable map) each time.
+    // The first instance is still copied term by term, which gives the
+    // cost to charge for every later instance.
+    auto *cells = m_clause.cells();
+    if (cells == nullptr) {
+	uint64_t cost = 0;
+	term t = common::term_env::copy_without_names(m_clause.clause(), cost);
+	std::shared_ptr<managed_clause::cells_t> new_cells(new managed_clause::cells_t());
+	if (!clause_cells(m_clause.clause(), *new_cells)) {
+	    new_cells->clear();
+	}
+	m_clause.set_cells(new_cells, cost);
+	add_accumulated_cost(cost);
+	return t;
+    }
+    if (cells->empty()) {
+	// No need to copy the names when instantiating a new clause from
+	// the program database, as it's the caller's names that matter.
+	return copy_without_names(m_clause.clause());
+    }
+    size_t index = get_heap().new_relocated_cells(&(*cells)[0], cells->size());
+    add_accumulated_cost(m_clause.cells_cost());
+    return heap_get(index);
+}
+
+bool interpreter::clause_cells(term clause, managed_clause::cells_t &cells)
+{
+    // The cells are laid out depth first like new_str() does it: a
+    // STR cell refers to the functor cell followed by the arguments,
+    // and the first occurrence of a variable refers to itself and the
+    // other ones to the first.
+    std::unordered_map<size_t, size_t> vars;
+    std::vector<std::pair<term, size_t> > todo;
+
+    cells.push_back(term());
+    todo.push_back(std::make_pair(clause, 0));
+    while (!todo.empty()) {
+	term t = deref(todo.back().first);
+	size_t at = todo.back().second;
+	todo.pop_back();
+	switch (t.tag()) {
+	case tag_t::REF: {
+	    size_t index = reinterpret_cast<ref_cell &>(t).index();
+	    auto it = vars.find(index);
+	    if (it == vars.end()) {
+		vars[index] = at;
+		cells[at] = ref_cell(at);
+	    } else {
+		cells[at] = ref_cell(it->second);
+	    }
+	    break;
+	    }
+	case tag_t::CON:
+	case tag_t::INT:
+	    cells[at] = t;
+	    break;
+	case tag_t::STR: {
+	    con_cell f = functor(t);
+	    size_t arity = f.arity();
+	    size_t index = cells.size();
+	    // (This also stops at cyclic terms.)
+	    if (index + 1 + arity > heap_block::MAX_SIZE) {
+		return false;
+	    }
+	    cells[at] = str_cell(index);
+	    cells.push_back(f);
+	    cells.resize(index + 1 + arity);
+	    for (size_t i = arity; i > 0; i--) {
+		todo.push_back(std::make_pair(arg(t, i - 1), index + i));
+	    }
+	    break;
+	    }
+	default:
+	    // E.g. bignums and attributed variables
+	    return false;
+	}
+    }
+    return true;
+}
+
 void interpreter::dispatch()
 {
     static const con_cell functor_colon(":",2);
 
+    check_gc();
+
     set_qr(p().term_code());
 
     con_cell f = functor(qr());
@@ -692,14 +936,24 @@ void interpreter::dispatch()
         }
 	if (code.has_wam_code()) {
 	    dispatch_wam(code.wam_code());
+	    if (is_predicate_statistics()) {
+		port_call(get_segment(code.wam_code()).qn, cp(), e0(), b());
+	    }
 	    return;
 	}
     }
 
-    auto first_arg = get_first_arg();
     const predicate &pred = get_predicate(module, f);
 
     if (pred.empty()) {
+	if (pred.is_dynamic()) {
+	    // All its clauses have been retracted
+	    if (is_predicate_statistics()) {
+		port_call_fail(qn);
+	    }
+	    fail();
+	    return;
+	}
         std::stringstream msg;
 	msg << "Undefined predicate ";
 	if (module != USER_MODULE) {
@@ -714,23 +968,33 @@ void interpreter::dispatch()
     set_pr(f);
 
     // Otherwise a vector of clauses
-    auto &clauses = pred.get_clauses(*this, first_arg);
+    auto &clauses = pred.get_clauses(*this, num_of_args(), args());
 
     set_b0(b());
+    auto *b_call = b();
 
-    size_t num_clauses = clauses.size();
-    bool has_choices = num_clauses > 1;
+    size_t first_clause = clauses.skip_erased();
+    bool has_choices = clauses.size() - first_clause > 1;
     size_t pred_id = pred.id();
+    size_t gen = pred.generation();
 
     // More than one clause that matches? We need a choice point.
     if (has_choices) {
         int_cell index_id_int(static_cast<int64_t>(pred_id) << 32);
 	code_point ch(index_id_int);
 	allocate_choice_point(ch);
+	b()->gen = gen;
     }
 
-    if (!select_clause(code_point(p().term_code()), pred_id, clauses, 0)) {
+    if (!select_clause(code_point(p().term_code()), pred_id, clauses, gen, first_clause, has_choices)) {
+	if (is_predicate_statistics()) {
+	    port_call_fail(qn);
+	}
 	fail();
+    } else if (is_predicate_statistics()) {
+	// The clause environment has the continuation (which is the
+	// caller's, if its environment was reused for the call.)
+	port_call(qn, ee()->cp, ee()->ce.ce0(), b_call);
     }
 }
 
@@ -816,6 +1080,142 @@ bool interpreter::compile_0(interpreter_base &interp0, size_t arity, common::ter
     return true;
 }
 
+bool interpreter::profile_start_0(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.clear_samples();
+    interp.start_sampling();
+    return true;
+}
+
+bool interpreter::profile_stop_0(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.stop_sampling();
+    return true;
+}
+
+bool interpreter::profile_dump_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    std::string filename;
+
+    if (interp.is_atom(args[0])) {
+        filename = interp.atom_name(args[0]);
+    } else if (interp.is_string(args[0])) {
+        filename = interp.list_to_string(args[0]);
+    } else {
+        throw interpreter_exception_wrong_arg_type("Atom or string expected; was " + interp.to_string(args[0]));
+    }
+
+    std::ofstream outfile(interp.get_full_path(filename));
+    if (!outfile.good()) {
+	throw interpreter_exception_file_not_found("Couldn't open file '" + filename + "'");
+    }
+    interp.print_samples(outfile);
+    return true;
+}
+
+bool interpreter::predicate_statistics_start_0(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.start_predicate_statistics();
+    return true;
+}
+
+bool interpreter::predicate_statistics_stop_0(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+    interp.stop_predicate_statistics();
+    return true;
+}
+
+//
+// predicate_statistics(+PI, -Stats): PI is Name/Arity or
+// Module:Name/Arity (without module we look in the current module and
+// then in system.) Fails if the predicate hasn't been called.
+//
+bool interpreter::predicate_statistics_2(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    static const con_cell COLON(":", 2);
+    static const con_cell SLASH("/", 2);
+
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    term pi = args[0];
+    con_cell module = interp.current_module();
+    bool has_module = false;
+    if (interp.is_functor(pi, COLON)) {
+	term m = interp.arg(pi, 0);
+	if (!interp.is_atom(m)) {
+	    throw interpreter_exception_wrong_arg_type("predicate_statistics/2: Module must be an atom; was " + interp.to_string(m));
+	}
+	module = interp.functor(m);
+	has_module = true;
+	pi = interp.arg(pi, 1);
+    }
+    if (!interp.is_functor(pi, SLASH) || !interp.is_atom(interp.arg(pi, 0))
+	|| interp.arg(pi, 1).tag() != common::tag_t::INT) {
+	throw interpreter_exception_wrong_arg_type("predicate_statistics/2: Name/Arity expected; was " + interp.to_string(args[0]));
+    }
+    auto name = interp.atom_name(interp.arg(pi, 0));
+    term n_term = interp.arg(pi, 1);
+    auto n = reinterpret_cast<const int_cell &>(n_term).value();
+    if (n < 0) {
+	throw interpreter_exception_wrong_arg_type("predicate_statistics/2: Arity must be non-negative; was " + boost::lexical_cast<std::string>(n));
+    }
+    con_cell f = interp.functor(name, static_cast<size_t>(n));
+
+    auto *st = interp.get_predicate_statistics(qname(module, f));
+    if (st == nullptr && !has_module) {
+	st = interp.get_predicate_statistics(qname(con_cell("system",0), f));
+    }
+    if (st == nullptr) {
+	return false;
+    }
+
+    term lst = interp.EMPTY_LIST;
+    auto push_it = [&](const std::string &key, uint64_t val) {
+	auto k = interp.functor(key, 1);
+	term v = int_cell(checked_cast<int64_t>(val));
+	lst = interp.new_dotted_pair( interp.new_term(k, { v }), lst);
+    };
+
+    push_it( "exclusive_time", st->exclusive_time / 1000);
+    push_it( "inclusive_time", st->inclusive_time / 1000);
+    push_it( "exclusive_cost", st->exclusive_cost);
+    push_it( "inclusive_cost", st->inclusive_cost);
+    push_it( "redos", st->redos);
+    push_it( "fails", st->fails);
+    push_it( "exits", st->exits);
+    push_it( "calls", st->calls);
+
+    return interp.unify(args[1], lst);
+}
+
+bool interpreter::predicate_statistics_dump_1(interpreter_base &interp0, size_t arity, common::term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    std::string filename;
+
+    if (interp.is_atom(args[0])) {
+        filename = interp.atom_name(args[0]);
+    } else if (interp.is_string(args[0])) {
+        filename = interp.list_to_string(args[0]);
+    } else {
+        throw interpreter_exception_wrong_arg_type("Atom or string expected; was " + interp.to_string(args[0]));
+    }
+
+    std::ofstream outfile(interp.get_full_path(filename));
+    if (!outfile.good()) {
+	throw interpreter_exception_file_not_found("Couldn't open file '" + filename + "'");
+    }
+    interp.print_predicate_statistics(outfile);
+    return true;
+}
+
 bool interpreter::consult_1(interpreter_base &interp0, size_t arity, common::term args[])
 {
     using namespace prologcoin::common;
@@ -1056,5 +1456,685 @@ bool interpreter::delete_instance_at(term_env &query_src, const std::string &whe
     interp->delete_instance();
     return true;
 }
+
+//
+// par/2
+//
+// par(G1, G2) executes G1 and G2 in parallel (nested par/2 terms are
+// flattened, so par(G1, par(G2, G3)) runs three goals.) It succeeds
+// at most once, i.e. it behaves as once((G1, G2)). The goals are
+// executed in parallel only if they are independent, i.e. they don't
+// share any unbound variables; otherwise they are executed in
+// sequence like the conjunction.
+//
+// Each goal is copied to a worker interpreter (with its own heap and
+// stacks), executed, and the result is copied back and unified with
+// the goal. The cost of the workers (and the copying) is added to
+// our accumulated cost. Workers execute par/2 in sequence, so
+// parallelism is only exploited at the top level.
+//
+
+bool interpreter::par_2(interpreter_base &interp0, size_t arity, term args[])
+{
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    std::vector<term> goals;
+    interp.par_goals(args[0], goals);
+    interp.par_goals(args[1], goals);
+
+    for (auto goal : goals) {
+	if (goal.tag() != tag_t::STR && goal.tag() != tag_t::CON) {
+	    std::stringstream msg;
+	    msg << "par/2: Goals must be callable; was " << interp.to_string(goal);
+	    interp.abort(interpreter_exception_wrong_arg_type(msg.str()));
+	}
+    }
+
+    if (interp.par_worker_ || !interp.par_independent(goals)) {
+	return interp.par_sequential(goals);
+    }
+
+    return interp.par_execute(goals);
+}
+
+void interpreter::par_goals(term t, std::vector<term> &goals)
+{
+    static const con_cell PAR("par", 2);
+
+    t = deref(t);
+    while (t.tag() == tag_t::STR && functor(t) == PAR) {
+	par_goals(arg(t, 0), goals);
+	t = deref(arg(t, 1));
+    }
+    goals.push_back(t);
+}
+
+bool interpreter::par_independent(const std::vector<term> &goals)
+{
+    std::unordered_set<term> seen;
+    std::vector<term> vars;
+
+    for (auto goal : goals) {
+	vars.clear();
+	for (auto it = begin(goal); it != end(goal); ++it) {
+	    term t = *it;
+	    if (t.tag().is_ref()) {
+		t = reinterpret_cast<ref_cell &>(t).unwatch();
+		if (seen.count(t)) {
+		    return false;
+		}
+		vars.push_back(t);
+	    }
+	}
+	seen.insert(vars.begin(), vars.end());
+    }
+    return true;
+}
+
+bool interpreter::par_sequential(const std::vector<term> &goals)
+{
+    static const con_cell COMMA(",", 2);
+    static const con_cell ARROW("->", 2);
+    static const con_cell TRUE("true", 0);
+
+    term conj = goals.back();
+    for (size_t i = goals.size() - 1; i > 0; i--) {
+	conj = new_term(COMMA, {goals[i-1], conj});
+    }
+    par_continue(new_term(ARROW, {conj, TRUE}));
+    return true;
+}
+
+void interpreter::par_continue(term goal)
+{
+    // Like call/1 (as we're a recursive builtin)
+    allocate_environment<ENV_NAIVE>();
+    set_p(code_point(goal));
+    set_cp(code_point(interpreter_base::EMPTY_LIST));
+}
+
+bool interpreter::par_execute(const std::vector<term> &goals)
+{
+    static const con_cell TRUE("true", 0);
+
+    struct par_job {
+	interpreter *interp;
+	size_t heap_mark;
+	term goal;
+	bool ok;
+	std::exception_ptr error;
+    };
+
+    size_t n = goals.size();
+    ensure_par_workers(n);
+    ensure_local_workers(n - 1);
+
+    // Everything is copied in this thread; the workers only touch
+    // their own heaps. The goals run at the same time, so the remaining
+    // budget is split evenly between them (a goal may thus run out of
+    // funds where the sequential conjunction wouldn't, but together
+    // they never spend more than the budget.)
+    uint64_t cost = 0;
+    uint64_t budget = maximum_cost() > accumulated_cost()
+	            ? maximum_cost() - accumulated_cost() : 0;
+    budget /= n;
+    std::vector<par_job> jobs(n);
+    for (size_t i = 0; i < n; i++) {
+	auto &job = jobs[i];
+	job.interp = par_workers_[i];
+	job.heap_mark = job.interp->heap_size();
+	uint64_t copy_cost = 0;
+	job.goal = job.interp->term_env::copy(goals[i], *this, copy_cost);
+	cost += copy_cost;
+	job.ok = false;
+	job.interp->set_maximum_cost(budget);
+    }
+
+    auto run_job = [](par_job &job) {
+	try {
+	    job.ok = job.interp->execute(job.goal);
+	} catch (...) {
+	    job.error = std::current_exception();
+	}
+    };
+
+    boost::mutex lock;
+    boost::condition_variable done;
+    size_t pending = n - 1;
+    for (size_t i = 1; i < n; i++) {
+	auto &job = jobs[i];
+	local_service_.add([&job, &run_job, &lock, &done, &pending]() {
+	    run_job(job);
+	    boost::lock_guard<boost::mutex> lockit(lock);
+	    if (--pending == 0) {
+		done.notify_one();
+	    }
+	});
+    }
+    run_job(jobs[0]);
+    {
+	boost::unique_lock<boost::mutex> lockit(lock);
+	while (pending > 0) {
+	    done.wait(lockit);
+	}
+    }
+
+    bool ok = true;
+    std::exception_ptr error;
+    for (auto &job : jobs) {
+	cost += job.interp->accumulated_cost();
+	if (job.error && !error) {
+	    error = job.error;
+	}
+	ok = ok && job.ok;
+    }
+
+    std::vector<term> results;
+    if (ok && !error) {
+	for (auto &job : jobs) {
+	    uint64_t copy_cost = 0;
+	    results.push_back(term_env::copy(job.goal, *job.interp, copy_cost));
+	    cost += copy_cost;
+	}
+    }
+
+    for (auto &job : jobs) {
+	job.interp->reset();
+	job.interp->trim_heap_safe(job.heap_mark);
+    }
+
+    // (What the workers spent is charged even if one failed.)
+    add_accumulated_cost(cost);
+
+    if (error) {
+	std::rethrow_exception(error);
+    }
+
+    if (!ok) {
+	return false;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	if (!unify(goals[i], results[i])) {
+	    return false;
+	}
+    }
+
+    par_continue(TRUE);
+    return true;
+}
+
+//
+// par_findall/3
+//
+// par_findall(T, G, L) is findall(T, G, L) where the alternatives of
+// the first choice point are split across (at most num_par_threads())
+// worker interpreters. To find the choice point, G is unfolded as long
+// as the first goal has a single candidate clause. The worker threads
+// take the next unprocessed alternative until there are none left (so
+// a thread that is done with a cheap alternative takes more work) and
+// the answers are merged in the order of the alternatives, i.e. in the
+// same order as findall/3. If a goal can't be split (it is a builtin,
+// a control construct or a cut is involved) we fall back to findall/3.
+//
+
+bool interpreter::par_findall_3(interpreter_base &interp0, size_t arity, term args[])
+{
+    static const con_cell FINDALL("findall", 3);
+    static const con_cell TRUE("true", 0);
+
+    auto &interp = reinterpret_cast<interpreter &>(interp0);
+
+    term tmpl, goal, rest;
+    std::vector<term> alts;
+    if (interp.par_worker_ ||
+	!interp.par_split(args[0], args[1], tmpl, goal, rest, alts)) {
+	interp.par_continue(interp.new_term(FINDALL, {args[0], args[1], args[2]}));
+	return true;
+    }
+
+    if (alts.empty()) {
+	if (!interp.unify(args[2], EMPTY_LIST)) {
+	    return false;
+	}
+	interp.par_continue(TRUE);
+	return true;
+    }
+
+    return interp.par_findall_execute(tmpl, goal, rest, alts, args[2]);
+}
+
+bool interpreter::par_split(term tmpl0, term goal0, term &tmpl, term &goal,
+			    term &rest, std::vector<term> &alts)
+{
+    static const con_cell COMMA(",", 2);
+    static const con_cell TRUE("true", 0);
+    static const size_t MAX_UNFOLD = 16;
+
+    // Unfold a copy, so the caller's variables remain unbound
+    term t = copy(new_term(COMMA, {tmpl0, goal0}));
+    tmpl = arg(t, 0);
+
+    std::vector<term> goals;  // In reverse order (next goal is last)
+    goals.push_back(arg(t, 1));
+
+    size_t num_unfolded = 0;
+    while (!goals.empty()) {
+	term g = deref(goals.back());
+	goals.pop_back();
+	if (g.tag() != tag_t::STR && g.tag() != tag_t::CON) {
+	    return false;
+	}
+	if (g == TRUE) {
+	    continue;
+	}
+	con_cell f = functor(g);
+	if (f == COMMA) {
+	    goals.push_back(arg(g, 1));
+	    goals.push_back(arg(g, 0));
+	    continue;
+	}
+
+	qname qn(current_module(), f);
+	if (get_code(qn).is_builtin()) {
+	    return false;
+	}
+	auto *pred = internal_get_predicate(qn);
+	if (pred == nullptr || pred->empty()) {
+	    return false;
+	}
+
+	size_t arity = f.arity();
+	term args[interpreter_base::MAX_ARGS];
+	for (size_t i = 0; i < arity; i++) {
+	    args[i] = deref(arg(g, i));
+	}
+	std::vector<term> cands;
+	auto &clauses = pred->get_clauses(*this, arity, args);
+	for (size_t i = 0; i < clauses.size(); i++) {
+	    auto &c = clauses[i];
+	    if (c.is_erased()) {
+		continue;
+	    }
+	    if (par_has_cut(clause_body(c.clause()))) {
+		return false;
+	    }
+	    cands.push_back(c.clause());
+	}
+
+	if (cands.size() == 1) {
+	    if (++num_unfolded > MAX_UNFOLD) {
+		return false;
+	    }
+	    term c = copy(cands[0]);
+	    if (!unify(clause_head(c), g)) {
+		// No solutions
+		alts.clear();
+		return true;
+	    }
+	    term body = clause_body(c);
+	    if (body != EMPTY_LIST) {
+		goals.push_back(body);
+	    }
+	    continue;
+	}
+
+	// The first choice point (or no solutions if there are no
+	// candidates.)
+	goal = g;
+	rest = TRUE;
+	for (auto g1 : goals) {
+	    rest = (rest == TRUE) ? g1 : new_term(COMMA, {g1, rest});
+	}
+	alts = cands;
+	return true;
+    }
+
+    // A single solution; nothing to split
+    return false;
+}
+
+bool interpreter::par_has_cut(term body)
+{
+    static const con_cell CUT("!", 0);
+    static const con_cell COMMA(",", 2);
+    static const con_cell SEMICOLON(";", 2);
+    static const con_cell ARROW("->", 2);
+
+    body = deref(body);
+    if (body == CUT) {
+	return true;
+    }
+    if (body.tag() != tag_t::STR) {
+	return false;
+    }
+    auto f = functor(body);
+    if (f == COMMA || f == SEMICOLON || f == ARROW) {
+	return par_has_cut(arg(body, 0)) || par_has_cut(arg(body, 1));
+    }
+    return false;
+}
+
+bool interpreter::par_findall_execute(term tmpl, term goal, term rest,
+				      const std::vector<term> &alts,
+				      term result)
+{
+    static const con_cell COMMA(",", 2);
+    static const con_cell EQUALS("=", 2);
+    static const con_cell FINDALL("findall", 3);
+    static const con_cell TRUE("true", 0);
+
+    struct par_thread {
+	interpreter *interp;
+	size_t heap_mark;
+	term tmpl, goal, rest;
+	std::vector<term> alts;
+	uint64_t cost;
+	std::exception_ptr error;
+    };
+
+    struct par_answers {
+	interpreter *interp;
+	term list;
+    };
+
+    size_t k = alts.size();
+    size_t n = std::min(num_par_threads_, k);
+    ensure_par_workers(n);
+    ensure_local_workers(n - 1);
+
+    // Each thread (worker) gets its own copy of the goal and all the
+    // alternatives (they are copied in this thread.)
+    term alts_list = EMPTY_LIST;
+    for (size_t i = k; i > 0; i--) {
+	alts_list = new_dotted_pair(alts[i-1], alts_list);
+    }
+    term all = new_term(functor("$par_findall", 4), {tmpl, goal, rest, alts_list});
+
+    uint64_t cost = 0;
+    uint64_t budget = maximum_cost() > accumulated_cost()
+	            ? maximum_cost() - accumulated_cost() : 0;
+    std::vector<par_thread> threads(n);
+    for (size_t i = 0; i < n; i++) {
+	auto &th = threads[i];
+	auto &w = *par_workers_[i];
+	th.interp = &w;
+	th.heap_mark = w.heap_size();
+	uint64_t copy_cost = 0;
+	term c = w.term_env::copy(all, *this, copy_cost);
+	cost += copy_cost;
+	th.tmpl = w.arg(c, 0);
+	th.goal = w.arg(c, 1);
+	th.rest = w.arg(c, 2);
+	for (auto alt : list_iterator(w, w.arg(c, 3))) {
+	    th.alts.push_back(alt);
+	}
+	th.cost = 0;
+    }
+
+    // The threads run at the same time, so what is left of the budget
+    // (after the copying) is split evenly between them, as in
+    // par_execute. A thread's alternatives may spend what is left of
+    // its share when they start, so together they never spend more
+    // than the budget.
+    uint64_t share = (budget > cost ? budget - cost : 0) / n;
+    std::vector<par_answers> answers(k);
+    boost::atomic<size_t> next(0);
+
+    auto run_thread = [&answers, &next, share, k](par_thread &th) {
+	auto &w = *th.interp;
+	for (size_t i = next++; i < k; i = next++) {
+	    w.set_maximum_cost(th.cost < share ? share - th.cost : 0);
+	    term c = th.alts[i];
+	    term body = w.clause_body(c);
+	    if (body == EMPTY_LIST) {
+		body = TRUE;
+	    }
+	    term g = w.new_term(COMMA, {w.new_term(EQUALS, {th.goal, w.clause_head(c)}),
+					w.new_term(COMMA, {body, th.rest})});
+	    term list = w.new_ref();
+	    try {
+		w.execute(w.new_term(FINDALL, {th.tmpl, g, list}));
+		th.cost += w.accumulated_cost();
+	    } catch (...) {
+		th.error = std::current_exception();
+		th.cost += w.accumulated_cost();
+		next = k;
+		return;
+	    }
+	    answers[i].interp = &w;
+	    answers[i].list = list;
+	}
+    };
+
+    boost::mutex lock;
+    boost::condition_variable done;
+    size_t pending = n - 1;
+    for (size_t i = 1; i < n; i++) {
+	auto &th = threads[i];
+	local_service_.add([&th, &run_thread, &lock, &done, &pending]() {
+	    run_thread(th);
+	    boost::lock_guard<boost::mutex> lockit(lock);
+	    if (--pending == 0) {
+		done.notify_one();
+	    }
+	});
+    }
+    run_thread(threads[0]);
+    {
+	boost::unique_lock<boost::mutex> lockit(lock);
+	while (pending > 0) {
+	    done.wait(lockit);
+	}
+    }
+
+    std::exception_ptr error;
+    for (auto &th : threads) {
+	cost += th.cost;
+	if (th.error && !error) {
+	    error = th.error;
+	}
+    }
+
+    // Merge the answers in the order of the alternatives
+    std::vector<term> elems;
+    if (!error) {
+	for (auto &a : answers) {
+	    uint64_t copy_cost = 0;
+	    term list = term_env::copy(a.list, *a.interp, copy_cost);
+	    cost += copy_cost;
+	    for (auto elem : list_iterator(*this, list)) {
+		elems.push_back(elem);
+	    }
+	}
+    }
+
+    for (auto &th : threads) {
+	th.interp->reset();
+	th.interp->trim_heap_safe(th.heap_mark);
+    }
+
+    add_accumulated_cost(cost);
+
+    if (error) {
+	std::rethrow_exception(error);
+    }
+
+    term out = EMPTY_LIST;
+    for (size_t i = elems.size(); i > 0; i--) {
+	out = new_dotted_pair(elems[i-1], out);
+    }
+    if (!unify(result, out)) {
+	return false;
+    }
+
+    par_continue(TRUE);
+    return true;
+}
+
+void interpreter::ensure_par_workers(size_t n)
+{
+    static const con_cell SECRET("$secret", 0);
+
+    // Find the predicates that have changed since the last call (if
+    // the program has changed at all.)
+    std::vector<qname> changed;
+    if (par_synced_generation_ != program_generation()) {
+	for (auto &qn : get_predicates()) {
+	    if (qn.first == SECRET) {
+		continue;
+	    }
+	    auto *pred = internal_get_predicate(qn);
+	    if (pred == nullptr) {
+		continue;
+	    }
+	    std::vector<term> clauses;
+	    for (auto &c : pred->clauses()) {
+		if (!c.is_erased()) {
+		    clauses.push_back(c.clause());
+		}
+	    }
+	    auto &synced = par_synced_[qn];
+	    if (synced != clauses) {
+		synced.swap(clauses);
+		changed.push_back(qn);
+	    }
+	}
+	par_synced_generation_ = program_generation();
+    }
+
+    // Only a new worker (or one in the other mode) needs everything
+    std::vector<qname> all;
+    auto get_all = [this, &all]() -> const std::vector<qname> & {
+	if (all.empty()) {
+	    for (auto &p : par_synced_) {
+		all.push_back(p.first);
+	    }
+	}
+	return all;
+    };
+
+    // (A worker that runs in another mode, WAM or not, gets everything
+    //  so that it is compiled.)
+    for (auto *w : par_workers_) {
+	if (w->is_wam_enabled() != is_wam_enabled()) {
+	    par_sync_worker(*w, get_all());
+	} else if (!changed.empty()) {
+	    par_sync_worker(*w, changed);
+	}
+    }
+
+    while (par_workers_.size() < n) {
+	auto *w = new interpreter("par");
+	w->par_worker_ = true;
+	w->enable_file_io();
+	w->setup_standard_lib();
+	w->set_current_directory(get_current_directory());
+	par_sync_worker(*w, get_all());
+	par_workers_.push_back(w);
+    }
+
+    for (auto *w : par_workers_) {
+	w->set_current_module(par_map(*w, current_module()));
+    }
+}
+
+void interpreter::par_sync_worker(interpreter &w, const std::vector<qname> &qns)
+{
+    w.set_wam_enabled(is_wam_enabled());
+
+    std::vector<std::pair<qname, qname> > imports;
+    for (auto &qn : qns) {
+	par_copy_predicate(w, qn, imports);
+    }
+    par_copy_module_state(w);
+
+    if (w.is_wam_enabled() && w.has_updated_predicates()) {
+	w.compile();
+    }
+
+    // The worker's own imports of the copied predicates may refer
+    // to old (WAM) code, so make them refer to the new code.
+    for (auto &imp : imports) {
+	w.set_code(imp.first, w.get_code(imp.second));
+    }
+}
+
+void interpreter::par_copy_predicate(interpreter &w, const qname &qn,
+				     std::vector<std::pair<qname, qname> > &imports)
+{
+    qname wqn(par_map(w, qn.first), par_map(w, qn.second));
+
+    auto old_cp = w.get_code(wqn);
+    if (!old_cp.is_fail()) {
+	for (auto &p : w.code_db_) {
+	    auto &cp = p.second;
+	    if (p.first != wqn && p.first.second == wqn.second &&
+		cp.module() == old_cp.module() &&
+		cp.term_code() == old_cp.term_code() &&
+		cp.wam_code() == old_cp.wam_code()) {
+		imports.push_back(std::make_pair(p.first, wqn));
+	    }
+	}
+    }
+
+    auto &wpred = w.get_predicate(wqn);
+    w.updated_predicate_pre(wqn);
+    wpred.clear();
+    w.internal_updated_predicate_post(wqn);
+
+    auto *pred = internal_get_predicate(qn);
+    if (pred == nullptr) {
+	return;
+    }
+    for (auto &c : pred->clauses()) {
+	if (c.is_erased()) {
+	    continue;
+	}
+	uint64_t cost = 0;
+	w.add_clause(wqn, w.term_env::copy(c.clause(), *this, cost), LAST_CLAUSE);
+    }
+}
+
+void interpreter::par_copy_module_state(interpreter &w)
+{
+    for (auto &qn : tabled_predicates_) {
+	w.tabled_predicates_.insert(qname(par_map(w, qn.first),
+					  par_map(w, qn.second)));
+    }
+
+    // Imported predicates (code points referring to another module)
+    for (auto &p : code_db_) {
+	auto &qn = p.first;
+	auto &cp = p.second;
+	if (cp.is_fail() || cp.is_builtin() || cp.has_wam_code() ||
+	    cp.module() == qn.first) {
+	    continue;
+	}
+	qname wqn(par_map(w, qn.first), par_map(w, qn.second));
+	if (w.get_code(wqn).is_fail()) {
+	    w.set_code(wqn, code_point(par_map(w, cp.module()),
+				       par_map(w, cp.name())));
+	}
+    }
+}
+
+con_cell interpreter::par_map(interpreter &w, con_cell c)
+{
+    if (c.is_direct()) {
+	return c;
+    }
+    return w.functor(atom_name(c), c.arity());
+}
+
+void interpreter::delete_par_workers()
+{
+    for (auto *w : par_workers_) {
+	delete w;
+    }
+    par_workers_.clear();
+    par_synced_.clear();
+    par_synced_generation_ = std::numeric_limits<size_t>::max();
+}
     
 }}
@@ -275,8 +275,29 @@ public:
 
     void total_reset();
 
+    // Make this (new) interpreter a fork of 'snapshot' (see
+    // wam_interpreter::snapshot()), e.g. to start a session without
+    // loading the standard library again.
+    void fork(const interpreter &snapshot);
+
     void setup_standard_lib();
 
+    // Opt in to the profiling builtins (profile_start/0, profile_stop/0,
+    // profile_dump/1 and the predicate_statistics family.) They are not
+    // loaded by default, as profile_start/0 installs a process wide
+    // SIGPROF handler and the dump builtins write files. Call it before
+    // loading programs that use them.
+    void enable_profiling();
+
+    // Load the precompiled standard library (standard_lib_gen.hpp,
+    // generated by the build.) Returns false if it doesn't fit this
+    // interpreter, and then setup_standard_lib() loads the source.
+    bool load_standard_lib_image();
+
+    // Load and compile the standard library from source and save it
+    // as an image (see script/make_standard_lib.cpp.)
+    void save_standard_lib_image(std::vector<uint8_t> &image);
+
     template<typename Pre = no_processing, typename Post = no_processing> void load_program(const std::string &str) {
         standard_clause_processing<Pre,Post> process(*this);
 	interpreter_base::load_program(str, process);
@@ -373,6 +394,15 @@ public:
 	}
     }
 
+    // Maximum number of threads used by par_findall/3
+    inline size_t num_par_threads() const {
+	return num_par_threads_;
+    }
+
+    inline void set_num_par_threads(size_t n) {
+	num_par_threads_ = std::max(n, static_cast<size_t>(1));
+    }
+
     inline bool is_retain_state_between_queries() const {
 	return retain_state_between_queries_;
     }
@@ -409,6 +439,15 @@ protected:
 
 private:
     static bool compile_0(interpreter_base &interp, size_t arity, common::term args[]);    
+    // Sampling profiler (see wam_interpreter::start_sampling())
+    static bool profile_start_0(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool profile_stop_0(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool profile_dump_1(interpreter_base &interp, size_t arity, common::term args[]);
+    // Port counts and cost per predicate (see wam_interpreter::start_predicate_statistics())
+    static bool predicate_statistics_start_0(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool predicate_statistics_stop_0(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool predicate_statistics_2(interpreter_base &interp, size_t arity, common::term args[]);
+    static bool predicate_statistics_dump_1(interpreter_base &interp, size_t arity, common::term args[]);
     static bool consult_1(interpreter_base &interp, size_t arity, common::term args[]);
 
 public:
@@ -417,6 +456,8 @@ public:
     static bool operator_at_2(interpreter_base &interp, size_t arity, common::term args[] );
     static bool operator_at_silent_2(interpreter_base &interp, size_t arity, common::term args[] );
     static bool operator_at_parallel_2(interpreter_base &interp, size_t arity, common::term args[] );
+    static bool par_2(interpreter_base &interp, size_t arity, common::term args[] );
+    static bool par_findall_3(interpreter_base &interp, size_t arity, common::term args[] );
 private:
     static bool is_else(interpreter_base &interp, common::term t);
     static std::pair<common::term, common::term> extract_else(interpreter_base &interp, common::term t);
@@ -431,8 +472,12 @@ private:
     bool can_unify_args(term clause_head, const code_point &p);  
     bool select_clause(const code_point &instruction,
 		       size_t index_id,
-		       const managed_clauses &clauses,
-		       size_t from_clause);
+		       const clause_list &clauses,
+		       size_t gen,
+		       size_t from_clause,
+		       bool has_choices);
+    term instantiate_clause(const managed_clause &m_clause);
+    bool clause_cells(term clause, managed_clause::cells_t &cells);
   
     inline std::vector<binding> & query_vars()
         { return *query_vars_; }
@@ -455,6 +500,40 @@ private:
 
     common::local_service local_service_;
     std::unordered_map<std::string, interpreter *> at_local_;
+
+    //
+    // par/2: Independent goals are executed on worker interpreters
+    // (each with its own heap and stacks.) The program database of
+    // a worker is a copy of ours and is synchronized before each
+    // call (only the predicates that have changed are copied.)
+    //
+    void par_goals(common::term t, std::vector<common::term> &goals);
+    bool par_independent(const std::vector<common::term> &goals);
+    bool par_sequential(const std::vector<common::term> &goals);
+    bool par_execute(const std::vector<common::term> &goals);
+    void par_continue(common::term goal);
+    bool par_split(common::term tmpl0, common::term goal0, common::term &tmpl,
+		   common::term &goal, common::term &rest,
+		   std::vector<common::term> &alts);
+    bool par_has_cut(common::term body);
+    bool par_findall_execute(common::term tmpl, common::term goal,
+			     common::term rest,
+			     const std::vector<common::term> &alts,
+			     common::term result);
+    void ensure_par_workers(size_t n);
+    void par_sync_worker(interpreter &w, const std::vector<qname> &qns);
+    void par_copy_predicate(interpreter &w, const qname &qn,
+			    std::vector<std::pair<qname, qname> > &imports);
+    void par_copy_module_state(interpreter &w);
+    common::con_cell par_map(interpreter &w, common::con_cell c);
+    void delete_par_workers();
+
+    bool par_worker_;
+    size_t num_par_threads_;
+    std::vector<interpreter *> par_workers_;
+    std::unordered_map<qname, std::vector<common::term> > par_synced_;
+    // program_generation() when par_synced_ was last updated
+    size_t par_synced_generation_;
 };
 
 template<typename Pre, typename Post> void standard_clause_processing<Pre,Post>::operator () (common::term clause)
@@ -1,6 +1,7 @@
 #include "../common/term_env.hpp"
 #include "interpreter_base.hpp"
 #include "builtins_fileio.hpp"
+#include "builtins_tabling.hpp"
 #include "wam_interpreter.hpp"
 #include <boost/filesystem.hpp>
 #include <boost/timer/timer.hpp>
@@ -34,6 +35,7 @@ meta_context::meta_context(interpreter_base &i, meta_fn mfn)
     old_cp = i.cp();
     old_qr = i.qr();
     old_hb = i.get_register_hb();
+    old_h = i.heap_size();
 }
 
 interpreter_base::interpreter_base(const std::string &name) : arith_(*this), locale_(*this), name_(name)
@@ -54,6 +56,7 @@ void interpreter_base::total_reset()
     program_predicates_.clear();
     updated_predicates_.clear();
     module_meta_db_.clear();
+    tabled_predicates_.clear();
     if (stack_) delete [] stack_;
     stack_ = nullptr;
     for (auto e : managed_data_) delete e.second;
@@ -65,6 +68,43 @@ void interpreter_base::total_reset()
     reset_accumulated_cost();
 }
 
+void interpreter_base::fork(const interpreter_base &base)
+{
+    get_heap().fork(base.get_heap());
+    get_ops() = base.get_ops();
+
+    code_db_ = base.code_db_;
+    builtins_ = base.builtins_;
+    program_db_ = base.program_db_;
+    module_db_ = base.module_db_;
+    module_db_set_ = base.module_db_set_;
+    program_predicates_ = base.program_predicates_;
+    has_updated_predicates_ = base.has_updated_predicates_;
+    updated_predicates_ = base.updated_predicates_;
+    module_meta_db_.clear();
+    for (auto &e : base.module_meta_db_) {
+	auto &meta = module_meta_db_[e.first];
+	meta.set_name(e.second.get_name());
+	meta.set_source_elements(e.second.get_source_elements());
+	if (e.second.has_changed()) {
+	    meta.changed();
+	}
+    }
+    tabled_predicates_ = base.tabled_predicates_;
+    current_module_ = base.current_module_;
+    clear_secret();
+
+    set_debug(base.debug_);
+    track_cost_ = base.track_cost_;
+    lco_ = base.lco_;
+
+    // The clauses of the program database are below the heap limit
+    heap_limit();
+    set_gc_threshold(base.gc_threshold_);
+    register_top_hb_ = heap_size();
+    set_register_hb(heap_size());
+}
+
 void interpreter_base::init()
 {
     delayed_ready_ = 0;
@@ -77,6 +117,12 @@ void interpreter_base::init()
 
     debug_ = false;
     track_cost_ = false;
+    lco_ = true;
+    gc_threshold_ = DEFAULT_GC_THRESHOLD;
+    gc_next_ = std::numeric_limits<size_t>::max();
+    gc_count_ = 0;
+    program_generation_ = 0;
+    gc_reclaimed_ = 0;
     file_id_count_ = 3;
     num_of_args_= 0;
     memset(register_ai_, 0, sizeof(register_ai_));
@@ -89,6 +135,7 @@ void interpreter_base::init()
 
     // These will be loaded into the system module
     builtins::load(*this);
+    load_builtins_tabling();
 
     register_top_b_ = nullptr;
     register_top_e_ = nullptr;
@@ -255,6 +302,8 @@ void interpreter_base::reset()
 	m->fn(*this, meta_reason_t::META_DELETE);
 	unwind_to_top_choice_point();
     }
+    builtins_tabling::abort_evaluations(*this);
+
     bool cont = false;
     do {
         cont = false;
@@ -494,7 +543,7 @@ term interpreter_base::rewrite_freeze_body(term freezeVar, term freezeBody)
     return closure_mod;
 }
     
-void interpreter_base::load_clause(term t, clause_position pos)
+void interpreter_base::load_clause(term t, clause_position pos, bool is_dynamic)
 {
     syntax_check_clause(t);
 
@@ -556,6 +605,28 @@ void interpreter_base::load_clause(term t, clause_position pos)
 
     auto qn = std::make_pair(module, pn);
 
+    if (is_tabled(qn)) {
+	// p/N gets the wrapper clause and the clause goes to the
+	// implementation 'p tabled'/N.
+	add_table_wrapper(qn);
+	qn = tabled_implementation(qn);
+	term head = clause_head(t);
+	term impl_head = new_term(qn.second);
+	for (size_t i = 0; i < pn.arity(); i++) {
+	    set_arg(impl_head, i, arg(head, i));
+	}
+	if (clause_body(t) == EMPTY_LIST) {
+	    t = impl_head;
+	} else {
+	    set_arg(t, 0, impl_head);
+	}
+    }
+
+    add_clause(qn, t, pos, is_dynamic);
+}
+
+void interpreter_base::add_clause(const qname &qn, term t, clause_position pos, bool is_dynamic)
+{
     // Required so that global interpreter loads the predicate
     // into memory.
     get_predicate(qn);
@@ -570,20 +641,68 @@ void interpreter_base::load_clause(term t, clause_position pos)
     }
 
     auto &pred = program_db_[qn];
+    if (is_dynamic) {
+        pred.set_dynamic();
+    }
     pred.add_clause(*this, t, pos);
     
+    auto module = qn.first;
     if (module_db_set_[module].count(qn) == 0) {
         module_db_set_[module].insert(qn);
 	module_db_[module].push_back(qn);
     }
 
-    set_code(qn, code_point(module, pn));
+    set_code(qn, code_point(module, qn.second));
 
     internal_updated_predicate_post(qn);
 
     heap_limit();
 }
 
+void interpreter_base::set_tabled(const qname &qn)
+{
+    tabled_predicates_.insert(qn);
+
+    // Clauses are (re)loaded after the table directive.
+    auto impl = tabled_implementation(qn);
+    auto *pred = internal_get_predicate(impl);
+    if (pred != nullptr && !pred->empty()) {
+	updated_predicate_pre(impl);
+	pred->clear();
+	program_generation_++;
+	internal_updated_predicate_post(impl);
+    }
+    add_table_wrapper(qn);
+}
+
+qname interpreter_base::tabled_implementation(const qname &qn)
+{
+    return qname(qn.first, functor(atom_name(qn.second) + " tabled",
+				   qn.second.arity()));
+}
+
+void interpreter_base::add_table_wrapper(const qname &qn)
+{
+    auto *pred = internal_get_predicate(qn);
+    if (pred != nullptr && !pred->empty()) {
+	return;
+    }
+
+    // p(X1,...,XN) :- '$tbl_call'(p(X1,...,XN), M:'p tabled'(X1,...,XN)).
+    size_t n = qn.second.arity();
+    term head = new_term(qn.second);
+    term goal = new_term(qn.second);
+    term impl = new_term(tabled_implementation(qn).second);
+    for (size_t i = 0; i < n; i++) {
+	term x = new_ref();
+	set_arg(head, i, x);
+	set_arg(goal, i, x);
+	set_arg(impl, i, x);
+    }
+    term body = new_term(functor("$tbl_call", 2), {goal, new_term(COLON, {qn.first, impl})});
+    add_clause(qn, new_term(IMPLIED_BY, {head, body}), LAST_CLAUSE);
+}
+
 void interpreter_base::load_builtin(const qname &qn, builtin b)
 {
     auto found = builtins_.find(qn);
@@ -654,6 +773,17 @@ void interpreter_base::load_builtins_file_io()
     load_builtin(con_cell("sformat",3), builtin(&builtins_fileio::sformat_3,true));
 }
 
+void interpreter_base::load_builtins_tabling()
+{
+    load_builtin(functor("table", 1), &builtins_tabling::table_1);
+    load_builtin(functor("abolish_all_tables", 0), &builtins_tabling::abolish_all_tables_0);
+    load_builtin(functor("$tbl_lookup", 3), &builtins_tabling::tbl_lookup_3);
+    load_builtin(functor("$tbl_push", 1), &builtins_tabling::tbl_push_1);
+    load_builtin(functor("$tbl_pop", 1), &builtins_tabling::tbl_pop_1);
+    load_builtin(functor("$tbl_add", 2), &builtins_tabling::tbl_add_2);
+    load_builtin(functor("$tbl_answers", 2), &builtins_tabling::tbl_answers_2);
+}
+
 qname interpreter_base::gen_predicate(const common::con_cell module, size_t arity) {
     static const char ALPHABET[64] = {
       'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p',
@@ -812,6 +942,7 @@ void interpreter_base::print_predicate(std::ostream &out, const qname &qn, bool
     opt.set(emitter_option::EMIT_PROGRAM);
     bool do_nl = false;
     for (auto &m_clause : pred.get_clauses()) {
+	if (m_clause.is_erased()) continue;
 	if (do_nl) out << "\n";
 	std::string mod = "";
 	if (qn.first != USER_MODULE) {
@@ -884,6 +1015,7 @@ void interpreter_base::prepare_execution()
     set_top_hb(heap_size());
     set_top_tr(trail_size());
     register_p_.reset();
+    set_gc_threshold(gc_threshold_);
 }
 
 
@@ -1035,6 +1167,11 @@ void interpreter_base::save_clause(term t, std::ostream &out)
 
 void interpreter_base::save_predicate(const qname &qn, std::ostream &out)
 {
+    if (is_tabled(qn)) {
+	// The wrapper clause is created by the table directive and the
+	// clauses are in the implementation predicate.
+	return;
+    }
     term_emitter emit(out, *this);
     emit.set_var_naming(&var_naming());    
     emit.options().set(emitter_option::EMIT_PROGRAM);
@@ -5,6 +5,7 @@
 
 #include <istream>
 #include <vector>
+#include <deque>
 #include <stack>
 #include <tuple>
 #include <map>
@@ -33,10 +34,15 @@ class predicate;
     
 class managed_clause {
 public:
+    // The died() stamp of a clause that hasn't been retracted
+    static const size_t ALIVE = ~static_cast<size_t>(0);
+
     inline managed_clause()
-        : clause_(), cost_(0), ordinal_(0) { }
-    inline managed_clause(common::term cl, uint64_t cost, size_t ord)
-        : clause_(cl), cost_(cost), ordinal_(ord) { }
+        : clause_(), cost_(0), ordinal_(0), born_(0), died_(ALIVE),
+	  cells_cost_(0) { }
+    inline managed_clause(common::term cl, uint64_t cost, int64_t ord, size_t born = 0)
+        : clause_(cl), cost_(cost), ordinal_(ord), born_(born), died_(ALIVE),
+	  cells_cost_(0) { }
     inline managed_clause(const managed_clause &other) = default;
 
     inline common::term clause() const {
@@ -44,42 +50,144 @@ public:
     }
 
     inline bool is_erased() const {
-        return clause_ == common::term();
+        return died_ != ALIVE;
     }
 
-    inline void erase() {
-        clause_ = common::term();
+    // Logical update view: a call made at generation 'gen' sees the
+    // clauses as they were when it was made, so a retracted clause
+    // is kept (as a tombstone) until no such call remains.
+    inline bool is_visible(size_t gen) const {
+        return born_ <= gen && gen < died_;
     }
-  
-    inline size_t ordinal() const {
+
+    inline int64_t ordinal() const {
         return ordinal_;
     }
 
+    inline size_t born() const {
+        return born_;
+    }
+
+    inline size_t died() const {
+        return died_;
+    }
+
     inline uint64_t cost() const {
 	return cost_;
     }
 
+    // The clause as cells for heap::new_relocated_cells(), built on
+    // first use by the ordinary interpreter (see select_clause.) Empty
+    // if the clause can't be stored like this. The cost is what copying
+    // the clause term costs, so instantiating from the cells is charged
+    // the same.
+    typedef std::vector<common::cell> cells_t;
+    inline const cells_t * cells() const { return cells_.get(); }
+    inline uint64_t cells_cost() const { return cells_cost_; }
+    inline void set_cells(std::shared_ptr<const cells_t> cells, uint64_t cost) const
+        { cells_ = cells; cells_cost_ = cost; }
+
 private:
     friend class predicate;
-    void set_ordinal(size_t ord) { ordinal_ = ord; }
+    inline void erase(size_t gen) { died_ = gen; }
 
     common::term clause_;
     size_t cost_;
-    size_t ordinal_;
+    int64_t ordinal_;
+    size_t born_;
+    size_t died_;
+    mutable std::shared_ptr<const cells_t> cells_;
+    mutable uint64_t cells_cost_;
 };
 
-typedef std::vector<managed_clause> managed_clauses;
+// Records are never moved by asserta/assertz (so clause_list can
+// refer to them), only when the predicate is compacted.
+typedef std::deque<managed_clause> managed_clauses;
 
 enum clause_position { FIRST_CLAUSE, LAST_CLAUSE };
+
+// Clauses in clause order (by ordinal.) Headroom is kept at both ends
+// so asserta and assertz are amortized O(1).
+class clause_list {
+public:
+    inline clause_list() : front_(0), skip_(0) { }
+
+    inline size_t size() const { return refs_.size() - front_; }
+    inline bool empty() const { return size() == 0; }
+
+    inline const managed_clause & operator [] (size_t i) const
+        { return *refs_[front_ + i]; }
+
+    inline void add(managed_clause *mc, clause_position pos)
+    {
+	if (pos == LAST_CLAUSE) {
+	    refs_.push_back(mc);
+	    return;
+	}
+	if (front_ == 0) {
+	    size_t n = std::max(size(), static_cast<size_t>(4));
+	    refs_.insert(refs_.begin(), n, nullptr);
+	    front_ = n;
+	}
+	refs_[--front_] = mc;
+	skip_ = 0;
+    }
+
+    inline void clear() { refs_.clear(); front_ = 0; skip_ = 0; }
+
+    // Set to the clauses of a and b (in clause order)
+    inline void merge(const clause_list &a, const clause_list &b)
+    {
+	refs_.resize(a.size() + b.size());
+	std::merge(a.refs_.begin() + a.front_, a.refs_.end(),
+		   b.refs_.begin() + b.front_, b.refs_.end(), refs_.begin(),
+		   [](const managed_clause *x, const managed_clause *y)
+		   { return x->ordinal() < y->ordinal(); });
+	front_ = 0;
+	skip_ = 0;
+    }
+
+    // Index of the first clause that hasn't been retracted. Those
+    // before it can't be seen by a new call, so it only moves forward
+    // (unless clauses are added first.)
+    inline size_t skip_erased() const
+    {
+	while (front_ + skip_ < refs_.size() && refs_[front_ + skip_]->is_erased()) {
+	    skip_++;
+	}
+	return skip_;
+    }
+
+    // Index of the first clause with ordinal >= ord
+    inline size_t lower_bound(int64_t ord) const
+    {
+	auto it = std::lower_bound(refs_.begin() + front_, refs_.end(), ord,
+		   [](const managed_clause *mc, int64_t o)
+		   { return mc->ordinal() < o; });
+	return static_cast<size_t>(it - (refs_.begin() + front_));
+    }
+
+private:
+    friend class predicate;
+    inline managed_clause & get(size_t i) const { return *refs_[front_ + i]; }
+
+    std::vector<managed_clause *> refs_;
+    size_t front_;
+    mutable size_t skip_;
+};
     
 class predicate {
 public:
-  inline predicate() = default;
-  inline predicate(const predicate &other) = default;
-  inline predicate(const qname &qn) : qname_(qn), id_(0), with_vars_(false), num_clauses_(0),was_compiled_(false),ok_to_compile_(true), performance_count_(0) { }
+  inline predicate() : id_(0), num_clauses_(0), num_erased_(0), compact_at_(MIN_COMPACT), generation_(0), was_compiled_(false), ok_to_compile_(true), dynamic_(false), performance_count_(0) { }
+  inline predicate(const predicate &other) { *this = other; }
+  inline predicate(const qname &qn) : qname_(qn), id_(0), num_clauses_(0), num_erased_(0), compact_at_(MIN_COMPACT), generation_(0), was_compiled_(false), ok_to_compile_(true), dynamic_(false), performance_count_(0) { }
+  predicate & operator = (const predicate &other);
+
   inline const qname & qualified_name() const { return qname_; }
 
-  inline const std::vector<managed_clause> & clauses() const { return clauses_; }
+  // All clauses, including retracted ones that haven't been
+  // compacted away yet (see is_erased.)
+  inline const managed_clauses & clauses() const { return clauses_; }
 
   inline bool empty() const { return num_clauses_ == 0; }
   
@@ -87,28 +195,30 @@ public:
 		  common::term clause,
 		  clause_position pos = LAST_CLAUSE);
 
-  size_t get_term_id(interpreter_base &interp, common::term first_arg) const;
-  const std::vector<managed_clause> & get_clauses(interpreter_base &interp, size_t term_id) const;
-  const std::vector<managed_clause> & get_clauses(interpreter_base &interp, common::term first_arg) const;
+  // Get the clauses that may match a call with these arguments.
+  // The most discriminating bound argument is used, and its index is
+  // built on demand (see argument_index.) Retracted clauses are
+  // included, so check is_visible() for the generation of the call.
+  const clause_list & get_clauses(interpreter_base &interp, size_t num_args, const common::term *args) const;
 
-  inline const std::vector<managed_clause> & get_clauses() const
+  inline const managed_clauses & get_clauses() const
       { return clauses_; }
 
   inline size_t num_clauses() const { return num_clauses_; }
 
+  // Every assert and retract starts a new generation. A call only
+  // sees the clauses of the generation it was made in.
+  inline size_t generation() const { return generation_; }
+
   inline void clear()
   {
       clauses_.clear();
-      indexed_.clear();
-      with_vars_ = false;
-      clear_cache();
+      all_.clear();
+      arg_indices_.clear();
       num_clauses_ = 0;
-  }
-
-  inline void clear_cache()
-  {
-      filtered_.clear();
-      term_id_.clear();
+      num_erased_ = 0;
+      compact_at_ = MIN_COMPACT;
+      generation_++;
   }
 
   inline bool was_compiled() const {
@@ -127,6 +237,19 @@ public:
       ok_to_compile_ = on;
   }
 
+  // Updated by assert/retract while running. Such a predicate is left
+  // to the ordinary interpreter instead of being recompiled (all of
+  // it) after every update.
+  inline bool is_dynamic() const {
+      return dynamic_;
+  }
+
+  inline void set_dynamic() {
+      dynamic_ = true;
+      was_compiled_ = false;
+      ok_to_compile_ = false;
+  }
+
   bool matching_clauses(interpreter_base &interp, common::term head);
   bool remove_clauses(interpreter_base &interp, common::term head, bool all);
 
@@ -135,22 +258,54 @@ public:
   size_t performance_count() const { return performance_count_; }
 
 private:
-    bool matched_indexed_clause(interpreter_base &interp, common::term head);
-    managed_clause remove_indexed_clause(interpreter_base &interp, common::term head);
+    // Don't compact for fewer retracted clauses than this
+    static const size_t MIN_COMPACT = 32;
+
+    // Clauses with one argument key at one argument position. The
+    // clauses with a variable there (see argument_index) are merged in
+    // when the bucket is looked up, and kept until either list changes.
+    struct argument_bucket {
+        inline argument_bucket() : merged_version(0), stale(true) { }
+        clause_list keyed;
+        clause_list merged;
+        size_t merged_version;
+        bool stale;
+    };
+
+    // Clauses per argument key for one argument position. Clauses with
+    // a variable at this position are only kept once, in var_clauses,
+    // which is also what an unknown key may match.
+    struct argument_index {
+        inline argument_index() : built(false), var_version(0) { }
+        bool built;
+        std::unordered_map<common::term, argument_bucket> buckets;
+        clause_list var_clauses;
+        size_t var_version; // Bumped when var_clauses changes
+    };
+
+    argument_index & get_argument_index(interpreter_base &interp, size_t arg_pos) const;
+    const clause_list & get_bucket_clauses(argument_index &idx, argument_bucket &bucket) const;
+    void index_clause(interpreter_base &interp, argument_index &idx, size_t arg_pos, managed_clause &mclause, clause_position pos) const;
+    const clause_list & get_head_clauses(interpreter_base &interp, common::term head) const;
+    void compact(interpreter_base &interp);
+    void rebuild();
+
     friend class interpreter_base;
   
     void set_id(size_t identifier) { id_ = identifier; }
   
     qname qname_;
     size_t id_;
-    mutable std::vector<managed_clause> clauses_;
-    mutable std::unordered_map<common::term, std::vector<managed_clause> > indexed_;
-    mutable std::vector<std::vector<managed_clause> > filtered_;
-    mutable std::unordered_map<common::term, size_t> term_id_;
-    bool with_vars_;
+    mutable managed_clauses clauses_;
+    clause_list all_;
+    mutable std::vector<argument_index> arg_indices_;
     size_t num_clauses_;
+    size_t num_erased_;
+    size_t compact_at_;
+    size_t generation_;
     bool was_compiled_;
     bool ok_to_compile_;
+    bool dynamic_;
     mutable size_t performance_count_;
 };
 
@@ -244,6 +399,11 @@ public:
 
     inline bool is_fail() const { return term_code_ == fail_term_; }
 
+    inline bool operator == (const code_point &other) const {
+	return module_ == other.module_ && term_code_ == other.term_code_
+	    && wam_code_ == other.wam_code_;
+    }
+
     inline bool has_wam_code() const {
 	static const common::con_cell WAM = common::con_cell("$WAM",0);
 	return module_ == WAM; 
@@ -353,6 +513,9 @@ struct choice_point_t {
     choice_point_t       *b0;
     common::term          qr; // Only used for naive interpreter (for now)
     common::con_cell      pr; // Only used for naive interpreter (for now)
+    size_t                gen; // Clause generation of the call (naive)
+    int64_t               ord; // Ordinal of next clause to try (naive)
+    wam_instruction_base *wp; // WAM code to resume at when a builtin is retried
     size_t                arity;
     common::term          ai[];
 };
@@ -431,6 +594,10 @@ struct meta_context {
     code_point old_cp;
     common::term old_qr;
     size_t old_hb;
+    // Heap size at creation. The garbage collector never moves cells
+    // below this point, so terms created before the meta context are
+    // safe to keep in it.
+    size_t old_h;
 };
 
 class interpreter;
@@ -457,12 +624,16 @@ class interpreter_base : public common::term_env {
     friend class builtins;
     friend class builtins_opt;
     friend class builtins_fileio;
+    friend class builtins_tabling;
+    friend class table_store;
     friend class arithmetics;
+    friend class arithmetics_fn;
     friend struct meta_context;
     friend class interpreter;
     friend struct new_instance_context;
     friend class remote_execution_proxy;
     friend class predicate;
+    friend class heap_gc;
 
 private:
     static const size_t STACK_BASE = 0x80000000000000;
@@ -517,9 +688,51 @@ public:
     void reset();
     void total_reset();
 
+    // Make this (new) interpreter a clone of 'base': the program
+    // database, the operators and the modules are copied and the heap
+    // is a copy-on-write fork of the heap of 'base' (which must not
+    // change from now on.) Frozen closures, open files and managed
+    // data are not cloned.
+    void fork(const interpreter_base &base);
+
     bool is_track_cost() const { return track_cost_; }
     void set_track_cost(bool b) { track_cost_ = b; }
 
+    // Last call optimization for the term interpreting path (naive
+    // environments.) Enabled by default.
+    inline bool is_lco() const { return lco_; }
+    inline void set_lco(bool enabled) { lco_ = enabled; }
+
+    // Heap garbage collection (see interpreter_gc.cpp.) A collection
+    // is triggered at the next safe point when the heap has grown by
+    // the threshold (number of cells) since the last collection.
+    // A threshold of 0 disables it.
+    static const size_t DEFAULT_GC_THRESHOLD = 1024*1024;
+
+    inline size_t gc_threshold() const { return gc_threshold_; }
+    inline void set_gc_threshold(size_t n) {
+	gc_threshold_ = n;
+	gc_next_ = (n == 0) ? std::numeric_limits<size_t>::max()
+	                    : heap_size() + n;
+    }
+    inline size_t gc_count() const { return gc_count_; }
+    inline size_t gc_reclaimed() const { return gc_reclaimed_; }
+
+    // Changed whenever the clauses of some predicate change, so a copy
+    // of the program only needs to be checked when this has changed.
+    inline size_t program_generation() const { return program_generation_; }
+
+    // Returns the number of reclaimed heap cells. Must only be called
+    // at a safe point, i.e. when every live term is reachable from
+    // the registers, the stack, the trail or the frozen closures.
+    size_t gc();
+
+    inline void check_gc() {
+	if (heap_size() >= gc_next_) {
+	    gc();
+	}
+    }
+
     void enable_file_io();
     const std::string & get_current_directory() const;
     void set_current_directory(const std::string &dir);
@@ -542,7 +755,14 @@ public:
 
     void load_clause(const std::string &str);
     void load_clause(std::istream &is);
-    void load_clause(term t, clause_position pos);
+    void load_clause(term t, clause_position pos, bool is_dynamic = false);
+
+    // Clauses of tabled predicates are loaded into their implementation
+    // predicate (see builtins_tabling.)
+    void set_tabled(const qname &qn);
+    inline bool is_tabled(const qname &qn) const
+        { return !tabled_predicates_.empty() && tabled_predicates_.count(qn) != 0; }
+    qname tabled_implementation(const qname &qn);
 
     con_cell clause_module(term clause)
     {
@@ -599,6 +819,11 @@ public:
     }
   
     term clause_first_arg(term clause)
+    {
+        return clause_arg(clause, 0);
+    }
+
+    term clause_arg(term clause, size_t index)
     {
         term head = clause_head(clause);
 	if (!is_functor(head)) {
@@ -612,10 +837,10 @@ public:
 	     }
 	     f = functor(head);
 	}
-	if (f.arity() <= 0) {
+	if (f.arity() <= index) {
 	    return EMPTY_LIST;      
 	}
-	return arg(head, 0);
+	return arg(head, index);
     }
 
     term arg_index(term arg)
@@ -788,6 +1013,7 @@ public:
 	auto it = program_db_.find(qn);
 	if (it != program_db_.end()) {
 	    program_db_.erase(it);
+	    program_generation_++;
 	    auto preds = module_db_[qn.first];
 	    auto it2 = std::find(preds.begin(), preds.end(), qn);
 	    if (it2 != preds.end()) {
@@ -846,7 +1072,7 @@ public:
 	size_t n = 0;
 	for (auto &p : program_db_) {
 	    auto &predicate = p.second;
-	    n += predicate.clauses().size();
+	    n += predicate.num_clauses();
 	}
 	return n;
     }
@@ -855,6 +1081,7 @@ public:
     {
 	const qname &qn = p.qualified_name();
 	program_db_[qn] = p;
+	program_generation_++;
     }  
 
     inline const module_meta & get_module_meta(con_cell name)
@@ -971,10 +1198,24 @@ public:
     inline bool is_builtin(const qname &qn) const
     { return builtins_.find(qn) != builtins_.end(); }
 
+    // Find the qualified name that builtin 'f' (with 'name') was
+    // loaded as. This is a linear scan.
+    inline bool find_builtin(builtin_fn f, con_cell name, qname &qn) const
+    {
+	for (auto &e : builtins_) {
+	    if (e.first.second == name && e.second.fn() == f) {
+		qn = e.first;
+		return true;
+	    }
+	}
+	return false;
+    }
+
     inline uint64_t accumulated_cost() const
         { return accumulated_cost_; }
 
     inline void set_maximum_cost(uint64_t cost) { maximum_cost_ = cost; }
+    inline uint64_t maximum_cost() const { return maximum_cost_; }
 
     inline bool unify(term a, term b)
        { using namespace prologcoin::common;
@@ -1522,6 +1763,7 @@ protected:
 	new_b->b0 = register_b0_;
 	new_b->qr = register_qr_;
 	new_b->pr = register_pr_;
+	new_b->wp = nullptr;
 	register_b_ = new_b;
 	set_register_hb(heap_size());
 
@@ -1674,6 +1916,7 @@ public:
     void told_standard_output();
     bool has_told_standard_outputs();
     void load_builtins_file_io();
+    void load_builtins_tabling();
 
 protected:
     void tidy_trail();
@@ -1700,6 +1943,9 @@ private:
     void syntax_check_body(term clause, term body);
     void syntax_check_goal(term clause, term goal);
 
+    void add_clause(const qname &qn, term t, clause_position pos, bool is_dynamic = false);
+    void add_table_wrapper(const qname &qn);
+
     void preprocess_freeze(term term);
     void preprocess_freeze_body(term term);
     term rewrite_freeze_body(term freeze_var, term freeze_body);
@@ -1710,6 +1956,12 @@ private:
 
     bool debug_;
     bool track_cost_;
+    bool lco_;
+
+    size_t gc_threshold_;
+    size_t gc_next_;
+    size_t gc_count_;
+    size_t gc_reclaimed_;
 
     std::unordered_map<qname, code_point> code_db_;
     std::unordered_map<qname, builtin> builtins_;
@@ -1717,9 +1969,11 @@ private:
     std::unordered_map<con_cell, std::vector<qname> > module_db_;
     std::unordered_map<con_cell, std::unordered_set<qname> > module_db_set_;
     std::vector<qname> program_predicates_;
+    size_t program_generation_;
     bool has_updated_predicates_;
     std::unordered_set<qname> updated_predicates_;
     std::unordered_map<con_cell, module_meta>  module_meta_db_;
+    std::unordered_set<qname> tabled_predicates_;
 
     // Stack is emulated at heap offset >= 2^59 (3 bits for tag, remember!)
     // (This conforms to the WAM standard where addr(stack) > addr(heap))
@@ -1803,6 +2057,17 @@ private:
 protected:
     void clear_secret();
 
+    // Collect the heap above 'floor'. Cells in [scan_from, floor) and
+    // the cells at the addresses in 'remembered' (below scan_from) are
+    // additional roots. For subclasses that know which older cells may
+    // point to newer ones.
+    size_t gc(size_t floor, size_t scan_from,
+	      const std::vector<size_t> &remembered);
+
+    // Terms kept by subclasses. Called for every root when marking and
+    // again when relocating, so 'fn' may update the term.
+    virtual void gc_roots(const std::function<void (term &)> &fn) { }
+
 private:
     std::map<size_t, term> frozen_closures_;
 
@@ -2052,181 +2317,264 @@ private:
     std::string name_;
 };
 
+inline predicate & predicate::operator = (const predicate &other)
+{
+    qname_ = other.qname_;
+    id_ = other.id_;
+    clauses_ = other.clauses_;
+    num_clauses_ = other.num_clauses_;
+    num_erased_ = other.num_erased_;
+    compact_at_ = other.compact_at_;
+    generation_ = other.generation_;
+    was_compiled_ = other.was_compiled_;
+    ok_to_compile_ = other.ok_to_compile_;
+    dynamic_ = other.dynamic_;
+    performance_count_ = other.performance_count_;
+    // The clause lists refer to records of the other predicate
+    rebuild();
+    return *this;
+}
+
+inline void predicate::rebuild()
+{
+    all_.clear();
+    for (auto &mclause : clauses_) {
+        all_.add(&mclause, LAST_CLAUSE);
+    }
+    // Indices are rebuilt on demand
+    arg_indices_.clear();
+}
+
 inline void predicate::add_clause(interpreter_base &interp, common::term clause0, clause_position pos)  {
     performance_count_++;
-    managed_clause clause(clause0, interp.cost(clause0), clauses_.size());
-    switch (pos) {
-    case FIRST_CLAUSE: clauses_.insert(clauses_.begin(), clause); break;
-    case LAST_CLAUSE: clauses_.push_back(clause); break;
-    }
-    auto first_arg_index = interp.arg_index(interp.clause_first_arg(clause0));
-
-    if (first_arg_index.tag().is_ref()) {
-        with_vars_ = true;
-	indexed_.clear();
-        filtered_.clear();
-	term_id_.clear();
-    }
-    if (!with_vars_) {
-        auto &idx = indexed_[first_arg_index];
-	if (pos == FIRST_CLAUSE) {
-	    idx.insert(idx.begin(), clause);
-	} else {
-	    idx.push_back(clause);
+    generation_++;
+    interp.program_generation_++;
+    auto cost = interp.cost(clause0);
+    managed_clause *mclause;
+    if (pos == FIRST_CLAUSE) {
+        int64_t ord = clauses_.empty() ? 0 : clauses_.front().ordinal() - 1;
+	clauses_.push_front(managed_clause(clause0, cost, ord, generation_));
+	mclause = &clauses_.front();
+    } else {
+        int64_t ord = clauses_.empty() ? 0 : clauses_.back().ordinal() + 1;
+	clauses_.push_back(managed_clause(clause0, cost, ord, generation_));
+	mclause = &clauses_.back();
+    }
+    all_.add(mclause, pos);
+    // Indices that have been built are updated (instead of rebuilt)
+    for (size_t i = 0; i < arg_indices_.size(); i++) {
+        if (arg_indices_[i].built) {
+	    index_clause(interp, arg_indices_[i], i, *mclause, pos);
 	}
     }
-    clear_cache();
     num_clauses_++;
 }
 
-inline bool predicate::matched_indexed_clause(interpreter_base &interp, common::term head) {
-    auto arg_index = interp.arg_index(interp.clause_first_arg(head));
-    auto &idx = indexed_[arg_index];
-    for (auto it = idx.begin(); it != idx.end();) {
-        auto idx_clause = (*it).clause();
-        auto idx_clause_head = interp.clause_head(idx_clause);
-        if (interp.can_unify(idx_clause_head, head)) {
-	    return true;
-        } else {
-            ++it;
-        }
+inline void predicate::index_clause(interpreter_base &interp, argument_index &idx, size_t arg_pos, managed_clause &mclause, clause_position pos) const
+{
+    auto key = interp.arg_index(interp.clause_arg(mclause.clause(), arg_pos));
+    if (key.tag().is_ref()) {
+        idx.var_clauses.add(&mclause, pos);
+	idx.var_version++;
+    } else {
+        auto &bucket = idx.buckets[key];
+	bucket.keyed.add(&mclause, pos);
+	bucket.stale = true;
     }
-    return false;
 }
 
-inline managed_clause predicate::remove_indexed_clause(interpreter_base &interp, common::term head)
+inline const clause_list & predicate::get_bucket_clauses(argument_index &idx, argument_bucket &bucket) const
 {
-    auto arg_index = interp.arg_index(interp.clause_first_arg(head));
-    auto &idx = indexed_[arg_index];
-    for (auto it = idx.begin(); it != idx.end();) {
-        performance_count_++;
-        auto &mclause = (*it);
-        auto idx_clause = mclause.clause();
-        auto idx_clause_head = interp.clause_head(idx_clause);
-        if (interp.can_unify(idx_clause_head, head)) {
-            it = idx.erase(it);
-	    return mclause;
-        } else {
-            ++it;
-        }
+    if (idx.var_clauses.empty()) {
+        return bucket.keyed;
+    }
+    if (bucket.stale || bucket.merged_version != idx.var_version) {
+        performance_count_ += bucket.keyed.size() + idx.var_clauses.size();
+        bucket.merged.merge(bucket.keyed, idx.var_clauses);
+	bucket.merged_version = idx.var_version;
+	bucket.stale = false;
+    }
+    return bucket.merged;
+}
+
+inline const clause_list & predicate::get_head_clauses(interpreter_base &interp, common::term head) const
+{
+    size_t n = (head.tag() == common::tag_t::STR) ? interp.functor(head).arity() : 0;
+    common::term args[interpreter_base::MAX_ARGS];
+    for (size_t i = 0; i < n; i++) {
+        args[i] = interp.arg(head, i);
     }
-    return managed_clause(common::term(), 0, 0);
+    return get_clauses(interp, n, args);
 }
 
 inline bool predicate::matching_clauses(interpreter_base &interp, common::term head) {
-    auto arg = interp.clause_first_arg(head);
-    if (with_vars_ || arg.tag().is_ref()) {
-	for (auto it = clauses_.begin(); it != clauses_.end();) {
-            performance_count_++;
-	    auto mclause = *it;
-	    if (mclause.is_erased()) {
-	        ++it;
-	        continue;
-	    }
-	    auto clause = mclause.clause();
-	    auto clause_head = interp.clause_head(clause);
-	    if (interp.can_unify(clause_head, head)) {
-		return true;
-	    } else {
-	        ++it;
-	    }
+    auto &candidates = get_head_clauses(interp, head);
+    for (size_t i = candidates.skip_erased(); i < candidates.size(); i++) {
+        performance_count_++;
+        auto &mclause = candidates[i];
+	if (mclause.is_erased()) {
+	    continue;
+	}
+	if (interp.can_unify(interp.clause_head(mclause.clause()), head)) {
+	    return true;
 	}
-	return false;
-    } else {
-	return matched_indexed_clause(interp, head);
     }
+    return false;
 }
 
 inline bool predicate::remove_clauses(interpreter_base &interp, common::term head, bool all)
 {
-    auto arg = interp.clause_first_arg(head);
+    // Retracted clauses are only stamped; calls that are already
+    // running (with an older generation) will still see them.
+    auto &candidates = get_head_clauses(interp, head);
     bool found = false;
-    if (with_vars_ || arg.tag().is_ref()) {
-	for (auto it = clauses_.begin(); it != clauses_.end();) {
-            performance_count_++;
-	    auto mclause = *it;
-	    if (mclause.is_erased()) {
-	        ++it;
-	        continue;
-	    }
-	    auto clause = mclause.clause();
-	    auto clause_head = interp.clause_head(clause);
-	    if (interp.can_unify(clause_head, head)) {
-	        if (!found) {
-	            found = true;
-		    filtered_.clear();
-		    term_id_.clear();
-		}
-		it = clauses_.erase(it);
-		remove_indexed_clause(interp, clause_head);
-		num_clauses_--;
-		if (!all) break;
-	    } else {
-	        ++it;
-	    }
+    for (size_t i = candidates.skip_erased(); i < candidates.size(); i++) {
+        performance_count_++;
+        auto &mclause = candidates.get(i);
+	if (mclause.is_erased()) {
+	    continue;
 	}
-    } else {
-        // Update index and remove clause
-        bool cont = false;
-        do {
-    	    auto mclause = remove_indexed_clause(interp, head);
-	    cont = all;
-	    if (mclause.clause() != common::term()) {
+	if (interp.can_unify(interp.clause_head(mclause.clause()), head)) {
+	    if (!found) {
 	        found = true;
-	        clauses_[mclause.ordinal()].erase();
-		num_clauses_--;
-	    } else {
-	        cont = false;
+		generation_++;
+		interp.program_generation_++;
 	    }
-	} while (cont);
+	    mclause.erase(generation_);
+	    num_clauses_--;
+	    num_erased_++;
+	    if (!all) break;
+	}
     }
-    if (!found && !all) {
-        return false;
+    if (num_erased_ >= compact_at_) {
+        compact(interp);
     }
-    clear_cache();
-    return true;
+    return found || all;
 }
 
-inline size_t predicate::get_term_id(interpreter_base &interp, common::term arg_index) const
+inline void predicate::compact(interpreter_base &interp)
 {
-    auto it = term_id_.find(arg_index);
-    performance_count_++;
-    if (it == term_id_.end()) {
-        size_t new_id = filtered_.size();
-	term_id_[arg_index] = new_id;
-	filtered_.resize(filtered_.size()+1);
-	auto &v = filtered_[new_id];
-	bool is_unknown = with_vars_ || arg_index.tag().is_ref();
-	auto &src_clauses = is_unknown ? clauses_ : indexed_[arg_index];
-	for (auto &mclause : src_clauses) {
-            performance_count_++;
-	    if (mclause.is_erased()) {
-	        continue;
-	    }
-	    auto farg_index = interp.arg_index(interp.clause_first_arg(mclause.clause()));
-	    if (!interp.definitely_inequal(farg_index, arg_index)) {
-	        v.push_back(mclause);
-	    }
+    // The generations of the calls to this predicate that still have
+    // clauses left to try (see interpreter::select_clause.)
+    std::vector<size_t> gens;
+    for (auto *ch = interp.b(); ch != nullptr; ch = ch->b) {
+        auto &bp = ch->bp;
+	if (bp.has_wam_code() || bp.is_builtin() ||
+	    bp.term_code().tag() != common::tag_t::INT) {
+	    continue;
+	}
+	auto bpterm = bp.term_code();
+	auto bpval = reinterpret_cast<const common::int_cell &>(bpterm).value();
+	if (static_cast<size_t>(bpval >> 32) == id_) {
+	    gens.push_back(ch->gen);
 	}
-	return new_id;
     }
-    return it->second;
+    std::sort(gens.begin(), gens.end());
+    gens.erase(std::unique(gens.begin(), gens.end()), gens.end());
+
+    managed_clauses kept;
+    for (auto &mclause : clauses_) {
+        performance_count_++;
+	bool keep = !mclause.is_erased();
+	for (size_t i = 0; !keep && i < gens.size(); i++) {
+	    keep = mclause.is_visible(gens[i]);
+	}
+	if (keep) {
+	    kept.push_back(mclause);
+	}
+    }
+    clauses_.swap(kept);
+    num_erased_ = clauses_.size() - num_clauses_;
+    compact_at_ = num_erased_ + std::max(num_clauses_, static_cast<size_t>(MIN_COMPACT));
+    rebuild();
 }
 
-inline const std::vector<managed_clause> & predicate::get_clauses(interpreter_base &interp, size_t term_id) const {
-    return filtered_[term_id];
+inline predicate::argument_index & predicate::get_argument_index(interpreter_base &interp, size_t arg_pos) const
+{
+    auto &idx = arg_indices_[arg_pos];
+    if (idx.built) {
+        return idx;
+    }
+    for (auto &mclause : clauses_) {
+        performance_count_++;
+        index_clause(interp, idx, arg_pos, mclause, LAST_CLAUSE);
+    }
+    idx.built = true;
+    return idx;
 }
 
-inline const std::vector<managed_clause> & predicate::get_clauses(interpreter_base &interp, common::term first_arg) const {
-    static const std::vector<managed_clause> NOT_FOUND;
+inline const clause_list & predicate::get_clauses(interpreter_base &interp, size_t num_args, const common::term *args) const {
     performance_count_++;
-    auto arg_index = interp.arg_index(first_arg);
-    size_t term_id = get_term_id(interp, arg_index);
-    return filtered_[term_id];
+    // Resize first so the buckets we point to won't move
+    if (arg_indices_.size() < num_args) {
+        arg_indices_.resize(num_args);
+    }
+    // Only the bucket we pick gets the variable clauses merged in
+    argument_index *best = nullptr;
+    argument_bucket *best_bucket = nullptr;
+    size_t best_size = 0;
+    for (size_t i = 0; i < num_args; i++) {
+        auto key = interp.arg_index(interp.deref(args[i]));
+	if (key.tag().is_ref()) {
+	    continue;
+	}
+	auto &idx = get_argument_index(interp, i);
+	auto it = idx.buckets.find(key);
+	auto *bucket = (it == idx.buckets.end()) ? nullptr : &it->second;
+	size_t n = idx.var_clauses.size() + (bucket ? bucket->keyed.size() : 0);
+	if (best == nullptr || n < best_size) {
+	    best = &idx;
+	    best_bucket = bucket;
+	    best_size = n;
+	    if (best_size <= 1) {
+	        // Can't get any better than this
+	        break;
+	    }
+	}
+    }
+    if (best == nullptr) {
+        return all_;
+    }
+    if (best_bucket == nullptr) {
+        return best->var_clauses;
+    }
+    return get_bucket_clauses(*best, *best_bucket);
 }
 
 template<> inline environment_naive_t * interpreter_base::allocate_environment<ENV_NAIVE>()
 {
+    // Last call optimization: if there is nothing left to do after
+    // the new environment has been popped (cp = []), then the current
+    // naive environment would be popped right after it. If that
+    // environment isn't protected by a choice point or a meta context
+    // we can reuse its slot; the new environment inherits what would
+    // be restored (ce, cp, b0, qr, pr) so tail recursion runs in
+    // constant stack space.
+    if (lco_ && !cp().has_wam_code() && cp().term_code() == EMPTY_LIST
+	&& e_kind() == ENV_NAIVE && e0() != top_e()
+	&& base(e0()) > base(b()) && base(e0()) > base(m())) {
+	environment_naive_t *ee1 = ee();
+	auto saved_ce = ee1->ce;
+	auto saved_cp = ee1->cp;
+	auto saved_b0 = ee1->b0;
+	auto saved_qr = ee1->qr;
+	auto saved_pr = ee1->pr;
+	auto current_cp = cp();
+	// Pop the current environment so the new one is placed where
+	// it was.
+	set_e(saved_ce);
+	set_cp(saved_cp);
+	auto new_ee = reinterpret_cast<environment_naive_t *>(allocate_stack(true));
+	new_ee->ce = saved_ce;
+	new_ee->cp = saved_cp;
+	new_ee->b0 = saved_b0;
+	new_ee->qr = saved_qr;
+	new_ee->pr = saved_pr;
+	set_cp(current_cp);
+	set_ee(new_ee);
+	return new_ee;
+    }
+
     auto new_ee = reinterpret_cast<environment_naive_t *>(allocate_stack(true));
     new_ee->ce = save_e();
     new_ee->cp = cp();
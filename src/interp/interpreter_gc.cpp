@@ -0,0 +1,577 @@
+#include "interpreter_base.hpp"
+#include <unordered_set>
+
+namespace prologcoin { namespace interp {
+
+using namespace prologcoin::common;
+
+//
+// Heap garbage collector.
+//
+// Mark & compact over the part of the heap that belongs to the current
+// execution, i.e. everything above the GC floor. The floor is the heap
+// top when the query started, the heap limiter (the program database
+// lives below it) and the heap top when the current meta context was
+// created (meta contexts may keep terms in C++ fields that we can't
+// see.) Nothing below the floor is moved.
+//
+// Cells below the floor can only point into the collected region
+// through bindings made during this execution. Bindings below HB are
+// on the trail. Bindings above HB (but below the floor) are found by
+// scanning from the lowest HB this execution can have.
+//
+// Compaction is sliding (order preserving), so choice point heap marks
+// (the HB boundaries) and the relative age of variables stay valid.
+// Instead of threading pointers (Morris) the forwarding address is
+// computed from a mark bitmap with a running count of live cells.
+//
+class heap_gc {
+public:
+    heap_gc(interpreter_base &interp, size_t floor, size_t scan_from,
+	    const std::vector<size_t> &remembered);
+
+    size_t collect();
+
+private:
+    inline bool in_region(size_t addr) const {
+	return addr >= floor_ && addr < top_;
+    }
+
+    inline bool is_marked(size_t addr) const {
+	size_t i = addr - floor_;
+	return (marked_[i >> 6] >> (i & 63)) & 1;
+    }
+
+    inline void set_marked(size_t addr) {
+	size_t i = addr - floor_;
+	marked_[i >> 6] |= static_cast<uint64_t>(1) << (i & 63);
+    }
+
+    inline bool is_raw(size_t addr) const {
+	size_t i = addr - floor_;
+	return (raw_[i >> 6] >> (i & 63)) & 1;
+    }
+
+    inline void set_raw(size_t addr) {
+	size_t i = addr - floor_;
+	raw_[i >> 6] |= static_cast<uint64_t>(1) << (i & 63);
+    }
+
+    inline cell get(size_t addr) const {
+	return static_cast<const heap &>(heap_)[addr];
+    }
+
+    void mark(size_t addr);
+    void mark_term(const term t);
+    void mark_structure(size_t index);
+    void mark_big(size_t index);
+    void mark_all();
+
+    // Number of live cells below 'addr' (in region) plus floor, i.e.
+    // the new address of a marked cell or the new value of a heap mark.
+    size_t forward(size_t addr) const;
+    bool relocate(term &t) const;
+    void relocate(code_point &cp) const;
+    void relocate_cell(size_t addr);
+
+    template<typename Fn> void for_each_scanned(Fn fn);
+    template<typename Fn> void for_each_root(Fn fn);
+
+    size_t num_y(const code_point &cp);
+    void compute_num_y();
+
+    interpreter_base &interp_;
+    heap &heap_;
+    size_t floor_;
+    size_t top_;
+    size_t scan_from_;
+    const std::vector<size_t> &remembered_;
+    std::vector<uint64_t> marked_;
+    std::vector<uint64_t> raw_;
+    std::vector<size_t> live_before_;
+    std::vector<size_t> stack_;
+    std::unordered_map<environment_t *, size_t> num_y_;
+};
+
+heap_gc::heap_gc(interpreter_base &interp, size_t floor, size_t scan_from,
+		 const std::vector<size_t> &remembered)
+  : interp_(interp), heap_(interp.get_heap()), floor_(floor),
+    top_(interp.heap_size()), scan_from_(scan_from), remembered_(remembered),
+    marked_((top_ - floor_ + 63) / 64, 0),
+    raw_((top_ - floor_ + 63) / 64, 0),
+    live_before_((top_ - floor_ + 63) / 64 + 1, 0)
+{
+}
+
+void heap_gc::mark(size_t addr)
+{
+    if (!in_region(addr) || is_marked(addr) || !heap_.is_cell(addr)) {
+	return;
+    }
+    set_marked(addr);
+    stack_.push_back(addr);
+}
+
+void heap_gc::mark_term(const term t)
+{
+    switch (t.tag()) {
+    case tag_t::REF: case tag_t::RFW:
+	mark(reinterpret_cast<const ptr_cell &>(t).index());
+	break;
+    case tag_t::STR:
+	mark_structure(reinterpret_cast<const ptr_cell &>(t).index());
+	break;
+    case tag_t::BIG:
+	mark_big(reinterpret_cast<const ptr_cell &>(t).index());
+	break;
+    default:
+	break;
+    }
+}
+
+void heap_gc::mark_structure(size_t index)
+{
+    if (!in_region(index) || !heap_.is_cell(index)) {
+	return;
+    }
+    cell f = get(index);
+    if (f.tag() != tag_t::CON) {
+	return;
+    }
+    size_t arity = reinterpret_cast<const con_cell &>(f).arity();
+    if (is_marked(index) && arity == 0) {
+	return;
+    }
+    set_marked(index);
+    for (size_t i = 1; i <= arity; i++) {
+	mark(index + i);
+    }
+}
+
+void heap_gc::mark_big(size_t index)
+{
+    if (!in_region(index) || is_raw(index) || !heap_.is_cell(index)) {
+	return;
+    }
+    cell hdr = get(index);
+    if (hdr.tag() != tag_t::DAT) {
+	return;
+    }
+    size_t n = reinterpret_cast<const dat_cell &>(hdr).num_cells();
+    for (size_t i = 0; i < n && in_region(index + i); i++) {
+	set_marked(index + i);
+	set_raw(index + i);
+    }
+}
+
+void heap_gc::mark_all()
+{
+    while (!stack_.empty()) {
+	size_t addr = stack_.back();
+	stack_.pop_back();
+	if (is_raw(addr)) {
+	    continue;
+	}
+	cell c = get(addr);
+	switch (c.tag()) {
+	case tag_t::REF: case tag_t::RFW:
+	    mark(reinterpret_cast<const ptr_cell &>(c).index());
+	    break;
+	default:
+	    mark_term(c);
+	    break;
+	}
+    }
+}
+
+size_t heap_gc::forward(size_t addr) const
+{
+    if (addr <= floor_) {
+	return addr;
+    }
+    if (addr >= top_) {
+	return floor_ + live_before_.back();
+    }
+    size_t i = addr - floor_;
+    uint64_t below = marked_[i >> 6] & ((static_cast<uint64_t>(1) << (i & 63)) - 1);
+    return floor_ + live_before_[i >> 6] + __builtin_popcountll(below);
+}
+
+bool heap_gc::relocate(term &t) const
+{
+    switch (t.tag()) {
+    case tag_t::REF: case tag_t::RFW: case tag_t::STR: case tag_t::BIG: {
+	auto &p = reinterpret_cast<ptr_cell &>(t);
+	size_t index = p.index();
+	if (!in_region(index) || !is_marked(index)) {
+	    return false;
+	}
+	p.set_index(forward(index));
+	return true;
+    }
+    default:
+	return false;
+    }
+}
+
+void heap_gc::relocate(code_point &cp) const
+{
+    if (cp.has_wam_code()) {
+	return;
+    }
+    term t = cp.term_code();
+    if (relocate(t)) {
+	cp.set_term_code(t);
+    }
+}
+
+void heap_gc::relocate_cell(size_t addr)
+{
+    term t = get(addr);
+    if (relocate(t)) {
+	heap_[addr] = t;
+    }
+}
+
+//
+// Visit the cells in [scan_from, floor). As scan_from is a heap mark
+// we can parse the cells linearly (and skip the raw data of bignums.)
+//
+template<typename Fn> void heap_gc::for_each_scanned(Fn fn)
+{
+    size_t addr = scan_from_;
+    while (addr < floor_) {
+	if (!heap_.is_cell(addr)) {
+	    // Unused space at the end of a block
+	    addr = (addr / heap_block::MAX_SIZE + 1) * heap_block::MAX_SIZE;
+	    continue;
+	}
+	cell c = get(addr);
+	fn(addr);
+	if (c.tag() == tag_t::DAT) {
+	    addr += reinterpret_cast<const dat_cell &>(c).num_cells();
+	} else {
+	    addr++;
+	}
+    }
+}
+
+//
+// The number of live Y registers of a WAM environment is given by
+// the call instruction before the continuation point of whoever will
+// return to it. num_y_fn() computes this from CP, so we temporarily
+// point CP at the continuation.
+//
+size_t heap_gc::num_y(const code_point &cp)
+{
+    if (!cp.has_wam_code()) {
+	return 0;
+    }
+    code_point saved_cp = interp_.cp();
+    interp_.set_cp(cp);
+    size_t n = interp_.num_y_fn()(&interp_, true);
+    interp_.set_cp(saved_cp);
+    return n;
+}
+
+void heap_gc::compute_num_y()
+{
+    auto add = [this](environment_saved_t ce, const code_point &cp) {
+	if (ce.kind() != ENV_WAM || ce.ce0() == nullptr) {
+	    return;
+	}
+	auto *e = reinterpret_cast<environment_t *>(ce.ce0());
+	size_t n = num_y(cp);
+	auto &current = num_y_[e];
+	if (n > current) current = n;
+    };
+
+    struct visit : public interpreter_base::stack_frame_visitor {
+	visit(std::function<void (environment_saved_t, const code_point &)> add0) : add_(add0) { }
+
+	virtual void visit_naive_environment(environment_naive_t *e) override {
+	    add_(e->ce, e->cp);
+	}
+	virtual void visit_wam_environment(environment_t *e) override {
+	    add_(e->ce, e->cp);
+	}
+	virtual void visit_frozen_environment(environment_frozen_t *e) override {
+	    add_(e->ce, e->cp);
+	}
+	virtual void visit_choice_point(choice_point_t *b) override {
+	    add_(b->ce, b->cp);
+	}
+	virtual void visit_meta_context(meta_context *m) override {
+	    add_(environment_saved_t(m->old_e, m->old_e_kind), m->old_cp);
+	}
+
+	std::function<void (environment_saved_t, const code_point &)> add_;
+    };
+
+    visit v(add);
+    interp_.foreach_stack_frame(v);
+    if (interp_.e0() != nullptr) {
+	add(interp_.save_e(), interp_.cp());
+    }
+}
+
+//
+// Registers and stack frames. 'fn' is called exactly once for every
+// root term location and may update it.
+//
+template<typename Fn> void heap_gc::for_each_root(Fn fn)
+{
+    for (size_t i = 0; i < interpreter_base::MAX_ARGS; i++) {
+	fn(interp_.a(i));
+    }
+    fn(interp_.register_qr_);
+
+    auto fn_cp = [&](code_point &cp) {
+	if (cp.has_wam_code()) {
+	    return;
+	}
+	term t = cp.term_code();
+	fn(t);
+	cp.set_term_code(t);
+    };
+
+    fn_cp(interp_.register_p_);
+    fn_cp(interp_.register_cp_);
+
+    struct visit : public interpreter_base::stack_frame_visitor {
+	visit(heap_gc &gc, Fn &fn0, std::function<void (code_point &)> fn_cp0)
+	    : gc_(gc), fn_(fn0), fn_cp_(fn_cp0) { }
+
+	virtual void visit_naive_environment(environment_naive_t *e) override {
+	    fn_cp_(e->cp);
+	    fn_(e->qr);
+	}
+	virtual void visit_wam_environment(environment_t *e) override {
+	    fn_cp_(e->cp);
+	    auto it = gc_.num_y_.find(e);
+	    size_t n = (it == gc_.num_y_.end()) ? 0 : it->second;
+	    for (size_t i = 0; i < n; i++) {
+		fn_(e->yn[i]);
+	    }
+	}
+	virtual void visit_frozen_environment(environment_frozen_t *e) override {
+	    fn_cp_(e->cp);
+	    fn_cp_(e->p);
+	    fn_(e->qr);
+	    for (size_t i = 0; i < e->num_extra; i++) {
+		fn_(e->extra[i]);
+	    }
+	}
+	virtual void visit_choice_point(choice_point_t *b) override {
+	    fn_cp_(b->cp);
+	    fn_cp_(b->bp);
+	    fn_(b->qr);
+	    for (size_t i = 0; i < b->arity; i++) {
+		fn_(b->ai[i]);
+	    }
+	}
+	virtual void visit_meta_context(meta_context *m) override {
+	    fn_cp_(m->old_p);
+	    fn_cp_(m->old_cp);
+	    fn_(m->old_qr);
+	}
+
+	heap_gc &gc_;
+	Fn &fn_;
+	std::function<void (code_point &)> fn_cp_;
+    };
+
+    visit v(*this, fn, fn_cp);
+    interp_.foreach_stack_frame(v);
+
+    interp_.gc_roots(fn);
+}
+
+size_t heap_gc::collect()
+{
+    compute_num_y();
+
+    //
+    // Mark
+    //
+
+    for_each_root([this](term &t) { mark_term(t); });
+    for_each_scanned([this](size_t addr) { mark_term(get(addr)); });
+
+    // Trailed variables in the region are kept (unwinding will reset
+    // them.) Below the floor the bindings are roots.
+    size_t tr_size = interp_.trail_size();
+    std::unordered_set<size_t> trailed;
+    for (size_t i = 0; i < tr_size; i++) {
+	size_t addr = interp_.trail_get(i);
+	if (in_region(addr)) {
+	    mark(addr);
+	} else if (addr < scan_from_ && heap_.is_cell(addr)) {
+	    trailed.insert(addr);
+	    mark_term(get(addr));
+	}
+    }
+    for (auto addr : remembered_) {
+	if (addr < scan_from_ && heap_.is_cell(addr) &&
+	    trailed.insert(addr).second) {
+	    mark_term(get(addr));
+	}
+    }
+
+    for (auto &fc : interp_.frozen_closures_) {
+	mark(fc.first);
+	mark_term(fc.second);
+    }
+    for (auto addr : heap_.watched()) {
+	mark(addr);
+    }
+
+    mark_all();
+
+    size_t num_words = marked_.size();
+    for (size_t i = 0; i < num_words; i++) {
+	live_before_[i+1] = live_before_[i] + __builtin_popcountll(marked_[i]);
+    }
+    size_t live = live_before_.back();
+    size_t new_top = floor_ + live;
+
+    //
+    // Update pointers (roots and live cells) while all cells are still
+    // at their old addresses.
+    //
+
+    for_each_root([this](term &t) { relocate(t); });
+    for_each_scanned([this](size_t addr) { relocate_cell(addr); });
+    for (auto addr : trailed) {
+	relocate_cell(addr);
+    }
+    for (size_t w = 0; w < num_words; w++) {
+	uint64_t bits = marked_[w] & ~raw_[w];
+	while (bits) {
+	    size_t bit = __builtin_ctzll(bits);
+	    bits &= bits - 1;
+	    relocate_cell(floor_ + (w << 6) + bit);
+	}
+    }
+
+    for (size_t i = 0; i < tr_size; i++) {
+	size_t addr = interp_.trail_get(i);
+	if (in_region(addr)) {
+	    interp_.trail_set(i, forward(addr));
+	}
+    }
+
+    std::vector<std::pair<size_t, term> > closures;
+    for (auto it = interp_.frozen_closures_.begin();
+	 it != interp_.frozen_closures_.end();) {
+	term closure = it->second;
+	relocate(closure);
+	closures.push_back(std::make_pair(forward(it->first), closure));
+	it = interp_.frozen_closures_.erase(it);
+    }
+    for (auto &fc : closures) {
+	interp_.frozen_closures_.insert(fc);
+    }
+
+    std::vector<size_t> watched(heap_.watched());
+    heap_.clear_watched();
+    for (auto addr : watched) {
+	heap_.add_watched(in_region(addr) ? forward(addr) : addr);
+    }
+
+    interp_.var_naming().relocate(floor_, [this](size_t &index) {
+	    if (!in_region(index) || !is_marked(index)) {
+		return false;
+	    }
+	    index = forward(index);
+	    return true;
+	});
+
+    // Heap marks
+    struct visit_h : public interpreter_base::stack_frame_visitor {
+	visit_h(const heap_gc &gc) : gc_(gc) { }
+	virtual void visit_choice_point(choice_point_t *b) override {
+	    b->h = gc_.forward(b->h);
+	}
+	const heap_gc &gc_;
+    };
+    visit_h vh(*this);
+    interp_.foreach_stack_frame(vh);
+    interp_.set_register_hb(forward(interp_.get_register_hb()));
+
+    //
+    // Slide live cells down
+    //
+
+    for (size_t w = 0; w < num_words; w++) {
+	uint64_t bits = marked_[w];
+	size_t dst = floor_ + live_before_[w];
+	while (bits) {
+	    size_t bit = __builtin_ctzll(bits);
+	    bits &= bits - 1;
+	    size_t src = floor_ + (w << 6) + bit;
+	    if (dst != src) {
+		heap_[dst] = get(src);
+	    }
+	    dst++;
+	}
+    }
+
+    heap_.compacted(floor_, new_top);
+
+    return top_ - new_top;
+}
+
+size_t interpreter_base::gc()
+{
+    size_t floor = std::max(top_hb(), get_heap_limit());
+    if (m() != nullptr) {
+	floor = std::max(floor, m()->old_h);
+    }
+
+    // Bindings to cells above the lowest HB this execution may have
+    // had are not trailed.
+    size_t scan_from = std::min(top_hb(), get_register_hb());
+    for (auto *ch = b(); ch != nullptr; ch = ch->b) {
+	scan_from = std::min(scan_from, ch->h);
+    }
+    scan_from = std::min(scan_from, floor);
+
+    static const std::vector<size_t> no_remembered;
+    size_t reclaimed = 0;
+    // Delayed (remote) goals keep terms outside of our reach
+    if (delayed_.empty()) {
+	reclaimed = gc(floor, scan_from, no_remembered);
+    }
+
+    // Give the live region at least as much room to grow before next
+    // collection to keep the cost amortized.
+    size_t live = heap_size() > floor ? heap_size() - floor : 0;
+    if (gc_threshold_ == 0) {
+	gc_next_ = std::numeric_limits<size_t>::max();
+    } else {
+	gc_next_ = heap_size() + std::max(gc_threshold_, live);
+    }
+
+    return reclaimed;
+}
+
+size_t interpreter_base::gc(size_t floor, size_t scan_from,
+			    const std::vector<size_t> &remembered)
+{
+    if (floor >= heap_size()) {
+	return 0;
+    }
+    heap_gc collector(*this, floor, scan_from, remembered);
+    size_t reclaimed = collector.collect();
+    gc_count_++;
+    gc_reclaimed_ += reclaimed;
+    if (is_debug()) {
+	std::cout << "interpreter_base::gc(): floor=" << floor
+		  << " reclaimed=" << reclaimed
+		  << " heap=" << heap_size() << "\n";
+    }
+    return reclaimed;
+}
+
+}}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <common/test/test_home_dir.hpp>
+#include <interp/interpreter.hpp>
+
+//
+// Generate standard_lib_gen.hpp, the precompiled standard library that
+// interpreter::setup_standard_lib() loads. The build runs it (see
+// src/interp/Makefile) whenever the interpreter objects change.
+//
+
+using namespace prologcoin::interp;
+
+int main(int argc, char *argv[])
+{
+    std::string dst_file = find_home_dir(argv[0]) + "/src/interp/standard_lib_gen.hpp";
+
+    std::vector<uint8_t> image;
+    interpreter interp("standard_lib");
+    interp.save_standard_lib_image(image);
+
+    std::ofstream out(dst_file);
+    if (!out) {
+	std::cout << "Failed to open: " << dst_file << std::endl;
+	return 1;
+    }
+
+    out << "// Generated by script/make_standard_lib.cpp. Do not edit.\n"
+	<< "\n"
+	<< "namespace prologcoin { namespace interp {\n"
+	<< "\n"
+	<< "static const uint8_t standard_lib_image[] = {";
+    for (size_t i = 0; i < image.size(); i++) {
+	out << ((i % 16 == 0) ? "\n    " : " ")
+	    << "0x" << std::hex << std::setw(2) << std::setfill('0')
+	    << static_cast<unsigned>(image[i]) << ",";
+    }
+    out << "\n};\n"
+	<< "\n"
+	<< "}}\n";
+
+    std::cout << "Wrote " << image.size() << " bytes to " << dst_file << std::endl;
+
+    return 0;
+}
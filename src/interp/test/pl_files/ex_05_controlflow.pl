@@ -195,3 +195,21 @@ myifthenelse8(A,B,C) :- (member(A, [1,2,foo,baz,foo]), matchit(A,foo) -> foo(B),
 % Expect: Q28 = 42, Q29 = 123
 % Expect: end
 
+
+%
+% Control constructs in a recursive predicate (every call has its own
+% instance of the clause)
+%
+
+classify([], [], []).
+classify([X|Xs], Ps, Ns) :-
+    ( X > 0 -> Ps = [X|Ps1], Ns = Ns1 ; Ps = Ps1, Ns = [X|Ns1] ),
+    \+ X == 0,
+    classify(Xs, Ps1, Ns1).
+
+?- classify([1,-2,3,-4,5], Q30, Q31).
+% Expect: Q30 = [1,3,5], Q31 = [-2,-4]
+% Expect: end
+
+?- classify([1,0,2], Q32, Q33).
+% Expect: fail
@@ -19,3 +19,43 @@ length([X|Xs], N) :-
 ?- length([1,2,3,4,5],Q2).
 % Expect: Q2 = 5
 % Expect: end
+
+%
+% Big integers
+%
+
+?- X is 1152921504606846975 + 1.
+% Expect: X = 1152921504606846976
+% Expect: end
+
+?- X is (1 << 100) >> 98.
+% Expect: X = 4
+% Expect: end
+
+?- X is 2 << -1, Y is -7 >> 1.
+% Expect: X = 1, Y = -4
+% Expect: end
+
+?- X is 340282366920938463463374607431768211456 mod 1000007.
+% Expect: X = 42916
+% Expect: end
+
+?- X is (340282366920938463463374607431768211456 + 5) // 18446744073709551616 - 18446744073709551610.
+% Expect: X = 6
+% Expect: end
+
+?- X is 123456789012345678901234567890 * 98765432109876543210 rem 1000000007.
+% Expect: X = 933239201
+% Expect: end
+
+big_cmp :- X is 1 << 200, X > 1152921504606846975, -5 < X, X >= X, X =< X + 1.
+
+?- big_cmp.
+% Expect: true
+% Expect: end
+
+?- X is 1 << 256, X < 1 << 255.
+% Expect: fail
+
+?- X is 0 - (1 << 100).
+% Expect: Negative big integers are unsupported.
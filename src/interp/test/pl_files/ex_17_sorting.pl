@@ -24,8 +24,8 @@ check_program_state :-
     member(temp_size(0), S),
     member(temp_trail_size(0), S),
     member(num_frozen_closures(0), S),
-    member(num_predicates(33), S),
-    member(num_clauses(307), S).
+    member(num_predicates(44), S),
+    member(num_clauses(330), S).
 
 ?- sort_and_check(256), check_program_state.
 % Expect: true
@@ -0,0 +1,27 @@
+%
+% Small classic benchmark programs. Besides being checked here they are
+% also used by test_wam_dispatch to measure WAM instruction throughput.
+%
+
+app([], Ys, Ys).
+app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).
+
+nrev([], []).
+nrev([X|Xs], Ys) :- nrev(Xs, Rs), app(Rs, [X], Ys).
+
+range(N, N, [N]) :- !.
+range(I, N, [I|Is]) :- I < N, I1 is I + 1, range(I1, N, Is).
+
+fib(0, 1).
+fib(1, 1).
+fib(N, R) :-
+    N > 1,
+    N1 is N - 1, N2 is N - 2,
+    fib(N1, R1), fib(N2, R2),
+    R is R1 + R2.
+
+?- range(1, 10, L), nrev(L, R).
+% Expect: L = [1,2,3,4,5,6,7,8,9,10], R = [10,9,8,7,6,5,4,3,2,1]
+
+?- fib(15, R).
+% Expect: R = 987
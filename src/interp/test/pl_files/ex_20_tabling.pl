@@ -0,0 +1,80 @@
+%
+% Tabling (see table/1)
+%
+
+:- table path/2.
+
+edge(a, b).
+edge(b, c).
+edge(c, a).
+edge(c, d).
+
+% Left recursion; loops without tabling
+path(X, Y) :- path(X, Z), edge(Z, Y).
+path(X, Y) :- edge(X, Y).
+
+reach(X, L) :- findall(Y, path(X, Y), L0), sort(L0, L).
+
+?- reach(a, L).
+% Expect: L = [a,b,c,d]
+% Expect: end
+
+?- reach(d, L).
+% Expect: L = []
+% Expect: end
+
+?- path(b, a).
+% Expect: true
+% Expect: end
+
+% Right recursion over the cycle (an SCC of the variants for a, b and c)
+
+:- table path2/2.
+
+path2(X, Y) :- edge(X, Y).
+path2(X, Y) :- edge(X, Z), path2(Z, Y).
+
+reach2(X, L) :- findall(Y, path2(X, Y), L0), sort(L0, L).
+
+?- reach2(b, L).
+% Expect: L = [a,b,c,d]
+% Expect: end
+
+% Double recursion
+
+:- table conn/2.
+
+conn(X, Y) :- edge(X, Y).
+conn(X, Y) :- conn(X, Z), conn(Z, Y).
+
+conn_all(L) :- findall(X-Y, conn(X, Y), L0), sort(L0, L).
+
+?- conn_all(L).
+% Expect: L = [a-a,a-b,a-c,a-d,b-a,b-b,b-c,b-d,c-a,c-b,c-c,c-d]
+% Expect: end
+
+% Mutual recursion
+
+:- table even/1, odd/1.
+
+even(0).
+even(N) :- odd(M), M < 20, N is M + 1.
+odd(N) :- even(M), M < 20, N is M + 1.
+
+odds(L) :- findall(N, odd(N), L0), sort(L0, L).
+
+?- odds(L).
+% Expect: L = [1,3,5,7,9,11,13,15,17,19]
+% Expect: end
+
+% Without tabling this is exponential
+
+:- table fib/2.
+
+fib(0, 0).
+fib(1, 1).
+fib(N, F) :- N > 1, N1 is N - 1, N2 is N - 2, fib(N1, F1), fib(N2, F2), F is F1 + F2.
+
+?- fib(80, F).
+% Expect: F = 23416728348467685
+% Expect: end
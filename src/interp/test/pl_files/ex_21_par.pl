@@ -0,0 +1,113 @@
+%
+% AND-parallelism with par/2
+%
+% Meta: stdlib
+
+fib(0, 1).
+fib(1, 1).
+fib(N, F) :- N > 1, N1 is N - 1, N2 is N - 2, fib(N1, F1), fib(N2, F2), F is F1 + F2.
+
+% (Our own list predicates, as the imported library predicates are
+%  WAM code that isn't visible to the ordinary run.)
+mem(X, [X|_]).
+mem(X, [_|Xs]) :- mem(X, Xs).
+
+app([], Ys, Ys).
+app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).
+
+len([], 0).
+len([_|Xs], N) :- len(Xs, N0), N is N0 + 1.
+
+pfib(N, F) :- N1 is N - 1, N2 is N - 2, par(fib(N1, F1), fib(N2, F2)), F is F1 + F2.
+
+?- pfib(15, F).
+% Expect: F = 987
+% Expect: end
+
+% Nested par/2 terms are flattened into independent goals
+
+?- par(fib(10, A), par(fib(11, B), fib(12, C))).
+% Expect: A = 89, B = 144, C = 233
+% Expect: end
+
+% par/2 succeeds at most once
+
+?- par(mem(X, [1,2,3]), mem(Y, [a,b])).
+% Expect: X = 1, Y = a
+% Expect: end
+
+?- par(mem(X, [1,2,3]), fib(5, 9)).
+% Expect: fail
+
+% Shared unbound variables; executed in sequence
+
+?- par(mem(X, [1,2,3]), X > 2).
+% Expect: X = 3
+% Expect: end
+
+% Structures come back as copies
+
+?- par(len(L, 3), app(P, Q, [1,2])).
+% Expect: L = [_, _, _], P = [], Q = [1,2]
+% Expect: end
+
+% Clauses asserted since the last call are visible to the workers
+
+:- assert(color(red)).
+
+?- par(color(X), fib(3, Y)).
+% Expect: X = red, Y = 3
+% Expect: end
+
+:- assert(color(green)), retract(color(red)).
+
+?- par(color(X), fib(3, Y)).
+% Expect: X = green, Y = 3
+% Expect: end
+
+?- par(foo(1), true).
+% Expect: Undefined predicate foo/1
+
+%
+% OR-parallel findall with par_findall/3
+%
+
+queen_size(5).
+
+col(1). col(2). col(3). col(4). col(5).
+
+queens(Qs) :- col(Q), queen_size(N), N1 is N - 1, place(N1, [Q], Qs).
+
+place(0, Qs, Qs).
+place(K, Qs0, Qs) :- K > 0, col(Q), safe(Q, Qs0, 1), K1 is K - 1, place(K1, [Q|Qs0], Qs).
+
+safe(_, [], _).
+safe(Q, [Q1|Qs], D) :-
+    Q \== Q1, A is Q1 + D, A \== Q, B is Q1 - D, B \== Q,
+    D1 is D + 1, safe(Q, Qs, D1).
+
+% Same answers in the same order as findall/3
+
+same_findall(T, G, L) :- findall(T, G, L0), par_findall(T, G, L), L == L0.
+
+?- same_findall(Qs, queens(Qs), L), len(L, N).
+% Expect: L = [[4,2,5,3,1],[3,5,2,4,1],[5,3,1,4,2],[4,1,3,5,2],[5,2,4,1,3],[1,4,2,5,3],[2,5,3,1,4],[1,3,5,2,4],[3,1,4,2,5],[2,4,1,3,5]], N = 10
+% Expect: end
+
+?- par_findall(X-Y, (col(X), Y is X * X), L).
+% Expect: L = [1-1,2-4,3-9,4-16,5-25]
+% Expect: end
+
+?- par_findall(X, (col(X), X > 5), L).
+% Expect: L = []
+% Expect: end
+
+?- par_findall(X, color(X), L).
+% Expect: L = [green]
+% Expect: end
+
+% A partially instantiated goal
+
+?- par_findall(Q, queens([Q|_]), L).
+% Expect: L = [4,3,5,4,5,1,2,1,3,2]
+% Expect: end
@@ -0,0 +1,66 @@
+%
+% Dynamic predicates (logical update view)
+%
+% A call sees the clauses as they were when it was made; clauses
+% asserted or retracted meanwhile don't change what it backtracks into.
+%
+
+reset :- retractall(cnt(_)), assertz(cnt(1)), assertz(cnt(2)), assertz(cnt(3)).
+
+all(L) :- findall(X, cnt(X), L).
+
+% Clauses added during the iteration are not seen by it
+
+grow(L) :- reset, findall(X, (cnt(X), Y is X + 10, assertz(cnt(Y))), L).
+
+?- grow(L), all(L2).
+% Expect: L = [1,2,3], L2 = [1,2,3,11,12,13]
+% Expect: end
+
+grow_first(L) :- reset, findall(X, (cnt(X), X < 3, Y is X - 10, asserta(cnt(Y))), L).
+
+?- grow_first(L), all(L2).
+% Expect: L = [1,2], L2 = [-8,-9,1,2,3]
+% Expect: end
+
+% Retracted clauses are still seen by the iteration
+
+shrink(L) :- reset, findall(X, (cnt(X), retractall(cnt(_))), L).
+
+?- shrink(L), all(L2).
+% Expect: L = [1,2,3], L2 = []
+% Expect: end
+
+shrink_one(L) :- reset, findall(X, (cnt(X), (retract(cnt(3)) -> true ; true)), L).
+
+?- shrink_one(L), all(L2).
+% Expect: L = [1,2,3], L2 = [1,2]
+% Expect: end
+
+% ...even when the predicate is compacted before we backtrack
+
+churn(0) :- !.
+churn(N) :- assertz(cnt(N)), retract(cnt(N)), N1 is N - 1, churn(N1).
+
+shrink_churn(L) :- reset, findall(X, (cnt(X), retractall(cnt(_)), churn(100)), L).
+
+?- shrink_churn(L), all(L2).
+% Expect: L = [1,2,3], L2 = []
+% Expect: end
+
+% Mutable state as a fact (replaced many times)
+
+set_counter(N) :- retractall(counter(_)), assertz(counter(N)).
+
+bump(0) :- !.
+bump(N) :- counter(C), C1 is C + 1, set_counter(C1), N1 is N - 1, bump(N1).
+
+?- set_counter(0), bump(1000), counter(C).
+% Expect: C = 1000
+% Expect: end
+
+% Retract of a clause with a variable in the indexed argument
+
+?- reset, assertz(cnt(_)), retract(cnt(2)), findall(X, (cnt(X), integer(X)), L), cnt(foo).
+% Expect: L = [1,3]
+% Expect: end
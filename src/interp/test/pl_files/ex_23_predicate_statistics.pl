@@ -0,0 +1,66 @@
+%
+% Per-predicate port counts (calls, exits, fails, redos) and cost
+%
+%
+% Meta: stdlib
+% Meta: profiling
+
+count(0) :- !.
+count(N) :- N1 is N - 1, count(N1).
+
+mem(X, [X|_]).
+mem(X, [_|T]) :- mem(X, T).
+
+len([], 0).
+len([_|T], N) :- len(T, N0), N is N0 + 1.
+
+stat(K, [K|_]) :- !.
+stat(K, [_|S]) :- stat(K, S).
+
+ports(PI, C, E, F, R) :-
+    predicate_statistics(PI, S),
+    stat(calls(C), S), stat(exits(E), S),
+    stat(fails(F), S), stat(redos(R), S).
+
+% Deterministic (tail) recursion
+
+?- predicate_statistics_start, count(10), predicate_statistics_stop, ports(count/1, C, E, F, R).
+% Expect: C = 11, E = 11, F = 0, R = 0
+% Expect: end
+
+% Nondeterministic: every solution is an exit and every retry a redo
+
+?- predicate_statistics_start, findall(X, mem(X, [a,b,c]), L), predicate_statistics_stop, ports(mem/2, C, E, F, R).
+% Expect: L = [a,b,c], C = 4, E = 6, F = 4, R = 6
+% Expect: end
+
+?- predicate_statistics_start, (mem(b, [a,b,c]) -> true ; true), predicate_statistics_stop, ports(mem/2, C, E, F, R).
+% Expect: C = 2, E = 2, F = 0, R = 0
+% Expect: end
+
+% Non-tail recursion: inclusive cost is counted once for the outermost
+% call and includes what the predicates it calls cost
+
+w(L, N) :- len(L, N), N > 0.
+
+cost(PI, I, X) :-
+    predicate_statistics(PI, S),
+    stat(inclusive_cost(I), S), stat(exclusive_cost(X), S).
+
+check_cost(Ok) :-
+    cost(w/2, WI, WX), cost(len/2, LI, LX),
+    (WI is WX + LI, LI >= LX, LX > 0 -> Ok = yes ; Ok = no).
+
+?- predicate_statistics_start, w([a,b,c,d], N), predicate_statistics_stop, check_cost(Ok).
+% Expect: N = 4, Ok = yes
+% Expect: end
+
+?- predicate_statistics_start, len([a,b,c,d], N), \+ len([a], 2), predicate_statistics_stop, ports(len/2, C, E, F, R).
+% Expect: N = 4, C = 7, E = 6, F = 1, R = 0
+% Expect: end
+
+% Statistics are only kept while counting
+
+?- predicate_statistics_start, predicate_statistics_stop, \+ predicate_statistics(len/2, _).
+% Expect: true
+% Expect: end
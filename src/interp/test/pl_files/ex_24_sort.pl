@@ -0,0 +1,59 @@
+%
+% Sorting builtins (msort/2, keysort/2, sort/2 and sort/4)
+%
+
+?- msort([c,a,b,a,f(x),2,1,f(a,b),X], L).
+% Expect: L = [X,1,2,a,a,b,c,f(x),f(a,b)]
+% Expect: end
+
+?- sort([f(a),c,f(a),b,c], L).
+% Expect: L = [b,c,f(a)]
+% Expect: end
+
+% Already sorted input and reversed input
+
+?- msort([1,2,2,3,4], L).
+% Expect: L = [1,2,2,3,4]
+% Expect: end
+
+?- msort([5,4,3,2,1], L).
+% Expect: L = [1,2,3,4,5]
+% Expect: end
+
+% Runs of different lengths
+
+?- msort([3,4,5,1,2,9,8,7,0,6,6], L).
+% Expect: L = [0,1,2,3,4,5,6,6,7,8,9]
+% Expect: end
+
+% keysort/2 is stable
+
+?- keysort([b-1,a-2,b-0,a-1,c-5,a-0], L).
+% Expect: L = [a-2,a-1,a-0,b-1,b-0,c-5]
+% Expect: end
+
+?- keysort([], L).
+% Expect: L = []
+% Expect: end
+
+% sort/4 on a key argument in all orders
+
+?- sort(1, '@<', [f(2,a),f(1,b),f(2,c)], L).
+% Expect: L = [f(1,b),f(2,a)]
+% Expect: end
+
+?- sort(1, '@=<', [f(2,a),f(1,b),f(2,c)], L).
+% Expect: L = [f(1,b),f(2,a),f(2,c)]
+% Expect: end
+
+?- sort(1, '@>', [f(2,a),f(1,b),f(2,c)], L).
+% Expect: L = [f(2,a),f(1,b)]
+% Expect: end
+
+?- sort(2, '@>=', [f(2,a),f(1,b),f(2,c),f(3,b)], L).
+% Expect: L = [f(2,c),f(1,b),f(3,b),f(2,a)]
+% Expect: end
+
+?- sort(0, '@>=', [b,a,c,a], L).
+% Expect: L = [c,b,a,a]
+% Expect: end
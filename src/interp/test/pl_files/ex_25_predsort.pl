@@ -0,0 +1,21 @@
+%
+% predsort/3 (from the standard library)
+%
+
+% Meta: WAM-only
+% Meta: stdlib
+
+% predsort/3 drops elements that compare =
+
+by_length(O, A, B) :- len(A, N), len(B, M), compare(O, N, M).
+
+len([], 0).
+len([_|Xs], N) :- len(Xs, N0), N is N0 + 1.
+
+?- predsort(by_length, [[a,b],[c],[d,e,f],[g,h],[],[i]], L).
+% Expect: L = [[],[c],[a,b],[d,e,f]]
+% Expect: end
+
+?- predsort(compare, [3,1,2,5,4,1,3], L).
+% Expect: L = [1,2,3,4,5]
+% Expect: end
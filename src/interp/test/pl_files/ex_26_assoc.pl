@@ -0,0 +1,62 @@
+%
+% Assoc builtins (AVL trees on the heap)
+%
+
+puts([], A, A).
+puts([K-V|Ps], A0, A) :- put_assoc(K, A0, V, A1), puts(Ps, A1, A).
+
+?- list_to_assoc([c-3,a-1,b-2], A), assoc_to_list(A, L).
+% Expect: A = t(b,2,=,t(a,1,=,t,t),t(c,3,=,t,t)), L = [a-1,b-2,c-3]
+% Expect: end
+
+?- empty_assoc(A0), puts([1-a,2-b,3-c,4-d,5-e,6-f,7-g], A0, A), assoc_to_list(A, L).
+% Expect: A0 = t, A = t(4,d,=,t(2,b,=,t(1,a,=,t,t),t(3,c,=,t,t)),t(6,f,=,t(5,e,=,t,t),t(7,g,=,t,t))), L = [1-a,2-b,3-c,4-d,5-e,6-f,7-g]
+% Expect: end
+
+% Double rotations
+
+?- empty_assoc(A0), puts([3-c,1-a,2-b], A0, A).
+% Expect: A0 = t, A = t(2,b,=,t(1,a,=,t,t),t(3,c,=,t,t))
+% Expect: end
+
+?- empty_assoc(A0), puts([1-a,3-c,2-b], A0, A).
+% Expect: A0 = t, A = t(2,b,=,t(1,a,=,t,t),t(3,c,=,t,t))
+% Expect: end
+
+% Replacing a value
+
+?- list_to_assoc([a-1,b-2], A0), put_assoc(a, A0, 10, A), get_assoc(a, A, X), get_assoc(a, A0, Y).
+% Expect: A0 = t(b,2,>,t(a,1,=,t,t),t), A = t(b,2,>,t(a,10,=,t,t),t), X = 10, Y = 1
+% Expect: end
+
+?- list_to_assoc([f(x)-1,g-2], A), get_assoc(f(x), A, X).
+% Expect: A = t(f(x),1,>,t(g,2,=,t,t),t), X = 1
+% Expect: end
+
+?- list_to_assoc([a-1], A), \+ get_assoc(b, A, _).
+% Expect: A = t(a,1,=,t,t)
+% Expect: end
+
+% Updates are undone on backtracking, and the old version is unchanged
+
+?- list_to_assoc([a-1], A0), (put_assoc(b, A0, 2, A), get_assoc(b, A, 2), fail ; true), assoc_to_list(A0, L).
+% Expect: A0 = t(a,1,=,t,t), L = [a-1]
+% Expect: end
+
+% A larger tree agrees with the sorted input
+
+range(N, N, []) :- !.
+range(I, N, [I-I|Ps]) :- I1 is I + 1, range(I1, N, Ps).
+
+check_range(N) :-
+    range(0, N, Ps), reverse(Ps, Rs),
+    empty_assoc(A0), puts(Rs, A0, A),
+    assoc_to_list(A, L), L = Ps,
+    list_to_assoc(Rs, A2), assoc_to_list(A2, L).
+
+reverse(Xs, Ys) :- reverse(Xs, [], Ys).
+reverse([], Ys, Ys).
+reverse([X|Xs], Acc, Ys) :- reverse(Xs, [X|Acc], Ys).
+
+?- check_range(1000).
+% Expect: true
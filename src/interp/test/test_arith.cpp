@@ -0,0 +1,205 @@
+#include <random>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+using namespace boost::multiprecision;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static term new_number(interpreter &interp, const cpp_int &v)
+{
+    if (v >= int_cell::min().value() && v <= int_cell::max().value()) {
+	return int_cell(static_cast<int64_t>(v));
+    }
+    assert(v > 0);
+    size_t nbits = ((msb(v) + 1 + 7) / 8) * 8;
+    term big = interp.new_big(nbits);
+    interp.set_big(big, v);
+    return big;
+}
+
+static cpp_int get_number(interpreter &interp, const term t)
+{
+    if (t.tag() == tag_t::INT) {
+	return cpp_int(reinterpret_cast<const int_cell &>(t).value());
+    }
+    assert(t.tag() == tag_t::BIG);
+    cpp_int v;
+    size_t nbits;
+    interp.get_big(t, v, nbits);
+    return v;
+}
+
+static cpp_int random_number(std::mt19937_64 &rnd, bool allow_negative)
+{
+    size_t nbits = 1 + rnd() % 256;
+    cpp_int v = 0;
+    for (size_t i = 0; i < 4; i++) {
+	v = (v << 64) | cpp_int(rnd());
+    }
+    v >>= (256 - nbits);
+    if (allow_negative && nbits <= 60 && rnd() % 2 == 0) {
+	v = -v;
+    }
+    return v;
+}
+
+static cpp_int floor_div(const cpp_int &a, const cpp_int &b)
+{
+    cpp_int q = a / b;
+    if (q*b != a && ((a < 0) != (b < 0))) {
+	q -= 1;
+    }
+    return q;
+}
+
+static void test_arith_big()
+{
+    header( "test_arith_big()" );
+
+    interpreter interp("test");
+    std::mt19937_64 rnd(42);
+
+    static const char *ops[] = { "+", "-", "*", "//", "rem", "div", "mod",
+				 "<<", ">>" };
+
+    size_t num_checked = 0, num_negative = 0;
+    for (size_t i = 0; i < 2000; i++) {
+	for (auto *op : ops) {
+	    std::string name = op;
+	    cpp_int a = random_number(rnd, true);
+	    cpp_int b = random_number(rnd, true);
+	    if (name == "<<" || name == ">>") {
+		b = rnd() % 300;
+	    }
+	    if (b == 0 && name != "+" && name != "-" && name != "*" &&
+		name != "<<" && name != ">>") {
+		continue;
+	    }
+	    cpp_int expect;
+	    if (name == "+") expect = a + b;
+	    else if (name == "-") expect = a - b;
+	    else if (name == "*") expect = a * b;
+	    else if (name == "//") expect = a / b;
+	    else if (name == "rem") expect = a % b;
+	    else if (name == "div") expect = floor_div(a, b);
+	    else if (name == "mod") expect = a - floor_div(a, b)*b;
+	    else if (name == "<<") expect = a << static_cast<unsigned>(b);
+	    else if (name == ">>") expect = floor_div(a, cpp_int(1) << static_cast<unsigned>(b));
+
+	    term expr = interp.new_term(interp.functor(name, 2),
+					{new_number(interp, a),
+					 new_number(interp, b)});
+	    if (expect < int_cell::min().value()) {
+		bool thrown = false;
+		try {
+		    interp.arith().eval(expr, "test");
+		} catch (arithmetic_exception &) {
+		    thrown = true;
+		}
+		assert(thrown);
+		num_negative++;
+		continue;
+	    }
+	    term result = interp.arith().eval(expr, "test");
+	    cpp_int actual = get_number(interp, result);
+	    if (actual != expect) {
+		std::cout << a << " " << name << " " << b << ": expected "
+			  << expect << ", got " << actual << "\n";
+	    }
+	    assert(actual == expect);
+	    num_checked++;
+
+	    // Comparison agrees with cpp_int
+	    int cmp = interp.arith().compare(new_number(interp, a),
+					     new_number(interp, b));
+	    assert(cmp == (a < b ? -1 : (a > b ? 1 : 0)));
+	}
+    }
+
+    std::cout << "Checked " << num_checked << " results ("
+	      << num_negative << " out of range)\n";
+}
+
+static void test_arith_big_time()
+{
+    header( "test_arith_big_time()" );
+
+    interpreter interp("test");
+    std::mt19937_64 rnd(4711);
+
+    // 256-bit operands
+    cpp_int a = 0, b = 0;
+    for (size_t i = 0; i < 4; i++) {
+	a = (a << 64) | cpp_int(rnd() | (static_cast<uint64_t>(1) << 63));
+	b = (b << 64) | cpp_int(rnd() | (static_cast<uint64_t>(1) << 63));
+    }
+    term big_a = new_number(interp, a), big_b = new_number(interp, b);
+
+    static const size_t N = 20000;
+    static const char *ops[] = { "+", "-", "*" };
+
+    for (auto *op : ops) {
+	std::string name = op;
+	term expr = interp.new_term(interp.functor(name, 2), {big_a, big_b});
+
+	auto start = utime::now();
+	for (size_t i = 0; i < N; i++) {
+	    interp.arith().eval(expr, "test");
+	}
+	auto native_ns = (utime::now() - start).in_us() * 1000 / N;
+
+	// The same operation as a round trip through cpp_int
+	start = utime::now();
+	for (size_t i = 0; i < N; i++) {
+	    cpp_int x, y;
+	    size_t nbits;
+	    interp.get_big(big_a, x, nbits);
+	    interp.get_big(big_b, y, nbits);
+	    cpp_int r;
+	    if (name == "+") r = x + y;
+	    else if (name == "-") r = x - y;
+	    else r = x * y;
+	    new_number(interp, r);
+	}
+	auto cpp_int_ns = (utime::now() - start).in_us() * 1000 / N;
+
+	std::cout << "256-bit " << name << ": native " << native_ns
+		  << " ns, cpp_int " << cpp_int_ns << " ns\n";
+	assert(native_ns < cpp_int_ns);
+    }
+
+    // is/2 on 256-bit operands
+    interp.load_program(R"PROG(
+loop(0, _, _, X, X) :- !.
+loop(N, A, B, X0, X) :- X1 is (X0 + A*B) >> 256, N1 is N - 1, loop(N1, A, B, X1, X).
+)PROG");
+    std::string goal = "loop(" + boost::lexical_cast<std::string>(N) + ", "
+	+ a.str() + ", " + b.str() + ", 0, X).";
+    term query = interp.parse(goal);
+    auto start = utime::now();
+    bool ok = interp.execute(query);
+    auto loop_ns = (utime::now() - start).in_us() * 1000 / N;
+    assert(ok);
+    std::cout << "is/2 on 256-bit operands: " << loop_ns
+	      << " ns per iteration (" << interp.get_result(false) << ")\n";
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+    test_arith_big();
+    test_arith_big_time();
+
+    return 0;
+}
@@ -88,6 +88,8 @@ static inline void process_meta(interpreter &interp, std::string &comments,
 	    interp.setup_standard_lib();
 	} else if (cmd == "fileio on") {
 	    interp.enable_file_io();
+	} else if (cmd == "profiling") {
+	    interp.enable_profiling();
 	} else if (cmd == "WAM-only") {
             opt["WAM-only"] = 1;
 	} else if (cmd == "retain state") {
@@ -0,0 +1,141 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static const char *program = R"PROG(
+nrev([],[]).
+nrev([X|Xs],Ys) :- nrev(Xs,Zs), append(Zs,[X],Ys).
+color(red).
+)PROG";
+
+static std::string run_goal(interpreter &interp, const std::string &goal)
+{
+    term query = interp.parse(goal);
+    if (!interp.execute(query)) {
+	return "fail";
+    }
+    return interp.get_result(false);
+}
+
+static const char *goals[] = {
+    "nrev([1,2,3,4],X).",
+    "member(X,[a,b]), length([1,2],N).",
+    "findall(C, color(C), L).",
+    "sort([c,b,a,b], L).",
+};
+
+static void test_fork_same()
+{
+    header( "test_fork_same()" );
+
+    interpreter base("base");
+    base.setup_standard_lib();
+    base.load_program(program);
+    base.compile();
+
+    std::vector<std::string> expect;
+    for (auto *goal : goals) {
+	expect.push_back(run_goal(base, goal));
+    }
+
+    base.reset();
+    base.snapshot();
+
+    for (size_t i = 0; i < 3; i++) {
+	interpreter f("fork");
+	f.fork(base);
+	for (size_t j = 0; j < sizeof(goals)/sizeof(goals[0]); j++) {
+	    auto r = run_goal(f, goals[j]);
+	    std::cout << goals[j] << " -> " << r << "\n";
+	    assert(r == expect[j]);
+	}
+    }
+}
+
+static void test_fork_isolation()
+{
+    header( "test_fork_isolation()" );
+
+    interpreter base("base");
+    base.setup_standard_lib();
+    base.load_program(program);
+    base.compile();
+    base.reset();
+    base.snapshot();
+
+    size_t base_heap_size = base.heap_size();
+
+    interpreter f1("fork1");
+    f1.fork(base);
+    assert(f1.heap_size() == base_heap_size);
+
+    auto r1 = run_goal(f1, "assert(color(green)), findall(C, color(C), L).");
+    std::cout << "fork1: " << r1 << "\n";
+    assert(r1 == "L = [red,green]");
+    assert(f1.heap_size() > base_heap_size);
+
+    // A new fork doesn't see the new clause (or the heap cells that
+    // fork1 wrote) and the base is unchanged.
+    interpreter f2("fork2");
+    f2.fork(base);
+    assert(f2.heap_size() == base_heap_size);
+    auto r2 = run_goal(f2, "findall(C, color(C), L).");
+    std::cout << "fork2: " << r2 << "\n";
+    assert(r2 == "L = [red]");
+
+    assert(base.heap_size() == base_heap_size);
+}
+
+static void test_fork_time()
+{
+    header( "test_fork_time()" );
+
+    interpreter base("base");
+    base.setup_standard_lib();
+    base.compile();
+    base.reset();
+    base.snapshot();
+
+    static const size_t N = 20;
+
+    auto start = utime::now();
+    for (size_t i = 0; i < N; i++) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.compile();
+    }
+    auto setup_us = (utime::now() - start).in_us() / N;
+
+    start = utime::now();
+    for (size_t i = 0; i < N; i++) {
+	interpreter interp("test");
+	interp.fork(base);
+    }
+    auto fork_us = (utime::now() - start).in_us() / N;
+
+    std::cout << "setup_standard_lib: " << setup_us << " us, "
+	      << "fork: " << fork_us << " us (incl. construction)\n";
+
+    assert(fork_us < setup_us);
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+    test_fork_same();
+    test_fork_isolation();
+    test_fork_time();
+
+    return 0;
+}
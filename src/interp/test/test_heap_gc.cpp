@@ -0,0 +1,113 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+//
+// Run goals that create lots of garbage with the heap collector
+// disabled and then with a small threshold. Both must give the same
+// answers (including on backtracking) and the same cost, and the
+// collected run must end up with a smaller heap at the first answer.
+//
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static const char *program = R"PROG(
+app([], Ys, Ys).
+app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).
+
+nrev([], []).
+nrev([X|Xs], Ys) :- nrev(Xs, Rs), app(Rs, [X], Ys).
+
+range(N, N, [N]) :- !.
+range(I, N, [I|Is]) :- I < N, I1 is I + 1, range(I1, N, Is).
+
+churn(0, L, L) :- !.
+churn(N, L, R) :- nrev(L, R0), nrev(R0, R1), N1 is N - 1, churn(N1, R1, R).
+
+pick(X, [X|_]).
+pick(X, [_|Xs]) :- pick(X, Xs).
+
+big(0, X, X) :- !.
+big(N, _, X) :- range(1, 32, L), bytes_number(L, X1), nrev(L, _), N1 is N - 1, big(N1, X1, X).
+
+keep(0, Acc, Acc) :- !.
+keep(N, Acc, R) :- range(1, 20, L), nrev(L, [H|_]), N1 is N - 1, keep(N1, f(H, Acc), R).
+)PROG";
+
+struct gc_result {
+    std::vector<std::string> answers;
+    uint64_t cost;
+    size_t heap_size;
+    size_t gc_count;
+};
+
+static gc_result run_goal(const std::string &goal, bool wam, size_t threshold)
+{
+    interpreter interp("test");
+    interp.load_program(program);
+    if (wam) {
+	interp.compile();
+	interp.set_wam_enabled(true);
+    }
+    interp.set_gc_threshold(threshold);
+
+    gc_result r;
+    term query = interp.parse(goal);
+    bool ok = interp.execute(query);
+    r.cost = interp.accumulated_cost();
+    r.heap_size = interp.heap_size();
+    while (ok) {
+	r.answers.push_back(interp.get_result(false));
+	ok = interp.next();
+    }
+    r.gc_count = interp.gc_count();
+    return r;
+}
+
+static void test_gc(const std::string &name, const std::string &goal)
+{
+    header( "test_gc " + name );
+
+    std::cout << "Goal: " << goal << "\n";
+
+    for (int wam = 0; wam <= 1; wam++) {
+	auto plain = run_goal(goal, wam, 0);
+	auto collected = run_goal(goal, wam, 2000);
+
+	std::cout << (wam ? "wam: " : "naive: ")
+		  << plain.answers.size() << " answers, heap "
+		  << plain.heap_size << " -> " << collected.heap_size
+		  << " (" << collected.gc_count << " collections)\n";
+	if (!plain.answers.empty()) {
+	    std::cout << "First answer: " << plain.answers[0].substr(0, 60) << "\n";
+	}
+
+	assert(!plain.answers.empty());
+	assert(plain.answers == collected.answers);
+	assert(plain.cost == collected.cost);
+	assert(plain.gc_count == 0);
+	assert(collected.gc_count > 0);
+	assert(collected.heap_size < plain.heap_size);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+    test_gc("churn", "range(1, 30, L), churn(20, L, R).");
+    test_gc("keep", "keep(200, nil, R).");
+    test_gc("backtrack", "pick(X, [1,2,3]), range(1, 30, L), churn(10, L, R), X >= 2.");
+    test_gc("bignum", "big(300, 0, X), bytes_number(L, X).");
+    test_gc("findall", "findall(R, (pick(X, [1,2,3,4]), range(1, 20, L), churn(5, L, [R|_])), Rs), range(1, 30, L), churn(10, L, _).");
+    test_gc("freeze", "freeze(X, Y = done(X)), range(1, 30, L), churn(10, L, R), X = 1.");
+
+    return 0;
+}
@@ -1,7 +1,11 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
 #include "../../common/term_tools.hpp"
 #include "../../common/term_serializer.hpp"
 #include "../interpreter.hpp"
+#include "../builtins.hpp"
 
 using namespace prologcoin::common;
 using namespace prologcoin::interp;
@@ -335,6 +339,634 @@ static void test_interpreter_freeze_preprocess()
     */
 }
 
+static void test_multi_arg_indexing()
+{
+    header("test_multi_arg_indexing()");
+
+    // The first argument does not discriminate; the second and third
+    // do. A call with any of them bound should not leave a choice point.
+    std::string program;
+    for (size_t i = 1; i <= 20; i++) {
+	auto istr = boost::lexical_cast<std::string>(i);
+	program += "utxo(tx(" + istr + "), key" + istr + ", "
+	         + boost::lexical_cast<std::string>(i*10) + ", " + istr + ").\n";
+    }
+
+    for (size_t mode = 0; mode < 2; mode++) {
+	bool use_wam = mode == 1;
+	std::cout << (use_wam ? "WAM" : "Naive") << " mode:\n";
+
+	interpreter interp("test");
+	interp.load_program(program);
+	interp.set_wam_enabled(use_wam);
+	if (use_wam) {
+	    interp.compile();
+	}
+
+	std::vector<std::pair<std::string, std::string> > checks = {
+	    { "utxo(T, key7, H, V).", "T = tx(7), H = 70, V = 7" },
+	    { "utxo(T, K, 130, V).", "T = tx(13), K = key13, V = 13" },
+	    { "utxo(tx(5), K, 50, V).", "K = key5, V = 5" } };
+
+	for (auto &check : checks) {
+	    term qr = interp.parse(check.first);
+	    std::cout << "?- " << interp.to_string(qr) << "\n";
+	    bool ok = interp.execute(qr);
+	    assert(ok);
+	    std::cout << interp.get_result(false) << "\n";
+	    assert(check_terms(interp.get_result(false), check.second));
+	    assert(!interp.has_more());
+	}
+
+	// Nothing bound; all clauses are candidates
+	term qr = interp.parse("utxo(T, K, H, V).");
+	size_t count = 0;
+	for (bool ok = interp.execute(qr); ok; ok = interp.next()) {
+	    count++;
+	}
+	assert(count == 20);
+    }
+}
+
+// High-water marks of the program stack and the heap for each window
+// of LCO_WINDOW iterations of count/2, recorded by probe/1.
+static const int64_t LCO_WINDOW = 100000;
+static const int64_t LCO_STACK_SAMPLE = 1000;
+static std::vector<std::pair<size_t, size_t> > lco_high_water;
+
+static bool lco_probe(interpreter_base &interp, size_t arity, term args[])
+{
+    auto i = reinterpret_cast<const int_cell &>(args[0]).value();
+    size_t w = static_cast<size_t>(i / LCO_WINDOW);
+    if (w >= lco_high_water.size()) {
+	lco_high_water.resize(w + 1);
+    }
+    auto &hw = lco_high_water[w];
+    hw.second = std::max(hw.second, interp.heap_size());
+    if (i % LCO_STACK_SAMPLE != 0) {
+	return true;
+    }
+    // The program stack size is only available through program_state/1
+    term state = interp.new_ref();
+    builtins::program_state_1(interp, 1, &state);
+    term lst = interp.deref(state);
+    while (interp.is_dotted_pair(lst)) {
+	term e = interp.arg(lst, 0);
+	if (interp.functor(e) == interp.functor("program_stack_size", 1)) {
+	    term n = interp.arg(e, 0);
+	    auto program_stack_size = reinterpret_cast<const int_cell &>(n).value();
+	    hw.first = std::max(hw.first, static_cast<size_t>(program_stack_size));
+	}
+	lst = interp.arg(lst, 1);
+    }
+    return true;
+}
+
+static void test_last_call_optimization()
+{
+    header("test_last_call_optimization()");
+
+    // count/2 runs far deeper than the stack would allow without last
+    // call optimization. With it the stack doesn't grow at all, and the
+    // heap is kept bounded by the garbage collector, so the high-water
+    // marks must be the same for every window of iterations. (A leak of
+    // a cell every 100 iterations would exceed the slack.)
+    static const size_t ITERATIONS = 1000000;
+    static const size_t HEAP_SLACK = LCO_WINDOW / 100;
+    const std::string program =
+	"count(N, N) :- !.\n"
+	"count(I, N) :- probe(I), I1 is I + 1, count(I1, N).\n";
+
+    interpreter interp("test");
+    interp.load_builtin(con_cell("probe", 1), &lco_probe);
+    interp.load_program(program);
+
+    term qr = interp.parse("count(0, 100000).");
+    interp.set_lco(false);
+    bool overflow = false;
+    try {
+	interp.execute(qr);
+    } catch (interpreter_exception_stack_overflow &ex) {
+	std::cout << "Without LCO: " << ex.what() << "\n";
+	overflow = true;
+    }
+    assert(overflow);
+
+    interp.reset();
+    interp.set_lco(true);
+    lco_high_water.clear();
+    auto start = boost::posix_time::microsec_clock::local_time();
+    qr = interp.parse("count(0, " + boost::lexical_cast<std::string>(ITERATIONS) + ").");
+    bool ok = interp.execute(qr);
+    assert(ok);
+    auto stop = boost::posix_time::microsec_clock::local_time();
+    std::cout << ITERATIONS << " iterations: "
+	      << (stop - start).total_milliseconds() << " ms, "
+	      << interp.gc_count() << " collections\n";
+
+    assert(lco_high_water.size() == ITERATIONS / LCO_WINDOW);
+    auto &hw0 = lco_high_water[0];
+    for (size_t w = 0; w < lco_high_water.size(); w++) {
+	auto &hw = lco_high_water[w];
+	std::cout << "Iterations " << w * LCO_WINDOW << "-: stack "
+		  << hw.first << ", heap " << hw.second << "\n";
+	assert(hw.first == hw0.first);
+	assert(hw.second <= hw0.second + HEAP_SLACK);
+    }
+}
+
+static void test_clause_instance_cost()
+{
+    header("test_clause_instance_cost()");
+
+    // The first instance of a clause is a term copy, the later ones are
+    // made from the cached cells. Both must cost the same.
+    const std::string program =
+	"classify([], [], []).\n"
+	"classify([X|Xs], Ps, Ns) :-\n"
+	"    ( X > 0 -> Ps = [X|Ps1], Ns = Ns1 ; Ps = Ps1, Ns = [X|Ns1] ),\n"
+	"    \\+ X == 0,\n"
+	"    classify(Xs, Ps1, Ns1).\n";
+
+    interpreter interp("test");
+    interp.load_program(program);
+
+    uint64_t costs[2];
+    for (size_t i = 0; i < 2; i++) {
+	term qr = interp.parse("classify([1,-2,3,-4,5], Ps, Ns).");
+	bool ok = interp.execute(qr);
+	assert(ok);
+	costs[i] = interp.accumulated_cost();
+	std::cout << "Run " << (i+1) << ": cost " << costs[i] << "\n";
+    }
+    assert(costs[0] == costs[1]);
+}
+
+static void test_control_construct_heap()
+{
+    header("test_control_construct_heap()");
+
+    // ;/2, ->/2 and \+/1 only push choice points and environments, so
+    // a call allocates exactly the cells of the clause instances (see
+    // interpreter::instantiate_clause) and nothing per control construct.
+    const std::string program =
+	"t(X) :- ( X > 0 -> Y = pos ; Y = neg ), \\+ Y == zero.\n"
+	"run(0) :- !.\n"
+	"run(N) :- t(N), N1 is N - 1, run(N1).\n";
+
+    interpreter interp("test");
+    interp.load_program(program);
+    interp.set_gc_threshold(0);
+
+    size_t heap[2];
+    const size_t calls[2] = { 1000, 2000 };
+    for (size_t i = 0; i < 2; i++) {
+	term qr = interp.parse("run(" + boost::lexical_cast<std::string>(calls[i]) + ").");
+	size_t before = interp.heap_size();
+	bool ok = interp.execute(qr);
+	assert(ok);
+	heap[i] = interp.heap_size() - before;
+    }
+    size_t per_call = (heap[1] - heap[0]) / (calls[1] - calls[0]);
+
+    size_t instance = 0;
+    auto &t_clauses = interp.get_predicate(con_cell("t", 1)).clauses();
+    auto &run_clauses = interp.get_predicate(con_cell("run", 1)).clauses();
+    instance += t_clauses[0].cells()->size();
+    instance += run_clauses[1].cells()->size();
+
+    std::cout << "Heap per call: " << per_call << " cells (clause instances "
+	      << instance << " cells)\n";
+    assert(per_call == instance);
+}
+
+static void test_dynamic_clauses()
+{
+    header("test_dynamic_clauses()");
+
+    // Replace a fact (as mutable state) many times. With a generation
+    // stamped clause store this is O(1) regardless of how many other
+    // clauses the predicate has, and retracted clauses are compacted.
+    const std::string program =
+	"fill(0) :- !.\n"
+	"fill(N) :- assertz(state(N, N)), N1 is N - 1, fill(N1).\n"
+	"bump(0) :- !.\n"
+	"bump(N) :- state(k, C), retract(state(k, _)), C1 is C + 1,\n"
+	"           assertz(state(k, C1)), N1 is N - 1, bump(N1).\n";
+
+    static const size_t BUMPS = 5000;
+    uint64_t times[2];
+    const size_t sizes[2] = { 100, 10000 };
+    for (size_t i = 0; i < 2; i++) {
+	interpreter interp("test");
+	interp.load_program(program);
+	term qr = interp.parse("fill(" + boost::lexical_cast<std::string>(sizes[i]) + "), assertz(state(k, 0)).");
+	bool ok = interp.execute(qr);
+	assert(ok);
+
+	auto start = boost::posix_time::microsec_clock::local_time();
+	qr = interp.parse("bump(" + boost::lexical_cast<std::string>(BUMPS) + "), state(k, C).");
+	ok = interp.execute(qr);
+	auto stop = boost::posix_time::microsec_clock::local_time();
+	assert(ok);
+	assert(interp.get_result(false) == "C = " + boost::lexical_cast<std::string>(BUMPS));
+	times[i] = (stop - start).total_microseconds();
+	std::cout << sizes[i] << " other clauses: " << times[i] / BUMPS
+		  << " us per retract+assert\n";
+
+	auto &pred = interp.get_predicate(con_cell("state", 2));
+	assert(pred.num_clauses() == sizes[i] + 1);
+	std::cout << "Clause records: " << pred.clauses().size()
+		  << " (" << pred.num_clauses() << " live)\n";
+	assert(pred.clauses().size() <= 2*(sizes[i] + 1) + 32);
+    }
+    // 100x more clauses shouldn't make updates notably slower
+    assert(times[1] < 3*times[0]);
+
+    // A compiled predicate that is updated at runtime is not
+    // recompiled; it's left to the ordinary interpreter.
+    interpreter interp("test");
+    interp.load_program("fact(1).\nfact(2).\n");
+    interp.compile();
+    qname qn(interp.current_module(), con_cell("fact", 1));
+    assert(interp.was_compiled(qn));
+    term qr = interp.parse("assertz(fact(3)), findall(X, fact(X), L).");
+    bool ok = interp.execute(qr);
+    assert(ok);
+    std::cout << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == "L = [1,2,3]");
+    assert(!interp.was_compiled(qn));
+    assert(interp.get_predicate(qn).is_dynamic());
+}
+
+static void test_sampling_profiler()
+{
+    header("test_sampling_profiler()");
+
+    const std::string program =
+	"count(0) :- !.\n"
+	"count(N) :- N1 is N - 1, count(N1).\n"
+	"work(N) :- count(N), done.\n"
+	"done.\n";
+
+    // Only available when enabled
+    {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	bool undefined = false;
+	try {
+	    interp.execute(interp.parse("profile_start."));
+	} catch (interpreter_exception_undefined_predicate &) {
+	    undefined = true;
+	}
+	assert(undefined && !interp.is_sampling());
+	undefined = false;
+	try {
+	    interp.execute(interp.parse("predicate_statistics_dump('/dev/null')."));
+	} catch (interpreter_exception_undefined_predicate &) {
+	    undefined = true;
+	}
+	assert(undefined);
+    }
+
+    auto dump_file = boost::filesystem::temp_directory_path() /
+	boost::filesystem::unique_path("profile-%%%%-%%%%.txt");
+
+    for (size_t wam = 0; wam < 2; wam++) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.enable_profiling();
+	interp.load_program(program);
+	if (wam) {
+	    interp.compile();
+	}
+	term qr = interp.parse("profile_start, work(" +
+			       std::string(wam ? "500000" : "200000") +
+			       "), profile_stop, profile_dump('" +
+			       dump_file.string() + "').");
+	bool ok = interp.execute(qr);
+	assert(ok);
+	assert(!interp.is_sampling());
+
+	// Collapsed stacks: "root;...;leaf count"
+	std::ifstream in(dump_file.string());
+	std::string line;
+	uint64_t total = 0, in_count = 0;
+	while (std::getline(in, line)) {
+	    auto sp = line.rfind(' ');
+	    assert(sp != std::string::npos);
+	    auto stack = line.substr(0, sp);
+	    auto n = boost::lexical_cast<uint64_t>(line.substr(sp+1));
+	    total += n;
+	    if (stack.find("work/1;count/1") != std::string::npos) {
+		in_count += n;
+	    }
+	    std::cout << line << "\n";
+	}
+	std::cout << (wam ? "WAM" : "Naive") << ": " << total << " samples, "
+		  << in_count << " in work/1;count/1\n";
+	assert(total == interp.num_samples());
+	assert(total > 0);
+	// Most of the time is spent counting
+	assert(2*in_count > total);
+    }
+    boost::filesystem::remove(dump_file);
+
+    // Only one interpreter can be sampled at a time
+    interpreter interp1("test1"), interp2("test2");
+    interp1.start_sampling();
+    bool thrown = false;
+    try {
+	interp2.start_sampling();
+    } catch (interpreter_exception &) {
+	thrown = true;
+    }
+    assert(thrown);
+    interp1.stop_sampling();
+    interp2.start_sampling();
+    interp2.stop_sampling();
+}
+
+static void test_predicate_statistics()
+{
+    header("test_predicate_statistics()");
+
+    const std::string program =
+	"count(0) :- !.\n"
+	"count(N) :- N1 is N - 1, count(N1).\n"
+	"gen(X) :- nat(0, X).\n"
+	"nat(N, N).\n"
+	"nat(N, X) :- N1 is N + 1, nat(N1, X).\n"
+	"work(N, M) :- count(N), gen(X), X >= M, !.\n";
+
+    static const size_t N = 20000, M = 200;
+
+    auto dump_file = boost::filesystem::temp_directory_path() /
+	boost::filesystem::unique_path("stats-%%%%-%%%%.txt");
+
+    uint64_t times[2];
+    for (size_t counting = 0; counting < 2; counting++) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.load_program(program);
+	interp.compile();
+	if (counting) {
+	    interp.start_predicate_statistics();
+	}
+	term qr = interp.parse("work(" + boost::lexical_cast<std::string>(N) + ", " + boost::lexical_cast<std::string>(M) + ").");
+	auto start = boost::posix_time::microsec_clock::local_time();
+	bool ok = interp.execute(qr);
+	auto stop = boost::posix_time::microsec_clock::local_time();
+	assert(ok);
+	times[counting] = (stop - start).total_microseconds();
+	if (!counting) {
+	    continue;
+	}
+
+	// Solution K of nat/2 exits through K+1 nested calls, and
+	// backtracking into it redoes the same calls
+	auto *st = interp.get_predicate_statistics(qname(interp.current_module(), con_cell("nat",2)));
+	assert(st != nullptr);
+	std::cout << "nat/2: calls=" << st->calls << " exits=" << st->exits
+		  << " redos=" << st->redos << "\n";
+	assert(st->calls == M + 1 && st->exits == (M+1)*(M+2)/2 &&
+	       st->redos == M*(M+1)/2);
+
+	interp.stop_predicate_statistics();
+	{
+	    std::ofstream out(dump_file.string());
+	    interp.print_predicate_statistics(out);
+	}
+	std::ifstream in(dump_file.string());
+	std::string line;
+	bool found = false;
+	while (std::getline(in, line)) {
+	    std::cout << line << "\n";
+	    if (line.empty() || line[0] == '#') {
+		continue;
+	    }
+	    std::vector<std::string> fields;
+	    boost::split(fields, line, boost::is_any_of(" "));
+	    assert(fields.size() == 9);
+	    if (fields[0] == "user:count/1") {
+		assert(boost::lexical_cast<uint64_t>(fields[1]) == N + 1);
+		assert(boost::lexical_cast<uint64_t>(fields[2]) == N + 1);
+		found = true;
+	    }
+	}
+	assert(found);
+    }
+    boost::filesystem::remove(dump_file);
+    std::cout << "Without counting: " << times[0] << " us, with: "
+	      << times[1] << " us\n";
+}
+
+static void test_sort_builtins()
+{
+    header("test_sort_builtins()");
+
+    // Same scale as ex_98_sorting_full.pl
+    static const size_t N = 8192*16;
+
+    interpreter interp("test");
+
+    // Numbers from the same generator as sorting.pl
+    std::vector<int64_t> random(N);
+    int64_t x = 123;
+    for (size_t i = 0; i < N; i++) {
+	x = x*1103515245 + 12345;
+	if (x < 0) x = -x;
+	x = x % 179424691;
+	random[i] = x;
+    }
+    // ...sorted in chunks of 16 as they are fed to the sorters there
+    std::vector<int64_t> chunks = random;
+    for (size_t i = 0; i < N; i += 16) {
+	std::sort(chunks.begin() + i, chunks.begin() + i + 16);
+    }
+    std::vector<int64_t> sorted = random;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int64_t> reversed(sorted.rbegin(), sorted.rend());
+
+    auto to_list = [&](const std::vector<int64_t> &v) {
+	term lst = interpreter_base::EMPTY_LIST;
+	for (auto it = v.rbegin(); it != v.rend(); ++it) {
+	    lst = interp.new_dotted_pair(int_cell(*it), lst);
+	}
+	return lst;
+    };
+
+    // How sort/2 used to do it: copy, stable_sort and rebuild
+    auto baseline = [&](term lst) {
+	std::vector<term> vec;
+	while (interp.is_dotted_pair(lst)) {
+	    vec.push_back(interp.arg(lst, 0));
+	    lst = interp.arg(lst, 1);
+	}
+	std::stable_sort(vec.begin(), vec.end(),
+			 [&](const term &t1, const term &t2)
+			 { return interp.standard_order(t1,t2) < 0; } );
+	term r = interpreter_base::EMPTY_LIST;
+	for (auto it = vec.rbegin(); it != vec.rend(); ++it) {
+	    r = interp.new_dotted_pair(*it, r);
+	}
+	return r;
+    };
+
+    const std::pair<const char *, std::vector<int64_t> *> inputs[] = {
+	{"random", &random}, {"chunks", &chunks},
+	{"sorted", &sorted}, {"reversed", &reversed} };
+    std::map<std::vector<int64_t> *, uint64_t> costs;
+
+    for (auto &input : inputs) {
+	term lst = to_list(*input.second);
+
+	auto start = boost::posix_time::microsec_clock::local_time();
+	term expect = baseline(lst);
+	auto stop = boost::posix_time::microsec_clock::local_time();
+	uint64_t baseline_us = (stop - start).total_microseconds();
+
+	term args[2] = { lst, interp.new_ref() };
+	uint64_t cost0 = interp.accumulated_cost();
+	start = boost::posix_time::microsec_clock::local_time();
+	bool ok = builtins::msort_2(interp, 2, args);
+	stop = boost::posix_time::microsec_clock::local_time();
+	uint64_t msort_us = (stop - start).total_microseconds();
+	costs[input.second] = interp.accumulated_cost() - cost0;
+	assert(ok);
+	assert(interp.standard_order(args[1], expect) == 0);
+
+	std::cout << input.first << ": msort/2 " << msort_us
+		  << " us (Cost " << costs[input.second]
+		  << "), copy and stable_sort " << baseline_us << " us\n";
+	if (input.second == &sorted) {
+	    assert(msort_us < baseline_us);
+	}
+    }
+    // Comparisons are charged (also of integers, which skip
+    // standard_order()), so the more there are the more it costs
+    assert(costs[&random] > costs[&chunks] && costs[&chunks] > costs[&sorted]);
+
+    // keysort/2 keeps the order of equal keys
+    term pairs = interpreter_base::EMPTY_LIST;
+    for (size_t i = 0; i < N; i++) {
+	term pair = interp.new_term(con_cell("-",2), {int_cell(random[i] % 100), int_cell(i)});
+	pairs = interp.new_dotted_pair(pair, pairs);
+    }
+    term args[2] = { pairs, interp.new_ref() };
+    auto start = boost::posix_time::microsec_clock::local_time();
+    bool ok = builtins::keysort_2(interp, 2, args);
+    auto stop = boost::posix_time::microsec_clock::local_time();
+    assert(ok);
+    int64_t last_key = -1, last_index = N;
+    size_t n = 0;
+    for (term lst = static_cast<interpreter_base &>(interp).deref(args[1]); interp.is_dotted_pair(lst); lst = interp.arg(lst, 1)) {
+	term pair = interp.arg(lst, 0);
+	term key_term = interp.arg(pair, 0), index_term = interp.arg(pair, 1);
+	auto key = reinterpret_cast<const int_cell &>(key_term).value();
+	auto index = reinterpret_cast<const int_cell &>(index_term).value();
+	assert(key > last_key || (key == last_key && index < last_index));
+	last_key = key;
+	last_index = index;
+	n++;
+    }
+    assert(n == N);
+    std::cout << "keysort/2: " << (stop - start).total_microseconds() << " us\n";
+}
+
+static void test_assoc_builtins()
+{
+    header("test_assoc_builtins()");
+
+    // The same AVL trees in Prolog, so we can compare both the
+    // resulting terms and the time and cost it takes.
+    const std::string program = R"PROG(
+p_get(t(K0,V0,_,L,R), K, V) :- compare(O, K, K0), p_get(O, K, V, V0, L, R).
+p_get('=', _, V, V, _, _).
+p_get('<', K, V, _, L, _) :- p_get(L, K, V).
+p_get('>', K, V, _, _, R) :- p_get(R, K, V).
+
+p_put(A0, K, V, A) :- p_ins(A0, K, V, A, _).
+
+p_ins(t, K, V, t(K,V,'=',t,t), yes).
+p_ins(t(K0,V0,B,L,R), K, V, A, G) :- compare(O, K, K0), p_ins(O, K0, V0, B, L, R, K, V, A, G).
+p_ins('=', K0, _, B, L, R, _, V, t(K0,V,B,L,R), no).
+p_ins('<', K0, V0, B, L, R, K, V, A, G) :- p_ins(L, K, V, L1, G1), p_left(G1, K0, V0, B, L1, R, A, G).
+p_ins('>', K0, V0, B, L, R, K, V, A, G) :- p_ins(R, K, V, R1, G1), p_right(G1, K0, V0, B, L, R1, A, G).
+
+p_left(no, K, V, B, L, R, t(K,V,B,L,R), no).
+p_left(yes, K, V, B, L, R, A, G) :- p_grew_left(B, K, V, L, R, A, G).
+p_grew_left('<', K, V, L, R, t(K,V,'=',L,R), no).
+p_grew_left('=', K, V, L, R, t(K,V,'>',L,R), yes).
+p_grew_left('>', K, V, t(K1,V1,B1,L1,R1), R, A, no) :- p_rot_left(B1, K, V, K1, V1, L1, R1, R, A).
+p_rot_left('>', K, V, K1, V1, L1, R1, R, t(K1,V1,'=',L1,t(K,V,'=',R1,R))).
+p_rot_left('<', K, V, K1, V1, L1, t(K2,V2,B2,L2,R2), R, t(K2,V2,'=',t(K1,V1,BL,L1,L2),t(K,V,BR,R2,R))) :- p_split(B2, BL, BR).
+
+p_right(no, K, V, B, L, R, t(K,V,B,L,R), no).
+p_right(yes, K, V, B, L, R, A, G) :- p_grew_right(B, K, V, L, R, A, G).
+p_grew_right('>', K, V, L, R, t(K,V,'=',L,R), no).
+p_grew_right('=', K, V, L, R, t(K,V,'<',L,R), yes).
+p_grew_right('<', K, V, L, t(K1,V1,B1,L1,R1), A, no) :- p_rot_right(B1, K, V, K1, V1, L, L1, R1, A).
+p_rot_right('<', K, V, K1, V1, L, L1, R1, t(K1,V1,'=',t(K,V,'=',L,L1),R1)).
+p_rot_right('>', K, V, K1, V1, L, t(K2,V2,B2,L2,R2), R1, t(K2,V2,'=',t(K,V,BL,L,L2),t(K1,V1,BR,R2,R1))) :- p_split(B2, BL, BR).
+
+p_split('<', '>', '=').
+p_split('=', '=', '=').
+p_split('>', '=', '<').
+
+put(native, K, V, A0, A) :- put_assoc(K, A0, V, A).
+put(prolog, K, V, A0, A) :- p_put(A0, K, V, A).
+get(native, K, A, V) :- get_assoc(K, A, V).
+get(prolog, K, A, V) :- p_get(A, K, V).
+
+next(X, X1) :- X1 is (X*75 + 74) mod 65537.
+
+fill(_, 0, _, A, A) :- !.
+fill(P, N, X, A0, A) :- next(X, X1), put(P, X1, N, A0, A1), N1 is N - 1, fill(P, N1, X1, A1, A).
+
+lookup(_, 0, _, _) :- !.
+lookup(P, N, X, A) :- next(X, X1), get(P, X1, A, _), N1 is N - 1, lookup(P, N1, X1, A).
+
+avl(t, 0).
+avl(t(_,_,B,L,R), H) :- avl(L, HL), avl(R, HR), bal(B, HL, HR), (HL > HR -> H is HL + 1 ; H is HR + 1).
+bal('<', HL, HR) :- HR is HL + 1.
+bal('=', H, H).
+bal('>', HL, HR) :- HL is HR + 1.
+
+run(P, N, A) :- fill(P, N, 1, t, A), lookup(P, N, 1, A).
+
+same(N, H) :- run(native, N, A1), run(prolog, N, A2), A1 == A2, avl(A1, H).
+)PROG";
+
+    static const size_t N = 20000;
+    const std::string n_str = boost::lexical_cast<std::string>(N);
+
+    interpreter interp("test");
+    interp.load_program(program);
+    interp.compile();
+
+    // Both build the same balanced tree
+    term qr = interp.parse("same(" + n_str + ", H).");
+    bool ok = interp.execute(qr);
+    assert(ok);
+    std::cout << "Height of tree with " << N << " inserts: " << interp.get_result(false) << "\n";
+
+    uint64_t times[2], costs[2];
+    const char *versions[] = { "native", "prolog" };
+    for (size_t i = 0; i < 2; i++) {
+	qr = interp.parse(std::string("run(") + versions[i] + ", " + n_str + ", _).");
+	auto start = boost::posix_time::microsec_clock::local_time();
+	ok = interp.execute(qr);
+	auto stop = boost::posix_time::microsec_clock::local_time();
+	assert(ok);
+	times[i] = (stop - start).total_microseconds();
+	costs[i] = interp.accumulated_cost();
+	std::cout << versions[i] << ": " << times[i] << " us, cost " << costs[i] << "\n";
+    }
+    assert(times[0] < times[1]);
+    assert(costs[0] < costs[1]);
+}
+
 int main( int argc, char *argv[] )
 {
     test_up_and_down();
@@ -343,6 +975,15 @@ int main( int argc, char *argv[] )
     test_interpreter_serialize();
     test_interpreter_multi_instance();
     test_interpreter_freeze_preprocess();
+    test_multi_arg_indexing();
+    test_last_call_optimization();
+    test_clause_instance_cost();
+    test_control_construct_heap();
+    test_dynamic_clauses();
+    test_sampling_profiler();
+    test_predicate_statistics();
+    test_sort_builtins();
+    test_assoc_builtins();
 
     return 0;
 }
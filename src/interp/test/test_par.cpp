@@ -0,0 +1,259 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+//
+// Run the same conjunction of independent goals in sequence and with
+// par/2 and check that the answers (and the costs) are the same. Then
+// do the same for findall/3 and par_findall/3 with 1, 2, 4 and 8
+// threads. Set to 1 to get bigger (more meaningful) timings.
+//
+#define PERFORMANCE_TEST 0
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+// (Deterministic, otherwise the sequential conjunction in the ordinary
+//  interpreter would run out of stack because of the choice points.)
+static const char *fib_program = R"PROG(
+fib(N,R) :- N < 2, !, R = 1.
+fib(N,R) :- N1 is N - 1, N2 is N - 2, fib(N1,R1), fib(N2,R2), R is R1 + R2.
+)PROG";
+
+// (Without cuts, so that par_findall/3 can split the first col/1
+//  goal; col/1 facts are added for the board size.)
+static const char *queens_program = R"PROG(
+queens(N, Qs) :- col(Q), N1 is N - 1, place(N1, [Q], Qs).
+
+place(0, Qs, Qs).
+place(K, Qs0, Qs) :- K > 0, col(Q), safe(Q, Qs0, 1), K1 is K - 1, place(K1, [Q|Qs0], Qs).
+
+safe(_, [], _).
+safe(Q, [Q1|Qs], D) :- Q \== Q1, A is Q1 + D, A \== Q, B is Q1 - D, B \== Q, D1 is D + 1, safe(Q, Qs, D1).
+)PROG";
+
+static std::string run_goal(interpreter &interp, const std::string &goal,
+			    uint64_t &cost, uint64_t &time_us)
+{
+    auto start = utime::now();
+    term query = interp.parse(goal);
+    bool ok = interp.execute(query);
+    time_us = (utime::now() - start).in_us();
+    assert(ok);
+    cost = interp.accumulated_cost();
+    return interp.get_result(false);
+}
+
+static void test_par(const std::string &n, size_t num_goals)
+{
+    header( "test_par fib(" + n + ") x " + std::to_string(num_goals) );
+
+    std::string seq_goal, par_goal;
+    for (size_t i = num_goals; i > 0; i--) {
+	std::string goal = "fib(" + n + ", R" + std::to_string(i) + ")";
+	if (i == num_goals) {
+	    seq_goal = goal;
+	    par_goal = goal;
+	} else {
+	    seq_goal = goal + ", " + seq_goal;
+	    par_goal = "par(" + goal + ", " + par_goal + ")";
+	}
+    }
+
+    for (int wam = 0; wam <= 1; wam++) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.load_program(fib_program);
+	if (wam) {
+	    interp.compile();
+	}
+	interp.set_wam_enabled(wam);
+
+	uint64_t seq_cost = 0, seq_time = 0;
+	uint64_t par_cost = 0, par_time = 0;
+	auto seq = run_goal(interp, seq_goal + ".", seq_cost, seq_time);
+	// The first call creates the workers
+	run_goal(interp, par_goal + ".", par_cost, par_time);
+	auto par = run_goal(interp, par_goal + ".", par_cost, par_time);
+
+	std::cout << (wam ? "wam:   " : "naive: ")
+		  << "sequential " << seq_time / 1000 << " ms, "
+		  << "par " << par_time / 1000 << " ms"
+		  << " (cost " << seq_cost << " vs " << par_cost << ")\n";
+
+	assert(seq == par);
+	// The par/2 cost also includes the copying of goals and results
+	assert(par_cost >= seq_cost && par_cost < seq_cost + 100*num_goals);
+    }
+}
+
+static void test_par_findall(const std::string &n)
+{
+    header( "test_par_findall queens(" + n + ")" );
+
+    std::string seq_goal = "findall(Qs, queens(" + n + ", Qs), L).";
+    std::string par_goal = "par_findall(Qs, queens(" + n + ", Qs), L).";
+
+    for (int wam = 0; wam <= 1; wam++) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.load_program(queens_program);
+	std::string cols;
+	for (int i = 1; i <= std::stoi(n); i++) {
+	    cols += "col(" + std::to_string(i) + ").\n";
+	}
+	interp.load_program(cols);
+	if (wam) {
+	    interp.compile();
+	}
+	interp.set_wam_enabled(wam);
+
+	uint64_t seq_cost = 0, seq_time = 0;
+	auto seq = run_goal(interp, seq_goal, seq_cost, seq_time);
+	std::cout << (wam ? "wam:   " : "naive: ")
+		  << "findall " << seq_time / 1000 << " ms"
+		  << " (cost " << seq_cost << ")\n";
+
+	for (size_t threads = 1; threads <= 8; threads *= 2) {
+	    interp.set_num_par_threads(threads);
+	    uint64_t par_cost = 0, par_time = 0;
+	    // The first call creates the workers
+	    run_goal(interp, par_goal, par_cost, par_time);
+	    auto par = run_goal(interp, par_goal, par_cost, par_time);
+
+	    std::cout << (wam ? "wam:   " : "naive: ")
+		      << "par_findall " << threads << " threads "
+		      << par_time / 1000 << " ms"
+		      << " (cost " << par_cost << ")\n";
+
+	    assert(seq == par);
+	    assert(par_cost >= seq_cost);
+	}
+    }
+}
+
+//
+// The workers get the clauses that are asserted and retracted after they
+// were created. Nothing is synced when the program hasn't changed.
+//
+
+static void test_par_sync()
+{
+    header( "test_par_sync" );
+
+    interpreter interp("test");
+    interp.setup_standard_lib();
+    interp.load_program("alt(1).\nalt(2).\nalt(3).\nalt(4).\n"
+			"ok(1).\nok(2).\nok(3).\n");
+    interp.set_num_par_threads(2);
+
+    uint64_t cost = 0, time_us = 0;
+    // (ok/1 is run by the workers)
+    auto goal = "par_findall(X, (alt(X), ok(X)), L).";
+    auto r1 = run_goal(interp, goal, cost, time_us);
+    std::cout << r1 << "\n";
+    assert(r1 == "L = [1,2,3]");
+
+    size_t gen = interp.program_generation();
+    run_goal(interp, goal, cost, time_us);
+    assert(interp.program_generation() == gen);
+
+    run_goal(interp, "assertz(ok(4)), retract(ok(2)).", cost, time_us);
+    assert(interp.program_generation() != gen);
+    auto r2 = run_goal(interp, goal, cost, time_us);
+    std::cout << r2 << "\n";
+    assert(r2 == "L = [1,3,4]");
+}
+
+//
+// The cost of the goals run by the workers can't exceed the budget of
+// the caller, even when each of them would fit in the budget by itself.
+//
+
+static void test_par_budget()
+{
+    header( "test_par_budget" );
+
+    // Each alt/1 alternative costs the same
+    std::string program = fib_program;
+    for (int i = 1; i <= 20; i++) {
+	program += "alt(" + std::to_string(i) + ").\n";
+    }
+    program += "work(X, R) :- alt(X), fib(10, R).\n";
+
+    uint64_t cost = 0, time_us = 0;
+
+    for (size_t threads = 1; threads <= 4; threads *= 2) {
+	interpreter interp("test");
+	interp.setup_standard_lib();
+	interp.load_program(program);
+	interp.compile();
+	interp.set_num_par_threads(threads);
+
+	run_goal(interp, "findall(X, work(X, _), L).", cost, time_us);
+	uint64_t all_cost = cost;
+
+	// Room for a fifth of the alternatives
+	interp.set_maximum_cost(all_cost / 5);
+	bool out_of_funds = false;
+	try {
+	    interp.execute(interp.parse("par_findall(X, work(X, _), L)."));
+	} catch (interpreter_exception_out_of_funds &) {
+	    out_of_funds = true;
+	}
+	std::cout << "par_findall " << threads << " threads: cost "
+		  << interp.accumulated_cost() << " of " << all_cost << "\n";
+	assert(out_of_funds);
+	// (The alternative that ran out of funds may have gone a little
+	// over its limit before it noticed.)
+	assert(interp.accumulated_cost() <= all_cost / 5 + all_cost / 20);
+    }
+
+    interpreter interp("test");
+    interp.setup_standard_lib();
+    interp.load_program(fib_program);
+    interp.compile();
+    run_goal(interp, "fib(12, R1), fib(12, R2).", cost, time_us);
+    uint64_t both_cost = cost;
+
+    // Room for one and a half goal
+    interp.set_maximum_cost(both_cost * 3 / 4);
+    bool out_of_funds = false;
+    try {
+	interp.execute(interp.parse("par(fib(12, R1), fib(12, R2))."));
+    } catch (interpreter_exception_out_of_funds &) {
+	out_of_funds = true;
+    }
+    std::cout << "par: cost " << interp.accumulated_cost() << " of "
+	      << both_cost << "\n";
+    assert(out_of_funds);
+    assert(interp.accumulated_cost() < both_cost);
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+#if PERFORMANCE_TEST
+    const std::string fib_n = "23";
+    const std::string queens_n = "8";
+#else
+    const std::string fib_n = "15";
+    const std::string queens_n = "6";
+#endif
+
+    test_par(fib_n, 2);
+    test_par(fib_n, 4);
+    test_par_findall(queens_n);
+    test_par_sync();
+    test_par_budget();
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static std::string run_goal(interpreter &interp, const std::string &goal)
+{
+    term query = interp.parse(goal);
+    if (!interp.execute(query)) {
+	return "fail";
+    }
+    return interp.get_result(false);
+}
+
+static void test_standard_lib_image()
+{
+    header( "test_standard_lib_image()" );
+
+    // If this fails, then the generated standard_lib_gen.hpp doesn't
+    // match the interpreter it was built into.
+    {
+	interpreter interp("test");
+	bool ok = interp.load_standard_lib_image();
+	std::cout << "Precompiled image loaded: " << (ok ? "yes" : "no") << "\n";
+	assert(ok);
+    }
+
+    interpreter interp("test");
+    interp.setup_standard_lib();
+
+    static const std::pair<const char *, const char *> goals[] = {
+	{ "append(X, Y, [1,2]).", "X = [], Y = [1,2]" },
+	{ "length([a,b,c], N).", "N = 3" },
+	{ "reverse([1,2,3], R), last(R, L).", "R = [3,2,1], L = 1" },
+	{ "forall(member(X, [1,2]), X > 0).", "true" },
+	{ "member(X, [a,b]), X == b.", "X = b" }
+    };
+    for (auto &g : goals) {
+	auto r = run_goal(interp, g.first);
+	std::cout << g.first << " -> " << r << "\n";
+	assert(r == g.second);
+    }
+}
+
+static void test_standard_lib_time()
+{
+    header( "test_standard_lib_time()" );
+
+    static const size_t N = 20;
+
+    uint64_t image_us = 0, source_us = 0;
+    for (size_t i = 0; i < N; i++) {
+	interpreter interp1("test");
+	auto start = utime::now();
+	interp1.setup_standard_lib();
+	image_us += (utime::now() - start).in_us();
+
+	interpreter interp2("test");
+	std::vector<uint8_t> image;
+	start = utime::now();
+	interp2.save_standard_lib_image(image);
+	source_us += (utime::now() - start).in_us();
+    }
+
+    std::cout << "From image: " << image_us / N << " us, "
+	      << "from source: " << source_us / N << " us\n";
+
+    assert(image_us < source_us);
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+    test_standard_lib_image();
+    test_standard_lib_time();
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+//
+// Run the same programs with and without ':- table' and check that
+// the answers are the same. Set to 1 to get bigger (more meaningful)
+// timings.
+//
+#define PERFORMANCE_TEST 0
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+// fib/2 from ex_18_parallel.pl (with a guard on the recursive clause,
+// otherwise the table for fib(1,_) would never complete.)
+static const char *fib_program = R"PROG(
+fib(0,1).
+fib(1,1).
+fib(N,R) :- N > 1, N1 is N - 1, N2 is N - 2, fib(N1,R1), fib(N2,R2), R is R1 + R2.
+)PROG";
+
+// Transitive closure over a DAG with node I connected to I+1 and I+2.
+// The number of paths grows exponentially with the number of nodes.
+static const char *path_program = R"PROG(
+edge(I, J) :- graph_size(N), I < N, J is I + 1.
+edge(I, J) :- graph_size(N), I < N - 1, J is I + 2.
+
+path(X, Y) :- edge(X, Y).
+path(X, Y) :- edge(X, Z), path(Z, Y).
+
+reach(X, L) :- findall(Y, path(X, Y), L0), sort(L0, L).
+)PROG";
+
+static std::string run_goal(const std::string &program, const std::string &table,
+			    const std::string &goal, bool wam,
+			    uint64_t &time_us)
+{
+    interpreter interp("test");
+    if (table.empty()) {
+	interp.load_program(program);
+    } else {
+	interp.load_program(":- table " + table + ".\n" + program);
+    }
+    if (wam) {
+	interp.compile();
+	interp.set_wam_enabled(true);
+    }
+    auto start = utime::now();
+    term query = interp.parse(goal);
+    bool ok = interp.execute(query);
+    time_us = (utime::now() - start).in_us();
+    assert(ok);
+    return interp.get_result(false);
+}
+
+static void test_tabling(const std::string &name, const std::string &program,
+			 const std::string &table, const std::string &goal)
+{
+    header( "test_tabling " + name );
+
+    std::cout << "Goal: " << goal << " (table " << table << ")\n";
+
+    for (int wam = 0; wam <= 1; wam++) {
+	uint64_t plain_time = 0, tabled_time = 0;
+	auto plain = run_goal(program, "", goal, wam, plain_time);
+	auto tabled = run_goal(program, table, goal, wam, tabled_time);
+
+	std::cout << (wam ? "wam:   " : "naive: ")
+		  << "untabled " << plain_time / 1000 << " ms, "
+		  << "tabled " << tabled_time / 1000 << " ms"
+		  << " (" << tabled.substr(0, 40) << ")\n";
+
+	assert(plain == tabled);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+#if PERFORMANCE_TEST
+    const std::string fib_n = "24";
+    const std::string graph_size = "22";
+#else
+    const std::string fib_n = "16";
+    const std::string graph_size = "14";
+#endif
+
+    test_tabling("fib", fib_program, "fib/2", "fib(" + fib_n + ", R).");
+    test_tabling("path", std::string(path_program) + "graph_size(" + graph_size + ").\n",
+		 "path/2", "reach(0, L).");
+
+    return 0;
+}
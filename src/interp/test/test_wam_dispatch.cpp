@@ -0,0 +1,185 @@
+#include "../../common/test/test_home_dir.hpp"
+#include "../../common/term_parser.hpp"
+#include "../../common/utime.hpp"
+#include "../interpreter.hpp"
+#include <fstream>
+
+using namespace prologcoin::common;
+using namespace prologcoin::interp;
+
+//
+// Run a few classic benchmarks with the function pointer dispatch loop
+// and the threaded one. Both must agree on results, cost and the number
+// of executed instructions. The same is then run without
+// superinstructions, which must give the same result and cost but
+// execute more instructions. Set to 1 to get bigger (more meaningful)
+// timings.
+//
+#define PERFORMANCE_TEST 0
+
+static void header( const std::string &str )
+{
+    std::cout << "\n";
+    std::cout << "--- [" + str + "] " + std::string(60 - str.length(), '-') << "\n";
+    std::cout << "\n";
+}
+
+static const char * mode_name(wam_dispatch_mode mode)
+{
+    switch (mode) {
+    case DISPATCH_CALL: return "call";
+    case DISPATCH_THREADED: return "threaded";
+    }
+    return "?";
+}
+
+// Load all clauses from a file in pl_files (queries and directives are
+// skipped.)
+static void load_file(interpreter &interp, const std::string &name)
+{
+    const std::string path = find_home_dir() + "/src/interp/test/pl_files/" + name;
+    std::ifstream in(path);
+    assert(in.good());
+    term_tokenizer tok(in);
+    term_parser parser(tok, interp.get_heap(), interp.get_ops());
+
+    con_cell query_op("?-", 1);
+    con_cell action_op(":-", 1);
+
+    while (!parser.is_eof()) {
+	term t = parser.parse();
+	parser.clear_var_names();
+	if (interp.is_functor(t, query_op) || interp.is_functor(t, action_op)) {
+	    continue;
+	}
+	interp.load_clause(t, LAST_CLAUSE);
+    }
+}
+
+struct bench_result {
+    std::string result;
+    uint64_t cost;
+    uint64_t instructions;
+    uint64_t time_us;
+};
+
+static bench_result run_bench(wam_dispatch_mode mode, bool fused,
+			      const std::string &goal, size_t iterations,
+			      size_t profile_n = 0)
+{
+    interpreter interp("test");
+    load_file(interp, "ex_03_qsort.pl");
+    load_file(interp, "ex_19_bench.pl");
+    interp.set_superinstructions(fused);
+    interp.compile();
+    interp.set_wam_enabled(true);
+    interp.set_dispatch_mode(mode);
+    interp.set_instruction_profiling(profile_n);
+
+    term query = interp.parse(goal);
+
+    bench_result r;
+    r.cost = 0;
+
+    interp.reset_instruction_count();
+    auto start = utime::now();
+    for (size_t i = 0; i < iterations; i++) {
+	size_t tr_mark = interp.trail_size();
+	bool ok = interp.execute(query);
+	assert(ok);
+	if (i == 0) {
+	    r.result = interp.get_result(false);
+	    r.cost = interp.accumulated_cost();
+	}
+	interp.reset();
+	interp.unwind(tr_mark);
+    }
+    r.time_us = (utime::now() - start).in_us();
+    r.instructions = interp.instruction_count();
+
+    if (profile_n != 0) {
+	interp.print_instruction_profile(std::cout, 10);
+    }
+
+    return r;
+}
+
+static void print_bench(const std::string &name, const bench_result &r)
+{
+    double secs = static_cast<double>(r.time_us) / 1000000.0;
+    double rate = secs > 0 ? static_cast<double>(r.instructions) / secs : 0;
+    std::cout << std::setw(16) << name << ": "
+	      << r.instructions << " instructions in "
+	      << r.time_us / 1000 << " ms ("
+	      << static_cast<uint64_t>(rate) << " instructions/sec)\n";
+}
+
+static void test_dispatch(const std::string &name, const std::string &goal,
+			  size_t iterations, bool has_fused)
+{
+    header( "test_dispatch " + name );
+
+    std::cout << "Goal: " << goal << " (" << iterations << " iterations)\n";
+
+    bench_result results[2];
+    wam_dispatch_mode modes[2] = { DISPATCH_CALL, DISPATCH_THREADED };
+
+    for (size_t i = 0; i < 2; i++) {
+	auto &r = results[i];
+	r = run_bench(modes[i], true, goal, iterations);
+	print_bench(mode_name(modes[i]), r);
+    }
+
+    auto unfused = run_bench(DISPATCH_THREADED, false, goal, iterations);
+    print_bench("threaded/unfused", unfused);
+
+    std::cout << "Result: " << results[0].result << "\n";
+
+    assert(results[0].instructions > 0);
+    assert(results[0].result == results[1].result);
+    assert(results[0].cost == results[1].cost);
+    assert(results[0].instructions == results[1].instructions);
+
+    assert(unfused.result == results[0].result);
+    assert(unfused.cost == results[0].cost);
+    if (has_fused) {
+	assert(unfused.instructions > results[0].instructions);
+    } else {
+	assert(unfused.instructions == results[0].instructions);
+    }
+}
+
+static void test_profile(const std::string &name, const std::string &goal)
+{
+    header( "test_profile " + name );
+
+    std::cout << "Goal: " << goal << "\n";
+
+    // Profile without superinstructions to see which pairs would be
+    // worth fusing.
+    std::cout << "Most frequent instruction pairs:\n";
+    auto r = run_bench(DISPATCH_THREADED, false, goal, 1, 2);
+    assert(r.instructions > 0);
+}
+
+int main(int argc, char *argv[])
+{
+    find_home_dir(argv[0]);
+
+#if PERFORMANCE_TEST
+    static const size_t SCALE = 50;
+#else
+    static const size_t SCALE = 1;
+#endif
+
+    test_dispatch("nrev", "range(1, 30, L), nrev(L, R).", 20*SCALE, true);
+    test_dispatch("qsort", "qsort([4711,27,74,17,33,94,18,46,83,65,2,32,53,28,85,99,47,28,82,6,11,55,29,39,81,90,37,10,0,66,51,7,21,85,27,31,63,75,4,95,99,11,28,61,74,18,92,40,53,59,8], Q).", 20*SCALE, true);
+    // No fusable pairs on the hot path of fib/2
+    test_dispatch("fib", "fib(15, R).", 2*SCALE, false);
+
+    test_profile("nrev", "range(1, 30, L), nrev(L, R).");
+    test_profile("qsort", "qsort([4711,27,74,17,33,94,18,46,83,65,2,32,53,28,85,99,47,28,82,6,11,55,29,39,81,90,37,10,0,66,51,7,21,85,27,31,63,75,4,95,99,11,28,61,74,18,92,40,53,59,8], Q).");
+    test_profile("fib", "fib(15, R).");
+
+    return 0;
+}
@@ -345,6 +345,243 @@ static void test_instruction_sequence()
     interp.print_code(std::cout);
 }
 
+static void test_code_segments()
+{
+    header("test_code_segments");
+
+    interpreter interp("test");
+    interp.load_program("app([], Ys, Ys).\n"
+			"app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n");
+    interp.compile();
+
+    qname app_qn(interp.current_module(), con_cell("app", 3));
+    size_t app_offset = interp.get_wam_predicate_meta_data(app_qn).code_offset;
+    auto *app_code = interp.to_code(app_offset);
+
+    // Compile lots of code. Already compiled code must not move.
+    std::stringstream ss;
+    for (size_t i = 0; i < 500; i++) {
+	ss << "p" << i << "(X, Y) :- app(X, [" << i << "], Y).\n";
+    }
+    interp.load_program(ss.str());
+    interp.compile();
+
+    std::cout << "Segments: " << interp.num_segments() << "\n";
+    assert(interp.num_segments() >= 501);
+    assert(interp.get_wam_predicate_meta_data(app_qn).code_offset == app_offset);
+    assert(interp.to_code(app_offset) == app_code);
+    assert(interp.to_code_addr(app_code) == app_offset);
+    assert(interp.get_segment(app_code).qn == app_qn);
+
+    interp.set_wam_enabled(true);
+    bool r = interp.execute(interp.parse("p499([1,2], L)."));
+    assert(r);
+    std::cout << "Result: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == "L = [1,2,499]");
+    interp.reset();
+
+    // Redefine app/3. The old code is left intact (it could still be
+    // referenced) and the new code is put in a new segment.
+    interp.load_program("app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n"
+			"app([], Ys, Ys).\n");
+    interp.compile();
+
+    size_t new_app_offset = interp.get_wam_predicate_meta_data(app_qn).code_offset;
+    assert(new_app_offset != app_offset);
+    assert(interp.get_segment(app_code).retired);
+    assert(interp.to_code(app_offset) == app_code);
+    assert(!interp.get_segment(interp.to_code(new_app_offset)).retired);
+
+    r = interp.execute(interp.parse("p7([a], L)."));
+    assert(r);
+    std::cout << "Result: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == "L = [a,7]");
+}
+
+static void test_code_gc()
+{
+    header("test_code_gc");
+
+    interpreter interp("test");
+    // Only collect when we ask for it
+    interp.set_dead_code_threshold(std::numeric_limits<size_t>::max());
+    interp.set_wam_enabled(true);
+
+    const std::string app = "app([], Ys, Ys).\n"
+	                    "app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n";
+    interp.load_program(app);
+    interp.compile();
+
+    size_t live = interp.live_code_size();
+    std::cout << "Live code: " << live << " bytes\n";
+    assert(live > 0);
+
+    // Redefining the predicate leaves dead code behind
+    for (size_t i = 0; i < 10; i++) {
+	interp.load_program(app);
+	interp.compile();
+    }
+    assert(interp.live_code_size() == live);
+    assert(interp.dead_code_size() == 10*live);
+
+    size_t released = interp.collect_dead_code();
+    std::cout << "Released: " << released << " bytes\n";
+    assert(released == 10*live);
+    assert(interp.dead_code_size() == 0);
+    assert(interp.reclaimed_code_size() == released);
+
+    // Code referenced from a choice point must be kept
+    bool r = interp.execute(interp.parse("app(X, Y, [1,2])."));
+    assert(r && interp.has_more());
+    interp.load_program(app);
+    interp.compile();
+    interp.collect_dead_code();
+    assert(interp.dead_code_size() == live);
+
+    r = interp.next();
+    assert(r);
+    std::cout << "Result: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == "X = [1], Y = [2]");
+
+    interp.reset();
+    interp.collect_dead_code();
+    assert(interp.dead_code_size() == 0);
+
+    // So must the return point of a builtin choice point (arg/3)
+    const std::string pick = "pick(T, X) :- arg(_, T, X), X > 1.\n";
+    interp.load_program(pick);
+    interp.compile();
+    size_t pick_live = interp.live_code_size() - live;
+    r = interp.execute(interp.parse("pick(f(1,2,3), X)."));
+    assert(r && interp.has_more());
+    assert(interp.get_result(false) == "X = 2");
+    interp.load_program(pick);
+    interp.compile();
+    interp.collect_dead_code();
+    assert(interp.dead_code_size() == pick_live);
+
+    r = interp.next();
+    assert(r);
+    std::cout << "Result: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == "X = 3");
+
+    interp.reset();
+    interp.collect_dead_code();
+    assert(interp.dead_code_size() == 0);
+
+    r = interp.execute(interp.parse("code_statistics(S)."));
+    assert(r);
+    std::cout << "Statistics: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false).find("dead_code_bytes(0)") != std::string::npos);
+}
+
+// Interpreter that gets its compiled code from saved images (like the
+// global interpreter does with its persistent code cache.)
+class image_cache_interpreter : public interpreter {
+public:
+    image_cache_interpreter(std::unordered_map<qname, std::vector<uint8_t> > &images)
+	: interpreter("test"), images_(images), hits_(0), misses_(0) { }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+protected:
+    virtual bool load_cached_code(const qname &qn) override {
+	auto it = images_.find(qn);
+	if (it != images_.end() &&
+	    load_code_image(qn, &it->second[0], it->second.size())) {
+	    hits_++;
+	    return true;
+	}
+	misses_++;
+	return false;
+    }
+
+    virtual void compiled_code(const qname &qn) override {
+	save_code_image(qn, images_[qn]);
+    }
+
+private:
+    std::unordered_map<qname, std::vector<uint8_t> > &images_;
+    size_t hits_, misses_;
+};
+
+static void test_code_image()
+{
+    header("test_code_image");
+
+    const std::string prog =
+	"app([], Ys, Ys).\n"
+	"app([X|Xs], Ys, [X|Zs]) :- app(Xs, Ys, Zs).\n"
+	"nrev([], []).\n"
+	"nrev([X|Xs], Ys) :- nrev(Xs, Zs), app(Zs, [X], Ys).\n"
+	"color(red, 1).\n"
+	"color(green, 2).\n"
+	"color(blue, 3).\n"
+	"color(f(X), X).\n"
+	"shape(circle(R), A) :- A is 3*R*R.\n"
+	"shape(square(S), A) :- A is S*S.\n"
+	"shape(rect(W,H), A) :- A is W*H.\n"
+	"max(X, Y, Z) :- (X > Y -> Z = X ; Z = Y).\n"
+	"q(L, R, C, A, M) :- nrev(L, R), color(green, C), shape(rect(2,3), A), max(3, 7, M).\n";
+    const std::string query = "q([1,2,3,4], R, C, A, M).";
+
+    std::unordered_map<qname, std::vector<uint8_t> > images;
+
+    std::string expect;
+    uint64_t expect_cost = 0;
+    {
+	image_cache_interpreter interp(images);
+	interp.load_program(prog);
+	interp.compile();
+	assert(interp.hits() == 0);
+	assert(images.size() == interp.misses());
+	interp.set_wam_enabled(true);
+	bool r = interp.execute(interp.parse(query));
+	assert(r);
+	expect = interp.get_result(false);
+	expect_cost = interp.accumulated_cost();
+	std::cout << "Compiled: " << expect << "\n";
+    }
+
+    size_t image_bytes = 0;
+    for (auto &e : images) {
+	assert(!e.second.empty());
+	image_bytes += e.second.size();
+    }
+    std::cout << "Images: " << images.size() << " predicates, "
+	      << image_bytes << " bytes\n";
+
+    // Everything comes from the images now (and in a different order
+    // so calls get bound both ways.)
+    image_cache_interpreter interp(images);
+    interp.load_program(prog);
+    auto preds = interp.get_predicates();
+    std::reverse(preds.begin(), preds.end());
+    for (auto &qn : preds) {
+	interp.compile(qn);
+    }
+    assert(interp.hits() == images.size());
+    assert(interp.misses() == 0);
+
+    std::stringstream ss;
+    interp.print_code(ss);
+    std::cout << ss.str();
+
+    interp.set_wam_enabled(true);
+    bool r = interp.execute(interp.parse(query));
+    assert(r);
+    std::cout << "Loaded: " << interp.get_result(false) << "\n";
+    assert(interp.get_result(false) == expect);
+    assert(interp.accumulated_cost() == expect_cost);
+
+    // Corrupt images are rejected
+    auto &image = images.begin()->second;
+    std::vector<uint8_t> truncated(image.begin(), image.begin() + image.size() / 2);
+    interp.remove_compiled(images.begin()->first);
+    assert(!interp.load_code_image(images.begin()->first, &truncated[0], truncated.size()));
+}
+
 static void test_partition()
 {
     header("test_partition");
@@ -457,6 +694,9 @@ int main( int argc, char *argv[] )
 {
     test_flatten();
     test_instruction_sequence();
+    test_code_segments();
+    test_code_gc();
+    test_code_image();
     test_partition();
     test_compile();
     test_compile2();
@@ -1644,6 +1644,101 @@ void wam_compiler::peephole_opt_void(wam_interim_code &instrs)
     }
 }
 
+static wam_instruction_base * fuse_pair(wam_interim_code &instrs,
+					wam_instruction_base *i1,
+					wam_instruction_base *i2)
+{
+    switch (i1->type()) {
+    case GET_VARIABLE_X:
+	if (i2->type() == GET_VALUE_X) {
+	    auto *g1 = reinterpret_cast<wam_instruction<GET_VARIABLE_X> *>(i1);
+	    auto *g2 = reinterpret_cast<wam_instruction<GET_VALUE_X> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<GET_VARIABLE_X_GET_VALUE_X>(
+		    g1->xn(), g1->ai(), g2->xn(), g2->ai()));
+	}
+	break;
+    case ALLOCATE:
+	if (i2->type() == GET_VARIABLE_Y) {
+	    auto *g2 = reinterpret_cast<wam_instruction<GET_VARIABLE_Y> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<ALLOCATE_GET_VARIABLE_Y>(g2->yn(), g2->ai()));
+	}
+	break;
+    case PUT_VALUE_X:
+	if (i2->type() == PUT_VALUE_X) {
+	    auto *p1 = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(i1);
+	    auto *p2 = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<PUT_VALUE_X2>(p1->xn(), p1->ai(),
+					       p2->xn(), p2->ai()));
+	}
+	if (i2->type() == EXECUTE) {
+	    auto *p1 = reinterpret_cast<wam_instruction<PUT_VALUE_X> *>(i1);
+	    auto *e2 = reinterpret_cast<wam_instruction<EXECUTE> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<PUT_VALUE_X_EXECUTE>(p1->xn(), p1->ai(),
+						      e2->p()));
+	}
+	break;
+    case UNIFY_VARIABLE_X:
+	if (i2->type() == UNIFY_VARIABLE_X) {
+	    auto *u1 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X> *>(i1);
+	    auto *u2 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<UNIFY_VARIABLE_X2>(u1->xn(), u2->xn()));
+	}
+	break;
+    case GET_LIST_A:
+	if (i2->type() == UNIFY_VARIABLE_X) {
+	    auto *g1 = reinterpret_cast<wam_instruction<GET_LIST_A> *>(i1);
+	    auto *u2 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<GET_LIST_A_UNIFY_VARIABLE_X>(g1->ai(), u2->xn()));
+	}
+	if (i2->type() == UNIFY_VALUE_X) {
+	    auto *g1 = reinterpret_cast<wam_instruction<GET_LIST_A> *>(i1);
+	    auto *u2 = reinterpret_cast<wam_instruction<UNIFY_VALUE_X> *>(i2);
+	    return instrs.new_instruction(
+		 wam_instruction<GET_LIST_A_UNIFY_VALUE_X>(g1->ai(), u2->xn()));
+	}
+	break;
+    default:
+	break;
+    }
+    return nullptr;
+}
+
+void wam_compiler::fuse_instructions(wam_interim_code &instrs)
+{
+    // The pairs below were picked from instruction profiles of
+    // typical list processing (see
+    // wam_interpreter::set_instruction_profiling().) Labels are
+    // separate elements in the sequence, so we never fuse across a
+    // jump target.
+
+    auto it = instrs.begin();
+    while (it != instrs.end()) {
+	auto it_next = it; ++it_next;
+	if (it_next == instrs.end()) {
+	    break;
+	}
+	auto *i1 = *it;
+	auto *i2 = *it_next;
+	if (is_interim_instruction(i1) || is_interim_instruction(i2)) {
+	    ++it;
+	    continue;
+	}
+	if (auto *fused = fuse_pair(instrs, i1, i2)) {
+	    *it = fused;
+	    instrs.erase_after(it);
+	    delete i1;
+	    delete i2;
+	}
+	++it;
+    }
+}
+
 void wam_compiler::reset_clause_temps()
 {
     goal_count_ = 0;
@@ -1862,12 +1957,13 @@ std::vector<common::int_cell> wam_compiler::new_labels_dup(size_t n)
 }
 
 std::vector<size_t> wam_compiler::find_clauses_on_cat(
-      const managed_clauses &m_clauses, wam_compiler::first_arg_cat_t cat)
+      const managed_clauses &m_clauses, wam_compiler::first_arg_cat_t cat,
+      size_t argno)
 {
     std::vector<size_t> found;
     size_t index = 0;
     for (auto &m_clause : m_clauses) {
-        if (first_arg_cat(m_clause.clause()) == cat) {
+        if (arg_cat(m_clause.clause(), argno) == cat) {
 	    found.push_back(index);
         }
 	index++;
@@ -1875,32 +1971,80 @@ std::vector<size_t> wam_compiler::find_clauses_on_cat(
     return found;
 }
 
+//
+// Argument positions to index on for a subsection (where the first
+// argument is always bound.) The best discriminating argument (most
+// distinct keys) comes first. If it is unbound at call time, the
+// SWITCH_ON_TERM for it continues with the next one and so on. Only
+// arguments that are bound in all clauses are considered. The first
+// argument wins ties and it's the only one if it's already unique.
+//
+std::vector<size_t> wam_compiler::index_positions(const managed_clauses &subsection)
+{
+    auto f = env_.functor(clause_head(subsection[0].clause()));
+    size_t arity = f.arity();
+    size_t n = subsection.size();
+
+    std::vector<std::pair<size_t, size_t> > ranked; // (#distinct, argno)
+    for (size_t argno = 0; argno < arity; argno++) {
+	std::unordered_set<term> keys;
+	bool all_bound = true;
+	for (auto &m_clause : subsection) {
+	    auto key = index_arg(m_clause.clause(), argno);
+	    if (key.tag().is_ref()) {
+		all_bound = false;
+		break;
+	    }
+	    keys.insert(key);
+	}
+	if (argno == 0) {
+	    ranked.push_back(std::make_pair(keys.size(), argno));
+	    if (keys.size() == n) {
+		break;
+	    }
+	} else if (all_bound && keys.size() > 1) {
+	    ranked.push_back(std::make_pair(keys.size(), argno));
+	}
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(),
+		     [](const std::pair<size_t,size_t> &a,
+			const std::pair<size_t,size_t> &b)
+		     { return a.first > b.first; });
+
+    std::vector<size_t> positions;
+    for (auto &r : ranked) {
+	positions.push_back(r.second);
+    }
+    return positions;
+}
+
 void wam_compiler::emit_switch_on_term(const managed_clauses &subsection,
 	       const std::vector<common::int_cell> &labels,
+	       size_t argno,
+	       code_point on_var_cp,
 	       wam_interim_code &instrs)
 {
-    auto on_var_cp = code_point(labels[0]);
-
-    auto on_con = find_clauses_on_cat(subsection, FIRST_CON);
+    auto on_con = find_clauses_on_cat(subsection, FIRST_CON, argno);
     auto on_con_cp = on_con.empty() ? code_point::fail() 
 	           : (on_con.size() == 1) ? code_point(labels[2*on_con[0]+1])
 	           : code_point(new_label());
 
-    auto on_lst = find_clauses_on_cat(subsection, FIRST_LST);
+    auto on_lst = find_clauses_on_cat(subsection, FIRST_LST, argno);
     auto on_lst_cp = on_lst.empty() ? code_point::fail() 
 	           : (on_lst.size() == 1) ? code_point(labels[2*on_lst[0]+1])
 	           : code_point(new_label());
 
-    auto on_str = find_clauses_on_cat(subsection, FIRST_STR);
+    auto on_str = find_clauses_on_cat(subsection, FIRST_STR, argno);
     auto on_str_cp = on_str.empty() ? code_point::fail() 
 	           : (on_str.size() == 1) ? code_point(labels[2*on_str[0]+1])
 	           : code_point(new_label());
 
-    instrs.push_back(wam_instruction<SWITCH_ON_TERM>(on_var_cp, on_con_cp, on_lst_cp, on_str_cp));
+    instrs.push_back(wam_instruction<SWITCH_ON_TERM>(on_var_cp, on_con_cp, on_lst_cp, on_str_cp, argno));
 
-    emit_second_level_indexing(FIRST_CON,subsection,labels,on_con,on_con_cp,instrs);
-    emit_second_level_indexing(FIRST_LST,subsection,labels,on_lst,on_lst_cp,instrs);
-    emit_second_level_indexing(FIRST_STR,subsection,labels,on_str,on_str_cp,instrs);
+    emit_second_level_indexing(FIRST_CON,subsection,labels,on_con,on_con_cp,argno,instrs);
+    emit_second_level_indexing(FIRST_LST,subsection,labels,on_lst,on_lst_cp,argno,instrs);
+    emit_second_level_indexing(FIRST_STR,subsection,labels,on_str,on_str_cp,argno,instrs);
 }
 
 void wam_compiler::emit_third_level_indexing(
@@ -1923,6 +2067,7 @@ void wam_compiler::emit_second_level_indexing(
 	      const std::vector<common::int_cell> &labels,
 	      const std::vector<size_t> &clause_indices,
 	      code_point cp,
+	      size_t argno,
 	      wam_interim_code &instrs)
 {
     if (clause_indices.size() < 2) {
@@ -1939,7 +2084,7 @@ void wam_compiler::emit_second_level_indexing(
 	common::int_cell new_lbl(0);
 	auto &m_clause = subsection[clause_index];
 
-	auto arg0 = first_arg(m_clause.clause());
+	auto arg0 = index_arg(m_clause.clause(), argno);
 
 	// Already managed?
 	if (map->count(arg0)) {
@@ -1950,7 +2095,7 @@ void wam_compiler::emit_second_level_indexing(
 	std::vector<size_t> same_arg0;
 	for (auto ci : clause_indices) {
 	    auto &other_m_clause = subsection[ci];
-	    auto other_arg0 = first_arg(other_m_clause.clause());
+	    auto other_arg0 = index_arg(other_m_clause.clause(), argno);
 	    if (arg0 == other_arg0) {
 		same_arg0.push_back(ci);
 	    }
@@ -1967,8 +2112,8 @@ void wam_compiler::emit_second_level_indexing(
 	}
     }
     switch (cat) {
-    case FIRST_CON: instrs.push_back(wam_instruction<SWITCH_ON_CONSTANT>(map)); break;
-    case FIRST_STR: instrs.push_back(wam_instruction<SWITCH_ON_STRUCTURE>(map)); break;
+    case FIRST_CON: instrs.push_back(wam_instruction<SWITCH_ON_CONSTANT>(map, argno)); break;
+    case FIRST_STR: instrs.push_back(wam_instruction<SWITCH_ON_STRUCTURE>(map, argno)); break;
     default: break;
     }
     size_t n = for_third_arg.size();
@@ -1991,7 +2136,19 @@ void wam_compiler::compile_subsection(const managed_clauses &subsection,
     
     if (n > 1) {
         std::vector<common::int_cell> labels = new_labels(2*n);
-	if (!arity_0) emit_switch_on_term(subsection, labels, instrs);
+	if (!arity_0) {
+	    auto positions = index_positions(subsection);
+	    size_t num_positions = positions.size();
+	    for (size_t i = 0; i < num_positions; i++) {
+		bool is_last = i == num_positions - 1;
+		auto on_var_lbl = is_last ? labels[0] : new_label();
+		emit_switch_on_term(subsection, labels, positions[i],
+				    code_point(on_var_lbl), instrs);
+		if (!is_last) {
+		    instrs.push_back(wam_interim_instruction<INTERIM_LABEL>(on_var_lbl));
+		}
+	    }
+	}
 	for (size_t i = 0; i < n; i++) {
 	    emit_cp(labels, i, n, instrs);
 	    auto &m_clause = subsection[i];
@@ -2073,7 +2230,9 @@ std::vector<managed_clauses> wam_compiler::partition_clauses(
 	if (f.arity() < 1) {
 	    // There's no argument, so no partition can be made. All clauses
 	    // becomes a single partition.
-	    *v = clauses;
+	    for (auto &c : clauses) {
+		if (!c.is_erased()) v->push_back(c);
+	    }
 	    return partitioned;
 	}
 
@@ -2100,13 +2259,18 @@ std::vector<managed_clauses> wam_compiler::partition_clauses(
 }
 
 term wam_compiler::first_arg(const term clause)
+{
+    return index_arg(clause, 0);
+}
+
+term wam_compiler::index_arg(const term clause, size_t argno)
 {
     auto head = clause_head(clause);
     auto f = env_.functor(head);
-    if (f.arity() == 0) {
+    if (f.arity() <= argno) {
 	return env_.EMPTY_LIST;
     }
-    auto arg = env_.arg(head, 0);
+    auto arg = env_.arg(head, argno);
     switch (arg.tag()) {
     case common::tag_t::REF: case common::tag_t::RFW: return arg;
     case common::tag_t::CON: return arg;
@@ -2119,7 +2283,12 @@ term wam_compiler::first_arg(const term clause)
 
 wam_compiler::first_arg_cat_t wam_compiler::first_arg_cat(const term cl)
 {
-    term arg = first_arg(cl);
+    return arg_cat(cl, 0);
+}
+
+wam_compiler::first_arg_cat_t wam_compiler::arg_cat(const term cl, size_t argno)
+{
+    term arg = index_arg(cl, argno);
 
     if (interp_.is_dotted_pair(arg)) {
 	return FIRST_LST;
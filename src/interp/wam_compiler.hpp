@@ -89,18 +89,10 @@ public:
     static inline void init() {
 	static bool init = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	for (auto &p : *from_) {
-	    update_ptr(p, old_base, new_base);
-	}
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
         assert("this instruction should never be executed." == nullptr);
@@ -120,12 +112,6 @@ public:
 	out << "]";
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_interim_instruction<INTERIM_MERGE> *>(self);
-	self1->update(old_base, new_base);
-    }
-
     const std::vector<code_point> & sources() const {
 	return *from_;
     }
@@ -210,9 +196,10 @@ public:
 	    std::forward_list<wam_instruction_base *>::iterator &it)
     {
 	size_--;
-	bool at_end = it == end_;
+	auto it_next = it; ++it_next;
+	bool at_end = it_next == end_;
         auto it1 = std::forward_list<wam_instruction_base *>::erase_after(it);
-	if (at_end) end_ = it1;
+	if (at_end) end_ = it;
 	return it1;
     }
 
@@ -222,9 +209,9 @@ public:
     {
 	auto n = std::distance(it, it_last) - 1;
 	size_ -= n;
-	bool at_end = it_last == end_;
+	bool at_end = it_last == end();
         auto it1 = std::forward_list<wam_instruction_base *>::erase_after(it, it_last);
-	if (at_end) end_ = it1;
+	if (at_end) end_ = it;
 	return it1;
     }
 
@@ -343,6 +330,11 @@ public:
 
     bool compile_predicate(const qname &qn, wam_interim_code &instrs);
 
+    // Replace frequent adjacent instruction pairs with superinstructions.
+    // Run this last as the fused instructions are not understood by
+    // the other passes.
+    void fuse_instructions(wam_interim_code &instrs);
+
     inline common::con_cell current_module()
     { return interp_.current_module(); }
 
@@ -537,8 +529,10 @@ private:
         FIRST_VAR, FIRST_CON, FIRST_LST, FIRST_STR
     };
     first_arg_cat_t first_arg_cat(const term clause);
+    first_arg_cat_t arg_cat(const term clause, size_t argno);
 
     term first_arg(const term clause);
+    term index_arg(const term clause, size_t argno);
     common::con_cell first_arg_functor(const term clause);
     bool first_arg_is_var(const term clause);
     bool first_arg_is_con(const term clause);
@@ -548,9 +542,13 @@ private:
     std::vector<managed_clauses> partition_clauses_nonvar(const managed_clauses &clauses);
     std::vector<managed_clauses> partition_clauses_first_arg(const managed_clauses &clauses);
     std::vector<size_t> find_clauses_on_cat(const managed_clauses &clauses,
-					    first_arg_cat_t cat);
+					    first_arg_cat_t cat,
+					    size_t argno);
+    std::vector<size_t> index_positions(const managed_clauses &subsection);
     void emit_switch_on_term(const managed_clauses &subsection,
 			     const std::vector<common::int_cell> &labels,
+			     size_t argno,
+			     code_point on_var_cp,
 			     wam_interim_code &instrs);
     void emit_second_level_indexing(
 	      wam_compiler::first_arg_cat_t cat,
@@ -558,6 +556,7 @@ private:
 	      const std::vector<common::int_cell> &labels,
 	      const std::vector<size_t> &clause_indices,
 	      code_point cp,
+	      size_t argno,
 	      wam_interim_code &instrs);
     void emit_third_level_indexing(
 	     const std::vector<size_t> &clause_indices,
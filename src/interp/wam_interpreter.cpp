@@ -1,26 +1,31 @@
 #include "wam_interpreter.hpp"
 #include "wam_compiler.hpp"
+#include "../common/term_serializer.hpp"
+#include <functional>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
 
 namespace prologcoin { namespace interp {
 
 std::unordered_map<wam_instruction_base::fn_type, wam_instruction_base::print_fn_type> wam_instruction_base::print_fns_;
-std::unordered_map<wam_instruction_base::fn_type, wam_instruction_base::updater_fn_type> wam_instruction_base::updater_fns_;
+boost::mutex wam_instruction_base::print_fns_lock_;
+const size_t wam_code::DEFAULT_SEGMENT_SIZE;
 
 size_t wam_code::add(const wam_instruction_base &i)
 {
     size_t offset = next_offset();
     size_t sz = i.size();
-    code_t *old_base = instrs_;
     code_t *data = ensure_fit(sz);
-    code_t *new_base = instrs_;
     auto p = reinterpret_cast<wam_instruction_base *>(data);
     memcpy(p, &i, sz*sizeof(code_t));
 
-    if (old_base != new_base) {
-	p->update(old_base, new_base);
-    }
-
-    if (i.type() == EXECUTE || i.type() == CALL) {
+    if (i.type() == EXECUTE || i.type() == CALL ||
+	i.type() == PUT_VALUE_X_EXECUTE) {
 	auto *cp_instr = reinterpret_cast<wam_instruction_code_point *>(p);
 	auto module = cp_instr->cp().module();
 	auto f = cp_instr->cp().name();
@@ -29,6 +34,55 @@ size_t wam_code::add(const wam_instruction_base &i)
     return sz;
 }
 
+void wam_code::new_segment(size_t capacity)
+{
+    if (current_ != nullptr && current_->size == 0) {
+	// Nothing was added; just replace it
+	segments_.erase(current_->addr);
+	segments_by_data_.erase(current_->data);
+	if (last_segment_ == current_) last_segment_ = nullptr;
+	delete current_;
+    }
+    current_ = new code_segment(next_addr_, capacity);
+    segments_[current_->addr] = current_;
+    segments_by_data_[current_->data] = current_;
+}
+
+void wam_code::free_segments()
+{
+    for (auto &e : segments_) {
+	delete e.second;
+    }
+    segments_.clear();
+    segments_by_data_.clear();
+    current_ = nullptr;
+    last_segment_ = nullptr;
+}
+
+void wam_code::free_segment(code_segment *seg)
+{
+    assert(seg->retired);
+
+    // Forget call sites in this segment
+    size_t from = seg->addr, to = seg->addr + seg->size;
+    for (auto &e : calls_) {
+	auto &offsets = e.second;
+	offsets.erase(std::remove_if(offsets.begin(), offsets.end(),
+				     [&](size_t offset) {
+					 return offset >= from && offset < to; }),
+		      offsets.end());
+    }
+
+    dead_size_ -= seg->size;
+    reclaimed_size_ += seg->size;
+
+    segments_.erase(seg->addr);
+    segments_by_data_.erase(seg->data);
+    if (last_segment_ == seg) last_segment_ = nullptr;
+    if (current_ == seg) current_ = nullptr;
+    delete seg;
+}
+
 void wam_code::remove_compiled(const qname &qn) 
 {
     auto it = predicate_map_.find(qn);
@@ -36,6 +90,16 @@ void wam_code::remove_compiled(const qname &qn)
 	auto meta_data = it->second;
 	predicate_map_.erase(qn);
 	predicate_rev_map_.erase(meta_data.code_offset);
+
+	// The code may still be referenced (e.g. by a choice point), so
+	// the segment is kept but it will never be extended again.
+	auto *seg = find_segment(meta_data.code_offset);
+	seg->retired = true;
+	live_size_ -= seg->size;
+	dead_size_ += seg->size;
+	if (seg == current_) {
+	    current_ = nullptr;
+	}
 	
 	auto &offsets = calls_[qn];
 	for (auto offset : offsets) {
@@ -46,117 +110,750 @@ void wam_code::remove_compiled(const qname &qn)
     }
 }
 
-void wam_code::update(code_t *old_base, code_t *new_base)
-{
-    wam_instruction_base *instr = reinterpret_cast<wam_instruction_base *>(new_base);
-    for (size_t i = 0; i < instrs_size_;) {
-	instr->update(old_base, new_base);
-	instr = interp_.next_instruction(instr);
-	i = static_cast<size_t>(reinterpret_cast<code_t *>(instr) - new_base);
-    }
-
-    for (auto &p : interp_.code_db())
-    {
-	code_point &code_p = p.second;
-	update_ptr(code_p, old_base, new_base);
-    }
-}
-
 void wam_code::print_code(std::ostream &out)
 {
-    print_code(out, 0, instrs_size_);
+    print_code(out, 0, next_offset());
 }
 	
 void wam_code::print_code(std::ostream &out, size_t from, size_t to)
 {
     static const common::con_cell default_module("[]",0);
-    for (size_t i = from; i < to;) {
-	if (predicate_rev_map_.count(i)) {
-	    auto name = predicate_rev_map_[i];
-	    if (name.first == default_module) {
-		out << interp_.to_string(name.second);
-	    } else {
-		out << interp_.to_string(name.first) << ":"
-		    << interp_.to_string(name.second);
-	    }
-	    out << "/" << name.second.arity() << ": ";
-	    if (predicate_map_.count(name)) {
-	      auto meta_data = predicate_map_[name];
-	      out << "(num_x=" << meta_data.num_x_registers << ")";
+
+    auto it = segments_.upper_bound(from);
+    if (it != segments_.begin()) --it;
+    for (; it != segments_.end() && it->first < to; ++it) {
+	auto *seg = it->second;
+	size_t seg_end = std::min(to, seg->addr + seg->size);
+	for (size_t i = std::max(from, seg->addr); i < seg_end;) {
+	    if (predicate_rev_map_.count(i)) {
+		auto name = predicate_rev_map_[i];
+		if (name.first == default_module) {
+		    out << interp_.to_string(name.second);
+		} else {
+		    out << interp_.to_string(name.first) << ":"
+			<< interp_.to_string(name.second);
+		}
+		out << "/" << name.second.arity() << ": ";
+		if (predicate_map_.count(name)) {
+		    auto meta_data = predicate_map_[name];
+		    out << "(num_x=" << meta_data.num_x_registers << ")";
+		}
+		out << std::endl;
 	    }
-	    out << std::endl;
-	}
 
-	wam_instruction_base *instr
-	  = reinterpret_cast<wam_instruction_base *>(&instrs_[i]);
-	out << "[" << std::setw(5) << i << "]: ";
-	instr->print(out, interp_);
-	out << std::endl;
+	    wam_instruction_base *instr
+		= reinterpret_cast<wam_instruction_base *>(&seg->data[i - seg->addr]);
+	    out << "[" << std::setw(5) << i << "]: ";
+	    instr->print(out, interp_);
+	    out << std::endl;
 	
-	i += instr->size();
+	    i += instr->size();
+	}
     }
 }
 
-wam_interpreter::wam_interpreter(const std::string &name) : interpreter_base(name), wam_code(*this), auto_wam_(false), compiler_(nullptr)
+wam_interpreter::wam_interpreter(const std::string &name) : interpreter_base(name), wam_code(*this), auto_wam_(false), dispatch_mode_(DISPATCH_THREADED), instruction_count_(0), superinstructions_(true), dead_code_threshold_(256*1024), profile_n_(0), profile_window_(0), profile_fill_(0), sampling_(false), sampled_ticks_(0), port_counting_(false), port_top_(NO_PORT_FRAME), port_num_exited_(0), port_max_exit_(0), port_cost_(0), port_last_cost_(0), port_time_(0), compiler_(nullptr)
 {
     total_reset();
 }
 
 wam_interpreter::~wam_interpreter()
 {
+    if (sampling_) {
+	stop_sampling();
+    }
     delete compiler_;
     for (auto m : hash_maps_) {
 	delete m;
     }
 }
 
-void wam_interpreter::update(code_t *old_base, code_t *new_base)
+size_t wam_interpreter::collect_dead_code()
 {
-    wam_code::update(old_base, new_base);
+    if (dead_code_size() == 0) {
+	return 0;
+    }
+
+    count_code_collection();
+
+    // Mark retired segments that are still referenced. Live code never
+    // refers to retired code (remove_compiled() unlinks all call sites)
+    // so it is enough to look at the stacks and registers.
+
+    std::unordered_set<code_segment *> referenced;
+
+    auto mark = [&](const code_point &cp) {
+	if (!cp.has_wam_code()) {
+	    return;
+	}
+	auto *seg = segment_of(reinterpret_cast<const code_t *>(cp.wam_code()));
+	if (seg != nullptr && seg->retired) {
+	    referenced.insert(seg);
+	}
+    };
 
     struct visit : public stack_frame_visitor {
-	visit(wam_interpreter &interp, code_t *old_base0, code_t *new_base0) :
-	    interp_(interp), old_base_(old_base0), new_base_(new_base0) { }
-	
+	visit(std::function<void (const code_point &)> mark0) : mark_(mark0) { }
+
 	virtual void visit_naive_environment(environment_naive_t *e) override {
-	    visit_env(e);
+	    mark_(e->cp);
 	}
 	virtual void visit_wam_environment(environment_t *e) override {
-	    visit_env(e);
+	    mark_(e->cp);
 	}
 	virtual void visit_frozen_environment(environment_frozen_t *e) override {
-	    visit_env(e);
-	    update(e->p);
+	    mark_(e->cp);
+	    mark_(e->p);
 	}
 	virtual void visit_choice_point(choice_point_t *cp) override {
-	    update(cp->cp);
-	    update(cp->bp);
+	    mark_(cp->cp);
+	    mark_(cp->bp);
+	    if (cp->wp != nullptr) {
+		mark_(code_point(cp->wp));
+	    }
 	}
 	virtual void visit_meta_context(meta_context *m) override {
-	    update(m->old_p);
-	    update(m->old_cp);	    
+	    mark_(m->old_p);
+	    mark_(m->old_cp);
 	}
-	inline void visit_env(environment_base_t *e) {
-	    update(e->cp);
+
+	std::function<void (const code_point &)> mark_;
+    };
+
+    visit v(mark);
+    foreach_stack_frame(v);
+
+    mark(p());
+    mark(cp());
+    mark(tmp_);
+    for (auto &e : code_db()) {
+	mark(e.second);
+    }
+
+    // Release the others
+
+    std::vector<code_segment *> dead;
+    for (auto &e : segments()) {
+	auto *seg = e.second;
+	if (seg->retired && !referenced.count(seg)) {
+	    dead.push_back(seg);
 	}
+    }
 
-	inline void update(code_point &cp) {
-	    update_ptr(cp, old_base_, new_base_);
+    size_t released = 0;
+    for (auto *seg : dead) {
+	release_hash_maps(seg);
+	released += seg->size * sizeof(code_t);
+	free_segment(seg);
+    }
+
+    return released;
+}
+
+void wam_interpreter::release_hash_maps(code_segment *seg)
+{
+    std::unordered_set<wam_hash_map *> maps;
+    auto *instr = reinterpret_cast<wam_instruction_base *>(seg->data);
+    auto *end = seg->data + seg->size;
+    while (reinterpret_cast<code_t *>(instr) < end) {
+	if (instr->type() == SWITCH_ON_CONSTANT ||
+	    instr->type() == SWITCH_ON_STRUCTURE) {
+	    maps.insert(&static_cast<wam_instruction_hash_map *>(instr)->map());
 	}
+	instr = next_instruction(instr);
+    }
+    if (maps.empty()) {
+	return;
+    }
+    hash_maps_.erase(std::remove_if(hash_maps_.begin(), hash_maps_.end(),
+				    [&](wam_hash_map *m) {
+					return maps.count(m) != 0; }),
+		     hash_maps_.end());
+    for (auto *m : maps) {
+	delete m;
+    }
+}
+
+//
+// Code images. The header is followed by the code (with relocatable
+// code points) and then the builtin modules and switch tables in the
+// order their instructions appear in the code.
+//
 
-	wam_interpreter &interp_;
-	code_t *old_base_;
-	code_t *new_base_;	
+static const code_t CODE_IMAGE_MAGIC = 0x57414d434f444500; // "WAMCODE"
+// Bump whenever the image layout changes.
+static const code_t CODE_IMAGE_FORMAT = 1;
+static const size_t CODE_IMAGE_HEADER_SIZE = 5;
+
+// The image format and a hash (FNV-1a) of the instruction set and the
+// size of each instruction, so images saved by an interpreter with
+// another instruction layout are rejected.
+static code_t code_image_version()
+{
+#define WAM_INSTRUCTION_SIZE(I) sizeof(wam_instruction<I>),
+    static const size_t sizes[] = {
+	WAM_INSTRUCTION_LIST(WAM_INSTRUCTION_SIZE)
     };
+#undef WAM_INSTRUCTION_SIZE
+    static const code_t version = [] {
+	code_t h = 0xcbf29ce484222325;
+	auto mix = [&h](code_t v) {
+	    h ^= v;
+	    h *= 0x100000001b3;
+	};
+	mix(CODE_IMAGE_FORMAT);
+	for (auto size : sizes) {
+	    mix(size);
+	}
+	return h;
+    }();
+    return version;
+}
 
-    visit v(*this, old_base, new_base);
-    foreach_stack_frame(v);
+typedef void (*wam_set_type_fn)(wam_instruction_base *instr);
+
+#define WAM_INSTRUCTION_SET_TYPE(I) [](wam_instruction_base *instr) { instr->set_type<I>(); },
+static const wam_set_type_fn wam_set_type_fns_[] = {
+    WAM_INSTRUCTION_LIST(WAM_INSTRUCTION_SET_TYPE)
+};
+#undef WAM_INSTRUCTION_SET_TYPE
+
+bool wam_interpreter::save_code_image(const qname &qn, std::vector<uint8_t> &image)
+{
+    using namespace common;
+
+    if (!is_compiled(qn)) {
+	return false;
+    }
+    auto &meta = get_wam_predicate_meta_data(qn);
+    const code_t *data = reinterpret_cast<const code_t *>(to_code(meta.code_offset));
+    size_t size = meta.end_offset - meta.code_offset;
 
-    update_ptr(p(), old_base, new_base);
-    update_ptr(cp(), old_base, new_base);
-    update_ptr(tmp_, old_base, new_base);
+    std::vector<code_t> words;
+    words.push_back(CODE_IMAGE_MAGIC);
+    words.push_back(code_image_version());
+    words.push_back(meta.num_x_registers);
+    words.push_back(meta.num_y_registers);
+    words.push_back(size);
+    words.insert(words.end(), data, data + size);
+    std::vector<code_t> aux;
+
+    auto is_constant = [](const term t) {
+	return t.tag() == tag_t::CON || t.tag() == tag_t::INT;
+    };
+
+    auto relative = [&](const code_point &cp, code_t &rel) {
+	if (!cp.has_wam_code()) {
+	    return false;
+	}
+	auto *p = reinterpret_cast<const code_t *>(cp.wam_code());
+	if (p < data || p >= data + size) {
+	    return false;
+	}
+	rel = static_cast<code_t>(p - data);
+	return true;
+    };
+
+    auto encode_label = [&](code_point &cp) {
+	if (cp.is_fail()) {
+	    cp.reset();
+	    return true;
+	}
+	code_t rel = 0;
+	if (!relative(cp, rel)) {
+	    return false;
+	}
+	cp = code_point(int_cell(static_cast<int64_t>(rel)));
+	return true;
+    };
+
+    auto encode_call = [&](code_point &cp) {
+	if (!cp.has_wam_code()) {
+	    return cp.term_code().tag() == tag_t::CON;
+	}
+	auto *callee = segment_of(reinterpret_cast<const code_t *>(cp.wam_code()));
+	if (callee == nullptr || !callee->owned) {
+	    return false;
+	}
+	cp = code_point(callee->qn.first, callee->qn.second);
+	return true;
+    };
+
+    code_t *code = &words[CODE_IMAGE_HEADER_SIZE];
+    for (size_t i = 0; i < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(&code[i]);
+	bool ok = true;
+	switch (instr->type()) {
+	case TRY_ME_ELSE:
+	case RETRY_ME_ELSE:
+	case TRY:
+	case RETRY:
+	case TRUST:
+	case GOTO:
+	    ok = encode_label(static_cast<wam_instruction_code_point *>(instr)->cp());
+	    break;
+	case SWITCH_ON_TERM: {
+	    auto *sw = static_cast<wam_instruction<SWITCH_ON_TERM> *>(instr);
+	    ok = encode_label(sw->pv()) && encode_label(sw->pc()) &&
+		 encode_label(sw->pl()) && encode_label(sw->ps());
+	    break;
+	    }
+	case SWITCH_ON_CONSTANT:
+	case SWITCH_ON_STRUCTURE: {
+	    auto *sw = static_cast<wam_instruction_hash_map *>(instr);
+	    aux.push_back(sw->map().size());
+	    for (auto &e : sw->map()) {
+		code_t rel = 0;
+		if (!is_constant(e.first) || !relative(e.second, rel)) {
+		    return false;
+		}
+		aux.push_back(e.first.raw_value());
+		aux.push_back(rel);
+	    }
+	    sw->set_map(nullptr);
+	    break;
+	    }
+	case CALL:
+	case EXECUTE:
+	case PUT_VALUE_X_EXECUTE:
+	    ok = encode_call(static_cast<wam_instruction_code_point *>(instr)->cp());
+	    break;
+	case BUILTIN:
+	case BUILTIN_R: {
+	    auto &cp = static_cast<wam_instruction_code_point *>(instr)->cp();
+	    qname bn_qn;
+	    if (!find_builtin(cp.bn(), cp.name(), bn_qn)) {
+		return false;
+	    }
+	    aux.push_back(bn_qn.first.raw_value());
+	    cp = code_point(cp.name(), nullptr, cp.is_builtin_recursive());
+	    break;
+	    }
+	case RESET_LEVEL:
+	    static_cast<wam_instruction_code_point *>(instr)->cp().reset();
+	    break;
+	case PUT_CONSTANT:
+	case GET_CONSTANT:
+	case SET_CONSTANT:
+	case UNIFY_CONSTANT:
+	case COST:
+	    ok = is_constant(static_cast<wam_instruction_term *>(instr)->get_term());
+	    break;
+	default:
+	    break;
+	}
+	if (!ok) {
+	    return false;
+	}
+	i += instr->size();
+	instr->set_type(nullptr, instr->type());
+    }
+
+    words.insert(words.end(), aux.begin(), aux.end());
+
+    image.resize(words.size() * sizeof(code_t));
+    memcpy(&image[0], &words[0], image.size());
+    return true;
 }
-	
+
+bool wam_interpreter::load_code_image(const qname &qn, const uint8_t *image, size_t n)
+{
+    using namespace common;
+
+    if (n % sizeof(code_t) != 0 || n < CODE_IMAGE_HEADER_SIZE*sizeof(code_t)) {
+	return false;
+    }
+    std::vector<code_t> words(n / sizeof(code_t));
+    memcpy(&words[0], image, n);
+    if (words[0] != CODE_IMAGE_MAGIC || words[1] != code_image_version()) {
+	return false;
+    }
+    size_t num_x = words[2], num_y = words[3], size = words[4];
+    if (size == 0 || size > words.size() - CODE_IMAGE_HEADER_SIZE) {
+	return false;
+    }
+    code_t *code = &words[CODE_IMAGE_HEADER_SIZE];
+    const code_t *aux = code + size, *aux_end = &words[0] + words.size();
+
+    auto valid_label = [&](const code_point &cp) {
+	return cp.is_fail() || (cp.term_code().tag() == tag_t::INT &&
+		static_cast<size_t>(cp.label().value()) < size);
+    };
+
+    // Restore the instructions (but keep code points relative) before
+    // anything is added to the code area.
+    std::vector<wam_hash_map *> maps;
+    bool ok = true;
+    for (size_t i = 0; ok && i < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(&code[i]);
+	if (instr->type() >= LAST || instr->size() == 0 ||
+	    instr->size() > size - i) {
+	    ok = false;
+	    break;
+	}
+	wam_set_type_fns_[instr->type()](instr);
+	switch (instr->type()) {
+	case TRY_ME_ELSE:
+	case RETRY_ME_ELSE:
+	case TRY:
+	case RETRY:
+	case TRUST:
+	case GOTO:
+	    ok = valid_label(static_cast<wam_instruction_code_point *>(instr)->cp());
+	    break;
+	case SWITCH_ON_TERM: {
+	    auto *sw = static_cast<wam_instruction<SWITCH_ON_TERM> *>(instr);
+	    ok = valid_label(sw->pv()) && valid_label(sw->pc()) &&
+		 valid_label(sw->pl()) && valid_label(sw->ps());
+	    break;
+	    }
+	case SWITCH_ON_CONSTANT:
+	case SWITCH_ON_STRUCTURE: {
+	    if (aux == aux_end) {
+		ok = false;
+		break;
+	    }
+	    size_t num = *aux++;
+	    if (num > static_cast<size_t>(aux_end - aux) / 2) {
+		ok = false;
+		break;
+	    }
+	    auto *map = new wam_hash_map();
+	    maps.push_back(map);
+	    for (size_t j = 0; j < num; j++) {
+		term key = cell(*aux++);
+		size_t rel = *aux++;
+		if (rel >= size) {
+		    ok = false;
+		}
+		(*map)[key] = code_point(int_cell(static_cast<int64_t>(rel)));
+	    }
+	    static_cast<wam_instruction_hash_map *>(instr)->set_map(map);
+	    break;
+	    }
+	case BUILTIN:
+	case BUILTIN_R: {
+	    if (aux == aux_end) {
+		ok = false;
+		break;
+	    }
+	    cell module_cell(*aux++);
+	    auto &module = reinterpret_cast<const con_cell &>(module_cell);
+	    auto &cp = static_cast<wam_instruction_code_point *>(instr)->cp();
+	    auto &bn = get_builtin(qname(module, cp.name()));
+	    if (bn.fn() == nullptr) {
+		ok = false;
+		break;
+	    }
+	    cp = code_point(cp.name(), bn.fn(), cp.is_builtin_recursive());
+	    break;
+	    }
+	default:
+	    break;
+	}
+	i += instr->size();
+    }
+    if (!ok || aux != aux_end) {
+	for (auto *map : maps) {
+	    delete map;
+	}
+	return false;
+    }
+    hash_maps_.insert(hash_maps_.end(), maps.begin(), maps.end());
+
+    new_segment(size);
+    size_t first_offset = next_offset();
+    for (size_t i = 0; i < size;) {
+	auto *instr = reinterpret_cast<wam_instruction_base *>(&code[i]);
+	add(*instr);
+	i += instr->size();
+    }
+
+    auto bind_label = [&](code_point &cp) {
+	if (!cp.is_fail()) {
+	    cp.set_wam_code(to_code(first_offset + static_cast<size_t>(cp.label().value())));
+	}
+    };
+
+    auto bind_call = [&](code_point &cp) {
+	qname callee(cp.module(), cp.name());
+	auto &callee_code = get_code(callee);
+	if (callee_code.has_wam_code()) {
+	    cp.set_wam_code(callee_code.wam_code());
+	} else if (auto instr = resolve_wam_predicate(callee.first, callee.second)) {
+	    cp.set_wam_code(instr);
+	}
+    };
+
+    auto *instr = to_code(first_offset);
+    for (size_t i = 0; i < size;) {
+	switch (instr->type()) {
+	case TRY_ME_ELSE:
+	case RETRY_ME_ELSE:
+	case TRY:
+	case RETRY:
+	case TRUST:
+	case GOTO:
+	    bind_label(static_cast<wam_instruction_code_point *>(instr)->cp());
+	    break;
+	case SWITCH_ON_TERM: {
+	    auto *sw = static_cast<wam_instruction<SWITCH_ON_TERM> *>(instr);
+	    bind_label(sw->pv());
+	    bind_label(sw->pc());
+	    bind_label(sw->pl());
+	    bind_label(sw->ps());
+	    break;
+	    }
+	case SWITCH_ON_CONSTANT:
+	case SWITCH_ON_STRUCTURE:
+	    for (auto &e : static_cast<wam_instruction_hash_map *>(instr)->map()) {
+		bind_label(e.second);
+	    }
+	    break;
+	case CALL:
+	case EXECUTE:
+	case PUT_VALUE_X_EXECUTE:
+	    bind_call(static_cast<wam_instruction_code_point *>(instr)->cp());
+	    break;
+	default:
+	    break;
+	}
+	i += instr->size();
+	instr = next_instruction(instr);
+    }
+
+    set_wam_predicate(qn, first_offset, next_offset(), num_x, num_y);
+    set_code(qn, code_point(to_code(first_offset)));
+    get_predicate(qn).set_was_compiled(true);
+
+    return true;
+}
+
+static const code_t MODULE_IMAGE_MAGIC = 0x57414d4d4f444c00; // "WAMMODL"
+
+void wam_interpreter::save_module_image(common::con_cell module, uint64_t key, std::vector<uint8_t> &image)
+{
+    using namespace common;
+
+    image.clear();
+    auto put_word = [&](uint64_t w) {
+	auto *p = reinterpret_cast<const uint8_t *>(&w);
+	image.insert(image.end(), p, p + sizeof(w));
+    };
+    auto put_bytes = [&](const uint8_t *bytes, size_t n) {
+	put_word(n);
+	image.insert(image.end(), bytes, bytes + n);
+    };
+
+    put_word(MODULE_IMAGE_MAGIC);
+    put_word(code_image_version());
+    put_word(key);
+
+    std::vector<std::pair<size_t, std::string> > atoms;
+    get_heap().save_atom_table(atoms);
+    put_word(atoms.size());
+    for (auto &atom : atoms) {
+	put_word(atom.first);
+	put_bytes(reinterpret_cast<const uint8_t *>(atom.second.data()),
+		  atom.second.size());
+    }
+
+    // All the clauses as one list (predicate by predicate)
+    auto &preds = get_module(module);
+    term clauses = EMPTY_LIST;
+    for (size_t i = preds.size(); i > 0; i--) {
+	auto &cls = get_predicate(preds[i-1]).clauses();
+	for (size_t j = cls.size(); j > 0; j--) {
+	    if (!cls[j-1].is_erased()) {
+		clauses = new_dotted_pair(cls[j-1].clause(), clauses);
+	    }
+	}
+    }
+    term_serializer ser(*this);
+    term_serializer::buffer_t buf;
+    ser.write(buf, clauses);
+    put_bytes(&buf[0], buf.size());
+
+    std::vector<std::pair<qname, std::vector<uint8_t> > > code;
+    for (auto &qn : preds) {
+	std::vector<uint8_t> bytes;
+	if (save_code_image(qn, bytes)) {
+	    code.push_back(std::make_pair(qn, std::move(bytes)));
+	}
+    }
+    put_word(code.size());
+    for (auto &c : code) {
+	put_word(c.first.first.raw_value());
+	put_word(c.first.second.raw_value());
+	put_bytes(&c.second[0], c.second.size());
+    }
+}
+
+bool wam_interpreter::load_module_image(common::con_cell module, uint64_t key, const uint8_t *image, size_t n)
+{
+    using namespace common;
+
+    size_t pos = 0;
+    bool ok = true;
+    auto get_word = [&]() {
+	uint64_t w = 0;
+	if (n - pos < sizeof(w)) {
+	    ok = false;
+	    return w;
+	}
+	memcpy(&w, image + pos, sizeof(w));
+	pos += sizeof(w);
+	return w;
+    };
+    auto get_bytes = [&](size_t &len) -> const uint8_t * {
+	len = get_word();
+	if (!ok || len > n - pos) {
+	    ok = false;
+	    return nullptr;
+	}
+	auto *p = image + pos;
+	pos += len;
+	return p;
+    };
+    auto get_con = [&]() {
+	cell c(get_word());
+	return reinterpret_cast<const con_cell &>(c);
+    };
+
+    if (get_word() != MODULE_IMAGE_MAGIC || get_word() != code_image_version() ||
+	get_word() != key || !ok) {
+	return false;
+    }
+
+    std::vector<std::pair<size_t, std::string> > atoms;
+    size_t num_atoms = get_word();
+    for (size_t i = 0; ok && i < num_atoms; i++) {
+	size_t index = get_word(), len = 0;
+	auto *name = get_bytes(len);
+	if (ok) {
+	    atoms.push_back(std::make_pair(index, std::string(reinterpret_cast<const char *>(name), len)));
+	}
+    }
+
+    size_t clauses_len = 0;
+    auto *clauses_bytes = get_bytes(clauses_len);
+
+    struct code_image {
+	qname qn;
+	const uint8_t *bytes;
+	size_t len;
+    };
+    std::vector<code_image> code;
+    size_t num_code = get_word();
+    for (size_t i = 0; ok && i < num_code; i++) {
+	code_image c;
+	c.qn.first = get_con();
+	c.qn.second = get_con();
+	c.bytes = get_bytes(c.len);
+	code.push_back(c);
+    }
+
+    if (!ok || pos != n) {
+	return false;
+    }
+
+    // The clauses and the code refer to atoms by index
+    if (!get_heap().load_atom_table(atoms)) {
+	return false;
+    }
+
+    term clauses;
+    try {
+	term_serializer ser(*this);
+	term_serializer::buffer_t buf(clauses_bytes, clauses_bytes + clauses_len);
+	clauses = ser.read(buf);
+    } catch (const serializer_exception &) {
+	return false;
+    }
+
+    con_cell old_module = current_module();
+    set_current_module(module);
+    load_program(clauses);
+    set_current_module(old_module);
+
+    for (auto &c : code) {
+	if (!load_code_image(c.qn, c.bytes, c.len)) {
+	    compile(c.qn);
+	}
+	clear_updated_predicate(c.qn);
+    }
+
+    return true;
+}
+
+void wam_interpreter::snapshot()
+{
+    std::unique_ptr<snapshot_code> snap(new snapshot_code());
+
+    for (auto &qn : get_predicates()) {
+	if (!is_compiled(qn)) {
+	    continue;
+	}
+	std::vector<uint8_t> image;
+	if (save_code_image(qn, image)) {
+	    snap->images.push_back(std::make_pair(qn, std::move(image)));
+	} else {
+	    snap->no_image.push_back(qn);
+	}
+    }
+
+    for (auto &e : code_db()) {
+	auto &cp = e.second;
+	if (!cp.has_wam_code()) {
+	    continue;
+	}
+	auto *seg = segment_of(reinterpret_cast<const code_t *>(cp.wam_code()));
+	qname owner = (seg != nullptr && seg->owned) ? seg->qn : e.first;
+	snap->code.push_back(std::make_pair(e.first, owner));
+    }
+
+    snapshot_ = std::move(snap);
+}
+
+void wam_interpreter::fork(const wam_interpreter &snapshot)
+{
+    assert(snapshot.is_snapshot());
+
+    interpreter_base::fork(snapshot);
+
+    auto_wam_ = snapshot.auto_wam_;
+    dispatch_mode_ = snapshot.dispatch_mode_;
+    superinstructions_ = snapshot.superinstructions_;
+    dead_code_threshold_ = snapshot.dead_code_threshold_;
+
+    auto &snap = *snapshot.snapshot_;
+
+    // The copied code points refer to the code of the snapshot
+    for (auto &c : snap.code) {
+	set_code(c.first, code_point());
+    }
+
+    for (auto &image : snap.images) {
+	auto &qn = image.first;
+	auto &bytes = image.second;
+	if (!load_code_image(qn, &bytes[0], bytes.size())) {
+	    compile(qn);
+	}
+    }
+    for (auto &qn : snap.no_image) {
+	compile(qn);
+    }
+
+    for (auto &c : snap.code) {
+	auto &qn = c.first, &owner = c.second;
+	if (qn == owner) {
+	    continue;
+	}
+	set_code(qn, is_compiled(owner) ? get_code(owner)
+		                        : code_point(owner.first, owner.second));
+    }
+}
+
 std::string wam_interpreter::to_string(const code_point &cp) const
 {
     using namespace common;
@@ -209,13 +906,27 @@ void wam_interpreter::total_reset()
     for (auto *m : hash_maps_) delete m;
     hash_maps_.clear();
     compiler_ = new wam_compiler(*this);
+    snapshot_.reset();
 }
 
 bool wam_interpreter::cont_wam()
 {
+    // Debug printouts and profiling are only supported by the function
+    // pointer loop.
+    if (dispatch_mode_ == DISPATCH_THREADED && !is_debug() && !profile_n_ &&
+	!is_instrumented()) {
+	return cont_wam_threaded();
+    }
+
     fail_ = false;
+    profile_window_ = 0;
+    profile_fill_ = 0;
     while (p().has_wam_code() && !is_top_fail()) {
 	if (auto instr = p().wam_code()) {
+	    instruction_count_++;
+	    if (profile_n_) {
+		profile_instruction(instr->type());
+	    }
 	    if (is_debug()) {
 		std::stringstream ss;
 		ss << "[WAM debug]: tr=" << trail_size() << " [" << std::setw(5)
@@ -224,6 +935,12 @@ bool wam_interpreter::cont_wam()
 		std::cout << ss.str() << "\n";
 	    }
 	    instr->invoke(*this);
+	    if (sampling_) {
+		sample_wam(instr);
+	    }
+	    if (port_counting_) {
+		port_step_wam(instr);
+	    }
 	}
     }
     if (is_debug()) {
@@ -236,8 +953,630 @@ bool wam_interpreter::cont_wam()
     return !fail_;
 }
 
+//
+// The jump table below is indexed by instruction type, so the
+// instruction list must enumerate wam_instruction_type in order.
+//
+#define WAM_INSTRUCTION_ENUM(I) I,
+static constexpr wam_instruction_type wam_dispatch_order_[] = {
+    WAM_INSTRUCTION_LIST(WAM_INSTRUCTION_ENUM)
+};
+#undef WAM_INSTRUCTION_ENUM
+
+static constexpr bool wam_dispatch_order_ok(size_t i)
+{
+    return i == LAST || (wam_dispatch_order_[i] == i && wam_dispatch_order_ok(i+1));
+}
+
+static_assert(sizeof(wam_dispatch_order_)/sizeof(wam_dispatch_order_[0]) == LAST && wam_dispatch_order_ok(0), "WAM_INSTRUCTION_LIST does not match wam_instruction_type");
+
+static_assert(LAST < 256, "wam_interpreter::profile_instruction() packs instruction types into 8 bits");
+
+#define WAM_INSTRUCTION_STRING(I) #I,
+static const char * wam_instruction_names_[] = {
+    WAM_INSTRUCTION_LIST(WAM_INSTRUCTION_STRING)
+};
+#undef WAM_INSTRUCTION_STRING
+
+const char * wam_instruction_name(wam_instruction_type t)
+{
+    if (t >= LAST) {
+	return "?";
+    }
+    return wam_instruction_names_[t];
+}
+
+void wam_interpreter::set_instruction_profiling(size_t n)
+{
+    if (n > 4) {
+	throw interpreter_exception_wrong_arg_type("set_instruction_profiling: n-gram size must be at most 4; was " + boost::lexical_cast<std::string>(n));
+    }
+    profile_n_ = n;
+    profile_window_ = 0;
+    profile_fill_ = 0;
+    profile_.clear();
+}
+
+void wam_interpreter::print_instruction_profile(std::ostream &out, size_t top) const
+{
+    std::vector<std::pair<uint32_t, uint64_t> > sorted(profile_.begin(), profile_.end());
+    std::sort(sorted.begin(), sorted.end(),
+	      [](const std::pair<uint32_t, uint64_t> &a,
+		 const std::pair<uint32_t, uint64_t> &b) {
+		  return a.second > b.second ||
+		      (a.second == b.second && a.first < b.first); });
+
+    uint64_t total = 0;
+    for (auto &e : sorted) total += e.second;
+
+    size_t n = std::min(top, sorted.size());
+    for (size_t i = 0; i < n; i++) {
+	auto &e = sorted[i];
+	double pct = total > 0 ? 100.0 * static_cast<double>(e.second) / static_cast<double>(total) : 0.0;
+	out << std::setw(10) << e.second << " " << std::fixed
+	    << std::setprecision(2) << std::setw(6) << pct << "%  ";
+	bool first = true;
+	for (size_t j = profile_n_; j > 0; j--) {
+	    uint32_t t = (e.first >> (8*(j-1))) & 0xff;
+	    if (t == 0) continue;
+	    if (!first) out << " + ";
+	    out << wam_instruction_name(static_cast<wam_instruction_type>(t-1));
+	    first = false;
+	}
+	out << "\n";
+    }
+}
+
+//
+// Sampling profiler. The signal handler only counts ticks; the
+// interpreter checks the count between instructions (and naive goals)
+// and records its call stack there, where it is in a consistent state.
+// A sample is weighted by the number of ticks since the last one.
+//
+
+static std::atomic<uint64_t> sampling_ticks_(0);
+static std::atomic<wam_interpreter *> sampling_interp_(nullptr);
+
+#ifndef _WIN32
+static struct sigaction sampling_old_action_;
+
+static void sampling_handler(int)
+{
+    sampling_ticks_++;
+}
+#endif
+
+void wam_interpreter::start_sampling(size_t interval_us)
+{
+#ifdef _WIN32
+    static_cast<void>(interval_us);
+    throw interpreter_exception_unsupported("start_sampling: not supported on this platform");
+#else
+    if (sampling_) {
+	return;
+    }
+    wam_interpreter *expected = nullptr;
+    if (!sampling_interp_.compare_exchange_strong(expected, this)) {
+	throw interpreter_exception("start_sampling: another interpreter is being sampled");
+    }
+    if (interval_us == 0) {
+	interval_us = 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &sampling_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &sampling_old_action_);
+
+    sampled_ticks_ = sampling_ticks_;
+    sampling_ = true;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
+
+void wam_interpreter::stop_sampling()
+{
+#ifndef _WIN32
+    if (!sampling_) {
+	return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &sampling_old_action_, nullptr);
+
+    sampling_ = false;
+    sampling_interp_ = nullptr;
+#endif
+}
+
+uint64_t wam_interpreter::num_samples() const
+{
+    uint64_t n = 0;
+    for (auto &s : samples_) n += s.second;
+    return n;
+}
+
+void wam_interpreter::print_samples(std::ostream &out) const
+{
+    std::vector<std::pair<std::string, uint64_t> > sorted(samples_.begin(), samples_.end());
+    std::sort(sorted.begin(), sorted.end());
+    for (auto &s : sorted) {
+	out << s.first << " " << s.second << "\n";
+    }
+}
+
+// Add the predicate the code point is in (if it is WAM code.)
+void wam_interpreter::sample_frame(std::vector<common::con_cell> &frames, const code_point &cp)
+{
+    if (!cp.has_wam_code()) {
+	return;
+    }
+    auto &seg = get_segment(cp.wam_code());
+    if (seg.owned) {
+	frames.push_back(seg.qn.second);
+    }
+}
+
+// Walk the environments from the current one to the root. A naive
+// environment belongs to the predicate it saved in pr, a WAM environment
+// to the predicate of its code. Either way its continuation point is in
+// the caller.
+void wam_interpreter::sample_stack(std::vector<common::con_cell> &frames)
+{
+    static const size_t MAX_DEPTH = 256;
+
+    sample_frame(frames, cp());
+
+    auto saved = save_e();
+    for (size_t depth = 0; saved.ce0() != nullptr && depth < MAX_DEPTH; depth++) {
+	auto *e = saved.ce0();
+	if (saved.kind() != ENV_WAM) {
+	    frames.push_back(reinterpret_cast<environment_naive_t *>(e)->pr);
+	}
+	sample_frame(frames, e->cp);
+	saved = e->ce;
+    }
+}
+
+void wam_interpreter::add_sample(const std::vector<common::con_cell> &frames, uint64_t weight)
+{
+    // Frames are leaf first. Consecutive frames of the same predicate
+    // (recursion, or a code point back into the same predicate) are
+    // merged.
+    static const common::con_cell NO_PREDICATE("",0);
+
+    std::string stack;
+    common::con_cell last;
+    for (size_t i = frames.size(); i > 0; i--) {
+	auto f = frames[i-1];
+	// No predicate (e.g. the environment of the query)
+	if (f == last || f == NO_PREDICATE) {
+	    continue;
+	}
+	if (!stack.empty()) stack += ";";
+	stack += atom_name(f);
+	stack += "/";
+	stack += boost::lexical_cast<std::string>(f.arity());
+	last = f;
+    }
+    if (stack.empty()) {
+	stack = "[top]";
+    }
+    samples_[stack] += weight;
+}
+
+void wam_interpreter::sample_wam(wam_instruction_base *instr)
+{
+    uint64_t ticks = sampling_ticks_;
+    if (ticks == sampled_ticks_) {
+	return;
+    }
+    uint64_t weight = ticks - sampled_ticks_;
+    sampled_ticks_ = ticks;
+
+    std::vector<common::con_cell> frames;
+    if (instr->type() == BUILTIN) {
+	frames.push_back(reinterpret_cast<wam_instruction<BUILTIN> *>(instr)->f());
+    } else if (instr->type() == BUILTIN_R) {
+	frames.push_back(reinterpret_cast<wam_instruction<BUILTIN_R> *>(instr)->f());
+    }
+    auto &seg = get_segment(instr);
+    if (seg.owned) {
+	frames.push_back(seg.qn.second);
+    }
+    sample_stack(frames);
+    add_sample(frames, weight);
+}
+
+void wam_interpreter::sample_naive()
+{
+    uint64_t ticks = sampling_ticks_;
+    if (ticks == sampled_ticks_) {
+	return;
+    }
+    uint64_t weight = ticks - sampled_ticks_;
+    sampled_ticks_ = ticks;
+
+    // The goal that was just dispatched
+    std::vector<common::con_cell> frames;
+    auto goal = qr();
+    if (goal.tag() == common::tag_t::STR || goal.tag() == common::tag_t::CON) {
+	auto f = functor(goal);
+	if (f != EMPTY_LIST) {
+	    frames.push_back(f);
+	}
+    }
+    sample_stack(frames);
+    add_sample(frames, weight);
+}
+
+//
+// Port counting
+//
+
+static inline uint64_t port_clock()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void wam_interpreter::start_predicate_statistics()
+{
+    clear_predicate_statistics();
+    port_counting_ = true;
+}
+
+void wam_interpreter::stop_predicate_statistics()
+{
+    if (port_counting_) {
+	port_reset();
+    }
+    port_counting_ = false;
+}
+
+void wam_interpreter::clear_predicate_statistics()
+{
+    port_reset();
+    port_stats_.clear();
+}
+
+const predicate_statistics * wam_interpreter::get_predicate_statistics(const qname &qn) const
+{
+    auto it = port_stats_.find(qn);
+    if (it == port_stats_.end()) {
+	return nullptr;
+    }
+    return &it->second;
+}
+
+void wam_interpreter::print_predicate_statistics(std::ostream &out) const
+{
+    std::vector<std::pair<std::string, const predicate_statistics *> > sorted;
+    for (auto &e : port_stats_) {
+	auto &qn = e.first;
+	std::string name = atom_name(qn.first) + ":" + atom_name(qn.second)
+	    + "/" + boost::lexical_cast<std::string>(qn.second.arity());
+	sorted.push_back(std::make_pair(name, &e.second));
+    }
+    std::sort(sorted.begin(), sorted.end(),
+	      [](const std::pair<std::string, const predicate_statistics *> &a,
+		 const std::pair<std::string, const predicate_statistics *> &b) {
+		  return a.second->exclusive_cost > b.second->exclusive_cost ||
+		      (a.second->exclusive_cost == b.second->exclusive_cost &&
+		       a.first < b.first); });
+
+    out << "# predicate calls exits fails redos inclusive_cost exclusive_cost inclusive_us exclusive_us\n";
+    for (auto &e : sorted) {
+	auto &st = *e.second;
+	out << e.first << " " << st.calls << " " << st.exits << " "
+	    << st.fails << " " << st.redos << " " << st.inclusive_cost << " "
+	    << st.exclusive_cost << " " << st.inclusive_time / 1000 << " "
+	    << st.exclusive_time / 1000 << "\n";
+    }
+}
+
+// Forget the calls in progress (e.g. when a new query is executed.)
+void wam_interpreter::port_reset()
+{
+    for (auto &f : port_frames_) {
+	if (!f.exited) {
+	    f.stats->active--;
+	}
+    }
+    port_frames_.clear();
+    port_top_ = NO_PORT_FRAME;
+    port_num_exited_ = 0;
+    port_max_exit_ = 0;
+    port_last_cost_ = accumulated_cost();
+    port_time_ = port_clock();
+}
+
+// Attribute the cost and time since the last charge to the predicate
+// that is executing (the topmost frame that hasn't exited.)
+void wam_interpreter::port_charge()
+{
+    uint64_t cost = accumulated_cost();
+    // The cost is reset for every query
+    uint64_t dcost = cost >= port_last_cost_ ? cost - port_last_cost_ : 0;
+    port_last_cost_ = cost;
+    port_cost_ += dcost;
+
+    uint64_t now = port_clock();
+    uint64_t dt = now - port_time_;
+    port_time_ = now;
+
+    if (port_top_ != NO_PORT_FRAME) {
+	auto *st = port_frames_[port_top_].stats;
+	st->exclusive_cost += dcost;
+	st->exclusive_time += dt;
+    }
+}
+
+void wam_interpreter::port_open(port_frame &f)
+{
+    f.outermost = f.stats->active == 0;
+    f.stats->active++;
+    f.cost0 = port_cost_;
+    f.time0 = port_time_;
+}
+
+void wam_interpreter::port_close(port_frame &f)
+{
+    f.stats->active--;
+    if (f.outermost) {
+	f.stats->inclusive_cost += port_cost_ - f.cost0;
+	f.stats->inclusive_time += port_time_ - f.time0;
+    }
+}
+
+void wam_interpreter::port_find_top()
+{
+    port_top_ = NO_PORT_FRAME;
+    for (size_t i = port_frames_.size(); i > 0; i--) {
+	if (!port_frames_[i-1].exited) {
+	    port_top_ = i-1;
+	    return;
+	}
+    }
+}
+
+void wam_interpreter::port_call(const qname &qn, const code_point &cont, environment_base_t *e, choice_point_t *b_call)
+{
+    port_charge();
+
+    auto *st = &port_stats_[qn];
+    st->calls++;
+
+    uintptr_t b0 = reinterpret_cast<uintptr_t>(b_call);
+    bool tail = false;
+    if (!port_frames_.empty() && port_top_ == port_frames_.size() - 1) {
+	auto &top = port_frames_.back();
+	if (top.b_call == b0 && top.e == e && top.cont == cont) {
+	    // Is the predicate already in the group? Then move it on
+	    // top so that it is charged for what it executes.
+	    for (size_t i = port_frames_.size(); i > 0; i--) {
+		auto &f = port_frames_[i-1];
+		if (f.stats == st) {
+		    f.count++;
+		    std::rotate(port_frames_.begin() + (i-1),
+				port_frames_.begin() + i,
+				port_frames_.end());
+		    std::swap(port_frames_[i-1].tail, port_frames_.back().tail);
+		    return;
+		}
+		if (!f.tail) {
+		    break;
+		}
+	    }
+	    tail = true;
+	}
+    }
+
+    port_frame f;
+    f.stats = st;
+    f.count = 1;
+    f.cont = cont;
+    f.e = e;
+    f.b_call = b0;
+    f.b_exit = 0;
+    f.tail = tail;
+    f.exited = false;
+    port_open(f);
+    port_frames_.push_back(f);
+    port_top_ = port_frames_.size() - 1;
+}
+
+// Called and failed without matching a clause
+void wam_interpreter::port_call_fail(const qname &qn)
+{
+    auto &st = port_stats_[qn];
+    st.calls++;
+    st.fails++;
+}
+
+void wam_interpreter::port_exit()
+{
+    port_charge();
+
+    uintptr_t b0 = reinterpret_cast<uintptr_t>(b());
+    do {
+	// The whole group exits
+	size_t i = port_top_ + 1;
+	while (i > 0) {
+	    auto &f = port_frames_[i-1];
+	    f.stats->exits += f.count;
+	    port_close(f);
+	    if (!f.tail) {
+		break;
+	    }
+	    i--;
+	}
+	size_t base = i-1;
+	auto &g = port_frames_[base];
+	if (b0 <= g.b_call) {
+	    // Deterministic exit. Frames above have no choice points
+	    // left either.
+	    for (size_t j = port_top_ + 1; j < port_frames_.size(); j++) {
+		port_num_exited_--;
+	    }
+	    port_frames_.resize(base);
+	} else {
+	    // Keep them for redo
+	    for (size_t j = base; j <= port_top_; j++) {
+		port_frames_[j].exited = true;
+		port_frames_[j].b_exit = b0;
+		port_num_exited_++;
+	    }
+	    port_max_exit_ = std::max(port_max_exit_, b0);
+	}
+	port_top_ = NO_PORT_FRAME;
+	for (size_t j = base; j > 0; j--) {
+	    if (!port_frames_[j-1].exited) {
+		port_top_ = j-1;
+		break;
+	    }
+	}
+    } while (port_top_ != NO_PORT_FRAME &&
+	     port_frames_[port_top_].e == e0() &&
+	     port_frames_[port_top_].cont == p());
+}
+
+// Choice points have been removed (e.g. by a cut.) Exited frames with
+// no choice points left can't be redone.
+void wam_interpreter::port_prune()
+{
+    uintptr_t b0 = reinterpret_cast<uintptr_t>(b());
+    size_t n = 0;
+    port_max_exit_ = 0;
+    for (size_t i = 0; i < port_frames_.size(); i++) {
+	auto &f = port_frames_[i];
+	if (f.exited) {
+	    if (b0 <= f.b_call) {
+		port_num_exited_--;
+		continue;
+	    }
+	    f.b_exit = std::min(f.b_exit, b0);
+	    port_max_exit_ = std::max(port_max_exit_, f.b_exit);
+	}
+	if (n != i) {
+	    port_frames_[n] = f;
+	}
+	n++;
+    }
+    port_frames_.resize(n);
+    port_find_top();
+}
+
+// We backtrack to choice point 'b0'.
+void wam_interpreter::port_backtrack(choice_point_t *b0)
+{
+    port_charge();
+
+    uintptr_t b1 = reinterpret_cast<uintptr_t>(b0);
+
+    // Calls made after the choice point fail (or were exited and are
+    // now gone.)
+    while (!port_frames_.empty() && port_frames_.back().b_call >= b1) {
+	auto &f = port_frames_.back();
+	if (f.exited) {
+	    port_num_exited_--;
+	} else {
+	    f.stats->fails += f.count;
+	    port_close(f);
+	}
+	port_frames_.pop_back();
+    }
+
+    // Calls that exited after the choice point was created are redone
+    size_t num_exited = port_num_exited_;
+    for (size_t i = port_frames_.size(); i > 0 && num_exited > 0; i--) {
+	auto &f = port_frames_[i-1];
+	if (!f.exited) {
+	    continue;
+	}
+	num_exited--;
+	if (f.b_exit >= b1) {
+	    f.exited = false;
+	    f.stats->redos += f.count;
+	    port_open(f);
+	    port_num_exited_--;
+	}
+    }
+    port_find_top();
+}
+
+//
+// Same semantics as the function pointer loop in cont_wam(), but the
+// instruction bodies are instantiated here so that the compiler can
+// inline them. With GCC/Clang we use computed gotos (each instruction
+// jumps directly to the next one) otherwise we fall back to a switch.
+//
+bool wam_interpreter::cont_wam_threaded()
+{
+    fail_ = false;
+    wam_instruction_base *instr = nullptr;
+
+#if defined(__GNUC__)
+
+#define WAM_LABEL(I) &&L_##I,
+    static void * const labels[] = { WAM_INSTRUCTION_LIST(WAM_LABEL) };
+#undef WAM_LABEL
+
+#define WAM_NEXT() \
+    if (!p().has_wam_code() || is_top_fail()) goto done; \
+    instr = p().wam_code(); \
+    instruction_count_++; \
+    goto *labels[instr->type()];
+
+#define WAM_CASE(I) \
+    L_##I: wam_instruction<I>::invoke(*this, instr); \
+    if ((I == BUILTIN || I == BUILTIN_R) && is_instrumented()) goto done; \
+    WAM_NEXT();
+
+    WAM_NEXT();
+    WAM_INSTRUCTION_LIST(WAM_CASE)
+
+#undef WAM_CASE
+#undef WAM_NEXT
+
+ done:
+
+#else
+
+#define WAM_CASE(I) \
+    case I: wam_instruction<I>::invoke(*this, instr); \
+	if ((I == BUILTIN || I == BUILTIN_R) && is_instrumented()) return !fail_; \
+	break;
+
+    while (p().has_wam_code() && !is_top_fail()) {
+	instr = p().wam_code();
+	instruction_count_++;
+	switch (instr->type()) {
+	WAM_INSTRUCTION_LIST(WAM_CASE)
+	default: instr->invoke(*this); break;
+	}
+    }
+
+#undef WAM_CASE
+
+#endif
+
+    return !fail_;
+}
+
 bool wam_interpreter::compile(const qname &qn)
 {
+    if (load_cached_code(qn)) {
+	return true;
+    }
+
     size_t heap_sz = heap_size();
 
     wam_interim_code instrs(*this);
@@ -248,20 +1587,29 @@ bool wam_interpreter::compile(const qname &qn)
     }
     size_t xn_size = compiler_->get_num_x_registers(instrs);
     size_t yn_size = compiler_->get_environment_size_of(instrs);    
+    if (superinstructions_) {
+	// After register counting as fused instructions are opaque to
+	// the compiler's register getters.
+	compiler_->fuse_instructions(instrs);
+    }
     size_t first_offset = next_offset();
     
     load_code(instrs);
 
-    auto *next_instr = to_code(first_offset);
-    auto *end_instr = to_code(next_offset());
-    set_wam_predicate(qn, next_instr, end_instr, xn_size, yn_size);
-    code_point cp(next_instr);
+    set_wam_predicate(qn, first_offset, next_offset(), xn_size, yn_size);
+    code_point cp(to_code(first_offset));
     set_code(qn, cp);
 
     trim_heap_safe(heap_sz);
 
     get_predicate(qn).set_was_compiled(true);
 
+    compiled_code(qn);
+
+    if (dead_code_size() >= dead_code_threshold_) {
+	collect_dead_code();
+    }
+
     return true;
 }
 
@@ -394,6 +1742,17 @@ void wam_interpreter::bind_code_point(std::unordered_map<size_t, size_t> &label_
 void wam_interpreter::load_code(wam_interim_code &instrs)
 {
     std::unordered_map<size_t, size_t> label_map;
+
+    // Each predicate gets a segment of its own (so it can be released
+    // on its own.)
+    size_t code_size = 0;
+    for (auto *instr : instrs) {
+	if (!wam_compiler::is_label_instruction(instr)) {
+	    code_size += instr->size();
+	}
+    }
+    new_segment(std::max(code_size, static_cast<size_t>(1)));
+
     size_t first_offset = next_offset();
     size_t offset = first_offset;
     
@@ -421,6 +1780,7 @@ void wam_interpreter::load_code(wam_interim_code &instrs)
 	case TRUST:
 	case CALL:
 	case EXECUTE:
+	case PUT_VALUE_X_EXECUTE:
 	case GOTO:
 	    {
 	    auto cp_instr = static_cast<wam_instruction_code_point *>(instr);
@@ -7,6 +7,7 @@
 #include <vector>
 #include <iomanip>
 #include <map>
+#include <memory>
 #include "interpreter_base.hpp"
 
 namespace prologcoin { namespace interp {
@@ -96,9 +97,86 @@ enum wam_instruction_type {
 
   COST, // Non-standard WAM; for accumulated cost
 
+  // Superinstructions (two instructions fused into one, see
+  // wam_compiler::fuse_instructions()). These are never emitted by
+  // the clause compiler.
+  PUT_VALUE_X2,
+  GET_VARIABLE_X_GET_VALUE_X,
+  ALLOCATE_GET_VARIABLE_Y,
+  PUT_VALUE_X_EXECUTE,
+  UNIFY_VARIABLE_X2,
+  GET_LIST_A_UNIFY_VARIABLE_X,
+  GET_LIST_A_UNIFY_VALUE_X,
+
   LAST
 };
 
+//
+// All executable instructions in the same order as wam_instruction_type.
+// This is used by the threaded dispatch loop (see cont_wam_threaded())
+// to build its jump table.
+//
+#define WAM_INSTRUCTION_LIST(X) \
+  X(PUT_VARIABLE_X) X(PUT_VARIABLE_Y) X(PUT_VALUE_X) X(PUT_VALUE_Y) \
+  X(PUT_UNSAFE_VALUE_Y) X(PUT_STRUCTURE_A) X(PUT_STRUCTURE_X) \
+  X(PUT_STRUCTURE_Y) X(PUT_LIST_A) X(PUT_LIST_X) X(PUT_LIST_Y) \
+  X(PUT_CONSTANT) \
+  X(GET_VARIABLE_X) X(GET_VARIABLE_Y) X(GET_VALUE_X) X(GET_VALUE_Y) \
+  X(GET_STRUCTURE_A) X(GET_STRUCTURE_X) X(GET_STRUCTURE_Y) \
+  X(GET_LIST_A) X(GET_LIST_X) X(GET_LIST_Y) X(GET_CONSTANT) \
+  X(SET_VARIABLE_A) X(SET_VARIABLE_X) X(SET_VARIABLE_Y) \
+  X(SET_VALUE_A) X(SET_VALUE_X) X(SET_VALUE_Y) \
+  X(SET_LOCAL_VALUE_X) X(SET_LOCAL_VALUE_Y) X(SET_CONSTANT) X(SET_VOID) \
+  X(UNIFY_VARIABLE_A) X(UNIFY_VARIABLE_X) X(UNIFY_VARIABLE_Y) \
+  X(UNIFY_VALUE_A) X(UNIFY_VALUE_X) X(UNIFY_VALUE_Y) \
+  X(UNIFY_LOCAL_VALUE_X) X(UNIFY_LOCAL_VALUE_Y) X(UNIFY_CONSTANT) \
+  X(UNIFY_VOID) \
+  X(ALLOCATE) X(DEALLOCATE) X(CALL) X(EXECUTE) X(PROCEED) \
+  X(BUILTIN) X(BUILTIN_R) \
+  X(TRY_ME_ELSE) X(RETRY_ME_ELSE) X(TRUST_ME) X(TRY) X(RETRY) X(TRUST) \
+  X(SWITCH_ON_TERM) X(SWITCH_ON_CONSTANT) X(SWITCH_ON_STRUCTURE) \
+  X(NECK_CUT) X(GET_LEVEL) X(CUT) \
+  X(GOTO) X(RESET_LEVEL) \
+  X(COST) \
+  X(PUT_VALUE_X2) X(GET_VARIABLE_X_GET_VALUE_X) X(ALLOCATE_GET_VARIABLE_Y) \
+  X(PUT_VALUE_X_EXECUTE) X(UNIFY_VARIABLE_X2) \
+  X(GET_LIST_A_UNIFY_VARIABLE_X) X(GET_LIST_A_UNIFY_VALUE_X)
+
+// Name of instruction type (e.g. "GET_LIST_A"), used by the profiler.
+const char * wam_instruction_name(wam_instruction_type t);
+
+//
+// How the WAM interpreter executes instructions. DISPATCH_CALL invokes
+// each instruction through its function pointer (one indirect call per
+// instruction.) DISPATCH_THREADED runs a threaded code loop where the
+// instruction bodies are inlined and jumped to directly.
+//
+enum wam_dispatch_mode { DISPATCH_CALL, DISPATCH_THREADED };
+
+//
+// Port counts (calls, exits, fails and redos) and the cost of a
+// predicate. Inclusive cost and time include the predicates it calls,
+// exclusive only what was spent in its own clauses (and the builtins
+// they call.) Cost is in cost units (see accumulated_cost()) and time
+// in nanoseconds.
+//
+struct predicate_statistics {
+    predicate_statistics()
+      : calls(0), exits(0), fails(0), redos(0),
+	inclusive_cost(0), exclusive_cost(0),
+	inclusive_time(0), exclusive_time(0), active(0) { }
+
+    uint64_t calls;
+    uint64_t exits;
+    uint64_t fails;
+    uint64_t redos;
+    uint64_t inclusive_cost;
+    uint64_t exclusive_cost;
+    uint64_t inclusive_time;
+    uint64_t exclusive_time;
+    size_t active; // Number of activations in progress
+};
+
 class wam_interpreter;
 class wam_compiler;
 class wam_interim_code;
@@ -111,14 +189,6 @@ typedef std::unordered_map<common::term, code_point> wam_hash_map;
 
 template<wam_instruction_type I> class wam_instruction;
 
-static inline void update_ptr(code_point &p, code_t *old_base, code_t *new_base)
-{
-    if (!p.has_wam_code()) {
-	return;
-    }
-    p.set_wam_code(reinterpret_cast<wam_instruction_base *>(reinterpret_cast<code_t *>(p.wam_code()) - old_base + new_base));
-}
-
 class wam_instruction_base
 {
 protected:
@@ -140,16 +210,6 @@ public:
 
     template<wam_instruction_type I> inline void set_type();
 
-protected:
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	auto it = updater_fns_.find(fn());
-	if (it != updater_fns_.end()) {
-	    auto updater_fn = it->second;
-	    updater_fn(this, old_base, new_base);
-	}
-    }
-
 private:
     fn_type fn_;
     wam_instruction_type type_;
@@ -157,22 +217,25 @@ private:
 
     typedef void (*print_fn_type)(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self);
 
-    typedef void (*updater_fn_type)(wam_instruction_base *self, code_t *old_base, code_t *new_base);
-
 public:
+    // Instructions can be created for the first time by interpreters
+    // running in different threads (see par/2.)
     static void register_printer(fn_type fn, print_fn_type print_fn)
     {
+	boost::lock_guard<boost::mutex> lockit(print_fns_lock_);
         print_fns_[fn] = print_fn;
     }
 
-    static void register_updater(fn_type fn, updater_fn_type updater_fn)
-    {
-	updater_fns_[fn] = updater_fn;
-    }
-
     void print(std::ostream &out, wam_interpreter &interp)
     {
-        print_fn_type pfn = print_fns_[fn_];
+        print_fn_type pfn = nullptr;
+	{
+	    boost::lock_guard<boost::mutex> lockit(print_fns_lock_);
+	    auto it = print_fns_.find(fn_);
+	    if (it != print_fns_.end()) {
+		pfn = it->second;
+	    }
+	}
 	if (pfn == nullptr) {
 	    std::cout << "???";
 	} else {
@@ -182,7 +245,7 @@ public:
 
 private:
     static std::unordered_map<fn_type, print_fn_type> print_fns_;
-    static std::unordered_map<fn_type, updater_fn_type> updater_fns_;
+    static boost::mutex print_fns_lock_;
 
     friend class wam_code;
 };
@@ -340,13 +403,6 @@ public:
 	cp_ = cp;
     }
 
-protected:
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction_code_point *>(self);
-	self1->update(old_base, new_base);
-    }
-
 private:
     code_point cp_;
 };
@@ -367,76 +423,110 @@ private:
 class wam_instruction_hash_map : public wam_instruction_base
 {
 public:
-    inline wam_instruction_hash_map(fn_type fn, uint64_t sz_bytes, wam_instruction_type t, wam_hash_map *map)
-	: wam_instruction_base(fn, sz_bytes, t), map_(map) { }
+    inline wam_instruction_hash_map(fn_type fn, uint64_t sz_bytes, wam_instruction_type t, wam_hash_map *map, uint32_t ai)
+	: wam_instruction_base(fn, sz_bytes, t), map_(map), ai_(ai) { }
 
     inline wam_hash_map & map() const { return *map_; }
-
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	for (auto &v : map()) {
-	    update_ptr(v.second, old_base, new_base);
-	}
-    }
-
-protected:
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction_hash_map *>(self);
-	self1->update(old_base, new_base);
-    }
+    inline bool has_map() const { return map_ != nullptr; }
+    inline void set_map(wam_hash_map *map) { map_ = map; }
+    inline uint32_t ai() const { return ai_; }
 
 private:
     wam_hash_map *map_;
+    uint32_t ai_;
 };
 
+//
+// Compiled code lives in segments that are never moved or resized, so
+// pointers into the code (code points in instructions, environments and
+// choice points) stay valid for as long as the segment exists. Each
+// compiled predicate gets its own segment, which makes it possible to
+// release the code of a single predicate.
+//
+// Code addresses (see to_code_addr() and to_code()) are offsets in a
+// virtual address space where segments are laid out back to back.
+// Addresses are never reused.
+//
 class wam_code
 {
 public:
+    static const size_t DEFAULT_SEGMENT_SIZE = 1024;
+
     wam_code(wam_interpreter &interp)
-	: interp_(interp), instrs_(nullptr)
+	: interp_(interp), next_addr_(0), current_(nullptr), last_segment_(nullptr),
+	  live_size_(0), dead_size_(0), reclaimed_size_(0), num_collections_(0)
     { total_reset(); }
 
+    ~wam_code()
+    { free_segments(); }
+
     void total_reset() {
-	if (instrs_) {
-	    memset(instrs_, 0, sizeof(code_t)*instrs_capacity_);
-	    delete [] instrs_;
-	}
-	instrs_capacity_ = 1024;
-	instrs_size_ = 0;
-	instrs_ = new code_t[instrs_capacity_];
-        reallocation_count_ = 0;
-	last_reallocation_count_ = std::numeric_limits<size_t>::max();
+	free_segments();
+	next_addr_ = 0;
+	live_size_ = 0;
+	dead_size_ = 0;
+	reclaimed_size_ = 0;
+	num_collections_ = 0;
 	predicate_map_.clear();
 	predicate_rev_map_.clear();
 	calls_.clear();
     }
 
+    struct predicate_meta_data {
+        inline predicate_meta_data(size_t off, size_t end, size_t num_x, size_t num_y)
+	  : code_offset(off),
+	    end_offset(end),
+	    num_x_registers(num_x),
+            num_y_registers(num_y) { }
+        predicate_meta_data() = default;
+
+        size_t code_offset;
+	size_t end_offset;
+        size_t num_x_registers;
+        size_t num_y_registers;
+    };
+
+    struct code_segment {
+	inline code_segment(size_t addr0, size_t capacity0)
+	    : addr(addr0), size(0), capacity(capacity0),
+	      data(new code_t[capacity0]), owned(false), retired(false),
+	      meta(addr0, addr0, 0, 0) { }
+	inline ~code_segment() { delete [] data; }
+
+	size_t addr;     // Code address of first instruction
+	size_t size;     // Used size (in code_t units)
+	size_t capacity;
+	code_t *data;
+	bool owned;      // Belongs to a compiled predicate
+	bool retired;    // Predicate has been removed (see remove_compiled)
+	qname qn;
+	predicate_meta_data meta;
+    };
+
     inline size_t next_offset() const
     {
-	return instrs_size_;
+	return next_addr_;
     }
     
     inline size_t to_code_addr(code_t *p) const
     {
-	size_t addr = static_cast<size_t>(p - instrs_);
-	return addr;
+	auto *seg = find_segment(p);
+	return seg->addr + static_cast<size_t>(p - seg->data);
     }
 
     inline size_t to_code_addr(wam_instruction_base *p) const
     {
-	size_t addr = static_cast<size_t>(reinterpret_cast<code_t *>(p) - instrs_);
-	return addr;
+	return to_code_addr(reinterpret_cast<code_t *>(p));
     }
 
     inline wam_instruction_base * to_code(size_t addr) const
     {
-	return reinterpret_cast<wam_instruction_base *>(&instrs_[addr]);
+	auto *seg = find_segment(addr);
+	return reinterpret_cast<wam_instruction_base *>(&seg->data[addr - seg->addr]);
     }
 
     size_t add(const wam_instruction_base &i);
 
-    void check_code();
     void print_code(std::ostream &out);
     void print_code(std::ostream &out, size_t from, size_t to);
 
@@ -453,20 +543,6 @@ public:
 
     void remove_compiled(const qname &pn);
 
-    struct predicate_meta_data {
-        inline predicate_meta_data(size_t off, size_t end, size_t num_x, size_t num_y)
-	  : code_offset(off),
-	    end_offset(end),
-	    num_x_registers(num_x),
-            num_y_registers(num_y) { }
-        predicate_meta_data() = default;
-
-        size_t code_offset;
-	size_t end_offset;
-        size_t num_x_registers;
-        size_t num_y_registers;
-    };
-
     const predicate_meta_data & get_wam_predicate_meta_data(const qname &qn)
     {
         return predicate_map_[qn];
@@ -474,28 +550,74 @@ public:
 
     const qname get_wam_predicate(size_t code_addr)
     {
-        auto it = predicate_rev_map_.find(code_addr);
-        if (it == predicate_rev_map_.end()) {
-	    it = predicate_rev_map_.lower_bound(code_addr);
-	    --it;
-	}
-	qname qn = (*it).second;
-	return qn;
+	return find_segment(code_addr)->qn;
     }
 
+    // Segment containing instruction. This also works for code of
+    // predicates that have been removed but may still be executing.
+    inline const code_segment & get_segment(const wam_instruction_base *p) const
+    {
+	return *find_segment(reinterpret_cast<const code_t *>(p));
+    }
+
+    inline size_t num_segments() const
+    { return segments_.size(); }
+
+    // Code sizes in bytes. Dead code is code of removed predicates that
+    // hasn't been reclaimed yet.
+    inline size_t live_code_size() const
+    { return live_size_ * sizeof(code_t); }
+
+    inline size_t dead_code_size() const
+    { return dead_size_ * sizeof(code_t); }
+
+    inline size_t reclaimed_code_size() const
+    { return reclaimed_size_ * sizeof(code_t); }
+
+    inline size_t num_code_collections() const
+    { return num_collections_; }
+
 protected:
+    // Start a new segment with room for at least 'capacity' code
+    // cells. Subsequent instructions are added there.
+    void new_segment(size_t capacity);
+
+    // Segment containing p or nullptr if there's none
+    inline code_segment * segment_of(const code_t *p) const
+    {
+	auto it = segments_by_data_.upper_bound(p);
+	if (it == segments_by_data_.begin()) {
+	    return nullptr;
+	}
+	--it;
+	auto *seg = it->second;
+	return (p < seg->data + seg->capacity) ? seg : nullptr;
+    }
+
+    inline const std::map<size_t, code_segment *> & segments() const
+    { return segments_; }
+
+    // Release a retired segment. The caller must make sure that
+    // nothing refers to it.
+    void free_segment(code_segment *seg);
+
     void set_wam_predicate(const qname &qn,
-			   wam_instruction_base *instr,
-			   wam_instruction_base *end_instr,
+			   size_t predicate_offset,
+			   size_t end_offset,
 			   size_t num_x_registers,
 			   size_t num_y_registers)
 
     {
-	size_t predicate_offset = to_code_addr(instr);
-	size_t end_offset = to_code_addr(end_instr);
-	predicate_map_[qn] = predicate_meta_data(predicate_offset, end_offset, num_x_registers, num_y_registers);
+	auto meta = predicate_meta_data(predicate_offset, end_offset, num_x_registers, num_y_registers);
+	predicate_map_[qn] = meta;
 	predicate_rev_map_[predicate_offset] = qn;
 
+	auto *seg = find_segment(predicate_offset);
+	seg->owned = true;
+	seg->qn = qn;
+	seg->meta = meta;
+
+	auto *instr = to_code(predicate_offset);
 	auto &offsets = calls_[qn];
 	for (auto offset : offsets) {
 	    auto *cp_instr = reinterpret_cast<wam_instruction_code_point *>(to_code(offset));
@@ -513,55 +635,64 @@ protected:
 	}
     }
 
-protected:
-    bool reallocation_occurred() {
-	bool r = reallocation_count_ != last_reallocation_count_;
-	last_reallocation_count_ = reallocation_count_;
-	return r;
-    }
-
 private:
     code_t * ensure_fit(size_t sz)
     {
-        ensure_capacity(instrs_size_ + sz);
-	code_t *data = &instrs_[instrs_size_];
-	instrs_size_ += sz;
+	if (current_ == nullptr || current_->size + sz > current_->capacity) {
+	    new_segment(std::max(sz, DEFAULT_SEGMENT_SIZE));
+	}
+	code_t *data = &current_->data[current_->size];
+	current_->size += sz;
+	next_addr_ += sz;
+	live_size_ += sz;
 	return data;
     }
 
-    void ensure_capacity(size_t cap)
+    inline code_segment * find_segment(size_t addr) const
     {
-        if (cap > instrs_capacity_) {
-   	    size_t new_cap = 2*std::max(cap, instrs_size_);
-	    code_t *new_instrs = new code_t[new_cap];
-
-	    memcpy(new_instrs, instrs_, sizeof(code_t)*instrs_size_);
-	    code_t *old_instrs = instrs_;
-	    instrs_ = new_instrs;
-
-	    update(old_instrs, new_instrs);
+	auto *seg = last_segment_;
+	if (seg != nullptr && addr >= seg->addr && addr < seg->addr + seg->size) {
+	    return seg;
+	}
+	auto it = segments_.upper_bound(addr);
+	assert(it != segments_.begin());
+	--it;
+	last_segment_ = it->second;
+	return it->second;
+    }
 
-	    memset(old_instrs, 0, sizeof(code_t)*instrs_capacity_);
-	    delete old_instrs;
+    inline code_segment * find_segment(const code_t *p) const
+    {
+	auto *seg = last_segment_;
+	if (seg != nullptr && p >= seg->data && p < seg->data + seg->capacity) {
+	    return seg;
+	}
+	auto it = segments_by_data_.upper_bound(p);
+	assert(it != segments_by_data_.begin());
+	--it;
+	last_segment_ = it->second;
+	return it->second;
+    }
 
-	    instrs_capacity_ = new_cap;
+    void free_segments();
 
-	    reallocation_count_++;
-        }
-    }
+    wam_interpreter &interp_;
+    size_t next_addr_;
+    code_segment *current_;
+    mutable code_segment *last_segment_;
+    std::map<size_t, code_segment *> segments_;
+    std::map<const code_t *, code_segment *> segments_by_data_;
+    size_t live_size_;
+    size_t dead_size_;
+    size_t reclaimed_size_;
+    size_t num_collections_;
 
 protected:
-    virtual void update(code_t *old_base, code_t *new_base);
+    inline void count_code_collection()
+    { num_collections_++; }
 
 private:
 
-    wam_interpreter &interp_;
-    size_t instrs_size_;
-    size_t instrs_capacity_;
-    code_t *instrs_;
-    size_t reallocation_count_;
-    size_t last_reallocation_count_;
-
     std::unordered_map<qname, predicate_meta_data> predicate_map_;
     std::map<size_t, qname> predicate_rev_map_;
     std::unordered_map<qname, std::vector<size_t> > calls_;
@@ -582,16 +713,10 @@ public:
     inline static void init() {
 	static bool init_ = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init_);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
@@ -609,8 +734,6 @@ public:
     static void invoke(wam_interpreter &interp, wam_instruction_base *self);
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self);
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base);
 };
 
 template<> class wam_instruction<BUILTIN> : public wam_instruction_code_point {
@@ -739,10 +862,157 @@ public:
     inline void set_auto_wam(bool enabled)
     { auto_wam_ = enabled; }
 
+    inline wam_dispatch_mode dispatch_mode() const
+    { return dispatch_mode_; }
+
+    inline void set_dispatch_mode(wam_dispatch_mode mode)
+    { dispatch_mode_ = mode; }
+
+    // Number of WAM instructions executed (regardless of dispatch mode)
+    inline uint64_t instruction_count() const
+    { return instruction_count_; }
+
+    inline void reset_instruction_count()
+    { instruction_count_ = 0; }
+
+    // Fuse frequent instruction pairs when compiling (default on)
+    inline bool is_superinstructions() const
+    { return superinstructions_; }
+
+    inline void set_superinstructions(bool enabled)
+    { superinstructions_ = enabled; }
+
+    // The options above that change the code compile() generates (as
+    // bits.) Caches of compiled code must include them in their keys.
+    inline uint64_t code_options() const
+    { return superinstructions_ ? 1 : 0; }
+
+    // Count sequences of n executed instructions (n-grams, 1 <= n <= 4.)
+    // Use n = 0 to turn it off. Profiling forces the function pointer
+    // dispatch loop.
+    void set_instruction_profiling(size_t n);
+
+    inline size_t instruction_profiling() const
+    { return profile_n_; }
+
+    inline void clear_instruction_profile()
+    { profile_.clear(); }
+
+    // Print the 'top' most frequent n-grams
+    void print_instruction_profile(std::ostream &out, size_t top) const;
+
+    // Sampling profiler. A CPU timer (SIGPROF) ticks every 'interval_us'
+    // microseconds and the interpreter records its call stack at the
+    // next instruction (or naive goal.) Only one interpreter can be
+    // sampled at a time. Sampling forces the function pointer dispatch
+    // loop.
+    void start_sampling(size_t interval_us = 1000);
+    void stop_sampling();
+
+    inline bool is_sampling() const
+    { return sampling_; }
+
+    inline void clear_samples()
+    { samples_.clear(); }
+
+    // Number of ticks recorded
+    uint64_t num_samples() const;
+
+    // Print the samples as collapsed stacks ("root;...;leaf count" per
+    // line), which is what flamegraph.pl and similar tools read.
+    void print_samples(std::ostream &out) const;
+
+    // Count calls, exits, fails and redos and attribute cost and time
+    // to predicates (see predicate_statistics.) Starting clears the
+    // previous counts. Counting forces the function pointer dispatch
+    // loop.
+    void start_predicate_statistics();
+    void stop_predicate_statistics();
+
+    inline bool is_predicate_statistics() const
+    { return port_counting_; }
+
+    void clear_predicate_statistics();
+
+    // Statistics of predicate (nullptr if it hasn't been called.)
+    const predicate_statistics * get_predicate_statistics(const qname &qn) const;
+
+    // One line per predicate (by exclusive cost), times in microseconds:
+    // module:name/arity calls exits fails redos inclusive_cost
+    //     exclusive_cost inclusive_time exclusive_time
+    void print_predicate_statistics(std::ostream &out) const;
+
+    // Release the code of removed predicates that is no longer
+    // referenced from any environment, choice point or register.
+    // Returns the number of bytes released.
+    size_t collect_dead_code();
+
+    // Dead code (in bytes) that triggers collect_dead_code() when a
+    // predicate is compiled.
+    inline size_t dead_code_threshold() const
+    { return dead_code_threshold_; }
+
+    inline void set_dead_code_threshold(size_t bytes)
+    { dead_code_threshold_ = bytes; }
+
+    // Relocatable image of the code of a compiled predicate. Code
+    // points within the predicate are stored as relative offsets,
+    // calls by predicate name, builtins by qualified name and the
+    // switch tables are inlined. Atoms are stored by index, so the
+    // image can only be loaded into an interpreter with the same atom
+    // table (e.g. the global interpreter.) Returns false if the
+    // predicate isn't compiled or has code that can't be relocated
+    // (e.g. bignum constants that live on the heap.)
+    bool save_code_image(const qname &qn, std::vector<uint8_t> &image);
+
+    // Load code saved with save_code_image() as the compiled code of
+    // 'qn'. The clauses must be the same as when the image was saved.
+    // Returns false if the image is invalid.
+    bool load_code_image(const qname &qn, const uint8_t *image, size_t n);
+
+    // Image of all the predicates of 'module': the clauses (as
+    // serialized terms), the code images of the compiled predicates
+    // and the atom table. Loading it is a lot faster than parsing and
+    // compiling the source, e.g. for the standard library (see
+    // interpreter::setup_standard_lib().) 'key' is stored with the
+    // image (e.g. a hash of the source it was compiled from.)
+    void save_module_image(common::con_cell module, uint64_t key, std::vector<uint8_t> &image);
+
+    // Load an image saved with save_module_image() into 'module'.
+    // Returns false, before any clause is loaded, if the image is
+    // invalid, has another key or its atoms have other indices in
+    // this interpreter (the image must be saved by an interpreter set
+    // up in the same way as this one.)
+    bool load_module_image(common::con_cell module, uint64_t key, const uint8_t *image, size_t n);
+
+    // Make this interpreter a snapshot that new interpreters can be
+    // forked from (e.g. one with the standard library loaded.) The
+    // code of the compiled predicates is saved as images, so a fork
+    // only needs to load it. A snapshot must not be used for anything
+    // but forking afterwards.
+    void snapshot();
+
+    inline bool is_snapshot() const
+    { return snapshot_ != nullptr; }
+
+    // Make this (new) interpreter a fork of 'snapshot.' See also
+    // interpreter_base::fork(). Forks of the same snapshot can be
+    // created concurrently.
+    void fork(const wam_interpreter &snapshot);
+
 protected:
+    // Called by compile(qn) before compiling. Return true if the code
+    // was loaded some other way (e.g. from a code cache.)
+    virtual bool load_cached_code(const qname &qn)
+    { static_cast<void>(qn); return false; }
+
+    // Called by compile(qn) after the predicate has been compiled.
+    virtual void compiled_code(const qname &qn)
+    { static_cast<void>(qn); }
+
     void load_code(wam_interim_code &code);
+    void release_hash_maps(code_segment *seg);
 
-    virtual void update(code_t *old_base, code_t *new_base) override;
     
     void bind_code_point(std::unordered_map<size_t, size_t> &label_map,
 			 code_point &cp);
@@ -755,6 +1025,55 @@ protected:
     }
 
     bool cont_wam();
+    bool cont_wam_threaded();
+
+    // Record the call stack if the sampling timer has ticked. 'instr'
+    // is the instruction just executed.
+    void sample_wam(wam_instruction_base *instr);
+    void sample_naive();
+
+    // Dispatch loops check for instrumentation (sampling or port
+    // counting) when a builtin returns, as it may have been turned on.
+    inline bool is_instrumented() const
+    { return sampling_ || port_counting_; }
+
+    // Port counting. The interpreter keeps a stack of the predicate
+    // calls in progress. A call exits when execution continues at its
+    // continuation (in the caller's environment), it fails when we
+    // backtrack to a choice point that is older than the call, and is
+    // redone when we backtrack to a choice point it left behind.
+    void port_call(const qname &qn, const code_point &cont, environment_base_t *e, choice_point_t *b_call);
+    void port_call_fail(const qname &qn);
+    void port_backtrack(choice_point_t *b0);
+    void port_reset();
+
+    // Called after each instruction (or naive dispatch)
+    inline void port_step()
+    {
+	if (port_top_ != NO_PORT_FRAME) {
+	    auto &f = port_frames_[port_top_];
+	    if (f.e == e0() && f.cont == p()) {
+		port_exit();
+	    }
+	}
+	if (reinterpret_cast<uintptr_t>(b()) < port_max_exit_) {
+	    port_prune();
+	}
+    }
+
+    inline void port_step_wam(wam_instruction_base *instr)
+    {
+	switch (instr->type()) {
+	case CALL: case EXECUTE: case PUT_VALUE_X_EXECUTE:
+	    if (p().has_wam_code()) {
+		port_call(get_segment(p().wam_code()).qn, cp(), e0(), b());
+	    }
+	    break;
+	default:
+	    break;
+	}
+	port_step();
+    }
 
     inline std::unordered_map<qname, code_point> & code_db() {
 	return interpreter_base::code_db();
@@ -763,8 +1082,81 @@ protected:
 private:
     bool auto_wam_;
     bool fail_;
+    wam_dispatch_mode dispatch_mode_;
+    uint64_t instruction_count_;
+    bool superinstructions_;
+    size_t dead_code_threshold_;
+    size_t profile_n_;
+    uint32_t profile_window_;
+    size_t profile_fill_;
+    std::unordered_map<uint32_t, uint64_t> profile_;
+    bool sampling_;
+    uint64_t sampled_ticks_;
+    std::unordered_map<std::string, uint64_t> samples_;
+
+    // A predicate call in progress. Calls in tail position (same
+    // continuation and no choice point in between) exit together, so
+    // they share the frame if it is the same predicate, otherwise
+    // they're grouped (tail = true joins the frame below.)
+    struct port_frame {
+	predicate_statistics *stats;
+	uint64_t count;       // Calls sharing the frame
+	code_point cont;      // Continuation and environment of call
+	environment_base_t *e;
+	uintptr_t b_call;     // Top choice point when called
+	uintptr_t b_exit;     // Top choice point when exited
+	uint64_t cost0;       // Cost and time when (re)activated
+	uint64_t time0;
+	bool outermost;       // Not a recursive activation
+	bool tail;
+	bool exited;
+    };
+    static const size_t NO_PORT_FRAME = static_cast<size_t>(-1);
+
+    bool port_counting_;
+    std::unordered_map<qname, predicate_statistics> port_stats_;
+    std::vector<port_frame> port_frames_;
+    size_t port_top_;         // Topmost frame that hasn't exited
+    size_t port_num_exited_;
+    uintptr_t port_max_exit_; // Max b_exit of exited frames
+    uint64_t port_cost_;      // Cost units seen so far
+    uint64_t port_last_cost_; // accumulated_cost() at last charge
+    uint64_t port_time_;      // Time of last charge
     wam_compiler *compiler_;
 
+    struct snapshot_code {
+	std::vector<std::pair<qname, std::vector<uint8_t> > > images;
+	std::vector<qname> no_image;  // Compiled, but not relocatable
+	// Code points with compiled code and the predicate that owns
+	// the code (which is another one for imported predicates.)
+	std::vector<std::pair<qname, qname> > code;
+    };
+    std::unique_ptr<snapshot_code> snapshot_;
+
+    inline void profile_instruction(wam_instruction_type t)
+    {
+	// Instruction types are packed into 8 bits each (+1 so that
+	// 0 means empty.)
+	uint32_t mask = profile_n_ == 4 ? ~static_cast<uint32_t>(0)
+	    : (static_cast<uint32_t>(1) << (8*profile_n_)) - 1;
+	profile_window_ = ((profile_window_ << 8) | (t + 1)) & mask;
+	if (profile_fill_ < profile_n_) profile_fill_++;
+	if (profile_fill_ == profile_n_) {
+	    profile_[profile_window_]++;
+	}
+    }
+
+    void port_charge();
+    void port_open(port_frame &f);
+    void port_close(port_frame &f);
+    void port_exit();
+    void port_prune();
+    void port_find_top();
+
+    void sample_frame(std::vector<common::con_cell> &frames, const code_point &cp);
+    void sample_stack(std::vector<common::con_cell> &frames);
+    void add_sample(const std::vector<common::con_cell> &frames, uint64_t weight);
+
     template<wam_instruction_type I> friend class wam_instruction;
 
     static inline size_t num_y(interpreter_base *interp, bool use_previous)
@@ -773,9 +1165,8 @@ private:
 
         if (!use_previous) {
 	    if (wami->p().has_wam_code()) {
-	        auto qn = wami->get_wam_predicate(wami->to_code_addr(wami->p().wam_code()));
-   	        auto meta_data = wami->get_wam_predicate_meta_data(qn);
-	        return meta_data.num_y_registers;
+	        auto &seg = wami->get_segment(wami->p().wam_code());
+	        return seg.meta.num_y_registers;
 	    }
         }
       
@@ -797,10 +1188,9 @@ private:
 	    return interpreter_base::save_state(interp);
         }
         auto wami = reinterpret_cast<wam_interpreter *>(interp);
-	size_t wam_addr = wami->to_code_addr(p.wam_code());
-	auto qn = wami->get_wam_predicate(wam_addr);
-	auto meta_data = wami->get_wam_predicate_meta_data(qn);
-	size_t num_x = meta_data.num_x_registers;
+	auto &seg = wami->get_segment(p.wam_code());
+	auto &qn = seg.qn;
+	size_t num_x = seg.meta.num_x_registers;
 	size_t num_a = qn.second.arity();
 	auto ef = interp->ef();
 	ef->extra[0] = int_cell(num_x);
@@ -842,6 +1232,9 @@ private:
 
     inline void backtrack()
     {
+	if (port_counting_) {
+	    port_backtrack(b());
+	}
         if (b() == top_b()) {
 	    if (b() != nullptr) {
 		set_b0(b()->b0);
@@ -1117,6 +1510,16 @@ private:
     }
 
     inline void get_structure(common::con_cell f, common::term t)
+    {
+	if (!match_structure(f, t)) {
+	    backtrack();
+	} else {
+	    goto_next_instruction();
+	}
+    }
+
+    // Same as get_structure, but without advancing P
+    inline bool match_structure(common::con_cell f, common::term t)
     {
         bool fail = false;
 	switch (t.tag()) {
@@ -1142,11 +1545,7 @@ private:
 	  fail = true;
 	  break;
 	}
-	if (fail) {
-	    backtrack();
-	} else {
-	    goto_next_instruction();
-	}
+	return !fail;
     }
 
     inline void get_list_a(uint32_t ai)
@@ -1282,45 +1681,49 @@ private:
 	goto_next_instruction();
     }
 
-    inline void unify_variable_a(uint32_t ai)
+    // Same as unify_variable_*, but without advancing P
+    inline void unify_variable(term &reg)
     {
         switch (mode_) {
-	case READ: a(ai) = heap_get(register_s_); break;
-	case WRITE: a(ai) = new_ref(); break;
+	case READ: reg = heap_get(register_s_); break;
+	case WRITE: reg = new_ref(); break;
         }
 	register_s_++;
+    }
+
+    inline void unify_variable_a(uint32_t ai)
+    {
+        unify_variable(a(ai));
 	goto_next_instruction();
     }
 
     inline void unify_variable_x(uint32_t xn)
     {
-        switch (mode_) {
-	case READ: x(xn) = heap_get(register_s_); break;
-	case WRITE: x(xn) = new_ref(); break;
-        }
-	register_s_++;
+        unify_variable(x(xn));
 	goto_next_instruction();
     }
 
     inline void unify_variable_y(uint32_t yn)
     {
-        switch (mode_) {
-	case READ: y(yn) = heap_get(register_s_); break;
-	case WRITE: y(yn) = new_ref(); break;
-        }
-	register_s_++;
+        unify_variable(y(yn));
 	goto_next_instruction();
     }
 
-    inline void unify_value_a(uint32_t ai)
+    // Same as unify_value_*, but without advancing P
+    inline bool unify_value(term reg)
     {
         bool fail = false;
         switch (mode_) {
-	case READ: fail = !unify(a(ai), heap_get(register_s_)); break;
-	case WRITE: new_term_copy_cell(a(ai)); break;
+	case READ: fail = !unify(reg, heap_get(register_s_)); break;
+	case WRITE: new_term_copy_cell(reg); break;
         }
 	register_s_++;
-	if (fail) {
+	return !fail;
+    }
+
+    inline void unify_value_a(uint32_t ai)
+    {
+	if (!unify_value(a(ai))) {
 	    backtrack();
 	} else {
 	    goto_next_instruction();
@@ -1329,13 +1732,7 @@ private:
 
     inline void unify_value_x(uint32_t xn)
     {
-        bool fail = false;
-        switch (mode_) {
-	case READ: fail = !unify(x(xn), heap_get(register_s_)); break;
-	case WRITE: new_term_copy_cell(x(xn)); break;
-        }
-	register_s_++;
-	if (fail) {
+	if (!unify_value(x(xn))) {
 	    backtrack();
 	} else {
 	    goto_next_instruction();
@@ -1344,13 +1741,7 @@ private:
 
     inline void unify_value_y(uint32_t yn)
     {
-        bool fail = false;
-        switch (mode_) {
-	case READ: fail = !unify(y(yn), heap_get(register_s_)); break;
-	case WRITE: new_term_copy_cell(y(yn)); break;
-        }
-	register_s_++;
-	if (fail) {
+	if (!unify_value(y(yn))) {
 	    backtrack();
 	} else {
 	    goto_next_instruction();
@@ -1498,6 +1889,7 @@ private:
         set_p(p1);
 	set_num_of_args(arity);
 	set_b0(b());
+	check_gc();
 	
 	if (!p1.has_wam_code()) {
 	    for (size_t i = 0; i < arity; i++) {
@@ -1514,6 +1906,63 @@ private:
 	set_b0(b());
         set_num_of_args(arity);
 	set_p(p1);
+	check_gc();
+    }
+
+    //
+    // Superinstructions. Same semantics as executing the two
+    // instructions in sequence, but P is only advanced once.
+    //
+
+    inline void put_value_x2(uint32_t xn1, uint32_t ai1,
+			     uint32_t xn2, uint32_t ai2)
+    {
+        a(ai1) = x(xn1);
+	put_value_x(xn2, ai2);
+    }
+
+    inline void get_variable_x_get_value_x(uint32_t xn1, uint32_t ai1,
+					   uint32_t xn2, uint32_t ai2)
+    {
+        x(xn1) = a(ai1);
+	get_value_x(xn2, ai2);
+    }
+
+    inline void allocate_get_variable_y(uint32_t yn, uint32_t ai)
+    {
+        allocate_environment<ENV_WAM>();
+	get_variable_y(yn, ai);
+    }
+
+    inline void put_value_x_execute(uint32_t xn, uint32_t ai,
+				    code_point &p1, size_t arity)
+    {
+        a(ai) = x(xn);
+	execute(p1, arity);
+    }
+
+    inline void unify_variable_x2(uint32_t xn1, uint32_t xn2)
+    {
+        unify_variable(x(xn1));
+	unify_variable_x(xn2);
+    }
+
+    inline void get_list_a_unify_variable_x(uint32_t ai, uint32_t xn)
+    {
+        if (!match_structure(DOTTED_PAIR, deref(a(ai)))) {
+	    backtrack();
+	    return;
+	}
+	unify_variable_x(xn);
+    }
+
+    inline void get_list_a_unify_value_x(uint32_t ai, uint32_t xn)
+    {
+        if (!match_structure(DOTTED_PAIR, deref(a(ai)))) {
+	    backtrack();
+	    return;
+	}
+	unify_value_x(xn);
     }
 
 protected:
@@ -1648,9 +2097,10 @@ private:
     inline void switch_on_term(const code_point &pv,
 			       const code_point &pc,
 			       const code_point &pl,
-			       const code_point &ps)
+			       const code_point &ps,
+			       uint32_t ai)
     {
-	term t = deref(a(0));
+	term t = deref(a(ai));
 
 	switch (t.tag()) {
 	case common::tag_t::CON: case common::tag_t::INT:
@@ -1689,9 +2139,9 @@ private:
 	}
     }
 
-    inline void switch_on_constant(wam_hash_map &map)
+    inline void switch_on_constant(wam_hash_map &map, uint32_t ai)
     {
-	term t = deref(a(0));
+	term t = deref(a(ai));
 	auto it = map.find(t);
 	if (it == map.end()) {
 	    backtrack();
@@ -1700,9 +2150,9 @@ private:
 	}
     }
 
-    inline void switch_on_structure(wam_hash_map &map)
+    inline void switch_on_structure(wam_hash_map &map, uint32_t ai)
     {
-	term t = functor(deref(a(0)));
+	term t = functor(deref(a(ai)));
 
 	auto it = map.find(t);
 	if (it == map.end()) {
@@ -3123,12 +3573,6 @@ inline void wam_instruction<CALL>::print(std::ostream &out, wam_interpreter &int
     out << ", " << self1->num_y();
 }
 
-inline void wam_instruction<CALL>::updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-{
-    auto self1 = reinterpret_cast<wam_instruction<CALL> *>(self);
-    self1->update(old_base, new_base);
-}
-
 template<> class wam_instruction<EXECUTE> : public wam_instruction_code_point {
 public:
     inline wam_instruction(const code_point &cp) :
@@ -3143,16 +3587,10 @@ public:
     static inline void init() {
 	static bool init_ = [] {
 	    register_printer(&invoke, &print);
-	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init_);
     }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
@@ -3170,12 +3608,6 @@ public:
 	interp.execute(self1->p(), self1->arity());
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<EXECUTE> *>(self);
-	self1->update(old_base, new_base);	
-    }
-
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<EXECUTE> *>(self);
@@ -3245,7 +3677,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3253,11 +3684,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRY_ME_ELSE> *>(self);
@@ -3269,12 +3695,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<TRY_ME_ELSE> *>(self);
 	out << "try_me_else " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRY_ME_ELSE> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RETRY_ME_ELSE> : public wam_instruction_code_point {
@@ -3287,7 +3707,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3295,11 +3714,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-        update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<RETRY_ME_ELSE> *>(self);
@@ -3311,12 +3725,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<RETRY_ME_ELSE> *>(self);
 	out << "retry_me_else " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<RETRY_ME_ELSE> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<TRUST_ME> : public wam_instruction_base {
@@ -3357,7 +3765,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3365,11 +3772,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRY> *>(self);
@@ -3381,12 +3783,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<TRY> *>(self);
 	out << "try " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRY> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RETRY> : public wam_instruction_code_point {
@@ -3399,7 +3795,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3407,11 +3802,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<RETRY> *>(self);
@@ -3423,12 +3813,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<RETRY> *>(self);
 	out << "retry " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<RETRY> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<TRUST> : public wam_instruction_code_point {
@@ -3441,7 +3825,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3449,11 +3832,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<TRUST> *>(self);
@@ -3465,12 +3843,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<TRUST> *>(self);
 	out << "trust " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<TRUST> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<SWITCH_ON_TERM> : public wam_instruction_base {
@@ -3478,16 +3850,16 @@ public:
       inline wam_instruction(code_point pv,
 			     code_point pc,
 			     code_point pl,
-			     code_point ps) :
+			     code_point ps,
+			     uint32_t ai = 0) :
       wam_instruction_base(&invoke, sizeof(*this), SWITCH_ON_TERM),
-      pv_(pv), pc_(pc), pl_(pl), ps_(ps) {
+      pv_(pv), pc_(pc), pl_(pl), ps_(ps), ai_(ai) {
       init();
     }
 
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3496,25 +3868,21 @@ public:
     inline code_point & pc() { return pc_; }
     inline code_point & pl() { return pl_; }
     inline code_point & ps() { return ps_; }
-
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-        update_ptr(pv_, old_base, new_base);
-	update_ptr(pc_, old_base, new_base);
-	update_ptr(pl_, old_base, new_base);
-	update_ptr(ps_, old_base, new_base);
-    }
+    inline uint32_t ai() const { return ai_; }
 
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(self);
-	interp.switch_on_term(self1->pv(), self1->pc(), self1->pl(), self1->ps());
+	interp.switch_on_term(self1->pv(), self1->pc(), self1->pl(), self1->ps(), self1->ai());
     }
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(self);
 	out << "switch_on_term ";
+	if (self1->ai() != 0) {
+	    out << "a" << self1->ai() << ", ";
+	}
         if (self1->pv().is_fail()) {
 	    out << "V->fail";
 	} else {
@@ -3540,29 +3908,23 @@ public:
 	}
     }
 
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_TERM> *>(self);
-	self1->update(old_base, new_base);
-    }
-
     code_point pv_;
     code_point pc_;
     code_point pl_;
     code_point ps_;
+    uint32_t ai_;
 };
 
 template<> class wam_instruction<SWITCH_ON_CONSTANT> : public wam_instruction_hash_map {
 public:
-    inline wam_instruction(wam_hash_map *map) :
-      wam_instruction_hash_map(&invoke, sizeof(*this), SWITCH_ON_CONSTANT,map){
+    inline wam_instruction(wam_hash_map *map, uint32_t ai = 0) :
+      wam_instruction_hash_map(&invoke, sizeof(*this), SWITCH_ON_CONSTANT,map,ai){
         init();
     }
 
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3570,13 +3932,16 @@ public:
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_CONSTANT> *>(self);
-	interp.switch_on_constant(self1->map());
+	interp.switch_on_constant(self1->map(), self1->ai());
     }
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_CONSTANT> *>(self);
 	out << "switch_on_constant ";
+	if (self1->ai() != 0) {
+	    out << "a" << self1->ai() << ", ";
+	}
 	bool first = true;
 	for (auto &v : self1->map()) {
 	    if (!first) out << ", ";
@@ -3590,16 +3955,15 @@ public:
 
 template<> class wam_instruction<SWITCH_ON_STRUCTURE> : public wam_instruction_hash_map {
 public:
-    inline wam_instruction(wam_hash_map *map) :
+    inline wam_instruction(wam_hash_map *map, uint32_t ai = 0) :
         wam_instruction_hash_map(&invoke, sizeof(*this), SWITCH_ON_STRUCTURE,
-				 map) {
+				 map, ai) {
         init();
     }
 
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3607,13 +3971,16 @@ public:
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
-	interp.switch_on_structure(self1->map());
+	interp.switch_on_structure(self1->map(), self1->ai());
     }
 
     static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
 	out << "switch_on_structure ";
+	if (self1->ai() != 0) {
+	    out << "a" << self1->ai() << ", ";
+	}
 	bool first = true;
 	for (auto &v : self1->map()) {
 	    if (!first) out << ", ";
@@ -3623,12 +3990,6 @@ public:
 	    first = false;
 	}
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<SWITCH_ON_STRUCTURE> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<NECK_CUT> : public wam_instruction_base {
@@ -3727,7 +4088,6 @@ public:
     static inline void init() {
 	static bool init = [] {
  	    register_printer(&invoke, &print);
- 	    register_updater(&invoke, &updater);
 	    return true; } ();
 	static_cast<void>(init);
     }
@@ -3735,11 +4095,6 @@ public:
     inline const code_point & p() const { return cp(); }
     inline code_point & p() { return cp(); }
 
-    inline void update(code_t *old_base, code_t *new_base)
-    {
-	update_ptr(p(), old_base, new_base);
-    }
-
     static void invoke(wam_interpreter &interp, wam_instruction_base *self)
     {
 	auto self1 = reinterpret_cast<wam_instruction<GOTO> *>(self);
@@ -3751,12 +4106,6 @@ public:
 	auto self1 = reinterpret_cast<wam_instruction<GOTO> *>(self);
 	out << "goto " << interp.to_string(self1->p());
     }
-
-    static void updater(wam_instruction_base *self, code_t *old_base, code_t *new_base)
-    {
-	auto self1 = reinterpret_cast<wam_instruction<GOTO> *>(self);
-	self1->update(old_base, new_base);
-    }
 };
 
 template<> class wam_instruction<RESET_LEVEL> : public wam_instruction_code_point_reg {
@@ -3827,6 +4176,248 @@ public:
 };
 
 
+template<> class wam_instruction<PUT_VALUE_X2> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t xn1, uint32_t ai1, uint32_t xn2, uint32_t ai2) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), PUT_VALUE_X2, xn1, ai1), xn2_(xn2), ai2_(ai2) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t xn1() const { return reg_1(); }
+    inline uint32_t ai1() const { return reg_2(); }
+    inline uint32_t xn2() const { return xn2_; }
+    inline uint32_t ai2() const { return ai2_; }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X2> *>(self);
+        interp.put_value_x2(self1->xn1(), self1->ai1(), self1->xn2(), self1->ai2());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X2> *>(self);
+        out << "put_value x" << self1->xn1() << ", a" << self1->ai1()
+	    << " + put_value x" << self1->xn2() << ", a" << self1->ai2();
+    }
+
+private:
+    uint32_t xn2_;
+    uint32_t ai2_;
+};
+
+template<> class wam_instruction<GET_VARIABLE_X_GET_VALUE_X> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t xn1, uint32_t ai1, uint32_t xn2, uint32_t ai2) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), GET_VARIABLE_X_GET_VALUE_X, xn1, ai1), xn2_(xn2), ai2_(ai2) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t xn1() const { return reg_1(); }
+    inline uint32_t ai1() const { return reg_2(); }
+    inline uint32_t xn2() const { return xn2_; }
+    inline uint32_t ai2() const { return ai2_; }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_VARIABLE_X_GET_VALUE_X> *>(self);
+        interp.get_variable_x_get_value_x(self1->xn1(), self1->ai1(), self1->xn2(), self1->ai2());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_VARIABLE_X_GET_VALUE_X> *>(self);
+        out << "get_variable x" << self1->xn1() << ", a" << self1->ai1()
+	    << " + get_value x" << self1->xn2() << ", a" << self1->ai2();
+    }
+
+private:
+    uint32_t xn2_;
+    uint32_t ai2_;
+};
+
+template<> class wam_instruction<ALLOCATE_GET_VARIABLE_Y> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t yn, uint32_t ai) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), ALLOCATE_GET_VARIABLE_Y, yn, ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t yn() const { return reg_1(); }
+    inline uint32_t ai() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ALLOCATE_GET_VARIABLE_Y> *>(self);
+        interp.allocate_get_variable_y(self1->yn(), self1->ai());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<ALLOCATE_GET_VARIABLE_Y> *>(self);
+        out << "allocate + get_variable y" << self1->yn() << ", a" << self1->ai();
+    }
+};
+
+template<> class wam_instruction<PUT_VALUE_X_EXECUTE> : public wam_instruction_code_point_reg {
+public:
+    inline wam_instruction(uint32_t xn, uint32_t ai, const code_point &cp) :
+        wam_instruction_code_point_reg(&invoke, sizeof(*this), PUT_VALUE_X_EXECUTE, cp, xn), ai_(ai) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t xn() const { return reg(); }
+    inline uint32_t ai() const { return ai_; }
+
+    inline const code_point & p() const { return cp(); }
+    inline code_point & p() { return cp(); }
+
+    inline common::con_cell pn() const
+    { auto c = p().term_code();
+      common::con_cell &cc = reinterpret_cast<common::con_cell &>(c);
+      return cc;
+    }
+
+    inline size_t arity() const { return pn().arity(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X_EXECUTE> *>(self);
+	interp.put_value_x_execute(self1->xn(), self1->ai(), self1->p(), self1->arity());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+	auto self1 = reinterpret_cast<wam_instruction<PUT_VALUE_X_EXECUTE> *>(self);
+	out << "put_value x" << self1->xn() << ", a" << self1->ai()
+	    << " + execute " << interp.to_string(self1->p());
+    }
+
+private:
+    uint32_t ai_;
+};
+
+template<> class wam_instruction<UNIFY_VARIABLE_X2> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t xn1, uint32_t xn2) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), UNIFY_VARIABLE_X2, xn1, xn2) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t xn1() const { return reg_1(); }
+    inline uint32_t xn2() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X2> *>(self);
+        interp.unify_variable_x2(self1->xn1(), self1->xn2());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<UNIFY_VARIABLE_X2> *>(self);
+        out << "unify_variable x" << self1->xn1()
+	    << " + unify_variable x" << self1->xn2();
+    }
+};
+
+template<> class wam_instruction<GET_LIST_A_UNIFY_VARIABLE_X> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t xn) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), GET_LIST_A_UNIFY_VARIABLE_X, ai, xn) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t xn() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UNIFY_VARIABLE_X> *>(self);
+        interp.get_list_a_unify_variable_x(self1->ai(), self1->xn());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UNIFY_VARIABLE_X> *>(self);
+        out << "get_list a" << self1->ai()
+	    << " + unify_variable x" << self1->xn();
+    }
+};
+
+template<> class wam_instruction<GET_LIST_A_UNIFY_VALUE_X> : public wam_instruction_binary_reg {
+public:
+    inline wam_instruction(uint32_t ai, uint32_t xn) :
+	wam_instruction_binary_reg(&invoke, sizeof(*this), GET_LIST_A_UNIFY_VALUE_X, ai, xn) {
+        init();
+    }
+
+    static inline void init() {
+	static bool init_ = [] {
+	    register_printer(&invoke, &print);
+	    return true; } ();
+	static_cast<void>(init_);
+    }
+
+    inline uint32_t ai() const { return reg_1(); }
+    inline uint32_t xn() const { return reg_2(); }
+
+    static void invoke(wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UNIFY_VALUE_X> *>(self);
+        interp.get_list_a_unify_value_x(self1->ai(), self1->xn());
+    }
+
+    static void print(std::ostream &out, wam_interpreter &interp, wam_instruction_base *self)
+    {
+        auto self1 = reinterpret_cast<wam_instruction<GET_LIST_A_UNIFY_VALUE_X> *>(self);
+        out << "get_list a" << self1->ai()
+	    << " + unify_value x" << self1->xn();
+    }
+};
+
 template<wam_instruction_type I> inline void wam_instruction_base::set_type()
 {
     wam_instruction<I>::init();
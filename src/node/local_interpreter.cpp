@@ -1469,6 +1469,12 @@ void local_interpreter::ensure_initialized()
     }
 }
 
+void local_interpreter::fork(const local_interpreter &snapshot)
+{
+    interpreter::fork(snapshot);
+    initialized_ = true;
+}
+
 void local_interpreter::setup_local_builtins()
 {
     load_builtin(con_cell("@",2), &me_builtins::operator_at_2);
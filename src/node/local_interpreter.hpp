@@ -139,6 +139,10 @@ public:
 
     void ensure_initialized();
 
+    // Become a copy of an initialized (and snapshotted) interpreter
+    // instead of initializing from scratch. See self_node::new_in_session.
+    void fork(const local_interpreter &snapshot);
+
     bool reset();
     void local_reset();
 
@@ -25,6 +25,7 @@ self_node::self_node(const std::string &data_dir, unsigned short port)
       timer_(ioservice_),
       comment_(env_.EMPTY_LIST),
       recent_in_connection_(nullptr),
+      session_snapshot_(nullptr),
       preferred_num_standard_out_connections_(DEFAULT_NUM_STANDARD_OUT_CONNECTIONS),
       preferred_num_verifier_connections_(DEFAULT_NUM_VERIFIER_CONNECTIONS),
       num_standard_out_connections_(0),
@@ -311,10 +312,25 @@ in_session_state * self_node::new_in_session(in_connection *conn, bool is_root)
     auto *ss = new in_session_state(this, conn, is_root);
     ss->set_available_funds( get_initial_funds() );
     boost::lock_guard<boost::recursive_mutex> guard(lock_);
+    // Root sessions run the startup file, so they initialize themselves.
+    if (!is_root) {
+	ss->interp().fork(session_snapshot());
+    }
     in_states_[ss->id()] = ss;
     return ss;
 }
 
+const local_interpreter & self_node::session_snapshot()
+{
+    boost::lock_guard<boost::recursive_mutex> guard(lock_);
+    if (session_snapshot_ == nullptr) {
+	session_snapshot_ = new in_session_state(this, nullptr, false);
+	session_snapshot_->interp().ensure_initialized();
+	session_snapshot_->interp().snapshot();
+    }
+    return session_snapshot_->interp();
+}
+
 in_session_state * self_node::find_in_session(const std::string &id)
 {
     boost::lock_guard<boost::recursive_mutex> guard(lock_);
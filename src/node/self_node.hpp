@@ -199,6 +199,7 @@ public:
 					size_t timeout);
 
     in_session_state * new_in_session(in_connection *conn, bool is_root);
+    const local_interpreter & session_snapshot();
     in_session_state * find_in_session(const std::string &id);
     void kill_in_session(in_session_state *sess);
     void in_session_connect(in_session_state *sess, in_connection *conn);
@@ -310,6 +311,8 @@ private:
 
     boost::recursive_mutex lock_;
     std::unordered_map<std::string, in_session_state *> in_states_;
+    // Initialized once; new (non-root) sessions are forked from it.
+    in_session_state *session_snapshot_;
     std::vector<connection *> closed_;
 
     address_book address_book_;